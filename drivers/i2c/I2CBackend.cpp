@@ -0,0 +1,149 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "dev_fs_lib_i2c.h"
+#include "I2CBackend.hpp"
+
+using namespace DriverFramework;
+
+static I2CBackend *g_default_backend = nullptr;
+
+I2CBackend &I2CBackend::getDefault(void)
+{
+	if (g_default_backend == nullptr) {
+#ifdef DF_I2C_BACKEND_LINUX
+		return LinuxI2CBackend::instance();
+#else
+		return DSPALI2CBackend::instance();
+#endif
+	}
+	return *g_default_backend;
+}
+
+void I2CBackend::setDefault(I2CBackend &backend)
+{
+	g_default_backend = &backend;
+}
+
+int I2CBackend::transfer(int fd, I2CSegment *segments, unsigned int count)
+{
+	int calls = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		I2CSegment &seg = segments[i];
+		int ret;
+
+		if (seg.type == I2CTransferType_ReadReg) {
+			ret = readReg(fd, seg.reg, seg.buffer, seg.length);
+			++calls;
+			if (ret != seg.length) {
+				return -1;
+			}
+		}
+		else if (seg.type == I2CTransferType_WriteReg) {
+			// Sent straight from the caller's buffer
+			seg.buffer[0] = seg.reg;
+			ret = write(fd, seg.buffer, seg.length + 1);
+			++calls;
+			if (ret != seg.length + 1) {
+				return -1;
+			}
+		}
+		else {
+			return -1;
+		}
+	}
+
+	return calls;
+}
+
+int I2CBackend::readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length)
+{
+	return -ENOTSUP;
+}
+
+/*************************************************************************
+  DSPALI2CBackend
+*************************************************************************/
+DSPALI2CBackend &DSPALI2CBackend::instance(void)
+{
+	static DSPALI2CBackend backend;
+	return backend;
+}
+
+int DSPALI2CBackend::open(const char *bus_path)
+{
+	int fd = ::open(bus_path, O_RDWR);
+	return (fd < 0) ? -errno : fd;
+}
+
+int DSPALI2CBackend::close(int fd)
+{
+	return ::close(fd);
+}
+
+int DSPALI2CBackend::setSlaveAddress(int fd, uint8_t address)
+{
+	struct dspal_i2c_ioctl_slave_config slave_config;
+
+	memset(&slave_config, 0, sizeof(slave_config));
+	slave_config.slave_address = address;
+	slave_config.bus_frequency_in_khz = 400;
+	slave_config.byte_transer_timeout_in_usecs = 9000;
+	return ::ioctl(fd, I2C_IOCTL_SLAVE, &slave_config);
+}
+
+int DSPALI2CBackend::readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length)
+{
+	struct dspal_i2c_ioctl_combined_write_read ioctl_write_read;
+
+	/* Save the address of the register to read from in the write buffer for the combined write. */
+	ioctl_write_read.write_buf = &reg;
+	ioctl_write_read.write_buf_len = 1;
+	ioctl_write_read.read_buf = out_buffer;
+	ioctl_write_read.read_buf_len = length;
+	return ::ioctl(fd, I2C_IOCTL_RDWR, &ioctl_write_read);
+}
+
+int DSPALI2CBackend::write(int fd, const uint8_t *buffer, int length)
+{
+	return ::write(fd, (const char *) buffer, length);
+}
@@ -0,0 +1,479 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <algorithm>
+#include "DriverFramework.hpp"
+#include "I2CDevObj.hpp"
+#include "I2CBus.hpp"
+
+using namespace DriverFramework;
+
+std::list<I2CBus *> I2CBus::m_buses;
+pthread_mutex_t I2CBus::m_buses_lock = PTHREAD_MUTEX_INITIALIZER;
+
+I2CBus::I2CBus(const char *bus_path, I2CBackend &backend) :
+	m_bus_path(bus_path),
+	m_backend(backend),
+	m_fd(-1),
+	m_slave_address(0),
+	m_refcount(0),
+	m_exit_requested(false),
+	m_max_priority(0),
+	m_head(nullptr),
+	m_busy_usec(0),
+	m_nested_usec(0),
+	m_start_time(0)
+{
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	pthread_cond_init(&m_done_cond, NULL);
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+I2CBus::~I2CBus()
+{
+	pthread_cond_destroy(&m_done_cond);
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_lock);
+}
+
+I2CBus *I2CBus::acquire(const char *bus_path, I2CBackend &backend, int priority)
+{
+	I2CBus *bus = nullptr;
+
+	pthread_mutex_lock(&m_buses_lock);
+	std::list<I2CBus *>::iterator it = m_buses.begin();
+	for (; it != m_buses.end(); ++it) {
+		if ((*it)->m_bus_path == bus_path && &(*it)->m_backend == &backend) {
+			bus = *it;
+			break;
+		}
+	}
+	if (bus == nullptr) {
+		bus = new I2CBus(bus_path, backend);
+		if (bus->start() < 0) {
+			delete bus;
+			pthread_mutex_unlock(&m_buses_lock);
+			return nullptr;
+		}
+		m_buses.push_back(bus);
+	}
+	bus->m_refcount++;
+
+	pthread_mutex_lock(&bus->m_lock);
+	bus->m_priorities.push_back(priority);
+	if (bus->m_priorities.size() == 1 || priority > bus->m_max_priority) {
+		bus->m_max_priority = priority;
+	}
+	pthread_mutex_unlock(&bus->m_lock);
+	pthread_mutex_unlock(&m_buses_lock);
+
+	return bus;
+}
+
+void I2CBus::release(I2CBus *bus, int priority)
+{
+	pthread_mutex_lock(&m_buses_lock);
+
+	// Batches of the remaining devices may no longer need to yield
+	pthread_mutex_lock(&bus->m_lock);
+	std::list<int>::iterator it = std::find(bus->m_priorities.begin(), bus->m_priorities.end(), priority);
+	if (it != bus->m_priorities.end()) {
+		bus->m_priorities.erase(it);
+	}
+	bus->m_max_priority = bus->m_priorities.empty() ? 0 :
+			      *std::max_element(bus->m_priorities.begin(), bus->m_priorities.end());
+	pthread_mutex_unlock(&bus->m_lock);
+
+	if (--bus->m_refcount == 0) {
+		m_buses.remove(bus);
+		bus->stop();
+		delete bus;
+	}
+	pthread_mutex_unlock(&m_buses_lock);
+}
+
+int I2CBus::start(void)
+{
+	m_fd = m_backend.open(m_bus_path.c_str());
+	if (m_fd < 0) {
+		DF_LOG_ERR("error: unable to open %s", m_bus_path.c_str());
+		return m_fd;
+	}
+
+	m_start_time = offsetTime();
+
+	// Bus transfers are on the critical path of the HRT work, so run just
+	// below it. Fall back to the default policy if not permitted.
+	pthread_attr_t attr;
+	sched_param param;
+	pthread_attr_init(&attr);
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+
+	int ret = pthread_create(&m_tid, &attr, process_trampoline, this);
+	if (ret) {
+		ret = pthread_create(&m_tid, NULL, process_trampoline, this);
+	}
+	pthread_attr_destroy(&attr);
+#ifdef __linux__
+	if (ret == 0) {
+		pthread_setname_np(m_tid, "df_i2c_bus");
+	}
+#endif
+
+	if (ret) {
+		m_backend.close(m_fd);
+		m_fd = -1;
+		return -ret;
+	}
+	return 0;
+}
+
+void I2CBus::stop(void)
+{
+	pthread_mutex_lock(&m_lock);
+	m_exit_requested = true;
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_lock);
+
+	pthread_join(m_tid, NULL);
+
+	m_backend.close(m_fd);
+	m_fd = -1;
+}
+
+bool I2CBus::outranks(const I2CTransfer &a, const I2CTransfer &b)
+{
+	if (a.priority != b.priority) {
+		return a.priority > b.priority;
+	}
+	// No deadline sorts last
+	return a.deadline && (b.deadline == 0 || a.deadline < b.deadline);
+}
+
+int I2CBus::submit(I2CTransfer &txn, i2cCompletionCallback completion, void *arg)
+{
+	pthread_mutex_lock(&m_lock);
+	if (txn.queued) {
+		pthread_mutex_unlock(&m_lock);
+		return -EBUSY;
+	}
+
+	txn.completion = completion;
+	txn.arg = arg;
+	txn.result = 0;
+	txn.calls = 0;
+	txn.queued = true;
+	txn.submit_time = offsetTime();
+	txn.deadline = txn.deadline_usec ? txn.submit_time + txn.deadline_usec : 0;
+
+	// Behind all transfers at least as urgent
+	I2CTransfer **pos = &m_head;
+	while (*pos && !outranks(txn, **pos)) {
+		pos = &(*pos)->next;
+	}
+	txn.next = *pos;
+	*pos = &txn;
+
+	m_stats.queue_depth++;
+	if (m_stats.queue_depth > m_stats.max_queue_depth) {
+		m_stats.max_queue_depth = m_stats.queue_depth;
+	}
+
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_lock);
+
+	return 0;
+}
+
+int I2CBus::transferSync(I2CTransfer &txn)
+{
+	// From a completion callback the worker cannot wait on itself
+	if (pthread_equal(pthread_self(), m_tid)) {
+		txn.calls = 0;
+		execute(txn);
+		return txn.result;
+	}
+
+	int ret = submit(txn, nullptr, nullptr);
+	if (ret < 0) {
+		return ret;
+	}
+
+	pthread_mutex_lock(&m_lock);
+	while (txn.queued) {
+		pthread_cond_wait(&m_done_cond, &m_lock);
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return txn.result;
+}
+
+void I2CBus::getStats(I2CBusStats &stats)
+{
+	pthread_mutex_lock(&m_lock);
+	stats = m_stats;
+	uint64_t elapsed = offsetTime() - m_start_time;
+	stats.utilization = elapsed ? (float)m_busy_usec / elapsed : 0.0f;
+	pthread_mutex_unlock(&m_lock);
+}
+
+void I2CBus::getDeviceStats(const I2CDeviceBusStats &device_stats, I2CDeviceBusStats &stats)
+{
+	pthread_mutex_lock(&m_lock);
+	stats = device_stats;
+	pthread_mutex_unlock(&m_lock);
+}
+
+void I2CBus::dumpStats(void)
+{
+	pthread_mutex_lock(&m_buses_lock);
+	std::list<I2CBus *>::iterator it = m_buses.begin();
+	for (; it != m_buses.end(); ++it) {
+		I2CBusStats stats;
+		(*it)->getStats(stats);
+		DF_LOG_INFO("%s: transfers=%lu errors=%lu depth=%u max_depth=%u "
+			"avg_xfer=%llu max_xfer=%llu avg_wait=%llu max_wait=%llu util=%f",
+			(*it)->m_bus_path.c_str(), stats.transfers, stats.errors,
+			stats.queue_depth, stats.max_queue_depth,
+			(unsigned long long)(stats.transfers ? stats.total_transfer_usec/stats.transfers : 0),
+			(unsigned long long)stats.max_transfer_usec,
+			(unsigned long long)(stats.transfers ? stats.total_wait_usec/stats.transfers : 0),
+			(unsigned long long)stats.max_wait_usec,
+			stats.utilization);
+	}
+	pthread_mutex_unlock(&m_buses_lock);
+}
+
+void *I2CBus::process_trampoline(void *arg)
+{
+	if (Framework::isRealtime()) {
+		Framework::prefaultStack(DF_STACK_PREFAULT);
+	}
+	reinterpret_cast<I2CBus *>(arg)->process();
+	return NULL;
+}
+
+I2CTransfer *I2CBus::popOutranking(I2CTransfer &txn)
+{
+	I2CTransfer *head = m_head;
+	if (head && outranks(*head, txn)) {
+		m_head = head->next;
+		m_stats.queue_depth--;
+		return head;
+	}
+	return nullptr;
+}
+
+void I2CBus::dispatch(I2CTransfer &txn)
+{
+	// Transfers dispatched between the segments of a preempted batch
+	// are accounted for on their own, not as part of the batch
+	uint64_t outer_nested = m_nested_usec;
+	m_nested_usec = 0;
+	pthread_mutex_unlock(&m_lock);
+
+	uint64_t start = offsetTime();
+	execute(txn);
+	uint64_t end = offsetTime();
+
+	pthread_mutex_lock(&m_lock);
+	uint64_t wait = start - txn.submit_time;
+	uint64_t duration = end - start - m_nested_usec;
+	m_stats.transfers++;
+	if (txn.result < 0) {
+		m_stats.errors++;
+	}
+	m_stats.total_transfer_usec += duration;
+	m_stats.total_wait_usec += wait;
+	if (duration > m_stats.max_transfer_usec) {
+		m_stats.max_transfer_usec = duration;
+	}
+	if (wait > m_stats.max_wait_usec) {
+		m_stats.max_wait_usec = wait;
+	}
+	m_busy_usec += duration;
+
+	I2CDeviceBusStats *dev_stats = txn.device_stats;
+	if (dev_stats) {
+		dev_stats->transfers++;
+		dev_stats->total_wait_usec += wait;
+		if (wait > dev_stats->max_wait_usec) {
+			dev_stats->max_wait_usec = wait;
+		}
+		if (txn.deadline && end > txn.deadline) {
+			dev_stats->deadline_misses++;
+		}
+	}
+
+	// txn may be reused or go out of scope once it is not queued
+	i2cCompletionCallback completion = txn.completion;
+	void *arg = txn.arg;
+	txn.queued = false;
+	pthread_cond_broadcast(&m_done_cond);
+	pthread_mutex_unlock(&m_lock);
+
+	// The completion may submit the transfer again
+	if (completion) {
+		completion(arg, txn);
+	}
+
+	pthread_mutex_lock(&m_lock);
+	m_nested_usec = outer_nested + (offsetTime() - start);
+}
+
+void I2CBus::process(void)
+{
+	pthread_mutex_lock(&m_lock);
+	while (!m_exit_requested) {
+		if (m_head == nullptr) {
+			pthread_cond_wait(&m_cond, &m_lock);
+			continue;
+		}
+
+		I2CTransfer *txn = m_head;
+		m_head = txn->next;
+		m_stats.queue_depth--;
+		dispatch(*txn);
+	}
+
+	// Fail what is left so the owners are not left waiting
+	while (m_head) {
+		I2CTransfer *txn = m_head;
+		m_head = txn->next;
+		m_stats.queue_depth--;
+		txn->result = -ECANCELED;
+		i2cCompletionCallback completion = txn->completion;
+		void *arg = txn->arg;
+		txn->queued = false;
+		pthread_cond_broadcast(&m_done_cond);
+		pthread_mutex_unlock(&m_lock);
+		if (completion) {
+			completion(arg, *txn);
+		}
+		pthread_mutex_lock(&m_lock);
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+bool I2CBus::selectSlave(I2CTransfer &txn)
+{
+	// Devices share the worker's file descriptor
+	if (txn.slave_address && txn.slave_address != m_slave_address) {
+		txn.calls++;
+		if (m_backend.setSlaveAddress(m_fd, txn.slave_address) < 0) {
+			txn.result = -EIO;
+			return false;
+		}
+		m_slave_address = txn.slave_address;
+	}
+	return true;
+}
+
+void I2CBus::execute(I2CTransfer &txn)
+{
+	if (!selectSlave(txn)) {
+		return;
+	}
+
+	switch (txn.type) {
+	case I2CTransferType_ReadReg:
+		txn.calls++;
+		txn.result = I2CDevObj::_readReg(m_backend, m_fd, txn.reg, txn.buffer, txn.length);
+		break;
+	case I2CTransferType_WriteReg:
+		txn.calls++;
+		txn.result = I2CDevObj::_writeReg(m_backend, m_fd, txn.reg, txn.buffer, txn.length);
+		break;
+	case I2CTransferType_ReadBlock:
+		txn.calls++;
+		txn.result = m_backend.readBlock(m_fd, txn.reg, txn.buffer, txn.length);
+		break;
+	case I2CTransferType_Batch:
+		executeBatch(txn);
+		break;
+	default:
+		txn.result = -EINVAL;
+		break;
+	}
+}
+
+void I2CBus::executeBatch(I2CTransfer &txn)
+{
+	pthread_mutex_lock(&m_lock);
+	bool preemptible = txn.priority < m_max_priority;
+	pthread_mutex_unlock(&m_lock);
+
+	if (!preemptible) {
+		int calls = I2CDevObj::_transfer(m_backend, m_fd, txn.segments, txn.num_segments);
+		if (calls > 0) {
+			txn.calls += calls;
+		}
+		txn.result = (calls < 0) ? calls : 0;
+		return;
+	}
+
+	// One segment per call; more urgent transfers run in between
+	for (unsigned int i = 0; i < txn.num_segments; i++) {
+		if (i) {
+			pthread_mutex_lock(&m_lock);
+			I2CTransfer *urgent;
+			while ((urgent = popOutranking(txn)) != nullptr) {
+				dispatch(*urgent);
+			}
+			pthread_mutex_unlock(&m_lock);
+
+			// Another device may have selected its slave
+			if (!selectSlave(txn)) {
+				return;
+			}
+		}
+
+		int calls = I2CDevObj::_transfer(m_backend, m_fd, &txn.segments[i], 1);
+		if (calls < 0) {
+			txn.result = calls;
+			return;
+		}
+		txn.calls += calls;
+	}
+	txn.result = 0;
+}
@@ -39,21 +39,52 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include "OSConfig.h"
-#include "dev_fs_lib_i2c.h"
 #include "I2CDevObj.hpp"
 
 using namespace DriverFramework;
 
+// Staged registers bridged with known values to merge two bursts
+#define SHADOW_MAX_GAP 2
+
+I2CDevObj::~I2CDevObj()
+{
+	delete m_shadow;
+}
+
 int I2CDevObj::start()
 {
-	m_fd = ::open(m_dev_instance_path.c_str(), O_RDWR);
-	return (m_fd < 0) ? m_fd : 0;
+	if (m_backend == nullptr) {
+		m_backend = &I2CBackend::getDefault();
+	}
+
+	// The device path is the bus the device is attached to. The bus
+	// arbiter owns its file descriptor. A handle opened on a started
+	// device calls start() again, which keeps the bus reference.
+	if (m_bus == nullptr) {
+		m_bus = I2CBus::acquire(m_dev_base_path.c_str(), *m_backend, m_bus_priority);
+		if (m_bus == nullptr) {
+			return -1;
+		}
+	}
+
+	int ret = DevObj::start();
+	if (ret < 0) {
+		stop();
+	}
+	return ret;
 }
 
 int I2CDevObj::stop()
 {
-	return  ::close(m_fd);
+	DevObj::stop();
+
+	if (m_bus) {
+		I2CBus::release(m_bus, m_bus_priority);
+		m_bus = nullptr;
+	}
+	return 0;
 }
 
 int I2CDevObj::readReg(DevHandle &h, uint8_t address, uint8_t *out_buffer, int length)
@@ -78,34 +109,296 @@ int I2CDevObj::writeReg(DevHandle &h, uint8_t address, uint8_t *in_buffer, int l
 	}
 }
 
+int I2CDevObj::readBlock(DevHandle &h, uint8_t address, uint8_t *out_buffer, int max_length)
+{
+	I2CDevObj *obj = DevMgr::getDevObjByHandle<I2CDevObj>(h);
+	if (obj) {
+		return obj->_readBlock(address, out_buffer, max_length);
+	}
+	else {
+		return -1;
+	}
+}
+
+int I2CDevObj::transfer(DevHandle &h, I2CSegment *segments, unsigned int count)
+{
+	I2CDevObj *obj = DevMgr::getDevObjByHandle<I2CDevObj>(h);
+	if (obj) {
+		return obj->_transfer(segments, count);
+	}
+	else {
+		return -1;
+	}
+}
+
+int I2CDevObj::getBusStats(I2CBusStats &stats)
+{
+	if (m_bus == nullptr) {
+		return -1;
+	}
+	m_bus->getStats(stats);
+	return 0;
+}
+
+void I2CDevObj::getDeviceBusStats(I2CDeviceBusStats &stats)
+{
+	// Updated by the bus worker under the bus lock
+	if (m_bus) {
+		m_bus->getDeviceStats(m_device_bus_stats, stats);
+	}
+	else {
+		stats = m_device_bus_stats;
+	}
+}
+
+int I2CDevObj::submit(I2CTransfer &txn, i2cCompletionCallback completion, void *arg)
+{
+	if (m_bus == nullptr) {
+		DF_LOG_ERR("error: i2c bus is not yet opened");
+		return -1;
+	}
+	txn.slave_address = m_id.dev_id_s.address;
+	txn.priority = m_bus_priority;
+	txn.deadline_usec = m_bus_deadline;
+	txn.device_stats = &m_device_bus_stats;
+	return m_bus->submit(txn, completion, arg);
+}
+
+int I2CDevObj::transferSync(I2CTransfer &txn)
+{
+	if (m_bus == nullptr) {
+		DF_LOG_ERR("error: i2c bus is not yet opened");
+		return -1;
+	}
+	txn.slave_address = m_id.dev_id_s.address;
+	txn.priority = m_bus_priority;
+	txn.deadline_usec = m_bus_deadline;
+	txn.device_stats = &m_device_bus_stats;
+	txn.queued = false;
+
+	int ret = m_bus->transferSync(txn);
+	m_syscall_count += txn.calls;
+	return ret;
+}
+
+void I2CDevObj::resumeCompletion(void *arg, I2CTransfer &txn)
+{
+	reinterpret_cast<I2CDevObj *>(arg)->resumeMeasure();
+}
+
+int I2CDevObj::submitAndResume(I2CTransfer &txn)
+{
+	suspendMeasure();
+	int ret = submit(txn, resumeCompletion, this);
+	if (ret < 0) {
+		// Continue right away so the next phase sees the error
+		txn.result = ret;
+		resumeMeasure();
+	}
+	return ret;
+}
+
 int I2CDevObj::_readReg(uint8_t address, uint8_t *out_buffer, int length)
 {
-	struct dspal_i2c_ioctl_combined_write_read ioctl_write_read;
-	uint8_t write_buffer[1];
+	I2CTransfer txn;
+	memset(&txn, 0, sizeof(txn));
+	txn.type = I2CTransferType_ReadReg;
+	txn.reg = address;
+	txn.buffer = out_buffer;
+	txn.length = length;
+
+	return (transferSync(txn) < 0) ? -1 : 0;
+}
+
+int I2CDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
+{
+	I2CTransfer txn;
+	memset(&txn, 0, sizeof(txn));
+	txn.type = I2CTransferType_WriteReg;
+	txn.reg = address;
+	txn.buffer = in_buffer;
+	txn.length = length;
+
+	return (transferSync(txn) < 0) ? -1 : 0;
+}
+
+int I2CDevObj::_transfer(I2CSegment *segments, unsigned int count)
+{
+	I2CTransfer txn;
+	memset(&txn, 0, sizeof(txn));
+	txn.type = I2CTransferType_Batch;
+	txn.segments = segments;
+	txn.num_segments = count;
+
+	return (transferSync(txn) < 0) ? -1 : 0;
+}
 
-	if (m_fd == 0) {
+int I2CDevObj::_readBlock(uint8_t address, uint8_t *out_buffer, int max_length)
+{
+	I2CTransfer txn;
+	memset(&txn, 0, sizeof(txn));
+	txn.type = I2CTransferType_ReadBlock;
+	txn.reg = address;
+	txn.buffer = out_buffer;
+	txn.length = max_length;
+
+	int ret = transferSync(txn);
+	if (ret < 0) {
+		DF_LOG_ERR("error: i2c block read of register 0x%02x failed (%d)", address, ret);
+	}
+	return ret;
+}
+
+int I2CDevObj::fifoReadReg(void *ctx, uint8_t address, uint8_t *out_buffer, int length)
+{
+	return static_cast<I2CDevObj *>(ctx)->_readReg(address, out_buffer, length);
+}
+
+int I2CDevObj::_drainFifo(const SensorFifoConfig &config, uint8_t *out_buffer,
+			  uint64_t *timestamps, unsigned int max_samples)
+{
+	return SensorFifo::drain(config, fifoReadReg, this, out_buffer, timestamps, max_samples);
+}
+
+int I2CDevObj::enableRegisterShadow()
+{
+	if (m_shadow) {
+		return -1;
+	}
+	m_shadow = new RegisterShadow();
+	return 0;
+}
+
+void I2CDevObj::setStaticRegs(uint8_t address, unsigned int count)
+{
+	if (m_shadow) {
+		m_shadow->setStatic(address, count);
+	}
+}
+
+int I2CDevObj::_readRegCached(uint8_t address, uint8_t *out_buffer, int length)
+{
+	if (m_shadow == nullptr) {
+		return _readReg(address, out_buffer, length);
+	}
+	if (m_shadow->lookup(address, out_buffer, length)) {
+		return 0;
+	}
+	if (m_shadow->isDirty(address, length) && _flushRegs() < 0) {
+		return -1;
+	}
+
+	int ret = _readReg(address, out_buffer, length);
+	if (ret == 0) {
+		m_shadow->fill(address, out_buffer, length);
+	}
+	return ret;
+}
+
+int I2CDevObj::_writeRegCached(uint8_t address, const uint8_t *in_buffer, int length)
+{
+	if (m_shadow == nullptr) {
+		return _writeReg(address, const_cast<uint8_t *>(in_buffer), length);
+	}
+	m_shadow->stage(address, in_buffer, length);
+	return 0;
+}
+
+int I2CDevObj::_flushRegs()
+{
+	if (m_shadow == nullptr) {
+		return 0;
+	}
+
+	unsigned int reg = 0;
+	unsigned int length;
+
+	while (m_shadow->nextDirtyRun(reg, length, SHADOW_MAX_GAP, MAX_LEN_TRANSMIT_BUFFER_IN_BYTES - 1)) {
+		if (_writeReg(reg, const_cast<uint8_t *>(m_shadow->values(reg)), length) < 0) {
+			return -1;
+		}
+		m_shadow->clean(reg, length);
+		reg += length;
+	}
+	return 0;
+}
+
+int I2CDevObj::_verifyRegs()
+{
+	if (m_shadow == nullptr) {
+		return 0;
+	}
+	if (_flushRegs() < 0) {
+		return -1;
+	}
+
+	uint8_t buffer[MAX_LEN_TRANSMIT_BUFFER_IN_BYTES];
+	unsigned int reg = 0;
+	unsigned int length;
+	int mismatches = 0;
+
+	while (m_shadow->nextStaticRun(reg, length, sizeof(buffer))) {
+		if (_readReg(reg, buffer, length) < 0) {
+			return -1;
+		}
+
+		const uint8_t *expected = m_shadow->values(reg);
+		for (unsigned int i = 0; i < length; i++) {
+			if (buffer[i] != expected[i]) {
+				// Restore the value the driver configured
+				m_shadow->stage(reg + i, &expected[i], 1);
+				++mismatches;
+			}
+		}
+		reg += length;
+	}
+
+	if (mismatches) {
+		DF_LOG_ERR("error: %d registers of %s changed on the device, restoring",
+			   mismatches, m_name.c_str());
+		m_reg_mismatches += mismatches;
+		if (_flushRegs() < 0) {
+			return -1;
+		}
+	}
+	return mismatches;
+}
+
+int I2CDevObj::_syncRegs()
+{
+	if (m_shadow == nullptr) {
+		return 0;
+	}
+
+	if (m_reg_verify_interval) {
+		uint64_t now = offsetTime();
+		if (now - m_reg_verify_time >= m_reg_verify_interval) {
+			m_reg_verify_time = now;
+			return (_verifyRegs() < 0) ? -1 : 0;
+		}
+	}
+	return _flushRegs();
+}
+
+int I2CDevObj::_readReg(I2CBackend &backend, int fd, uint8_t address, uint8_t *out_buffer, int length)
+{
+	if (fd < 0) {
 		DF_LOG_ERR("error: i2c bus is not yet opened");
 		return -1;
 	}
 
-	/* Save the address of the register to read from in the write buffer for the combined write. */
-	write_buffer[0] = address;
-	ioctl_write_read.write_buf = write_buffer;
-	ioctl_write_read.write_buf_len = 1;
-	ioctl_write_read.read_buf = out_buffer;
-	ioctl_write_read.read_buf_len = length;
-	int bytes_written = ::ioctl(m_fd, I2C_IOCTL_RDWR, &ioctl_write_read);
-	if (bytes_written != length) {
+	int bytes_read = backend.readReg(fd, address, out_buffer, length);
+	if (bytes_read != length) {
 		DF_LOG_ERR(
 			"error: read register reports a read of %d bytes, but attempted to set %d bytes",
-			bytes_written, length);
+			bytes_read, length);
 		return -1;
 	}
 
 	return 0;
 }
 
-int I2CDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
+int I2CDevObj::_writeReg(I2CBackend &backend, int fd, uint8_t address, uint8_t *in_buffer, int length)
 {
 	uint8_t write_buffer[MAX_LEN_TRANSMIT_BUFFER_IN_BYTES];
 
@@ -117,7 +410,7 @@ int I2CDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
 		DF_LOG_ERR("error: caller's buffer exceeds size of local buffer");
 		return -1;
 	}
-	if (m_fd == 0) {
+	if (fd < 0) {
 		DF_LOG_ERR("error: i2c bus is not yet opened");
 		return -1;
 	}
@@ -125,7 +418,7 @@ int I2CDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
 	/* Save the address of the register to read from in the write buffer for the combined write. */
 	write_buffer[0] = address;
 	memcpy(&write_buffer[1], in_buffer, length);
-	int bytes_written = ::write(m_fd, (char *) write_buffer, length + 1);
+	int bytes_written = backend.write(fd, write_buffer, length + 1);
 	if (bytes_written != length + 1) {
 		DF_LOG_ERR("Error: i2c write failed. Reported %d bytes written",
 				bytes_written);
@@ -135,3 +428,16 @@ int I2CDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
 	return 0;
 }
 
+int I2CDevObj::_transfer(I2CBackend &backend, int fd, I2CSegment *segments, unsigned int count)
+{
+	if (fd < 0) {
+		DF_LOG_ERR("error: i2c bus is not yet opened");
+		return -1;
+	}
+
+	int calls = backend.transfer(fd, segments, count);
+	if (calls < 0) {
+		DF_LOG_ERR("error: i2c batch transfer of %u segments failed", count);
+	}
+	return calls;
+}
@@ -0,0 +1,257 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#ifdef __linux__
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "I2CBackend.hpp"
+
+using namespace DriverFramework;
+
+LinuxI2CBackend::LinuxI2CBackend()
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+LinuxI2CBackend::~LinuxI2CBackend()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+LinuxI2CBackend &LinuxI2CBackend::instance(void)
+{
+	static LinuxI2CBackend backend;
+	return backend;
+}
+
+int LinuxI2CBackend::sysOpen(const char *path, int flags)
+{
+	int fd = ::open(path, flags);
+	return (fd < 0) ? -errno : fd;
+}
+
+int LinuxI2CBackend::sysClose(int fd)
+{
+	return (::close(fd) < 0) ? -errno : 0;
+}
+
+int LinuxI2CBackend::sysWrite(int fd, const void *buffer, size_t length)
+{
+	ssize_t ret = ::write(fd, buffer, length);
+	return (ret < 0) ? -errno : (int)ret;
+}
+
+int LinuxI2CBackend::sysIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret = ::ioctl(fd, request, arg);
+	return (ret < 0) ? -errno : ret;
+}
+
+int LinuxI2CBackend::open(const char *bus_path)
+{
+	return sysOpen(bus_path, O_RDWR);
+}
+
+int LinuxI2CBackend::close(int fd)
+{
+	pthread_mutex_lock(&m_lock);
+	m_slave_address.erase(fd);
+	pthread_mutex_unlock(&m_lock);
+
+	return sysClose(fd);
+}
+
+int LinuxI2CBackend::setSlaveAddress(int fd, uint8_t address)
+{
+	// Also selects the slave for plain write() calls
+	int ret = sysIoctl(fd, I2C_SLAVE, (void *)(unsigned long)address);
+	if (ret < 0) {
+		return ret;
+	}
+
+	pthread_mutex_lock(&m_lock);
+	m_slave_address[fd] = address;
+	pthread_mutex_unlock(&m_lock);
+
+	return 0;
+}
+
+int LinuxI2CBackend::getSlaveAddress(int fd, uint16_t &address)
+{
+	int ret = -EDESTADDRREQ;
+
+	pthread_mutex_lock(&m_lock);
+	std::map<int, uint16_t>::iterator it = m_slave_address.find(fd);
+	if (it != m_slave_address.end()) {
+		address = it->second;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+int LinuxI2CBackend::readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length)
+{
+	uint16_t address;
+	int ret = getSlaveAddress(fd, address);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Register write and data read with a repeated start
+	struct i2c_msg msgs[2];
+	msgs[0].addr = address;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &reg;
+	msgs[1].addr = address;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = length;
+	msgs[1].buf = out_buffer;
+
+	struct i2c_rdwr_ioctl_data data;
+	data.msgs = msgs;
+	data.nmsgs = 2;
+
+	ret = sysIoctl(fd, I2C_RDWR, &data);
+	return (ret < 0) ? ret : length;
+}
+
+int LinuxI2CBackend::write(int fd, const uint8_t *buffer, int length)
+{
+	return sysWrite(fd, buffer, length);
+}
+
+int LinuxI2CBackend::transfer(int fd, I2CSegment *segments, unsigned int count)
+{
+	uint16_t address;
+	int ret = getSlaveAddress(fd, address);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// The kernel limits the messages per ioctl; longer batches are split
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	unsigned int nmsgs = 0;
+	int calls = 0;
+
+	for (unsigned int i = 0; i <= count; i++) {
+		bool last = (i == count);
+
+		if (last || nmsgs + 2 > I2C_RDWR_IOCTL_MAX_MSGS) {
+			if (nmsgs) {
+				struct i2c_rdwr_ioctl_data data;
+				data.msgs = msgs;
+				data.nmsgs = nmsgs;
+
+				ret = sysIoctl(fd, I2C_RDWR, &data);
+				++calls;
+				if (ret < 0) {
+					return ret;
+				}
+				nmsgs = 0;
+			}
+			if (last) {
+				break;
+			}
+		}
+
+		I2CSegment &seg = segments[i];
+
+		if (seg.type == I2CTransferType_ReadReg) {
+			msgs[nmsgs].addr = address;
+			msgs[nmsgs].flags = 0;
+			msgs[nmsgs].len = 1;
+			msgs[nmsgs].buf = &seg.reg;
+			++nmsgs;
+			msgs[nmsgs].addr = address;
+			msgs[nmsgs].flags = I2C_M_RD;
+			msgs[nmsgs].len = seg.length;
+			msgs[nmsgs].buf = seg.buffer;
+			++nmsgs;
+		}
+		else if (seg.type == I2CTransferType_WriteReg) {
+			seg.buffer[0] = seg.reg;
+			msgs[nmsgs].addr = address;
+			msgs[nmsgs].flags = 0;
+			msgs[nmsgs].len = seg.length + 1;
+			msgs[nmsgs].buf = seg.buffer;
+			++nmsgs;
+		}
+		else {
+			return -EINVAL;
+		}
+	}
+
+	return calls;
+}
+
+int LinuxI2CBackend::readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length)
+{
+	union i2c_smbus_data smbus_data;
+	struct i2c_smbus_ioctl_data args;
+
+	args.read_write = I2C_SMBUS_READ;
+	args.command = reg;
+	args.size = I2C_SMBUS_BLOCK_DATA;
+	args.data = &smbus_data;
+
+	// Uses the slave selected with I2C_SLAVE
+	int ret = sysIoctl(fd, I2C_SMBUS, &args);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// block[0] holds the count sent by the device
+	int length = smbus_data.block[0];
+	if (length > I2C_SMBUS_BLOCK_MAX) {
+		return -EPROTO;
+	}
+	if (length > max_length) {
+		length = max_length;
+	}
+	memcpy(out_buffer, &smbus_data.block[1], length);
+
+	return length;
+}
+
+#endif
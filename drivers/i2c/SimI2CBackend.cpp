@@ -0,0 +1,468 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "DriverFramework.hpp"
+#include "SimI2CBackend.hpp"
+
+using namespace DriverFramework;
+
+// Simulated file descriptors start here, to stand out from real ones
+#define SIM_FD_BASE 1000
+
+/*************************************************************************
+  SimI2CDevice
+*************************************************************************/
+SimI2CDevice::SimI2CDevice(uint8_t address) :
+	m_address(address)
+{
+	memset(m_regs, 0, sizeof(m_regs));
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+SimI2CDevice::~SimI2CDevice()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+void SimI2CDevice::lock()
+{
+	pthread_mutex_lock(&m_lock);
+}
+
+void SimI2CDevice::unlock()
+{
+	pthread_mutex_unlock(&m_lock);
+}
+
+void SimI2CDevice::setReg(uint8_t reg, uint8_t value)
+{
+	lock();
+	m_regs[reg] = value;
+	unlock();
+}
+
+void SimI2CDevice::setRegs(uint8_t reg, const uint8_t *values, unsigned int length)
+{
+	lock();
+	for (unsigned int i = 0; i < length; i++) {
+		m_regs[(uint8_t)(reg + i)] = values[i];
+	}
+	unlock();
+}
+
+uint8_t SimI2CDevice::getReg(uint8_t reg)
+{
+	lock();
+	uint8_t value = m_regs[reg];
+	unlock();
+	return value;
+}
+
+void SimI2CDevice::scriptRegs(uint8_t reg, const uint8_t *values, unsigned int step_length, unsigned int steps)
+{
+	Script script;
+	script.reg = reg;
+	script.step_length = step_length;
+	script.steps = steps;
+	script.next = 0;
+	script.values.assign(values, values + step_length*steps);
+
+	lock();
+	std::list<Script>::iterator it = m_scripts.begin();
+	while (it != m_scripts.end()) {
+		if (it->reg == reg) {
+			it = m_scripts.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	if (steps) {
+		m_scripts.push_back(script);
+	}
+	unlock();
+}
+
+void SimI2CDevice::read(uint8_t reg, uint8_t *out_buffer, int length)
+{
+	// Advance a script starting at this register
+	std::list<Script>::iterator it = m_scripts.begin();
+	for (; it != m_scripts.end(); ++it) {
+		if (it->reg == reg) {
+			const uint8_t *step = &it->values[it->next * it->step_length];
+			for (unsigned int i = 0; i < it->step_length; i++) {
+				m_regs[(uint8_t)(reg + i)] = step[i];
+			}
+			it->next = (it->next + 1) % it->steps;
+			break;
+		}
+	}
+
+	for (int i = 0; i < length; i++) {
+		out_buffer[i] = m_regs[(uint8_t)(reg + i)];
+	}
+}
+
+void SimI2CDevice::write(uint8_t reg, const uint8_t *data, int length)
+{
+	for (int i = 0; i < length; i++) {
+		m_regs[(uint8_t)(reg + i)] = data[i];
+	}
+}
+
+/*************************************************************************
+  SimI2CBackend
+*************************************************************************/
+SimI2CBackend::SimI2CBackend() :
+	m_call_count(0),
+	m_combined_transfers(true)
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+SimI2CBackend::~SimI2CBackend()
+{
+	std::list<SimBus *>::iterator it = m_buses.begin();
+	for (; it != m_buses.end(); ++it) {
+		pthread_mutex_destroy(&(*it)->lock);
+		delete *it;
+	}
+	pthread_mutex_destroy(&m_lock);
+}
+
+// Call with m_lock held
+SimI2CBackend::SimBus *SimI2CBackend::getBus(const char *bus_path)
+{
+	std::list<SimBus *>::iterator it = m_buses.begin();
+	for (; it != m_buses.end(); ++it) {
+		if ((*it)->path == bus_path) {
+			return *it;
+		}
+	}
+
+	SimBus *bus = new SimBus;
+	bus->path = bus_path;
+	bus->latency_usec = 0;
+	bus->bus_rate_hz = 400000;
+	pthread_mutex_init(&bus->lock, NULL);
+	m_buses.push_back(bus);
+	return bus;
+}
+
+int SimI2CBackend::attach(const char *bus_path, SimI2CDevice &dev)
+{
+	pthread_mutex_lock(&m_lock);
+	SimBus *bus = getBus(bus_path);
+	bus->devices.push_back(&dev);
+	pthread_mutex_unlock(&m_lock);
+	return 0;
+}
+
+void SimI2CBackend::detach(SimI2CDevice &dev)
+{
+	pthread_mutex_lock(&m_lock);
+	std::list<SimBus *>::iterator it = m_buses.begin();
+	for (; it != m_buses.end(); ++it) {
+		pthread_mutex_lock(&(*it)->lock);
+		(*it)->devices.remove(&dev);
+		pthread_mutex_unlock(&(*it)->lock);
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+void SimI2CBackend::setTiming(const char *bus_path, uint32_t latency_usec, uint32_t bus_rate_hz)
+{
+	pthread_mutex_lock(&m_lock);
+	SimBus *bus = getBus(bus_path);
+	bus->latency_usec = latency_usec;
+	bus->bus_rate_hz = bus_rate_hz;
+	pthread_mutex_unlock(&m_lock);
+}
+
+int SimI2CBackend::open(const char *bus_path)
+{
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+
+	SimFd sim_fd;
+	sim_fd.bus = getBus(bus_path);
+	sim_fd.address = 0;
+
+	// Reuse a closed slot
+	unsigned int i = 0;
+	for (; i < m_fds.size(); i++) {
+		if (m_fds[i].bus == nullptr) {
+			break;
+		}
+	}
+	if (i == m_fds.size()) {
+		m_fds.push_back(sim_fd);
+	}
+	else {
+		m_fds[i] = sim_fd;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return SIM_FD_BASE + i;
+}
+
+int SimI2CBackend::close(int fd)
+{
+	int ret = -EBADF;
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+	unsigned int i = fd - SIM_FD_BASE;
+	if (fd >= SIM_FD_BASE && i < m_fds.size() && m_fds[i].bus) {
+		m_fds[i].bus = nullptr;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+int SimI2CBackend::setSlaveAddress(int fd, uint8_t address)
+{
+	int ret = -EBADF;
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+	unsigned int i = fd - SIM_FD_BASE;
+	if (fd >= SIM_FD_BASE && i < m_fds.size() && m_fds[i].bus) {
+		m_fds[i].address = address;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+// Find the bus and selected device of fd. Without a slave address the
+// first device on the bus is selected.
+SimI2CBackend::SimBus *SimI2CBackend::getFdBus(int fd, SimI2CDevice *&dev)
+{
+	SimBus *bus = nullptr;
+	dev = nullptr;
+
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+	unsigned int i = fd - SIM_FD_BASE;
+	if (fd >= SIM_FD_BASE && i < m_fds.size() && m_fds[i].bus) {
+		bus = m_fds[i].bus;
+		uint8_t address = m_fds[i].address;
+
+		pthread_mutex_lock(&bus->lock);
+		std::list<SimI2CDevice *>::iterator it = bus->devices.begin();
+		for (; it != bus->devices.end(); ++it) {
+			if (address == 0 || (*it)->m_address == address) {
+				dev = *it;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&bus->lock);
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return bus;
+}
+
+// Hold the bus for the duration of a transfer of bytes (call with bus.lock held)
+void SimI2CBackend::occupyBus(SimBus &bus, unsigned int bytes)
+{
+	uint64_t usec = bus.latency_usec;
+	if (bus.bus_rate_hz) {
+		usec += ((uint64_t)bytes * 9 * 1000000 + bus.bus_rate_hz - 1) / bus.bus_rate_hz;
+	}
+	if (usec) {
+		struct timespec ts;
+		ts.tv_sec = usec / 1000000;
+		ts.tv_nsec = (usec % 1000000) * 1000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+	}
+}
+
+int SimI2CBackend::readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length)
+{
+	SimI2CDevice *dev;
+	SimBus *bus = getFdBus(fd, dev);
+	if (bus == nullptr) {
+		return -EBADF;
+	}
+
+	pthread_mutex_lock(&bus->lock);
+
+	// address+W, register, address+R, data
+	occupyBus(*bus, length + 3);
+
+	int ret = -EIO;	// no ACK
+	if (dev) {
+		dev->lock();
+		dev->m_read_count++;
+		dev->read(reg, out_buffer, length);
+		dev->unlock();
+		ret = length;
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	return ret;
+}
+
+int SimI2CBackend::write(int fd, const uint8_t *buffer, int length)
+{
+	SimI2CDevice *dev;
+	SimBus *bus = getFdBus(fd, dev);
+	if (bus == nullptr) {
+		return -EBADF;
+	}
+	if (length < 1) {
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&bus->lock);
+
+	// address+W, register, data
+	occupyBus(*bus, length + 1);
+
+	int ret = -EIO;
+	if (dev) {
+		dev->lock();
+		dev->m_write_count++;
+		dev->write(buffer[0], &buffer[1], length - 1);
+		dev->unlock();
+		ret = length;
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	return ret;
+}
+
+// Execute one segment on dev (call with the bus locked)
+int SimI2CBackend::access(SimI2CDevice *dev, I2CSegment &seg)
+{
+	if (dev == nullptr) {
+		return -EIO;
+	}
+
+	dev->lock();
+	if (seg.type == I2CTransferType_ReadReg) {
+		dev->m_read_count++;
+		dev->read(seg.reg, seg.buffer, seg.length);
+	}
+	else {
+		dev->m_write_count++;
+		dev->write(seg.reg, &seg.buffer[1], seg.length);
+	}
+	dev->unlock();
+
+	return 0;
+}
+
+int SimI2CBackend::transfer(int fd, I2CSegment *segments, unsigned int count)
+{
+	if (!m_combined_transfers) {
+		return I2CBackend::transfer(fd, segments, count);
+	}
+
+	SimI2CDevice *dev;
+	SimBus *bus = getFdBus(fd, dev);
+	if (bus == nullptr) {
+		return -EBADF;
+	}
+
+	unsigned int bytes = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (segments[i].type == I2CTransferType_ReadReg) {
+			bytes += segments[i].length + 3;
+		}
+		else if (segments[i].type == I2CTransferType_WriteReg) {
+			bytes += segments[i].length + 2;
+		}
+		else {
+			return -EINVAL;
+		}
+	}
+
+	pthread_mutex_lock(&bus->lock);
+	occupyBus(*bus, bytes);
+
+	int ret = 1;
+	for (unsigned int i = 0; i < count; i++) {
+		if (access(dev, segments[i]) < 0) {
+			ret = -EIO;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	return ret;
+}
+
+int SimI2CBackend::readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length)
+{
+	SimI2CDevice *dev;
+	SimBus *bus = getFdBus(fd, dev);
+	if (bus == nullptr) {
+		return -EBADF;
+	}
+
+	uint8_t block[33];
+	int ret = -EIO;
+
+	pthread_mutex_lock(&bus->lock);
+	if (dev) {
+		dev->lock();
+		dev->m_read_count++;
+		dev->read(reg, block, sizeof(block));
+		dev->unlock();
+
+		ret = block[0];
+		if (ret > 32) {
+			ret = -EPROTO;
+		}
+	}
+
+	// address+W, register, address+R, count, data
+	occupyBus(*bus, 4 + ((ret > 0) ? ret : 0));
+	pthread_mutex_unlock(&bus->lock);
+
+	if (ret > max_length) {
+		ret = max_length;
+	}
+	if (ret > 0) {
+		memcpy(out_buffer, &block[1], ret);
+	}
+	return ret;
+}
@@ -0,0 +1,212 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "DriverFramework.hpp"
+#include "I2CBackend.hpp"
+
+using namespace DriverFramework;
+
+// Runs LinuxI2CBackend against an in-process fake of an i2c-dev node
+// with register-map devices, in the way the kernel handles the calls.
+
+#define FAKE_FD 42
+
+class FakeLinuxI2C : public LinuxI2CBackend
+{
+public:
+	FakeLinuxI2C()
+	{
+		memset(m_regs, 0, sizeof(m_regs));
+	}
+
+	uint8_t		m_regs[128][256];
+	unsigned int	m_ioctls = 0;
+
+protected:
+	virtual int sysOpen(const char *path, int flags)
+	{
+		return FAKE_FD;
+	}
+
+	virtual int sysClose(int fd)
+	{
+		return (fd == FAKE_FD) ? 0 : -EBADF;
+	}
+
+	virtual int sysWrite(int fd, const void *buffer, size_t length)
+	{
+		const uint8_t *data = (const uint8_t *)buffer;
+		for (size_t i = 1; i < length; i++) {
+			m_regs[m_slave][(uint8_t)(data[0] + i - 1)] = data[i];
+		}
+		return length;
+	}
+
+	virtual int sysIoctl(int fd, unsigned long request, void *arg);
+
+private:
+	uint8_t		m_slave = 0;
+	uint8_t		m_pointer = 0;
+};
+
+int FakeLinuxI2C::sysIoctl(int fd, unsigned long request, void *arg)
+{
+	if (fd != FAKE_FD) {
+		return -EBADF;
+	}
+	++m_ioctls;
+
+	if (request == I2C_SLAVE) {
+		m_slave = (unsigned long)arg & 0x7f;
+		return 0;
+	}
+
+	if (request == I2C_RDWR) {
+		struct i2c_rdwr_ioctl_data *data = (struct i2c_rdwr_ioctl_data *)arg;
+		if (data->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+			return -EINVAL;
+		}
+		for (unsigned int i = 0; i < data->nmsgs; i++) {
+			struct i2c_msg &msg = data->msgs[i];
+			uint8_t *regs = m_regs[msg.addr & 0x7f];
+
+			if (msg.flags & I2C_M_RD) {
+				for (unsigned int j = 0; j < msg.len; j++) {
+					msg.buf[j] = regs[m_pointer++];
+				}
+			}
+			else if (msg.len) {
+				m_pointer = msg.buf[0];
+				for (unsigned int j = 1; j < msg.len; j++) {
+					regs[m_pointer++] = msg.buf[j];
+				}
+			}
+		}
+		return data->nmsgs;
+	}
+
+	if (request == I2C_SMBUS) {
+		struct i2c_smbus_ioctl_data *args = (struct i2c_smbus_ioctl_data *)arg;
+		if (args->read_write != I2C_SMBUS_READ || args->size != I2C_SMBUS_BLOCK_DATA) {
+			return -EOPNOTSUPP;
+		}
+		// The count is the first byte the device sends
+		uint8_t *regs = m_regs[m_slave];
+		for (unsigned int j = 0; j <= regs[args->command] && j <= I2C_SMBUS_BLOCK_MAX; j++) {
+			args->data->block[j] = regs[(uint8_t)(args->command + j)];
+		}
+		return 0;
+	}
+
+	return -ENOTTY;
+}
+
+static int check(bool cond, const char *what)
+{
+	DF_LOG_INFO("%s: %s", what, cond ? "PASSED" : "FAILED");
+	return cond ? 0 : 1;
+}
+
+int main()
+{
+	FakeLinuxI2C backend;
+	int failures = 0;
+	uint8_t buf[64];
+
+	int fd = backend.open("/dev/i2c-1");
+	failures += check(fd == FAKE_FD, "open");
+
+	failures += check(backend.readReg(fd, 0x00, buf, 1) == -EDESTADDRREQ,
+			  "read without slave address");
+
+	failures += check(backend.setSlaveAddress(fd, 0x76) == 0, "select slave");
+
+	// Write through write(), read back through a combined transaction
+	uint8_t wr[4] = { 0xf4, 0x11, 0x22, 0x33 };
+	failures += check(backend.write(fd, wr, sizeof(wr)) == sizeof(wr), "write");
+	backend.m_ioctls = 0;
+	failures += check(backend.readReg(fd, 0xf4, buf, 3) == 3 &&
+			  buf[0] == 0x11 && buf[1] == 0x22 && buf[2] == 0x33 &&
+			  backend.m_ioctls == 1, "combined register read");
+
+	// Non-contiguous reads and a write in a single ioctl
+	for (unsigned int i = 0; i < 256; i++) {
+		backend.m_regs[0x76][i] = i;
+	}
+	uint8_t wbuf[3] = { 0, 0xaa, 0xbb };
+	I2CSegment segs[4] = {
+		{ I2CTransferType_ReadReg, 0x10, &buf[0], 2 },
+		{ I2CTransferType_ReadReg, 0x80, &buf[2], 3 },
+		{ I2CTransferType_WriteReg, 0x40, wbuf, 2 },
+		{ I2CTransferType_ReadReg, 0x40, &buf[5], 2 },
+	};
+	backend.m_ioctls = 0;
+	int calls = backend.transfer(fd, segs, 4);
+	failures += check(calls == 1 && backend.m_ioctls == 1 &&
+			  buf[0] == 0x10 && buf[1] == 0x11 &&
+			  buf[2] == 0x80 && buf[4] == 0x82 &&
+			  buf[5] == 0xaa && buf[6] == 0xbb, "batched transfer");
+
+	// Batches beyond the kernel message limit are split
+	I2CSegment many[30];
+	for (unsigned int i = 0; i < 30; i++) {
+		many[i].type = I2CTransferType_ReadReg;
+		many[i].reg = i;
+		many[i].buffer = &buf[i];
+		many[i].length = 1;
+	}
+	calls = backend.transfer(fd, many, 30);
+	failures += check(calls == 2 && buf[29] == 29, "split batch");
+
+	// SMBus block read
+	backend.m_regs[0x76][0x20] = 4;
+	backend.m_regs[0x76][0x21] = 0xde;
+	backend.m_regs[0x76][0x24] = 0xef;
+	int len = backend.readBlock(fd, 0x20, buf, sizeof(buf));
+	failures += check(len == 4 && buf[0] == 0xde && buf[3] == 0xef, "block read");
+	len = backend.readBlock(fd, 0x20, buf, 2);
+	failures += check(len == 2, "truncated block read");
+
+	failures += check(backend.close(fd) == 0, "close");
+
+	DF_LOG_INFO("Test %s", failures ? "FAILED" : "PASSED");
+	return failures;
+}
@@ -0,0 +1,333 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "DriverFramework.hpp"
+#include "I2CDevObj.hpp"
+#include "SimI2CBackend.hpp"
+
+using namespace DriverFramework;
+
+// Benchmark of the I2C access patterns against simulated devices on a
+// 400 kHz bus with a fixed per-call latency. Each sample reads three
+// non-contiguous register blocks.
+
+#define BENCH_BUS_PATH		"/dev/i2c-sim"
+#define BENCH_NUM_DEVICES	4
+#define BENCH_INTERVAL_USEC	5000
+#define BENCH_DURATION_USEC	2000000
+#define BENCH_LATENCY_USEC	100
+
+enum BenchMode {
+	BenchMode_PerRegister,
+	BenchMode_Batched,
+	BenchMode_Async,
+};
+
+static const char *modeName(BenchMode mode)
+{
+	switch (mode) {
+	case BenchMode_PerRegister:
+		return "per-register";
+	case BenchMode_Batched:
+		return "batched";
+	default:
+		return "async";
+	}
+}
+
+class BenchDevice : public I2CDevObj
+{
+public:
+	BenchDevice(BenchMode mode, uint8_t address) :
+		I2CDevObj("BenchDevice", BENCH_BUS_PATH, BENCH_INTERVAL_USEC),
+		m_mode(mode)
+	{
+		setSlaveAddress(address);
+
+		m_segments[0] = { I2CTransferType_ReadReg, 0x10, &m_data[0], 6 };
+		m_segments[1] = { I2CTransferType_ReadReg, 0x20, &m_data[6], 2 };
+		m_segments[2] = { I2CTransferType_ReadReg, 0x30, &m_data[8], 1 };
+
+		memset(&m_txn, 0, sizeof(m_txn));
+		m_txn.type = I2CTransferType_Batch;
+		m_txn.segments = m_segments;
+		m_txn.num_segments = 3;
+	}
+
+	virtual ~BenchDevice() {}
+
+	unsigned long	m_samples = 0;
+	unsigned long	m_errors = 0;
+	uint64_t	m_max_measure_usec = 0;	// longest time _measure() held the HRT thread
+
+protected:
+	virtual void _measure();
+
+private:
+	BenchMode	m_mode;
+	uint8_t		m_data[9];
+	I2CSegment	m_segments[3];
+	I2CTransfer	m_txn;
+};
+
+void BenchDevice::_measure()
+{
+	uint64_t start = offsetTime();
+	int ret = 0;
+
+	switch (m_mode) {
+	case BenchMode_PerRegister:
+		for (unsigned int i = 0; i < 3 && ret == 0; i++) {
+			ret = _readReg(m_segments[i].reg, m_segments[i].buffer, m_segments[i].length);
+		}
+		break;
+
+	case BenchMode_Batched:
+		ret = _transfer(m_segments, 3);
+		break;
+
+	case BenchMode_Async:
+		if (measurePhase() == 0) {
+			submitAndResume(m_txn);
+			ret = 1;
+		}
+		else {
+			ret = m_txn.result;
+		}
+		break;
+	}
+
+	if (ret == 0) {
+		++m_samples;
+	}
+	else if (ret < 0) {
+		++m_errors;
+	}
+
+	uint64_t elapsed = offsetTime() - start;
+	if (elapsed > m_max_measure_usec) {
+		m_max_measure_usec = elapsed;
+	}
+}
+
+static void runBenchmark(SimI2CBackend &backend, BenchMode mode)
+{
+	BenchDevice *devs[BENCH_NUM_DEVICES];
+	unsigned long calls = backend.getCallCount();
+
+	for (unsigned int i = 0; i < BENCH_NUM_DEVICES; i++) {
+		devs[i] = new BenchDevice(mode, 0x40 + i);
+		devs[i]->setBackend(backend);
+		if (devs[i]->start() < 0) {
+			DF_LOG_ERR("error: unable to start bench device %u", i);
+		}
+	}
+
+	usleep(BENCH_DURATION_USEC);
+
+	I2CBusStats stats;
+	memset(&stats, 0, sizeof(stats));
+	devs[0]->getBusStats(stats);
+
+	unsigned long samples = 0;
+	unsigned long errors = 0;
+	unsigned long overruns = 0;
+	uint64_t max_measure = 0;
+
+	for (unsigned int i = 0; i < BENCH_NUM_DEVICES; i++) {
+		devs[i]->stop();
+		samples += devs[i]->m_samples;
+		errors += devs[i]->m_errors;
+		overruns += devs[i]->getMeasureOverruns();
+		if (devs[i]->m_max_measure_usec > max_measure) {
+			max_measure = devs[i]->m_max_measure_usec;
+		}
+		delete devs[i];
+	}
+
+	// Opening and closing the bus are not per-sample calls
+	calls = backend.getCallCount() - calls - 2;
+
+	DF_LOG_INFO("%-12s samples/s: %6.1f  calls/sample: %4.2f  bus util: %4.2f  "
+		    "max hrt block (us): %5llu  overruns: %lu  errors: %lu",
+		    modeName(mode),
+		    samples * 1000000.0 / BENCH_DURATION_USEC,
+		    samples ? (double)calls / samples : 0.0,
+		    stats.utilization,
+		    (unsigned long long)max_measure, overruns, errors);
+}
+
+// A high-rate device with a tight deadline shares the bus with a device
+// doing long batched reads. Both submit asynchronously.
+#define ARB_FAST_INTERVAL_USEC	2000
+#define ARB_FAST_DEADLINE_USEC	1500
+#define ARB_SLOW_INTERVAL_USEC	20000
+#define ARB_SLOW_SEGMENTS	8
+#define ARB_SLOW_SEGMENT_LEN	24
+
+class ArbiterDevice : public I2CDevObj
+{
+public:
+	ArbiterDevice(uint8_t address, unsigned int interval, unsigned int segments, int length) :
+		I2CDevObj("ArbiterDevice", BENCH_BUS_PATH, interval)
+	{
+		setSlaveAddress(address);
+
+		for (unsigned int i = 0; i < segments; i++) {
+			m_segments[i] = { I2CTransferType_ReadReg, (uint8_t)(i * length), &m_data[i * length], length };
+		}
+
+		memset(&m_txn, 0, sizeof(m_txn));
+		m_txn.type = I2CTransferType_Batch;
+		m_txn.segments = m_segments;
+		m_txn.num_segments = segments;
+	}
+
+	virtual ~ArbiterDevice() {}
+
+protected:
+	virtual void _measure()
+	{
+		if (measurePhase() == 0) {
+			submitAndResume(m_txn);
+		}
+	}
+
+private:
+	uint8_t		m_data[ARB_SLOW_SEGMENTS * ARB_SLOW_SEGMENT_LEN];
+	I2CSegment	m_segments[ARB_SLOW_SEGMENTS];
+	I2CTransfer	m_txn;
+};
+
+static void runArbitration(SimI2CBackend &backend, bool prioritized)
+{
+	ArbiterDevice fast(0x40, ARB_FAST_INTERVAL_USEC, 1, 14);
+	ArbiterDevice slow(0x41, ARB_SLOW_INTERVAL_USEC, ARB_SLOW_SEGMENTS, ARB_SLOW_SEGMENT_LEN);
+
+	fast.setBackend(backend);
+	slow.setBackend(backend);
+	fast.setBusDeadline(ARB_FAST_DEADLINE_USEC);
+	if (prioritized) {
+		fast.setBusPriority(1);
+	}
+
+	fast.start();
+	slow.start();
+	usleep(BENCH_DURATION_USEC);
+	slow.stop();
+	fast.stop();
+
+	I2CDeviceBusStats stats;
+	fast.getDeviceBusStats(stats);
+
+	DF_LOG_INFO("%-12s fast device transfers: %lu  avg wait (us): %5llu  max wait (us): %5llu  "
+		    "deadline misses: %lu",
+		    prioritized ? "prioritized" : "fifo",
+		    stats.transfers,
+		    (unsigned long long)(stats.transfers ? stats.total_wait_usec / stats.transfers : 0),
+		    (unsigned long long)stats.max_wait_usec,
+		    stats.deadline_misses);
+}
+
+// The slow device keeps the bus busy, so its batches are preempted by
+// the fast device at nearly every segment. Transfers run between the
+// segments of a batch must not be counted as part of the batch as well.
+#define SATURATE_SLOW_INTERVAL_USEC	1000
+#define SATURATE_FAST_INTERVAL_USEC	500
+
+static bool checkPreemptedUtilization(SimI2CBackend &backend)
+{
+	ArbiterDevice fast(0x40, SATURATE_FAST_INTERVAL_USEC, 1, 14);
+	ArbiterDevice slow(0x41, SATURATE_SLOW_INTERVAL_USEC, ARB_SLOW_SEGMENTS, ARB_SLOW_SEGMENT_LEN);
+
+	fast.setBackend(backend);
+	slow.setBackend(backend);
+	fast.setBusPriority(1);
+
+	fast.start();
+	slow.start();
+	usleep(BENCH_DURATION_USEC / 2);
+
+	I2CBusStats stats;
+	fast.getBusStats(stats);
+	slow.stop();
+	fast.stop();
+
+	bool pass = stats.utilization <= 1.0f;
+	DF_LOG_INFO("%-12s bus util: %4.2f  %s", "saturated", stats.utilization, pass ? "PASSED" : "FAILED");
+	return pass;
+}
+
+int main()
+{
+	int ret = Framework::initialize();
+	if (ret < 0) {
+		return ret;
+	}
+
+	SimI2CBackend backend;
+	SimI2CDevice *models[BENCH_NUM_DEVICES];
+
+	backend.setTiming(BENCH_BUS_PATH, BENCH_LATENCY_USEC, 400000);
+
+	for (unsigned int i = 0; i < BENCH_NUM_DEVICES; i++) {
+		models[i] = new SimI2CDevice(0x40 + i);
+		backend.attach(BENCH_BUS_PATH, *models[i]);
+	}
+
+	DF_LOG_INFO("%d devices at %d us interval, %d us call latency, 400 kHz",
+		    BENCH_NUM_DEVICES, BENCH_INTERVAL_USEC, BENCH_LATENCY_USEC);
+
+	runBenchmark(backend, BenchMode_PerRegister);
+	runBenchmark(backend, BenchMode_Batched);
+	runBenchmark(backend, BenchMode_Async);
+
+	runArbitration(backend, false);
+	runArbitration(backend, true);
+	bool pass = checkPreemptedUtilization(backend);
+
+	for (unsigned int i = 0; i < BENCH_NUM_DEVICES; i++) {
+		backend.detach(*models[i]);
+		delete models[i];
+	}
+
+	Framework::shutdown();
+
+	return pass ? 0 : 1;
+}
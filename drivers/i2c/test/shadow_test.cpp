@@ -0,0 +1,180 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "DriverFramework.hpp"
+#include "I2CDevObj.hpp"
+#include "SimI2CBackend.hpp"
+
+using namespace DriverFramework;
+
+#define TEST_BUS_PATH		"/dev/i2c-shadow"
+#define TEST_CONFIG_REG		0x20
+#define TEST_CONFIG_LEN		16
+
+class ShadowTestDevice : public I2CDevObj
+{
+public:
+	ShadowTestDevice() :
+		I2CDevObj("ShadowTestDevice", TEST_BUS_PATH, 0)
+	{
+		enableRegisterShadow();
+		setStaticRegs(TEST_CONFIG_REG, TEST_CONFIG_LEN);
+	}
+
+	virtual ~ShadowTestDevice() {}
+
+	int readRegCached(uint8_t address, uint8_t *out_buffer, int length)
+	{
+		return _readRegCached(address, out_buffer, length);
+	}
+
+	int writeRegCached(uint8_t address, uint8_t value)
+	{
+		return _writeRegCached(address, &value, 1);
+	}
+
+	int flushRegs()
+	{
+		return _flushRegs();
+	}
+
+	int verifyRegs()
+	{
+		return _verifyRegs();
+	}
+
+protected:
+	virtual void _measure() {}
+};
+
+// Counts the bus file descriptors the arbiter opens and closes
+class CountingBackend : public SimI2CBackend
+{
+public:
+	CountingBackend() : m_opens(0), m_closes(0) {}
+
+	virtual int open(const char *bus_path)
+	{
+		m_opens++;
+		return SimI2CBackend::open(bus_path);
+	}
+
+	virtual int close(int fd)
+	{
+		m_closes++;
+		return SimI2CBackend::close(fd);
+	}
+
+	unsigned int m_opens;
+	unsigned int m_closes;
+};
+
+static int check(bool cond, const char *what)
+{
+	DF_LOG_INFO("%s: %s", what, cond ? "PASSED" : "FAILED");
+	return cond ? 0 : 1;
+}
+
+int main()
+{
+	int ret = Framework::initialize();
+	if (ret < 0) {
+		return ret;
+	}
+
+	CountingBackend backend;
+	SimI2CDevice model(0x68);
+	ShadowTestDevice dev;
+	int failures = 0;
+
+	backend.setTiming(TEST_BUS_PATH, 0, 0);
+	backend.attach(TEST_BUS_PATH, model);
+	dev.setBackend(backend);
+	dev.setSlaveAddress(0x68);
+	failures += check(dev.start() == 0, "start");
+
+	// 0x23 is unknown, so it cannot bridge the two runs
+	dev.writeRegCached(0x20, 1);
+	dev.writeRegCached(0x21, 2);
+	dev.writeRegCached(0x22, 3);
+	dev.writeRegCached(0x24, 5);
+	failures += check(model.m_write_count == 0, "writes staged");
+	failures += check(dev.flushRegs() == 0 && model.m_write_count == 2 &&
+			  model.getReg(0x22) == 3 && model.getReg(0x24) == 5, "adjacent writes combined");
+
+	// One read makes all static registers known
+	uint8_t buf[TEST_CONFIG_LEN];
+	failures += check(dev.readRegCached(TEST_CONFIG_REG, buf, TEST_CONFIG_LEN) == 0 &&
+			  model.m_read_count == 1 && buf[4] == 5, "fill shadow");
+	failures += check(dev.readRegCached(0x21, buf, 2) == 0 && model.m_read_count == 1 &&
+			  buf[0] == 2 && buf[1] == 3, "static read from shadow");
+
+	// Known registers between staged ones are rewritten in the same burst
+	unsigned long writes = model.m_write_count;
+	dev.writeRegCached(0x20, 7);
+	dev.writeRegCached(0x23, 8);
+	failures += check(dev.flushRegs() == 0 && model.m_write_count == writes + 1 &&
+			  model.getReg(0x20) == 7 && model.getReg(0x23) == 8 &&
+			  model.getReg(0x21) == 2, "gap bridged");
+
+	// A staged write is flushed before a non-static read of it
+	dev.writeRegCached(0x40, 9);
+	failures += check(dev.readRegCached(0x40, buf, 1) == 0 && buf[0] == 9, "read after staged write");
+
+	// Device reset
+	model.setReg(0x20, 0);
+	model.setReg(0x24, 0);
+	failures += check(dev.verifyRegs() == 2 && model.getReg(0x20) == 7 && model.getReg(0x24) == 5 &&
+			  dev.getRegMismatches() == 2, "verify restores registers");
+	failures += check(dev.verifyRegs() == 0, "verify clean");
+
+	// The first handle calls start() again, which must not take a second
+	// bus reference. The bus is closed once the last reference is gone.
+	DevHandle h;
+	DevMgr::getHandle(dev.m_dev_instance_path, h);
+	failures += check(h.isValid() && backend.m_opens == 1, "handle on started device");
+	DevMgr::releaseHandle(h);
+	dev.stop();
+	failures += check(backend.m_opens == 1 && backend.m_closes == 1, "bus released");
+
+	backend.detach(model);
+	Framework::shutdown();
+
+	DF_LOG_INFO("Test %s", failures ? "FAILED" : "PASSED");
+	return failures;
+}
@@ -0,0 +1,190 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "DFSimd.hpp"
+#include "BarometricAltitude.hpp"
+
+#define BAROMETRIC_SCALE_M	44330.8f
+#define BAROMETRIC_EXPONENT	0.190263f
+
+// Splits x into 2^e * m with m in [2/3, 4/3)
+#define BAROMETRIC_SPLIT	0x3f2aaaab
+
+using namespace DriverFramework;
+
+// log2(1 + z) / z on z in [-1/3, 1/3], error < 1.2e-7
+static const float s_log2_poly[] = {
+	1.442694810e+00f, -7.213473121e-01f, 4.809645811e-01f, -3.607335772e-01f,
+	2.856044631e-01f, -2.377996765e-01f, 2.467269602e-01f, -2.169923523e-01f
+};
+
+// 2^f on f in [0, 1), relative error < 1.1e-7
+static const float s_exp2_poly[] = {
+	9.999998984e-01f, 6.931544897e-01f, 2.401418182e-01f,
+	5.586033708e-02f, 8.949590424e-03f, 1.893754058e-03f
+};
+
+#define POLY_LEN(p) (sizeof(p) / sizeof(p[0]))
+
+static inline df_f32x4 polyEval(const float *coeff, int len, df_f32x4 x)
+{
+	df_f32x4 r = df_set1_f32x4(coeff[len - 1]);
+
+	for (int i = len - 2; i >= 0; i--) {
+		r = df_add_f32x4(df_mul_f32x4(r, x), df_set1_f32x4(coeff[i]));
+	}
+
+	return r;
+}
+
+static inline df_f32x4 altitudeKernel(df_f32x4 p, df_f32x4 p0_exponent, df_f32x4 p0_log2_mantissa)
+{
+	// log2(p) - log2(p0), exponent and mantissa terms kept apart
+	df_i32x4 bits = df_as_i32x4(p);
+	df_i32x4 e = df_srai_i32x4(df_sub_i32x4(bits, df_set1_i32x4(BAROMETRIC_SPLIT)), 23);
+	df_f32x4 m = df_as_f32x4(df_sub_i32x4(bits, df_slli_i32x4(e, 23)));
+	df_f32x4 z = df_sub_f32x4(m, df_set1_f32x4(1.0f));
+	df_f32x4 log2_m = df_mul_f32x4(z, polyEval(s_log2_poly, POLY_LEN(s_log2_poly), z));
+	df_f32x4 d = df_add_f32x4(df_sub_f32x4(df_cvt_i32x4_f32x4(e), p0_exponent),
+				  df_sub_f32x4(log2_m, p0_log2_mantissa));
+
+	// 2^y for y = exponent * d, split into integer and fraction. y is
+	// well above -128, so truncating y + 128 is a floor.
+	df_f32x4 y = df_mul_f32x4(d, df_set1_f32x4(BAROMETRIC_EXPONENT));
+	df_i32x4 yi = df_sub_i32x4(df_cvt_f32x4_i32x4(df_add_f32x4(y, df_set1_f32x4(128.0f))), df_set1_i32x4(128));
+	df_f32x4 f = df_sub_f32x4(y, df_cvt_i32x4_f32x4(yi));
+	df_f32x4 r = polyEval(s_exp2_poly, POLY_LEN(s_exp2_poly), f);
+	r = df_as_f32x4(df_add_i32x4(df_as_i32x4(r), df_slli_i32x4(yi, 23)));
+
+	return df_mul_f32x4(df_sub_f32x4(df_set1_f32x4(1.0f), r), df_set1_f32x4(BAROMETRIC_SCALE_M));
+}
+
+BarometricAltitude::BarometricAltitude() :
+	m_altimeter_mbars(BAROMETRIC_STD_MBARS),
+	m_stale(true),
+	m_p0_exponent(0.0f),
+	m_p0_log2_mantissa(0.0f)
+{
+}
+
+void BarometricAltitude::setAltimeter(float altimeter_setting_in_mbars)
+{
+	if (altimeter_setting_in_mbars <= 0.0f) {
+		altimeter_setting_in_mbars = BAROMETRIC_STD_MBARS;
+	}
+
+	if (altimeter_setting_in_mbars != m_altimeter_mbars) {
+		m_altimeter_mbars = altimeter_setting_in_mbars;
+		m_stale = true;
+	}
+}
+
+void BarometricAltitude::update()
+{
+	// Same split as the kernel, but the mantissa term from libm
+	float p0 = m_altimeter_mbars * 100.0f;
+	int32_t bits;
+	memcpy(&bits, &p0, sizeof(bits));
+	int32_t e = (int32_t)(bits - BAROMETRIC_SPLIT) >> 23;
+	bits -= e * (1 << 23);
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+
+	m_p0_exponent = (float)e;
+	m_p0_log2_mantissa = (float)log2((double)m);
+	m_stale = false;
+}
+
+float BarometricAltitude::getAltitude(float pressure_in_pa)
+{
+	if (!(pressure_in_pa > 0.0f)) {
+		return NAN;
+	}
+
+	// For one value libm's powf() is faster than the 4 lane kernel
+	return referenceAltitude(pressure_in_pa, m_altimeter_mbars);
+}
+
+void BarometricAltitude::getAltitudes(const uint32_t *pressure_in_pa, unsigned count, float *altitude_in_m)
+{
+	if (m_stale) {
+		update();
+	}
+
+	const df_f32x4 p0_exponent = df_set1_f32x4(m_p0_exponent);
+	const df_f32x4 p0_log2_mantissa = df_set1_f32x4(m_p0_log2_mantissa);
+	unsigned i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		df_f32x4 p = df_cvt_i32x4_f32x4(df_load_i32x4((const int32_t *)&pressure_in_pa[i]));
+		df_store_f32x4(&altitude_in_m[i], altitudeKernel(p, p0_exponent, p0_log2_mantissa));
+	}
+
+	if (i < count) {
+		// Pad the tail so it goes through the same kernel
+		int32_t in[4] = { 1, 1, 1, 1 };
+		float out[4];
+
+		for (unsigned j = 0; i + j < count; j++) {
+			in[j] = (int32_t)pressure_in_pa[i + j];
+		}
+
+		df_store_f32x4(out, altitudeKernel(df_cvt_i32x4_f32x4(df_load_i32x4(in)),
+						   p0_exponent, p0_log2_mantissa));
+
+		for (unsigned j = 0; i + j < count; j++) {
+			altitude_in_m[i + j] = out[j];
+		}
+	}
+
+	// The kernel has no log of 0, so fix up missing readings afterwards
+	for (i = 0; i < count; i++) {
+		if ((int32_t)pressure_in_pa[i] <= 0) {
+			altitude_in_m[i] = NAN;
+		}
+	}
+}
+
+float BarometricAltitude::referenceAltitude(float pressure_in_pa, float altimeter_setting_in_mbars)
+{
+	if (altimeter_setting_in_mbars <= 0.0f) {
+		altimeter_setting_in_mbars = BAROMETRIC_STD_MBARS;
+	}
+
+	return BAROMETRIC_SCALE_M * (1.0f - powf(pressure_in_pa / (altimeter_setting_in_mbars * 100.0f),
+						 BAROMETRIC_EXPONENT));
+}
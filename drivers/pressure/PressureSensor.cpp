@@ -31,15 +31,158 @@
  *
  ****************************************************************************/
 
+#include <stddef.h>
 #include <pthread.h>
 #include "DriverFramework.hpp"
+#include "DFSimd.hpp"
 #include "PressureSensor.hpp"
 
+// Registers
+#define BMP280_REG_CALIB	0x88
+#define BMP280_REG_ID		0xd0
+#define BMP280_REG_RESET	0xe0
+#define BMP280_REG_STATUS	0xf3
+#define BMP280_REG_CTRL_MEAS	0xf4
+#define BMP280_REG_CONFIG	0xf5
+#define BMP280_REG_DATA		0xf7	// press_msb..temp_xlsb
+
+#define BMP280_CHIP_ID		0x58
+#define BMP280_CALIB_LEN	24
+#define BMP280_DATA_LEN		6
+#define BMP280_ADC_NONE		0x80000	// reset value of the data registers
+
+// ctrl_meas: osrs_t x1, osrs_p x4, normal mode
+#define BMP280_CTRL_MEAS	((1 << 5) | (3 << 2) | 3)
+#define BMP280_CTRL_SLEEP	((1 << 5) | (3 << 2) | 0)
+// config: t_sb 0.5 ms, IIR filter x16
+#define BMP280_CONFIG		((0 << 5) | (4 << 2))
+
+// Samples compensated per pass of the batch kernels
+#define BMP280_BATCH_CHUNK	64
+
 using namespace DriverFramework;
 
+// The timestamp and counters change by about the same amount every sample
+const SampleField PressureSensor::s_sample_layout[PRESSURE_SAMPLE_FIELDS] = {
+	{ offsetof(pressure_sensor_data, t_fine),			FIELD_INT32,		0 },
+	{ offsetof(pressure_sensor_data, pressure_in_pa),		FIELD_UINT32,		0 },
+	{ offsetof(pressure_sensor_data, temperature_in_c),		FIELD_FLOAT,		0 },
+	{ offsetof(pressure_sensor_data, altitude_in_m),		FIELD_FLOAT,		0 },
+	{ offsetof(pressure_sensor_data, sensor_read_counter),		FIELD_UINT32,		0 },
+	{ offsetof(pressure_sensor_data, last_read_time_in_usecs),	FIELD_TIMESTAMP,	0 },
+	{ offsetof(pressure_sensor_data, error_count),			FIELD_UINT64,		0 },
+};
+
+int PressureSensor::start()
+{
+	// Already started, e.g. by the first handle opened after start()
+	m_synchronize.lock();
+	bool started = m_calibrated;
+	m_synchronize.unlock();
+	if (started) {
+		return 0;
+	}
+
+	int ret = I2CDevObj::start();
+	if (ret < 0) {
+		return ret;
+	}
+
+	uint8_t id = 0;
+	if (_readReg(BMP280_REG_ID, &id, 1) < 0 || id != BMP280_CHIP_ID) {
+		DF_LOG_ERR("error: no BMP280 at %s (id 0x%02x)", m_dev_base_path.c_str(), id);
+		stop();
+		return -1;
+	}
+
+	if (loadCalibration() < 0) {
+		stop();
+		return -1;
+	}
+
+	// The filter is configured while the sensor sleeps, as writes to
+	// config may be ignored in normal mode
+	uint8_t ctrl = BMP280_CTRL_SLEEP;
+	uint8_t config = BMP280_CONFIG;
+	if (_writeReg(BMP280_REG_CTRL_MEAS, &ctrl, 1) < 0 ||
+	    _writeReg(BMP280_REG_CONFIG, &config, 1) < 0) {
+		stop();
+		return -1;
+	}
+	ctrl = BMP280_CTRL_MEAS;
+	if (_writeReg(BMP280_REG_CTRL_MEAS, &ctrl, 1) < 0) {
+		stop();
+		return -1;
+	}
+
+	m_synchronize.lock();
+	m_calibrated = true;
+	m_synchronize.unlock();
+
+	return 0;
+}
+
+int PressureSensor::stop()
+{
+	m_synchronize.lock();
+	bool calibrated = m_calibrated;
+	m_calibrated = false;
+	m_synchronize.unlock();
+
+	// No measurement may run once the sensor is put to sleep. The bus
+	// stays attached until I2CDevObj::stop().
+	DevObj::stop();
+
+	if (calibrated) {
+		uint8_t ctrl = BMP280_CTRL_SLEEP;
+		_writeReg(BMP280_REG_CTRL_MEAS, &ctrl, 1);
+	}
+
+	return I2CDevObj::stop();
+}
+
+int PressureSensor::loadCalibration()
+{
+	uint8_t buf[BMP280_CALIB_LEN];
+
+	if (_readReg(BMP280_REG_CALIB, buf, sizeof(buf)) < 0) {
+		DF_LOG_ERR("error: unable to read the BMP280 calibration");
+		return -1;
+	}
+
+	uint16_t words[BMP280_CALIB_LEN / 2];
+	for (unsigned int i = 0; i < BMP280_CALIB_LEN / 2; i++) {
+		words[i] = buf[2 * i] | (buf[2 * i + 1] << 8);
+	}
+
+	m_synchronize.lock();
+	m_calibration.dig_T1 = words[0];
+	m_calibration.dig_T2 = (int16_t)words[1];
+	m_calibration.dig_T3 = (int16_t)words[2];
+	m_calibration.dig_P1 = words[3];
+	m_calibration.dig_P2 = (int16_t)words[4];
+	m_calibration.dig_P3 = (int16_t)words[5];
+	m_calibration.dig_P4 = (int16_t)words[6];
+	m_calibration.dig_P5 = (int16_t)words[7];
+	m_calibration.dig_P6 = (int16_t)words[8];
+	m_calibration.dig_P7 = (int16_t)words[9];
+	m_calibration.dig_P8 = (int16_t)words[10];
+	m_calibration.dig_P9 = (int16_t)words[11];
+	m_synchronize.unlock();
+
+	if (m_calibration.dig_P1 == 0) {
+		DF_LOG_ERR("error: invalid BMP280 calibration");
+		return -1;
+	}
+	return 0;
+}
+
 void PressureSensor::setAltimeter(float altimeter_setting_in_mbars)
 {
-	m_altimeter_mbars = altimeter_setting_in_mbars;
+	// Takes effect with the next sample
+	m_synchronize.lock();
+	m_altitude.setAltimeter(altimeter_setting_in_mbars);
+	m_synchronize.unlock();
 }
 
 int PressureSensor::getSensorData(struct pressure_sensor_data &out_data, bool is_new_data_required)
@@ -51,30 +194,181 @@ int PressureSensor::getSensorData(struct pressure_sensor_data &out_data, bool is
 	out_data = m_sensor_data;
 	m_synchronize.unlock();
 
-	return 1;
+	return 0;
 }
 
-uint32_t PressureSensor::getPressure()
+int32_t PressureSensor::compensateTemperature(const struct bmp280_calibration &cal, int32_t adc_T, int32_t &t_fine)
 {
-	// TBD
-	return 0;
+	int32_t var1 = ((((adc_T >> 3) - ((int32_t)cal.dig_T1 << 1))) * ((int32_t)cal.dig_T2)) >> 11;
+	int32_t var2 = (((((adc_T >> 4) - ((int32_t)cal.dig_T1)) * ((adc_T >> 4) - ((int32_t)cal.dig_T1))) >> 12) *
+			((int32_t)cal.dig_T3)) >> 14;
+
+	t_fine = var1 + var2;
+	return (t_fine * 5 + 128) >> 8;
+}
+
+uint32_t PressureSensor::compensatePressure(const struct bmp280_calibration &cal, int32_t adc_P, int32_t t_fine)
+{
+	int64_t var1 = ((int64_t)t_fine) - 128000;
+	int64_t var2 = var1 * var1 * (int64_t)cal.dig_P6;
+	var2 = var2 + ((var1 * (int64_t)cal.dig_P5) << 17);
+	var2 = var2 + (((int64_t)cal.dig_P4) << 35);
+	var1 = ((var1 * var1 * (int64_t)cal.dig_P3) >> 8) + ((var1 * (int64_t)cal.dig_P2) << 12);
+	var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)cal.dig_P1) >> 33;
+
+	if (var1 == 0) {
+		// Avoid a division by zero
+		return 0;
+	}
+
+	int64_t p = 1048576 - adc_P;
+	p = (((p << 31) - var2) * 3125) / var1;
+	var1 = (((int64_t)cal.dig_P9) * (p >> 13) * (p >> 13)) >> 25;
+	var2 = (((int64_t)cal.dig_P8) * p) >> 19;
+	p = ((p + var1 + var2) >> 8) + (((int64_t)cal.dig_P7) << 4);
+
+	return (uint32_t)p;
 }
 
-float PressureSensor::getTemperature()
+void PressureSensor::compensateBatch(const struct bmp280_calibration &cal,
+				     const int32_t *adc_P, const int32_t *adc_T, unsigned count,
+				     uint32_t *pressure_in_pa, float *temperature_in_c)
 {
-	// TBD
-	return 0.0;
+	int32_t t_fine[BMP280_BATCH_CHUNK];
+
+	const df_i32x4 T1 = df_set1_i32x4((int32_t)cal.dig_T1);
+	const df_i32x4 T1x2 = df_set1_i32x4((int32_t)cal.dig_T1 << 1);
+	const df_i32x4 T2 = df_set1_i32x4((int32_t)cal.dig_T2);
+	const df_i32x4 T3 = df_set1_i32x4((int32_t)cal.dig_T3);
+	const df_i32x4 round = df_set1_i32x4(128);
+	const df_f32x4 hundred = df_set1_f32x4(100.0f);
+
+	const int64_t P4 = ((int64_t)cal.dig_P4) << 35;
+	const int64_t P7 = ((int64_t)cal.dig_P7) << 4;
+
+	// The pressure divisor only depends on t_fine, which rarely changes
+	// between consecutive samples
+	int32_t last_t_fine = 0;
+	int64_t offset = 0;
+	int64_t divisor = 0;
+	bool have_divisor = false;
+
+	for (unsigned base = 0; base < count; base += BMP280_BATCH_CHUNK) {
+		unsigned n = count - base;
+
+		if (n > BMP280_BATCH_CHUNK) {
+			n = BMP280_BATCH_CHUNK;
+		}
+
+		// Temperature fits in 32 bit lanes
+		unsigned i = 0;
+
+		for (; i + 4 <= n; i += 4) {
+			df_i32x4 adc = df_load_i32x4(&adc_T[base + i]);
+			df_i32x4 var1 = df_srai_i32x4(df_mullo_i32x4(df_sub_i32x4(df_srai_i32x4(adc, 3), T1x2), T2), 11);
+			df_i32x4 d = df_sub_i32x4(df_srai_i32x4(adc, 4), T1);
+			df_i32x4 var2 = df_srai_i32x4(df_mullo_i32x4(df_srai_i32x4(df_mullo_i32x4(d, d), 12), T3), 14);
+			df_i32x4 tf = df_add_i32x4(var1, var2);
+			df_i32x4 t = df_srai_i32x4(df_add_i32x4(df_add_i32x4(df_slli_i32x4(tf, 2), tf), round), 8);
+
+			df_store_i32x4(&t_fine[i], tf);
+
+			if (temperature_in_c) {
+				df_store_f32x4(&temperature_in_c[base + i],
+					       df_div_f32x4(df_cvt_i32x4_f32x4(t), hundred));
+			}
+		}
+
+		for (; i < n; i++) {
+			int32_t t = compensateTemperature(cal, adc_T[base + i], t_fine[i]);
+
+			if (temperature_in_c) {
+				temperature_in_c[base + i] = t / 100.0f;
+			}
+		}
+
+		if (!pressure_in_pa) {
+			continue;
+		}
+
+		// Pressure needs 64 bit products and a 64 bit divide, neither of
+		// which the vector units provide, so it stays scalar
+		for (i = 0; i < n; i++) {
+			if (!have_divisor || t_fine[i] != last_t_fine) {
+				int64_t var1 = ((int64_t)t_fine[i]) - 128000;
+				offset = var1 * var1 * (int64_t)cal.dig_P6;
+				offset = offset + ((var1 * (int64_t)cal.dig_P5) << 17);
+				offset = offset + P4;
+				var1 = ((var1 * var1 * (int64_t)cal.dig_P3) >> 8) + ((var1 * (int64_t)cal.dig_P2) << 12);
+				divisor = (((((int64_t)1) << 47) + var1)) * ((int64_t)cal.dig_P1) >> 33;
+				last_t_fine = t_fine[i];
+				have_divisor = true;
+			}
+
+			if (divisor == 0) {
+				pressure_in_pa[base + i] = 0;
+				continue;
+			}
+
+			int64_t p = 1048576 - adc_P[base + i];
+			p = (((p << 31) - offset) * 3125) / divisor;
+			int64_t var1 = (((int64_t)cal.dig_P9) * (p >> 13) * (p >> 13)) >> 25;
+			int64_t var2 = (((int64_t)cal.dig_P8) * p) >> 19;
+			p = ((p + var1 + var2) >> 8) + P7;
+
+			pressure_in_pa[base + i] = (uint32_t)p >> 8;
+		}
+	}
 }
 
 void PressureSensor::_measure(void)
 {
+	uint8_t data[BMP280_DATA_LEN];
+
+	// Nothing to convert the data with until start() has loaded the
+	// calibration, so leave the bus to other devices meanwhile
+	m_synchronize.lock();
+	bool calibrated = m_calibrated;
+	m_synchronize.unlock();
+	if (!calibrated) {
+		return;
+	}
+
+	// The data registers are shadowed during a burst read, so pressure
+	// and temperature come from the same conversion
+	int ret = _readReg(BMP280_REG_DATA, data, sizeof(data));
+
 	m_synchronize.lock();
 
-	m_sensor_data.pressure_in_pa = getPressure();
-	m_sensor_data.temperature_in_c = getTemperature();
+	if (ret < 0) {
+		m_sensor_data.error_count++;
+		m_synchronize.unlock();
+		return;
+	}
+
+	int32_t adc_P = (data[0] << 12) | (data[1] << 4) | (data[2] >> 4);
+	int32_t adc_T = (data[3] << 12) | (data[4] << 4) | (data[5] >> 4);
+
+	if (adc_P == BMP280_ADC_NONE || adc_T == BMP280_ADC_NONE) {
+		// No conversion completed yet
+		m_synchronize.unlock();
+		return;
+	}
+
+	int32_t t_fine;
+	int32_t temperature = compensateTemperature(m_calibration, adc_T, t_fine);
+
+	m_sensor_data.t_fine = t_fine;
+	m_sensor_data.temperature_in_c = temperature / 100.0f;
+	m_sensor_data.pressure_in_pa = compensatePressure(m_calibration, adc_P, t_fine) >> 8;
+	m_sensor_data.altitude_in_m = m_altitude.getAltitude(m_sensor_data.pressure_in_pa);
 	m_sensor_data.last_read_time_in_usecs = DriverFramework::offsetTime();
 	m_sensor_data.sensor_read_counter++;
+	struct pressure_sensor_data sample = m_sensor_data;
 
 	m_synchronize.signal();
 	m_synchronize.unlock();
+
+	// Also notifies
+	publishSamples(&sample, &sample.last_read_time_in_usecs, 1);
 }
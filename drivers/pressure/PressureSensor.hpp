@@ -34,11 +34,25 @@
 #pragma once
 
 #include <pthread.h>
+#include <string.h>
 #include "SyncObj.hpp"
 #include "I2CDevObj.hpp"
+#include "BarometricAltitude.hpp"
 
 #define PRESSURE_DEVICE_PATH "/dev/i2c-2"
 
+// BMP280 with SDO tied low
+#define BMP280_SLAVE_ADDRESS 0x76
+
+// Normal mode: oversampling x4 pressure and x1 temperature, IIR filter x16
+// and 0.5 ms standby convert continuously every ~14 ms, so each sample is
+// a single burst read without conversion waits.
+#define BMP280_MEASURE_INTERVAL_US 20000
+
+// Published samples kept for readers
+#define PRESSURE_SAMPLE_CAPACITY 16
+#define PRESSURE_SAMPLE_FIELDS 7
+
 /**
  * The sensor independent data structure containing pressure values.
  */
@@ -47,39 +61,91 @@ struct pressure_sensor_data
 	int32_t  t_fine; 			/*! used internally to calculate a temperature compensated pressure value. */
 	uint32_t pressure_in_pa; 		/*! current pressure in Pascals */
 	float    temperature_in_c; 		/*! current temperature in C at which the pressure was read */
+	float    altitude_in_m;			/*! pressure altitude in meters relative to the altimeter setting */
 	uint32_t sensor_read_counter;		/*! the total number of pressure sensor readings since the system was started */
 	uint64_t last_read_time_in_usecs; 	/*! time stamp indicating the time at which the pressure in this data structure was read */
 	uint64_t error_count; 			/*! the total number of errors detected when reading the pressure, since the system was started */
 };
 
+/**
+ * BMP280 trimming parameters, registers 0x88-0x9f in little endian order.
+ */
+struct bmp280_calibration
+{
+	uint16_t dig_T1;
+	int16_t  dig_T2;
+	int16_t  dig_T3;
+	uint16_t dig_P1;
+	int16_t  dig_P2;
+	int16_t  dig_P3;
+	int16_t  dig_P4;
+	int16_t  dig_P5;
+	int16_t  dig_P6;
+	int16_t  dig_P7;
+	int16_t  dig_P8;
+	int16_t  dig_P9;
+};
+
 using namespace DriverFramework;
 
 class PressureSensor : public I2CDevObj
 {
 public:
 	PressureSensor(const char *device_path) :
-		I2CDevObj("PressureSensor", device_path, 1000)
-	{}
+		I2CDevObj("PressureSensor", device_path, BMP280_MEASURE_INTERVAL_US),
+		m_synchronize(SYNC_OBJ_PRIO_INHERIT, "PressureSensor")
+	{
+		setSlaveAddress(BMP280_SLAVE_ADDRESS);
+		memset(&m_sensor_data, 0, sizeof(m_sensor_data));
+
+		// Published so the samples can be recorded
+		enableSampleBuffer(sizeof(struct pressure_sensor_data), PRESSURE_SAMPLE_CAPACITY);
+		setSampleLayout(s_sample_layout, PRESSURE_SAMPLE_FIELDS);
+	}
 
+	// Check the chip id, read the calibration and start continuous conversion
+	virtual int start();
+
+	// Put the sensor to sleep
+	virtual int stop();
+
+	// Altimeter setting (QNH) used for altitude_in_m, 0 for the standard
+	// atmosphere
 	void setAltimeter(float altimeter_setting_in_mbars);
 
+	// Returns 0 on success
 	int getSensorData(struct pressure_sensor_data &out_data, bool is_new_data_required);
 
+	// Integer compensation of the BMP280 datasheet. Returns the
+	// temperature in 0.01 degrees C and the t_fine used for the pressure.
+	static int32_t compensateTemperature(const struct bmp280_calibration &cal, int32_t adc_T, int32_t &t_fine);
+
+	// Returns the pressure in Pa as unsigned Q24.8
+	static uint32_t compensatePressure(const struct bmp280_calibration &cal, int32_t adc_P, int32_t t_fine);
+
+	// Compensate count raw samples at once, e.g. after a FIFO drain or
+	// when replaying a log. Results are bit-exact with the functions
+	// above (pressure >> 8, temperature / 100.0f).
+	static void compensateBatch(const struct bmp280_calibration &cal,
+				    const int32_t *adc_P, const int32_t *adc_T, unsigned count,
+				    uint32_t *pressure_in_pa, float *temperature_in_c);
+
+	// Fields of struct pressure_sensor_data, for the recorder's codec
+	static const SampleField s_sample_layout[PRESSURE_SAMPLE_FIELDS];
+
 protected:
 	virtual void _measure();
 
 private:
-
-	// Return pressure in pascals
-	uint32_t getPressure();
-
-	// Get temperature in degrees C
-	float getTemperature();
+	int loadCalibration();
 
 	struct pressure_sensor_data 	m_sensor_data;
+	struct bmp280_calibration	m_calibration;
+	bool				m_calibrated = false;
 
-	float 				m_altimeter_mbars = 0.0;
+	BarometricAltitude		m_altitude;
 
+	// Taken by _measure() on the HRT thread and by readers of any
+	// priority, so it boosts a reader holding it
 	SyncObj 			m_synchronize;
 };
-
@@ -0,0 +1,102 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include "SimI2CBackend.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+// BMP280 register model with the calibration example of the datasheet.
+// The data registers hold their reset value until normal mode is set.
+class SimBMP280 : public SimI2CDevice
+{
+public:
+	SimBMP280() :
+		SimI2CDevice(0x76)
+	{
+		static const uint8_t calib[24] = {
+			0x70, 0x6b,	// dig_T1 27504
+			0x43, 0x67,	// dig_T2 26435
+			0x18, 0xfc,	// dig_T3 -1000
+			0x7d, 0x8e,	// dig_P1 36477
+			0x43, 0xd6,	// dig_P2 -10685
+			0xd0, 0x0b,	// dig_P3 3024
+			0x27, 0x0b,	// dig_P4 2855
+			0x8c, 0x00,	// dig_P5 140
+			0xf9, 0xff,	// dig_P6 -7
+			0x8c, 0x3c,	// dig_P7 15500
+			0xf8, 0xc6,	// dig_P8 -14600
+			0x70, 0x17,	// dig_P9 6000
+		};
+		static const uint8_t reset[6] = { 0x80, 0x00, 0x00, 0x80, 0x00, 0x00 };
+
+		setRegs(0x88, calib, sizeof(calib));
+		setReg(0xd0, 0x58);
+		setRegs(0xf7, reset, sizeof(reset));
+
+		// Expected: 25.08 C, 100653 Pa
+		setRaw(415148, 519888);
+	}
+
+	void setRaw(int32_t adc_P, int32_t adc_T)
+	{
+		m_adc_P = adc_P;
+		m_adc_T = adc_T;
+	}
+
+protected:
+	virtual void write(uint8_t reg, const uint8_t *data, int length)
+	{
+		SimI2CDevice::write(reg, data, length);
+
+		// Normal mode starts conversions
+		if (reg <= 0xf4 && reg + length > 0xf4 && (m_regs[0xf4] & 3) == 3) {
+			m_regs[0xf7] = m_adc_P >> 12;
+			m_regs[0xf8] = m_adc_P >> 4;
+			m_regs[0xf9] = (m_adc_P & 0xf) << 4;
+			m_regs[0xfa] = m_adc_T >> 12;
+			m_regs[0xfb] = m_adc_T >> 4;
+			m_regs[0xfc] = (m_adc_T & 0xf) << 4;
+		}
+	}
+
+private:
+	int32_t		m_adc_P;
+	int32_t		m_adc_T;
+};
+
+};
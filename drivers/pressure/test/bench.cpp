@@ -0,0 +1,285 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DriverFramework.hpp"
+#include "DFSimd.hpp"
+#include "PressureSensor.hpp"
+#include "BarometricAltitude.hpp"
+
+// Single threaded, so the rates are per core
+#define BENCH_SAMPLES	(1 << 20)
+#define BENCH_ROUNDS	8
+
+using namespace DriverFramework;
+
+// Datasheet example calibration, as in SimBMP280
+static const struct bmp280_calibration s_cal = {
+	27504, 26435, -1000,
+	36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000
+};
+
+static uint32_t s_seed = 1;
+
+static int32_t randomRange(int32_t lo, int32_t hi)
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return lo + (int32_t)((s_seed >> 8) % (uint32_t)(hi - lo));
+}
+
+static void compensateReference(const int32_t *adc_P, const int32_t *adc_T, unsigned count,
+				 uint32_t *pressure_in_pa, float *temperature_in_c)
+{
+	for (unsigned i = 0; i < count; i++) {
+		int32_t t_fine;
+		int32_t t = PressureSensor::compensateTemperature(s_cal, adc_T[i], t_fine);
+		temperature_in_c[i] = t / 100.0f;
+		pressure_in_pa[i] = PressureSensor::compensatePressure(s_cal, adc_P[i], t_fine) >> 8;
+	}
+}
+
+static int compare(const char *name, const uint32_t *p_ref, const float *t_ref,
+		   const uint32_t *p, const float *t, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		if (p_ref[i] != p[i] || memcmp(&t_ref[i], &t[i], sizeof(float)) != 0) {
+			DF_LOG_ERR("FAILED: %s sample %u: %u Pa %f C, expected %u Pa %f C",
+				   name, i, p[i], (double)t[i], p_ref[i], (double)t_ref[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static double exactAltitude(double pressure_in_pa, double altimeter_setting_in_mbars)
+{
+	return 44330.8 * (1.0 - pow(pressure_in_pa / (altimeter_setting_in_mbars * 100.0), 0.190263));
+}
+
+// Error of the altitude kernel and of powf() against double precision
+// over 1-1100 mbar, then the throughput of both
+static int benchAltitude(uint32_t *pressure, float *altitude, unsigned count)
+{
+	static const float settings[] = { 950.0f, BAROMETRIC_STD_MBARS, 1050.0f };
+	BarometricAltitude baro;
+	double max_err = 0.0;
+	double max_err_powf = 0.0;
+	int failures = 0;
+
+	for (unsigned s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+		baro.setAltimeter(settings[s]);
+
+		for (uint32_t base = 100; base < 110000; base += count) {
+			unsigned n = 0;
+
+			for (; n < count && base + n <= 110000; n++) {
+				pressure[n] = base + n;
+			}
+
+			baro.getAltitudes(pressure, n, altitude);
+
+			for (unsigned i = 0; i < n; i++) {
+				double exact = exactAltitude(pressure[i], settings[s]);
+				double err = fabs(altitude[i] - exact);
+				double err_powf = fabs(BarometricAltitude::referenceAltitude(pressure[i], settings[s]) - exact);
+
+				if (err > max_err) {
+					max_err = err;
+				}
+
+				if (err_powf > max_err_powf) {
+					max_err_powf = err_powf;
+				}
+
+				// Both are within 1 cm of the exact altitude
+				if (fabsf(baro.getAltitude(pressure[i]) - altitude[i]) > 0.02f) {
+					failures++;
+				}
+			}
+		}
+	}
+
+	DF_LOG_INFO("altitude max error (m): fast %.4f  powf %.4f", max_err, max_err_powf);
+
+	if (max_err > 0.01) {
+		DF_LOG_ERR("FAILED: altitude error above 1 cm");
+		failures++;
+	}
+
+	// A pressure of 0 is what compensation returns without a valid reading
+	pressure[0] = 0;
+	baro.getAltitudes(pressure, 1, altitude);
+	if (!isnan(baro.getAltitude(0.0f)) || !isnan(altitude[0])) {
+		DF_LOG_ERR("FAILED: altitude of a 0 Pa reading");
+		failures++;
+	}
+
+	if (failures) {
+		return failures;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		pressure[i] = 90000 + randomRange(0, 15000);
+	}
+
+	volatile float sink = 0.0f;
+	uint64_t start = offsetTime();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (unsigned i = 0; i < count; i++) {
+			altitude[i] = BarometricAltitude::referenceAltitude(pressure[i], BAROMETRIC_STD_MBARS);
+		}
+
+		sink = sink + altitude[r];
+	}
+
+	uint64_t powf_usec = offsetTime() - start;
+	start = offsetTime();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		baro.getAltitudes(pressure, count, altitude);
+		sink = sink + altitude[r];
+	}
+
+	uint64_t batch_usec = offsetTime() - start;
+	start = offsetTime();
+
+	// One sample per call, as PressureSensor::_measure() does
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (unsigned i = 0; i < count; i++) {
+			altitude[i] = baro.getAltitude(pressure[i]);
+		}
+
+		sink = sink + altitude[r];
+	}
+
+	uint64_t single_usec = offsetTime() - start;
+
+	double samples = (double)count * BENCH_ROUNDS;
+	DF_LOG_INFO("altitude powf     samples/s: %6.1fM", samples / powf_usec);
+	DF_LOG_INFO("altitude single   samples/s: %6.1fM  speedup: %4.2fx",
+		    samples / single_usec, (double)powf_usec / single_usec);
+	DF_LOG_INFO("altitude (%-6s)  samples/s: %6.1fM  speedup: %4.2fx", DF_SIMD_NAME,
+		    samples / batch_usec, (double)powf_usec / batch_usec);
+
+	return 0;
+}
+
+int main()
+{
+	int32_t *adc_P = new int32_t[BENCH_SAMPLES];
+	int32_t *adc_T = new int32_t[BENCH_SAMPLES];
+	uint32_t *p_ref = new uint32_t[BENCH_SAMPLES];
+	uint32_t *p = new uint32_t[BENCH_SAMPLES];
+	float *t_ref = new float[BENCH_SAMPLES];
+	float *t = new float[BENCH_SAMPLES];
+	int failures = 0;
+
+	// Bit-exactness over the operating range, including odd batch sizes
+	// that exercise the scalar tails
+	for (unsigned i = 0; i < BENCH_SAMPLES; i++) {
+		adc_P[i] = randomRange(150000, 750000);
+		adc_T[i] = randomRange(300000, 750000);
+	}
+
+	compensateReference(adc_P, adc_T, BENCH_SAMPLES, p_ref, t_ref);
+	PressureSensor::compensateBatch(s_cal, adc_P, adc_T, BENCH_SAMPLES, p, t);
+	failures += compare("random", p_ref, t_ref, p, t, BENCH_SAMPLES);
+
+	for (unsigned count = 1; count < 140; count += 7) {
+		memset(p, 0, count * sizeof(p[0]));
+		PressureSensor::compensateBatch(s_cal, &adc_P[count], &adc_T[count], count, p, t);
+		failures += compare("tail", &p_ref[count], &t_ref[count], p, t, count);
+	}
+
+	// Filtered readings as drained from the FIFO: temperature drifts
+	// slowly, pressure is noisy
+	int32_t temp = 519888;
+
+	for (unsigned i = 0; i < BENCH_SAMPLES; i++) {
+		if ((i & 15) == 0) {
+			temp += randomRange(-8, 9);
+		}
+
+		adc_T[i] = temp;
+		adc_P[i] = 415148 + randomRange(-400, 400);
+	}
+
+	compensateReference(adc_P, adc_T, BENCH_SAMPLES, p_ref, t_ref);
+	PressureSensor::compensateBatch(s_cal, adc_P, adc_T, BENCH_SAMPLES, p, t);
+	failures += compare("filtered", p_ref, t_ref, p, t, BENCH_SAMPLES);
+
+	uint64_t start = offsetTime();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		compensateReference(adc_P, adc_T, BENCH_SAMPLES, p_ref, t_ref);
+	}
+
+	uint64_t ref_usec = offsetTime() - start;
+	start = offsetTime();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		PressureSensor::compensateBatch(s_cal, adc_P, adc_T, BENCH_SAMPLES, p, t);
+	}
+
+	uint64_t batch_usec = offsetTime() - start;
+
+	double samples = (double)BENCH_SAMPLES * BENCH_ROUNDS;
+	DF_LOG_INFO("scalar reference  samples/s: %6.1fM", samples / ref_usec);
+	DF_LOG_INFO("batch (%-6s)    samples/s: %6.1fM  speedup: %4.2fx", DF_SIMD_NAME,
+		    samples / batch_usec, (double)ref_usec / batch_usec);
+
+	failures += benchAltitude(p, t, BENCH_SAMPLES);
+
+	delete[] adc_P;
+	delete[] adc_T;
+	delete[] p_ref;
+	delete[] p;
+	delete[] t_ref;
+	delete[] t;
+
+	if (failures) {
+		DF_LOG_ERR("FAILED: %d mismatches", failures);
+		return 1;
+	}
+
+	DF_LOG_INFO("PASSED");
+	return 0;
+}
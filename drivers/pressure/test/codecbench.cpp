@@ -0,0 +1,213 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "DriverFramework.hpp"
+#include "Recorder.hpp"
+#include "SampleCodec.hpp"
+#include "PressureSensor.hpp"
+#include "BarometricAltitude.hpp"
+#include "bench.hpp"
+
+// Size and speed of recorded pressure_sensor_data coded by SampleCodec,
+// with the PressureSensor layout and with the default one. Single
+// threaded, blocks decode independently so decoding scales with cores.
+
+#define BENCH_SAMPLES		(1 << 20)
+#define BENCH_ROUNDS		5
+#define BENCH_MAX_BLOCKS	(BENCH_SAMPLES / 16)
+#define BENCH_MIN_RATIO		3.0	// fail below this with the layout
+
+using namespace DriverFramework;
+
+// Datasheet example calibration, as in SimBMP280
+static const struct bmp280_calibration s_cal = {
+	27504, 26435, -1000,
+	36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000
+};
+
+static uint32_t s_seed = 1;
+
+static int32_t randomRange(int32_t lo, int32_t hi)
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return lo + (int32_t)((s_seed >> 8) % (uint32_t)(hi - lo));
+}
+
+struct Block
+{
+	uint32_t	offset;
+	uint16_t	length;
+	uint16_t	count;
+	uint64_t	timestamp;
+};
+
+static pressure_sensor_data s_samples[BENCH_SAMPLES];
+static uint64_t s_timestamps[BENCH_SAMPLES];
+static pressure_sensor_data s_decoded[BENCH_SAMPLES];
+static uint64_t s_decoded_timestamps[BENCH_SAMPLES];
+static uint8_t s_coded[BENCH_SAMPLES * sizeof(pressure_sensor_data) * 2];
+static Block s_blocks[BENCH_MAX_BLOCKS];
+
+// A 50 Hz sensor with a little noise and scheduling jitter
+static void generate()
+{
+	BarometricAltitude altitude;
+	int32_t adc_T = 519888;
+	uint64_t t = 1000000;
+
+	memset(s_samples, 0, sizeof(s_samples));
+	for (unsigned int i = 0; i < BENCH_SAMPLES; i++) {
+		pressure_sensor_data &s = s_samples[i];
+		if (i % 64 == 0) {
+			adc_T += randomRange(-8, 9);
+		}
+		int32_t adc_P = 415148 + randomRange(-24, 25);
+		int32_t temperature = PressureSensor::compensateTemperature(s_cal, adc_T, s.t_fine);
+		s.temperature_in_c = temperature / 100.0f;
+		s.pressure_in_pa = PressureSensor::compensatePressure(s_cal, adc_P, s.t_fine) >> 8;
+		s.altitude_in_m = altitude.getAltitude(s.pressure_in_pa);
+		s.sensor_read_counter = i + 1;
+		t += BMP280_MEASURE_INTERVAL_US + randomRange(-40, 41);
+		s.last_read_time_in_usecs = t;
+		s.error_count = i / 100000;
+		s_timestamps[i] = t;
+	}
+}
+
+// Returns the size as RECORD_BLOCKs
+static size_t encode(SampleCodec &codec, unsigned int &num_blocks)
+{
+	size_t offset = 0;
+	size_t recorded = 0;
+	num_blocks = 0;
+
+	for (unsigned int i = 0; i < BENCH_SAMPLES; ) {
+		codec.beginBlock(&s_coded[offset], CODEC_BLOCK_BYTES);
+		while (i < BENCH_SAMPLES && codec.encode(&s_samples[i], s_timestamps[i])) {
+			i++;
+		}
+		Block &b = s_blocks[num_blocks++];
+		b.offset = offset;
+		b.length = codec.blockSize();
+		b.count = codec.blockCount();
+		b.timestamp = codec.blockTimestamp();
+		offset += b.length;
+		recorded += (sizeof(RecordHeader) + sizeof(RecordBlockInfo) + b.length + 7) & ~7;
+	}
+	return recorded;
+}
+
+static bool decode(SampleCodec &codec, unsigned int num_blocks)
+{
+	unsigned int n = 0;
+	for (unsigned int b = 0; b < num_blocks; b++) {
+		const Block &blk = s_blocks[b];
+		if (codec.decode(&s_coded[blk.offset], blk.length, blk.count, blk.timestamp,
+				 &s_decoded[n], &s_decoded_timestamps[n]) != blk.count) {
+			return false;
+		}
+		n += blk.count;
+	}
+	return n == BENCH_SAMPLES;
+}
+
+static bool run(const char *name, const SampleField *fields, unsigned int num_fields, double &ratio)
+{
+	SampleCodec encoder;
+	SampleCodec decoder;
+	if (encoder.init(sizeof(pressure_sensor_data), fields, num_fields) < 0 ||
+	    decoder.init(sizeof(pressure_sensor_data), fields, num_fields) < 0) {
+		printf("%s: layout refused\n", name);
+		return false;
+	}
+
+	uint64_t best_encode = UINT64_MAX;
+	uint64_t best_decode = UINT64_MAX;
+	unsigned int num_blocks = 0;
+	size_t recorded = 0;
+	bool ok = true;
+
+	for (unsigned int r = 0; r < BENCH_ROUNDS; r++) {
+		uint64_t start = nowNsec();
+		recorded = encode(encoder, num_blocks);
+		uint64_t elapsed = nowNsec() - start;
+		if (elapsed < best_encode) {
+			best_encode = elapsed;
+		}
+
+		start = nowNsec();
+		ok = ok && decode(decoder, num_blocks);
+		elapsed = nowNsec() - start;
+		if (elapsed < best_decode) {
+			best_decode = elapsed;
+		}
+	}
+
+	ok = ok && memcmp(s_decoded, s_samples, sizeof(s_samples)) == 0 &&
+	     memcmp(s_decoded_timestamps, s_timestamps, sizeof(s_timestamps)) == 0;
+
+	size_t raw = (size_t)BENCH_SAMPLES * ((sizeof(RecordHeader) + sizeof(pressure_sensor_data) + 7) & ~7);
+	size_t bytes = (size_t)BENCH_SAMPLES * (sizeof(pressure_sensor_data) + sizeof(uint64_t));
+	ratio = (double)raw / recorded;
+
+	printf("%-14s %5.2f bytes/sample  ratio %5.2f  encode %6.1f M samples/s  decode %6.1f M samples/s %5.2f GB/s%s\n",
+	       name, (double)recorded / BENCH_SAMPLES, ratio,
+	       BENCH_SAMPLES * 1e3 / best_encode, BENCH_SAMPLES * 1e3 / best_decode,
+	       (double)bytes / best_decode, ok ? "" : "  MISMATCH");
+	return ok;
+}
+
+int main()
+{
+	generate();
+
+	printf("%u samples of %zu bytes, %zu bytes/sample as RECORD_SAMPLEs\n", BENCH_SAMPLES,
+	       sizeof(pressure_sensor_data), (sizeof(RecordHeader) + sizeof(pressure_sensor_data) + 7) & ~7);
+
+	double layout_ratio, default_ratio;
+	bool ok = run("layout", PressureSensor::s_sample_layout, PRESSURE_SAMPLE_FIELDS, layout_ratio);
+	ok = run("default layout", nullptr, 0, default_ratio) && ok;
+
+	if (!ok || layout_ratio < BENCH_MIN_RATIO) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
@@ -1,10 +1,12 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <unistd.h>
+#include <string.h>
 #include "DriverFramework.hpp"
 #include "PressureSensor.hpp"
+#include "SimBMP280.hpp"
 
 using namespace DriverFramework;
 
@@ -15,9 +17,15 @@ public:
 	static const int TEST_PASS = 0;
 	static const int TEST_FAIL = 1;
 
-	PressureTester() :
-		m_sensor(PRESSURE_DEVICE_PATH)
-	{}
+	// Without a backend the sensor is simulated
+	PressureTester(I2CBackend *backend) :
+		m_sensor(PRESSURE_DEVICE_PATH),
+		m_simulated(backend != nullptr)
+	{
+		if (backend) {
+			m_sensor.setBackend(*backend);
+		}
+	}
 
 	static void readSensorCallback(void *arg, WorkHandle wh);
 
@@ -35,13 +43,17 @@ private:
 
 	int		m_pass;
 	bool		m_done = false;
+	bool		m_simulated;
 };
 
+#define PRESSURE_TEST_READINGS	50
+#define PRESSURE_TEST_ATTEMPTS	5000
+
 static void printPressureValues(struct pressure_sensor_data &sensor_data)
 {
-	DF_LOG_INFO("bmp280 data [cntr: %d, time stamp: %" PRId64 ", pressure (pascals): %d, temp (C): %f]",
+	DF_LOG_INFO("bmp280 data [cntr: %d, time stamp: %" PRId64 ", pressure (pascals): %d, temp (C): %f, altitude (m): %f]",
         	sensor_data.sensor_read_counter, sensor_data.last_read_time_in_usecs, 
-		sensor_data.pressure_in_pa, sensor_data.temperature_in_c);
+		sensor_data.pressure_in_pa, sensor_data.temperature_in_c, sensor_data.altitude_in_m);
 }
 
 void PressureTester::readSensorCallback(void *arg, WorkHandle wh)
@@ -60,20 +72,41 @@ void PressureTester::wait(void)
 
 void PressureTester::readSensor()
 {
-	int status = m_sensor.getSensorData(m_sensor_data, true);
+	// Runs on the HRT thread like the sensor, so it must not wait for data
+	int status = m_sensor.getSensorData(m_sensor_data, false);
+	m_read_attempts++;
 
-	if ((status == 0) && (m_read_counter != m_sensor_data.sensor_read_counter)) {
+	if (status != 0) {
+		DF_LOG_INFO("error: unable to read the pressure sensor device.");
+	}
+	else if (m_read_counter != m_sensor_data.sensor_read_counter) {
 		m_read_counter = m_sensor_data.sensor_read_counter;
 		printPressureValues(m_sensor_data);
-	} else {
-		DF_LOG_INFO("error: unable to read the pressure sensor device.");
+
+		if (m_simulated && (m_sensor_data.pressure_in_pa != 100653 ||
+				    m_sensor_data.temperature_in_c < 25.075f ||
+				    m_sensor_data.temperature_in_c > 25.085f)) {
+			DF_LOG_INFO("error: compensated values differ from the datasheet example");
+			m_pass = TEST_FAIL;
+			m_done = true;
+			return;
+		}
+
+		float expected = BarometricAltitude::referenceAltitude(m_sensor_data.pressure_in_pa, 0.0f);
+		if (fabsf(m_sensor_data.altitude_in_m - expected) > 0.05f) {
+			DF_LOG_INFO("error: altitude %f m, expected %f m", m_sensor_data.altitude_in_m, expected);
+			m_pass = TEST_FAIL;
+			m_done = true;
+			return;
+		}
 	}
-	if ((m_read_counter < 1000) && (m_read_attempts < 2000)) {
+
+	if ((m_read_counter < PRESSURE_TEST_READINGS) && (m_read_attempts < PRESSURE_TEST_ATTEMPTS)) {
 		WorkMgr::schedule(m_work_handle);
 	}
 	else {
 		// Done test
-		m_pass = TEST_PASS;
+		m_pass = (m_read_counter >= PRESSURE_TEST_READINGS) ? TEST_PASS : TEST_FAIL;
 		m_done = true;
 	}
 }
@@ -99,22 +132,46 @@ int PressureTester::run(void) {
 	}
 
 	wait();
+
+	// One bus transaction per sample after the 5 setup transactions
+	I2CDeviceBusStats stats;
+	m_sensor.getDeviceBusStats(stats);
+	m_sensor.getSensorData(m_sensor_data, false);
+	DF_LOG_INFO("%lu bus transactions for %u samples", stats.transfers,
+		    m_sensor_data.sensor_read_counter);
+	if (m_pass == TEST_PASS && stats.transfers > 5 + m_sensor_data.sensor_read_counter + 2) {
+		m_pass = TEST_FAIL;
+	}
+
 	DF_LOG_INFO("Closing pressure sensor\n");
+	WorkMgr::destroy(m_work_handle);
 	m_sensor.stop();
 	return m_pass;
 }
 
-int main()
+// Pass "hw" to use the sensor at PRESSURE_DEVICE_PATH
+int main(int argc, char *argv[])
 {
 	int ret = Framework::initialize();
 	if (ret < 0) {
 		return ret;
 	}
 
-	PressureTester pt;
+	bool use_hw = (argc > 1 && strcmp(argv[1], "hw") == 0);
+	SimI2CBackend backend;
+	SimBMP280 model;
+	backend.attach(PRESSURE_DEVICE_PATH, model);
+
+	PressureTester pt(use_hw ? nullptr : &backend);
 
 	ret = pt.run();
 
+	// stop() leaves the sensor in sleep mode
+	if (!use_hw && ret == PressureTester::TEST_PASS && (model.getReg(0xf4) & 0x03) != 0) {
+		DF_LOG_INFO("error: sensor not asleep after stop");
+		ret = PressureTester::TEST_FAIL;
+	}
+
 	Framework::shutdown();
 
 	DF_LOG_INFO("Test %s", (ret == PressureTester::TEST_PASS) ? "PASSED" : "FAILED");
@@ -0,0 +1,151 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __linux__
+#include <linux/spi/spidev.h>
+#endif
+#include "SPIBackend.hpp"
+
+using namespace DriverFramework;
+
+// Segments per SPI_IOC_MESSAGE ioctl; longer transfers are split
+#define SPI_MAX_SEGMENTS 32
+
+static SPIBackend *g_default_backend = nullptr;
+
+SPIBackend *SPIBackend::getDefault(void)
+{
+#ifdef __linux__
+	if (g_default_backend == nullptr) {
+		return &LinuxSPIBackend::instance();
+	}
+#endif
+	return g_default_backend;
+}
+
+void SPIBackend::setDefault(SPIBackend &backend)
+{
+	g_default_backend = &backend;
+}
+
+#ifdef __linux__
+/*************************************************************************
+  LinuxSPIBackend
+*************************************************************************/
+LinuxSPIBackend &LinuxSPIBackend::instance(void)
+{
+	static LinuxSPIBackend backend;
+	return backend;
+}
+
+int LinuxSPIBackend::sysOpen(const char *path, int flags)
+{
+	int fd = ::open(path, flags);
+	return (fd < 0) ? -errno : fd;
+}
+
+int LinuxSPIBackend::sysClose(int fd)
+{
+	return (::close(fd) < 0) ? -errno : 0;
+}
+
+int LinuxSPIBackend::sysIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret = ::ioctl(fd, request, arg);
+	return (ret < 0) ? -errno : ret;
+}
+
+int LinuxSPIBackend::open(const char *dev_path)
+{
+	return sysOpen(dev_path, O_RDWR);
+}
+
+int LinuxSPIBackend::close(int fd)
+{
+	return sysClose(fd);
+}
+
+int LinuxSPIBackend::configure(int fd, uint8_t mode, uint8_t bits_per_word, uint32_t speed_hz)
+{
+	int ret = sysIoctl(fd, SPI_IOC_WR_MODE, &mode);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sysIoctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sysIoctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz);
+	return (ret < 0) ? ret : 0;
+}
+
+int LinuxSPIBackend::transfer(int fd, SPISegment *segments, unsigned int count, uint32_t speed_hz)
+{
+	struct spi_ioc_transfer xfers[SPI_MAX_SEGMENTS];
+	int calls = 0;
+
+	while (count) {
+		unsigned int n = (count > SPI_MAX_SEGMENTS) ? SPI_MAX_SEGMENTS : count;
+
+		// Unused fields must be zero
+		memset(xfers, 0, n * sizeof(xfers[0]));
+		for (unsigned int i = 0; i < n; i++) {
+			xfers[i].tx_buf = (unsigned long)segments[i].tx_buffer;
+			xfers[i].rx_buf = (unsigned long)segments[i].rx_buffer;
+			xfers[i].len = segments[i].length;
+			xfers[i].speed_hz = speed_hz;
+			xfers[i].delay_usecs = segments[i].delay_usec;
+			xfers[i].cs_change = segments[i].cs_change;
+		}
+
+		int ret = sysIoctl(fd, SPI_IOC_MESSAGE(n), xfers);
+		++calls;
+		if (ret < 0) {
+			return ret;
+		}
+
+		segments += n;
+		count -= n;
+	}
+
+	return calls;
+}
+#endif
@@ -0,0 +1,180 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "SPIDevObj.hpp"
+
+using namespace DriverFramework;
+
+int SPIDevObj::start()
+{
+	if (m_backend == nullptr) {
+		m_backend = SPIBackend::getDefault();
+		if (m_backend == nullptr) {
+			DF_LOG_ERR("error: no SPI backend for %s", m_dev_base_path.c_str());
+			return -ENODEV;
+		}
+	}
+
+	// Already started, e.g. by the first handle opened after start()
+	if (m_fd >= 0) {
+		return 0;
+	}
+
+	m_fd = m_backend->open(m_dev_base_path.c_str());
+	if (m_fd < 0) {
+		DF_LOG_ERR("error: unable to open %s", m_dev_base_path.c_str());
+		return m_fd;
+	}
+
+	int ret = m_backend->configure(m_fd, m_mode, 8, m_speed_hz);
+	if (ret < 0) {
+		DF_LOG_ERR("error: unable to set mode %u at %u Hz on %s",
+			m_mode, m_speed_hz, m_dev_base_path.c_str());
+		m_backend->close(m_fd);
+		m_fd = -1;
+		return ret;
+	}
+
+	ret = DevObj::start();
+	if (ret < 0) {
+		stop();
+	}
+	return ret;
+}
+
+int SPIDevObj::stop()
+{
+	DevObj::stop();
+
+	int ret = 0;
+	if (m_fd >= 0) {
+		ret = m_backend->close(m_fd);
+		m_fd = -1;
+	}
+	return ret;
+}
+
+int SPIDevObj::readReg(DevHandle &h, uint8_t address, uint8_t *out_buffer, int length)
+{
+	SPIDevObj *obj = DevMgr::getDevObjByHandle<SPIDevObj>(h);
+	if (obj) {
+		return obj->_readReg(address, out_buffer, length);
+	}
+	else {
+		return -1;
+	}
+}
+
+int SPIDevObj::writeReg(DevHandle &h, uint8_t address, uint8_t *in_buffer, int length)
+{
+	SPIDevObj *obj = DevMgr::getDevObjByHandle<SPIDevObj>(h);
+	if (obj) {
+		return obj->_writeReg(address, in_buffer, length);
+	}
+	else {
+		return -1;
+	}
+}
+
+int SPIDevObj::transfer(DevHandle &h, SPISegment *segments, unsigned int count)
+{
+	SPIDevObj *obj = DevMgr::getDevObjByHandle<SPIDevObj>(h);
+	if (obj) {
+		return obj->_transfer(segments, count);
+	}
+	else {
+		return -1;
+	}
+}
+
+int SPIDevObj::_readReg(uint8_t address, uint8_t *out_buffer, int length)
+{
+	uint8_t cmd = address | SPI_READ_FLAG;
+
+	// Register byte out, then clock in the data
+	SPISegment segments[2];
+	memset(segments, 0, sizeof(segments));
+	segments[0].tx_buffer = &cmd;
+	segments[0].length = 1;
+	segments[1].rx_buffer = out_buffer;
+	segments[1].length = length;
+
+	return _transfer(segments, 2);
+}
+
+int SPIDevObj::_writeReg(uint8_t address, uint8_t *in_buffer, int length)
+{
+	uint8_t cmd = address & ~SPI_READ_FLAG;
+
+	// The data is sent from the caller's buffer without a copy
+	SPISegment segments[2];
+	memset(segments, 0, sizeof(segments));
+	segments[0].tx_buffer = &cmd;
+	segments[0].length = 1;
+	segments[1].tx_buffer = in_buffer;
+	segments[1].length = length;
+
+	return _transfer(segments, 2);
+}
+
+int SPIDevObj::_transfer(SPISegment *segments, unsigned int count)
+{
+	if (m_fd < 0) {
+		DF_LOG_ERR("error: spi device is not yet opened");
+		return -1;
+	}
+
+	int calls = m_backend->transfer(m_fd, segments, count, m_speed_hz);
+	if (calls < 0) {
+		DF_LOG_ERR("error: spi transfer of %u segments failed (%d)", count, calls);
+		return -1;
+	}
+	m_syscall_count += calls;
+	return 0;
+}
+
+int SPIDevObj::fifoReadReg(void *ctx, uint8_t address, uint8_t *out_buffer, int length)
+{
+	return static_cast<SPIDevObj *>(ctx)->_readReg(address, out_buffer, length);
+}
+
+int SPIDevObj::_drainFifo(const SensorFifoConfig &config, uint8_t *out_buffer,
+			  uint64_t *timestamps, unsigned int max_samples)
+{
+	return SensorFifo::drain(config, fifoReadReg, this, out_buffer, timestamps, max_samples);
+}
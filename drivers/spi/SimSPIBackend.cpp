@@ -0,0 +1,347 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "DriverFramework.hpp"
+#include "SimSPIBackend.hpp"
+
+using namespace DriverFramework;
+
+// Simulated file descriptors start here, to stand out from real ones
+#define SIM_FD_BASE 2000
+
+/*************************************************************************
+  SimSPIDevice
+*************************************************************************/
+SimSPIDevice::SimSPIDevice() :
+	m_fifo_reg(-1),
+	m_first(true),
+	m_read(false),
+	m_reg(0)
+{
+	memset(m_regs, 0, sizeof(m_regs));
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+SimSPIDevice::~SimSPIDevice()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+void SimSPIDevice::lock()
+{
+	pthread_mutex_lock(&m_lock);
+}
+
+void SimSPIDevice::unlock()
+{
+	pthread_mutex_unlock(&m_lock);
+}
+
+void SimSPIDevice::setReg(uint8_t reg, uint8_t value)
+{
+	lock();
+	m_regs[reg & 0x7f] = value;
+	unlock();
+}
+
+void SimSPIDevice::setRegs(uint8_t reg, const uint8_t *values, unsigned int length)
+{
+	lock();
+	for (unsigned int i = 0; i < length; i++) {
+		m_regs[(reg + i) & 0x7f] = values[i];
+	}
+	unlock();
+}
+
+uint8_t SimSPIDevice::getReg(uint8_t reg)
+{
+	lock();
+	uint8_t value = m_regs[reg & 0x7f];
+	unlock();
+	return value;
+}
+
+void SimSPIDevice::setFifoReg(uint8_t reg)
+{
+	lock();
+	m_fifo_reg = reg & 0x7f;
+	unlock();
+}
+
+void SimSPIDevice::pushFifo(const uint8_t *data, unsigned int length)
+{
+	lock();
+	m_fifo.insert(m_fifo.end(), data, data + length);
+	unlock();
+}
+
+unsigned int SimSPIDevice::getFifoLength()
+{
+	lock();
+	unsigned int length = m_fifo.size();
+	unlock();
+	return length;
+}
+
+void SimSPIDevice::select()
+{
+	m_first = true;
+}
+
+uint8_t SimSPIDevice::exchange(uint8_t tx)
+{
+	if (m_first) {
+		m_first = false;
+		m_read = (tx & SPI_READ_FLAG) != 0;
+		m_reg = tx & 0x7f;
+		return 0;
+	}
+
+	uint8_t rx = 0;
+
+	if (m_reg == m_fifo_reg) {
+		if (m_read && !m_fifo.empty()) {
+			rx = m_fifo.front();
+			m_fifo.pop_front();
+		}
+		return rx;
+	}
+
+	if (m_read) {
+		rx = m_regs[m_reg];
+	}
+	else {
+		m_regs[m_reg] = tx;
+	}
+	m_reg = (m_reg + 1) & 0x7f;
+
+	return rx;
+}
+
+/*************************************************************************
+  SimSPIBackend
+*************************************************************************/
+SimSPIBackend::SimSPIBackend() :
+	m_latency_usec(0),
+	m_call_count(0)
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+SimSPIBackend::~SimSPIBackend()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+int SimSPIBackend::attach(const char *dev_path, SimSPIDevice &dev)
+{
+	SimNode node;
+	node.path = dev_path;
+	node.dev = &dev;
+	node.mode = 0;
+	node.speed_hz = 1000000;
+
+	pthread_mutex_lock(&m_lock);
+	m_nodes.push_back(node);
+	pthread_mutex_unlock(&m_lock);
+	return 0;
+}
+
+void SimSPIBackend::detach(SimSPIDevice &dev)
+{
+	pthread_mutex_lock(&m_lock);
+	std::list<SimNode>::iterator it = m_nodes.begin();
+	for (; it != m_nodes.end(); ++it) {
+		if (it->dev == &dev) {
+			it->dev = nullptr;
+		}
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+int SimSPIBackend::getConfig(SimSPIDevice &dev, uint8_t &mode, uint32_t &speed_hz)
+{
+	int ret = -ENODEV;
+
+	pthread_mutex_lock(&m_lock);
+	std::list<SimNode>::iterator it = m_nodes.begin();
+	for (; it != m_nodes.end(); ++it) {
+		if (it->dev == &dev) {
+			mode = it->mode;
+			speed_hz = it->speed_hz;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+int SimSPIBackend::open(const char *dev_path)
+{
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+
+	std::list<SimNode>::iterator it = m_nodes.begin();
+	for (; it != m_nodes.end(); ++it) {
+		if (it->path == dev_path && it->dev) {
+			break;
+		}
+	}
+	if (it != m_nodes.end()) {
+		unsigned int i = 0;
+		for (; i < m_fds.size(); i++) {
+			if (m_fds[i] == nullptr) {
+				break;
+			}
+		}
+		if (i == m_fds.size()) {
+			m_fds.push_back(&(*it));
+		}
+		else {
+			m_fds[i] = &(*it);
+		}
+		ret = SIM_FD_BASE + i;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+int SimSPIBackend::close(int fd)
+{
+	int ret = -EBADF;
+
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+	unsigned int i = fd - SIM_FD_BASE;
+	if (fd >= SIM_FD_BASE && i < m_fds.size() && m_fds[i]) {
+		m_fds[i] = nullptr;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+// Call with m_lock held
+SimSPIBackend::SimNode *SimSPIBackend::getNode(int fd)
+{
+	unsigned int i = fd - SIM_FD_BASE;
+	if (fd >= SIM_FD_BASE && i < m_fds.size()) {
+		return m_fds[i];
+	}
+	return nullptr;
+}
+
+int SimSPIBackend::configure(int fd, uint8_t mode, uint8_t bits_per_word, uint32_t speed_hz)
+{
+	int ret = -EBADF;
+
+	pthread_mutex_lock(&m_lock);
+	m_call_count += 3;
+	SimNode *node = getNode(fd);
+	if (node) {
+		if (mode > 3 || bits_per_word != 8 || speed_hz == 0) {
+			ret = -EINVAL;
+		}
+		else {
+			node->mode = mode;
+			node->speed_hz = speed_hz;
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+int SimSPIBackend::transfer(int fd, SPISegment *segments, unsigned int count, uint32_t speed_hz)
+{
+	pthread_mutex_lock(&m_lock);
+	m_call_count++;
+	SimNode *node = getNode(fd);
+	SimSPIDevice *dev = node ? node->dev : nullptr;
+	if (node && (speed_hz == 0 || speed_hz > node->speed_hz)) {
+		speed_hz = node->speed_hz;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	if (dev == nullptr) {
+		return -EBADF;
+	}
+
+	uint64_t bytes = 0;
+	uint64_t delay_usec = 0;
+
+	dev->lock();
+	dev->m_transactions++;
+	dev->select();
+	for (unsigned int i = 0; i < count; i++) {
+		SPISegment &seg = segments[i];
+		for (uint32_t j = 0; j < seg.length; j++) {
+			uint8_t rx = dev->exchange(seg.tx_buffer ? seg.tx_buffer[j] : 0);
+			if (seg.rx_buffer) {
+				seg.rx_buffer[j] = rx;
+			}
+		}
+		bytes += seg.length;
+		delay_usec += seg.delay_usec;
+
+		if (seg.cs_change && i + 1 < count) {
+			dev->deselect();
+			dev->select();
+		}
+	}
+	dev->deselect();
+	dev->unlock();
+
+	uint64_t usec = m_latency_usec + delay_usec + (bytes * 8 * 1000000 + speed_hz - 1) / speed_hz;
+	if (usec) {
+		struct timespec ts;
+		ts.tv_sec = usec / 1000000;
+		ts.tv_nsec = (usec % 1000000) * 1000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+	}
+
+	return 1;
+}
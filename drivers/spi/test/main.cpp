@@ -0,0 +1,362 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "DriverFramework.hpp"
+#include "SPIDevObj.hpp"
+#include "SimSPIBackend.hpp"
+
+using namespace DriverFramework;
+
+#define TEST_SPI_DEV_PATH	"/dev/spidev-sim0.0"
+#define IMU_WHO_AM_I		0x75
+#define IMU_DATA		0x3b
+#define IMU_DATA_LEN		14
+#define IMU_INTERVAL_USEC	125	// 8 kHz
+#define IMU_DURATION_USEC	1000000
+
+// Samples the data registers of a simulated IMU in one burst per period
+class ImuTestDevice : public SPIDevObj
+{
+public:
+	ImuTestDevice(unsigned int sample_interval) :
+		SPIDevObj("ImuTestDevice", TEST_SPI_DEV_PATH, sample_interval)
+	{}
+
+	virtual ~ImuTestDevice() {}
+
+	int readReg(uint8_t address, uint8_t *out_buffer, int length)
+	{
+		return _readReg(address, out_buffer, length);
+	}
+
+	int writeReg(uint8_t address, uint8_t *in_buffer, int length)
+	{
+		return _writeReg(address, in_buffer, length);
+	}
+
+	int transfer(SPISegment *segments, unsigned int count)
+	{
+		return _transfer(segments, count);
+	}
+
+	unsigned long	m_samples = 0;
+	unsigned long	m_errors = 0;
+
+protected:
+	virtual void _measure()
+	{
+		uint8_t data[IMU_DATA_LEN];
+		if (_readReg(IMU_DATA, data, sizeof(data)) == 0) {
+			++m_samples;
+		}
+		else {
+			++m_errors;
+		}
+	}
+};
+
+// IMU with a hardware FIFO. Each entry holds a sequence number and the
+// time the sample was taken, to check the drained timestamps against.
+#define FIFO_COUNT_REG		0x72
+#define FIFO_DATA_REG		0x74
+#define FIFO_ODR_HZ		8000
+#define FIFO_SAMPLE_SIZE	12
+#define FIFO_DRAIN_USEC		1000
+
+struct FifoSample {
+	uint32_t	seq;
+	uint64_t	time;
+} __attribute__((packed));
+
+class FifoImuModel : public SimSPIDevice
+{
+public:
+	FifoImuModel()
+	{
+		setFifoReg(FIFO_DATA_REG);
+	}
+
+	void run()
+	{
+		m_start = offsetTime();
+		m_seq = 0;
+	}
+
+protected:
+	// Produce the samples due since the last access
+	virtual void select()
+	{
+		if (m_start) {
+			uint64_t period = 1000000 / FIFO_ODR_HZ;
+			uint64_t now = offsetTime();
+			while (m_start + m_seq * period <= now) {
+				FifoSample sample = { m_seq, m_start + m_seq * period };
+				const uint8_t *bytes = (const uint8_t *)&sample;
+				m_fifo.insert(m_fifo.end(), bytes, bytes + sizeof(sample));
+				++m_seq;
+			}
+		}
+		m_regs[FIFO_COUNT_REG] = m_fifo.size() >> 8;
+		m_regs[FIFO_COUNT_REG + 1] = m_fifo.size() & 0xff;
+
+		SimSPIDevice::select();
+	}
+
+private:
+	uint64_t	m_start = 0;
+	uint32_t	m_seq = 0;
+};
+
+class FifoImuDevice : public SPIDevObj
+{
+public:
+	FifoImuDevice() :
+		SPIDevObj("FifoImuDevice", TEST_SPI_DEV_PATH, FIFO_DRAIN_USEC)
+	{
+		m_fifo.count_reg = FIFO_COUNT_REG;
+		m_fifo.count_length = 2;
+		m_fifo.count_big_endian = true;
+		m_fifo.count_mask = 0x0fff;
+		m_fifo.count_in_bytes = true;
+		m_fifo.data_reg = FIFO_DATA_REG;
+		m_fifo.sample_size = FIFO_SAMPLE_SIZE;
+		m_fifo.odr_hz = FIFO_ODR_HZ;
+
+		enableSampleBuffer(FIFO_SAMPLE_SIZE, 256);
+	}
+
+	virtual ~FifoImuDevice() {}
+
+	unsigned long	m_drains = 0;
+
+protected:
+	virtual void _measure()
+	{
+		uint8_t data[32 * FIFO_SAMPLE_SIZE];
+		uint64_t timestamps[32];
+
+		int count = _drainFifo(m_fifo, data, timestamps, 32);
+		if (count > 0) {
+			++m_drains;
+			publishSamples(data, timestamps, count);
+		}
+	}
+
+private:
+	SensorFifoConfig	m_fifo;
+};
+
+static int check(bool cond, const char *what)
+{
+	DF_LOG_INFO("%s: %s", what, cond ? "PASSED" : "FAILED");
+	return cond ? 0 : 1;
+}
+
+static int testTransfers(SimSPIBackend &backend, SimSPIDevice &model)
+{
+	int failures = 0;
+	ImuTestDevice dev(0);
+
+	dev.setBackend(backend);
+	dev.setMode(3);
+	dev.setBusFrequency(10000000);
+	failures += check(dev.start() == 0, "start");
+
+	uint8_t mode = 0;
+	uint32_t speed_hz = 0;
+	backend.getConfig(model, mode, speed_hz);
+	failures += check(mode == 3 && speed_hz == 10000000, "mode and clock");
+
+	uint8_t buf[16];
+	failures += check(dev.readReg(IMU_WHO_AM_I, buf, 1) == 0 && buf[0] == 0x71, "read register");
+
+	uint8_t wr[2] = { 0x12, 0x34 };
+	failures += check(dev.writeReg(0x1a, wr, 2) == 0 &&
+			  model.getReg(0x1a) == 0x12 && model.getReg(0x1b) == 0x34, "write registers");
+
+	// Three register reads, each in its own chip select frame of the
+	// register byte plus one data byte, in one call
+	uint8_t tx[6] = { IMU_WHO_AM_I | SPI_READ_FLAG, 0, 0x1a | SPI_READ_FLAG, 0, 0x1b | SPI_READ_FLAG, 0 };
+	uint8_t rx[6];
+	SPISegment segs[3];
+	for (unsigned int i = 0; i < 3; i++) {
+		segs[i].tx_buffer = &tx[2 * i];
+		segs[i].rx_buffer = &rx[2 * i];
+		segs[i].length = 2;
+		segs[i].cs_change = true;
+		segs[i].delay_usec = 0;
+	}
+	unsigned long calls = dev.getSyscallCount();
+	failures += check(dev.transfer(segs, 3) == 0 && dev.getSyscallCount() == calls + 1 &&
+			  rx[1] == 0x71 && rx[3] == 0x12 && rx[5] == 0x34, "batched transfer");
+
+	// FIFO data port
+	uint8_t fifo[4] = { 1, 2, 3, 4 };
+	model.setFifoReg(0x74);
+	model.pushFifo(fifo, sizeof(fifo));
+	failures += check(dev.readReg(0x74, buf, 4) == 0 && buf[0] == 1 && buf[3] == 4 &&
+			  model.getFifoLength() == 0, "fifo burst");
+
+	dev.stop();
+	return failures;
+}
+
+static int testRate(SimSPIBackend &backend)
+{
+	ImuTestDevice dev(IMU_INTERVAL_USEC);
+
+	dev.setBackend(backend);
+	dev.setBusFrequency(10000000);
+	if (dev.start() < 0) {
+		return check(false, "start imu");
+	}
+
+	usleep(IMU_DURATION_USEC);
+	dev.stop();
+
+	DF_LOG_INFO("imu at %d us interval: %.1f samples/s, %lu overruns",
+		    IMU_INTERVAL_USEC, dev.m_samples * 1000000.0 / IMU_DURATION_USEC,
+		    dev.getMeasureOverruns());
+
+	return check(dev.m_samples > 0 && dev.m_errors == 0, "imu sampling");
+}
+
+static int testFifo(SimSPIBackend &backend)
+{
+	int failures = 0;
+	FifoImuModel model;
+	FifoImuDevice dev;
+
+	backend.attach(TEST_SPI_DEV_PATH, model);
+	dev.setBackend(backend);
+	dev.setBusFrequency(10000000);
+	model.run();
+	if (dev.start() < 0) {
+		backend.detach(model);
+		return check(false, "start fifo imu");
+	}
+
+	FifoSample samples[64];
+	uint64_t timestamps[64];
+	unsigned long received = 0;
+	bool in_order = true;
+	uint32_t next_seq = 0;
+	uint64_t max_error = 0;
+
+	uint64_t end = offsetTime() + IMU_DURATION_USEC;
+	while (offsetTime() < end) {
+		usleep(5000);
+		int count;
+		while ((count = dev.readSamples(samples, timestamps, 64)) > 0) {
+			for (int i = 0; i < count; i++) {
+				in_order = in_order && (samples[i].seq == next_seq);
+				next_seq = samples[i].seq + 1;
+				uint64_t error = (timestamps[i] > samples[i].time) ?
+						 timestamps[i] - samples[i].time :
+						 samples[i].time - timestamps[i];
+				if (error > max_error) {
+					max_error = error;
+				}
+			}
+			received += count;
+		}
+	}
+	dev.stop();
+	backend.detach(model);
+
+	DF_LOG_INFO("fifo imu at %d Hz: %.1f samples/s, %.1f drains/s, %.3f calls/sample, "
+		    "max timestamp error %llu us",
+		    FIFO_ODR_HZ, received * 1000000.0 / IMU_DURATION_USEC,
+		    dev.m_drains * 1000000.0 / IMU_DURATION_USEC,
+		    received ? (double)dev.getSyscallCount() / received : 0.0,
+		    (unsigned long long)max_error);
+
+	failures += check(received > 0 && in_order, "fifo samples in order");
+	failures += check(received && dev.getSyscallCount() < received / 2, "fifo batching");
+	failures += check(max_error < 2000, "fifo timestamps");
+	return failures;
+}
+
+static int testFifoConfig()
+{
+	int failures = 0;
+	SensorFifoConfig config = {};
+	config.count_length = 4;
+	config.sample_size = FIFO_SAMPLE_SIZE;
+	failures += check(SensorFifo::validate(config) < 0, "fifo count length checked");
+
+	// 3 kHz is not a whole number of microseconds per sample. The oldest of
+	// 900 samples is 899 periods (299.667 ms) old; a period truncated to
+	// 333 us would put it 300 us late.
+	uint64_t timestamps[900];
+	config.count_length = 2;
+	config.odr_hz = 3000;
+	SensorFifo::backInterpolate(config, 1000000, 900, 0, timestamps);
+	failures += check(timestamps[0] == 1000000 - 299667 && timestamps[899] == 1000000,
+			  "fifo timestamps do not drift");
+	return failures;
+}
+
+int main()
+{
+	int ret = Framework::initialize();
+	if (ret < 0) {
+		return ret;
+	}
+
+	SimSPIBackend backend;
+	SimSPIDevice model;
+
+	// 15 bytes at 10 MHz plus the call overhead
+	backend.setLatency(10);
+	model.setReg(IMU_WHO_AM_I, 0x71);
+	backend.attach(TEST_SPI_DEV_PATH, model);
+
+	int failures = testTransfers(backend, model);
+	failures += testRate(backend);
+
+	backend.detach(model);
+	failures += testFifo(backend);
+	failures += testFifoConfig();
+
+	Framework::shutdown();
+
+	DF_LOG_INFO("Test %s", failures ? "FAILED" : "PASSED");
+	return failures;
+}
@@ -0,0 +1,73 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Checks that realtime threads stay off the heap. The HRT thread is
+// realtime, and so is any thread inside DevMgr::waitForUpdate(). Once
+// armed, each heap allocation made by a realtime thread is a violation.
+//
+// Framework::initialize() arms the guard when it completes. Allocations
+// are only seen when the global operator new is replaced. Linking
+// df_alloc_guard into a test does that, and it aborts the run on the
+// first violation.
+class AllocGuard
+{
+public:
+	static void arm();
+	static void disarm();
+
+	// Marks the calling thread realtime while in scope. Scopes nest.
+	class RealtimeScope
+	{
+	public:
+		RealtimeScope();
+		~RealtimeScope();
+	};
+
+	static bool inRealtime();
+
+	// Called by the replacement operator new. Returns true if the
+	// allocation is a violation.
+	static bool onAllocate(size_t size);
+
+	static unsigned long getViolations();
+};
+
+};
@@ -0,0 +1,145 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <new>
+#include <utility>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Bump allocator over one block reserved up front. Memory is never given
+// back to the arena; it lives as long as the process.
+class Arena
+{
+public:
+	Arena();
+	~Arena() {}
+
+	// Reserve size bytes. With prefault, every page is touched so later
+	// use cannot page fault. Returns 0 on success.
+	int init(size_t size, bool prefault);
+
+	// Returns nullptr when the arena is exhausted
+	void *alloc(size_t size);
+
+	bool contains(const void *p) const
+	{
+		return (const uint8_t *)p >= m_base && (const uint8_t *)p < m_base + m_size;
+	}
+
+	size_t getSize() const
+	{
+		return m_size;
+	}
+
+	size_t getUsed();
+
+	// The arena of the realtime mode, nullptr otherwise
+	static Arena *framework();
+
+	// Whether p was allocated from the framework arena, which stays valid
+	// after Framework::shutdown() for devices that outlive the framework
+	static bool owns(const void *p);
+
+private:
+	// Disallow copy
+	Arena(const Arena&);
+
+	uint8_t *		m_base;
+	size_t			m_size;
+	size_t			m_used;
+	pthread_mutex_t		m_lock;
+};
+
+// Framework-internal allocation: from the framework arena in realtime
+// mode, from the heap otherwise. Return nullptr when out of memory.
+template <typename T, typename... Args>
+T *dfNew(Args&&... args)
+{
+	Arena *arena = Arena::framework();
+	if (arena) {
+		void *p = arena->alloc(sizeof(T));
+		return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+	}
+	return new (std::nothrow) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void dfDelete(T *p)
+{
+	if (p == nullptr) {
+		return;
+	}
+	if (Arena::owns(p)) {
+		p->~T();
+	}
+	else {
+		delete p;
+	}
+}
+
+// Elements are default constructed. Arena arrays are not destructed, so
+// only use these for types whose destructor does no cleanup.
+template <typename T>
+T *dfNewArray(size_t count)
+{
+	Arena *arena = Arena::framework();
+	if (arena) {
+		void *p = arena->alloc(sizeof(T) * count);
+		if (p == nullptr) {
+			return nullptr;
+		}
+		T *array = (T *)p;
+		for (size_t i = 0; i < count; i++) {
+			new (&array[i]) T();
+		}
+		return array;
+	}
+	return new (std::nothrow) T[count]();
+}
+
+template <typename T>
+void dfDeleteArray(T *p)
+{
+	if (p && !Arena::owns(p)) {
+		delete [] p;
+	}
+}
+
+};
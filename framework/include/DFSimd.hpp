@@ -0,0 +1,181 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#pragma once
+
+// Minimal 4-lane vector abstraction for batch kernels. Uses SSE2 (SSE4.1
+// when enabled) on x86, NEON on ARM and plain arrays otherwise. Integer
+// operations wrap like their scalar int32_t counterparts, so kernels are
+// bit-exact with scalar code.
+
+namespace DriverFramework {
+
+#if defined(__SSE2__)
+#if defined(__SSE4_1__)
+#define DF_SIMD_NAME "sse4.1"
+#else
+#define DF_SIMD_NAME "sse2"
+#endif
+
+typedef __m128i df_i32x4;
+typedef __m128 df_f32x4;
+
+static inline df_i32x4 df_load_i32x4(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void df_store_i32x4(int32_t *p, df_i32x4 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline df_i32x4 df_set1_i32x4(int32_t x) { return _mm_set1_epi32(x); }
+static inline df_i32x4 df_add_i32x4(df_i32x4 a, df_i32x4 b) { return _mm_add_epi32(a, b); }
+static inline df_i32x4 df_sub_i32x4(df_i32x4 a, df_i32x4 b) { return _mm_sub_epi32(a, b); }
+#define df_srai_i32x4(v, n) _mm_srai_epi32((v), (n))
+#define df_slli_i32x4(v, n) _mm_slli_epi32((v), (n))
+
+static inline df_i32x4 df_mullo_i32x4(df_i32x4 a, df_i32x4 b)
+{
+#if defined(__SSE4_1__)
+	return _mm_mullo_epi32(a, b);
+#else
+	// Low halves of the even and odd lane products
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+static inline df_f32x4 df_load_f32x4(const float *p) { return _mm_loadu_ps(p); }
+static inline void df_store_f32x4(float *p, df_f32x4 v) { _mm_storeu_ps(p, v); }
+static inline df_f32x4 df_set1_f32x4(float x) { return _mm_set1_ps(x); }
+static inline df_f32x4 df_add_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_add_ps(a, b); }
+static inline df_f32x4 df_sub_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_sub_ps(a, b); }
+static inline df_f32x4 df_mul_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_mul_ps(a, b); }
+static inline df_f32x4 df_div_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_div_ps(a, b); }
+static inline df_f32x4 df_min_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_min_ps(a, b); }
+static inline df_f32x4 df_max_f32x4(df_f32x4 a, df_f32x4 b) { return _mm_max_ps(a, b); }
+static inline df_f32x4 df_cvt_i32x4_f32x4(df_i32x4 v) { return _mm_cvtepi32_ps(v); }
+// Truncates toward zero
+static inline df_i32x4 df_cvt_f32x4_i32x4(df_f32x4 v) { return _mm_cvttps_epi32(v); }
+// Reinterpret the bits
+static inline df_i32x4 df_as_i32x4(df_f32x4 v) { return _mm_castps_si128(v); }
+static inline df_f32x4 df_as_f32x4(df_i32x4 v) { return _mm_castsi128_ps(v); }
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DF_SIMD_NAME "neon"
+
+typedef int32x4_t df_i32x4;
+typedef float32x4_t df_f32x4;
+
+static inline df_i32x4 df_load_i32x4(const int32_t *p) { return vld1q_s32(p); }
+static inline void df_store_i32x4(int32_t *p, df_i32x4 v) { vst1q_s32(p, v); }
+static inline df_i32x4 df_set1_i32x4(int32_t x) { return vdupq_n_s32(x); }
+static inline df_i32x4 df_add_i32x4(df_i32x4 a, df_i32x4 b) { return vaddq_s32(a, b); }
+static inline df_i32x4 df_sub_i32x4(df_i32x4 a, df_i32x4 b) { return vsubq_s32(a, b); }
+static inline df_i32x4 df_mullo_i32x4(df_i32x4 a, df_i32x4 b) { return vmulq_s32(a, b); }
+#define df_srai_i32x4(v, n) vshrq_n_s32((v), (n))
+#define df_slli_i32x4(v, n) vshlq_n_s32((v), (n))
+
+static inline df_f32x4 df_load_f32x4(const float *p) { return vld1q_f32(p); }
+static inline void df_store_f32x4(float *p, df_f32x4 v) { vst1q_f32(p, v); }
+static inline df_f32x4 df_set1_f32x4(float x) { return vdupq_n_f32(x); }
+static inline df_f32x4 df_add_f32x4(df_f32x4 a, df_f32x4 b) { return vaddq_f32(a, b); }
+static inline df_f32x4 df_sub_f32x4(df_f32x4 a, df_f32x4 b) { return vsubq_f32(a, b); }
+static inline df_f32x4 df_mul_f32x4(df_f32x4 a, df_f32x4 b) { return vmulq_f32(a, b); }
+static inline df_f32x4 df_div_f32x4(df_f32x4 a, df_f32x4 b)
+{
+#if defined(__aarch64__)
+	return vdivq_f32(a, b);
+#else
+	// ARMv7 NEON has no exact divide, only a reciprocal estimate
+	float x[4], y[4];
+	vst1q_f32(x, a);
+	vst1q_f32(y, b);
+	for (int i = 0; i < 4; i++) {
+		x[i] /= y[i];
+	}
+	return vld1q_f32(x);
+#endif
+}
+static inline df_f32x4 df_min_f32x4(df_f32x4 a, df_f32x4 b) { return vminq_f32(a, b); }
+static inline df_f32x4 df_max_f32x4(df_f32x4 a, df_f32x4 b) { return vmaxq_f32(a, b); }
+static inline df_f32x4 df_cvt_i32x4_f32x4(df_i32x4 v) { return vcvtq_f32_s32(v); }
+static inline df_i32x4 df_cvt_f32x4_i32x4(df_f32x4 v) { return vcvtq_s32_f32(v); }
+static inline df_i32x4 df_as_i32x4(df_f32x4 v) { return vreinterpretq_s32_f32(v); }
+static inline df_f32x4 df_as_f32x4(df_i32x4 v) { return vreinterpretq_f32_s32(v); }
+
+#else
+#define DF_SIMD_NAME "scalar"
+
+struct df_i32x4 { int32_t v[4]; };
+struct df_f32x4 { float v[4]; };
+
+#define DF_SIMD_LANES(expr) for (int i = 0; i < 4; i++) { expr; }
+
+static inline df_i32x4 df_load_i32x4(const int32_t *p) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = p[i]); return r; }
+static inline void df_store_i32x4(int32_t *p, df_i32x4 a) { DF_SIMD_LANES(p[i] = a.v[i]); }
+static inline df_i32x4 df_set1_i32x4(int32_t x) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = x); return r; }
+static inline df_i32x4 df_add_i32x4(df_i32x4 a, df_i32x4 b) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = (int32_t)((uint32_t)a.v[i] + (uint32_t)b.v[i])); return r; }
+static inline df_i32x4 df_sub_i32x4(df_i32x4 a, df_i32x4 b) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = (int32_t)((uint32_t)a.v[i] - (uint32_t)b.v[i])); return r; }
+static inline df_i32x4 df_mullo_i32x4(df_i32x4 a, df_i32x4 b) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = (int32_t)((uint32_t)a.v[i] * (uint32_t)b.v[i])); return r; }
+static inline df_i32x4 df_srai_i32x4(df_i32x4 a, int n) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = a.v[i] >> n); return r; }
+static inline df_i32x4 df_slli_i32x4(df_i32x4 a, int n) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = (int32_t)((uint32_t)a.v[i] << n)); return r; }
+
+static inline df_f32x4 df_load_f32x4(const float *p) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = p[i]); return r; }
+static inline void df_store_f32x4(float *p, df_f32x4 a) { DF_SIMD_LANES(p[i] = a.v[i]); }
+static inline df_f32x4 df_set1_f32x4(float x) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = x); return r; }
+static inline df_f32x4 df_add_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = a.v[i] + b.v[i]); return r; }
+static inline df_f32x4 df_sub_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = a.v[i] - b.v[i]); return r; }
+static inline df_f32x4 df_mul_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = a.v[i] * b.v[i]); return r; }
+static inline df_f32x4 df_div_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = a.v[i] / b.v[i]); return r; }
+static inline df_f32x4 df_min_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = (a.v[i] < b.v[i]) ? a.v[i] : b.v[i]); return r; }
+static inline df_f32x4 df_max_f32x4(df_f32x4 a, df_f32x4 b) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]); return r; }
+static inline df_f32x4 df_cvt_i32x4_f32x4(df_i32x4 a) { df_f32x4 r; DF_SIMD_LANES(r.v[i] = (float)a.v[i]); return r; }
+static inline df_i32x4 df_cvt_f32x4_i32x4(df_f32x4 a) { df_i32x4 r; DF_SIMD_LANES(r.v[i] = (int32_t)a.v[i]); return r; }
+static inline df_i32x4 df_as_i32x4(df_f32x4 a) { df_i32x4 r; memcpy(r.v, a.v, sizeof(r.v)); return r; }
+static inline df_f32x4 df_as_f32x4(df_i32x4 a) { df_f32x4 r; memcpy(r.v, a.v, sizeof(r.v)); return r; }
+
+#undef DF_SIMD_LANES
+#endif
+
+};
@@ -0,0 +1,173 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "DevServer.hpp"
+
+#pragma once
+
+#define DEV_CLIENT_MAX_BATCH	64	// requests per submit()
+
+namespace DriverFramework {
+
+/**
+ * Samples of a device streamed by a DevServer through shared memory.
+ * Each stream has a single reader.
+ */
+class DevStream
+{
+public:
+	DevStream();
+	~DevStream();
+
+	bool isValid()
+	{
+		return m_ring != nullptr;
+	}
+
+	unsigned int getSampleSize()
+	{
+		return m_ring ? m_ring->sample_size : 0;
+	}
+
+	// Take up to max_samples published since the last read, oldest first.
+	// timestamps may be nullptr. Returns the number of samples, or -1 if
+	// the stream is not open.
+	int read(void *out, uint64_t *timestamps, unsigned int max_samples);
+
+	// Wait up to timeout_ms for samples to read. Returns 1 if there are,
+	// 0 on timeout, or -EPIPE once the server closed the stream and every
+	// sample was read.
+	int wait(unsigned int timeout_ms);
+
+	// Samples overwritten before they were read
+	unsigned long getLost()
+	{
+		return m_lost;
+	}
+
+	void close();
+
+private:
+	friend class DevClient;
+
+	// Disallow copy
+	DevStream(const DevStream&);
+
+	int attach(int fd);
+
+	DevStreamRing *	m_ring;
+	size_t		m_map_size;
+	uint64_t	m_pos;		// next sample to read
+	unsigned long	m_lost;
+};
+
+/**
+ * Client of a DevServer, for one thread.
+ *
+ * The single request calls send a request and wait for its reply. To
+ * save round trips, requests can instead be queued and sent together by
+ * submit(), which stores each result and fills the read buffers when the
+ * replies arrive.
+ */
+class DevClient
+{
+public:
+	DevClient();
+	~DevClient();
+
+	// Returns 0 or -errno
+	int connect(const char *socket_path);
+	void disconnect();
+
+	bool isConnected()
+	{
+		return m_fd >= 0;
+	}
+
+	// Return the handle, or the result of the request, or -errno
+	int open(const char *dev_path);
+	int close(int handle);
+	ssize_t read(int handle, void *buf, size_t len);
+	ssize_t write(int handle, const void *buf, size_t len);
+
+	// arg is a buffer of len bytes, copied back with the result. len is
+	// at least the size the device declares for cmd, else -EINVAL.
+	// Commands the device does not declare fail with -ENOTTY.
+	int ioctl(int handle, unsigned long cmd, void *arg, size_t len);
+
+	// Stream the device's published samples through a ring of capacity
+	// samples, rounded up to a power of 2. No requests may be queued.
+	int openStream(int handle, unsigned int capacity, DevStream &stream);
+
+	// Queue a request. Returns 0, or -ENOSPC if it does not fit in the
+	// batch, which is then left to submit().
+	int queueOpen(const char *dev_path, int *result);
+	int queueClose(int handle, int *result);
+	int queueRead(int handle, void *buf, size_t len, int *result);
+	int queueWrite(int handle, const void *buf, size_t len, int *result);
+	int queueIoctl(int handle, unsigned long cmd, void *arg, size_t len, int *result);
+
+	// Send the queued requests and wait for their results. Returns 0, or
+	// -errno if the server could not be reached, which disconnects.
+	int submit();
+
+private:
+	struct Pending
+	{
+		int *	result;
+		void *	out;		// reply data goes here
+		size_t	out_len;
+	};
+
+	// Disallow copy
+	DevClient(const DevClient&);
+
+	int queue(uint8_t op, int handle, uint64_t arg, const void *data, size_t len,
+		  int *result, void *out, size_t out_len);
+
+	int		m_fd;
+	uint8_t *	m_request;
+	uint8_t *	m_reply;
+	size_t		m_request_len;
+	size_t		m_reply_len;	// most the replies of the queued requests take
+	Pending		m_pending[DEV_CLIENT_MAX_BATCH];
+	unsigned int	m_num_pending;
+	int		m_received_fd;	// passed with the last replies, -1 if none
+};
+
+};
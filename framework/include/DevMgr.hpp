@@ -35,12 +35,18 @@
 *************************************************************************/
 #include <stdint.h>
 #include <time.h>
-#include <list>
 
 #pragma once
 
 #define NO_VERIFY 1 // Use fast method to get Driver Obj by Handle
 
+// Most handles an UpdateList can hold
+#define UPDATE_LIST_MAX 16
+
+// Most registered devices, and most dependencies between derived devices
+#define DEV_MGR_MAX_DRIVERS		64
+#define DEV_MGR_MAX_DEPENDENCIES	64
+
 namespace DriverFramework {
 
 // Forward class declarations
@@ -52,7 +58,8 @@ class DevHandle
 public:
 	DevHandle() :
 		m_handle(nullptr),
-		m_errno(0)
+		m_errno(0),
+		m_next(nullptr)
 	{
 	}
 
@@ -74,15 +81,76 @@ public:
 
 private:
 	friend DevMgr;
+	friend DevObj;
 
 	// Disallow copy
 	DevHandle(const DevHandle&);
 
-	void *	m_handle;
-	int 	m_errno;
+	void *		m_handle;
+	int 		m_errno;
+	DevHandle *	m_next;		// in the handle list of the DevObj
 };
 
-typedef std::list<DevHandle *> UpdateList;
+// Fixed capacity set of handles for waitForUpdate(). It never allocates,
+// so waiting and notifying stay off the heap.
+class UpdateList
+{
+public:
+	typedef DevHandle **iterator;
+
+	UpdateList() :
+		m_count(0)
+	{}
+
+	// Returns false if the list is full
+	bool push_back(DevHandle *h)
+	{
+		if (m_count >= UPDATE_LIST_MAX) {
+			return false;
+		}
+		m_handles[m_count++] = h;
+		return true;
+	}
+
+	bool contains(const DevHandle *h) const
+	{
+		for (unsigned int i = 0; i < m_count; i++) {
+			if (m_handles[i] == h) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	iterator begin()
+	{
+		return m_handles;
+	}
+
+	iterator end()
+	{
+		return m_handles + m_count;
+	}
+
+	unsigned int size() const
+	{
+		return m_count;
+	}
+
+	bool empty() const
+	{
+		return m_count == 0;
+	}
+
+	void clear()
+	{
+		m_count = 0;
+	}
+
+private:
+	DevHandle *	m_handles[UPDATE_LIST_MAX];
+	unsigned int	m_count;
+};
 
 
 
@@ -117,7 +185,18 @@ public:
 	// Called by DevObj to notify threads waiting on an update
 	static void updateNotify(DevObj &obj);
 
-	// Similar to poll
+	// Run the _measure() of downstream, in the context of the notifying
+	// thread, whenever upstream calls updateNotify(). Dependent devices
+	// run in topological order within the same update.
+	// Returns -EINVAL if the dependency would create a cycle, -ENOSPC if
+	// there are DEV_MGR_MAX_DEPENDENCIES already.
+	static int addDependency(DevObj &upstream, DevObj &downstream);
+	static void removeDependency(DevObj &upstream, DevObj &downstream);
+
+	// Remove all dependencies to and from obj
+	static void removeDependencies(DevObj &obj);
+
+	// Similar to poll. Handles of updated devices are added to out_set.
 	static int waitForUpdate(UpdateList &in_set, UpdateList &out_set, unsigned int timeout_ms);
 
 	static void setDevHandleError(DevHandle &h, int error);
@@ -126,6 +205,10 @@ private:
 
 	static DevObj *_getDevObjByHandle(DevHandle &handle);
 
+	static void propagateUpdate(DevObj &obj);
+	static void rankDependencies(void);
+	static bool lowerRank(DevObj *a, DevObj *b);
+
 	DevMgr();
 	~DevMgr();
 
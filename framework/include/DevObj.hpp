@@ -37,11 +37,16 @@
 #include <string>
 #include "DriverFramework.hpp"
 #include "DevMgr.hpp"
+#include "SampleBuffer.hpp"
+#include "SampleCodec.hpp"
 
 #pragma once
 
 #define DRIVER_MAX_INSTANCES 5
 
+// Longest device instance path, including the terminating null
+#define DEV_PATH_MAX 64
+
 namespace DriverFramework {
 
 // Re-use Device ID types from PX4
@@ -78,6 +83,10 @@ public:
 
 	virtual int start(void);
 
+	// Derived devices call DevObj::stop() before tearing down their own
+	// state. It closes the handles of DevServer clients and removes the
+	// device from the Recorder, so neither calls into it afterwards. Stop
+	// a device before destroying it.
 	virtual int stop(void);
 
 	void setSampleInterval(unsigned int sample_interval);
@@ -101,15 +110,23 @@ public:
 
         virtual int devIOCTL(unsigned long request, void *arg);
 
+	// Bytes of the argument of request, for callers in other processes
+	// (see DevServer): 0 if it takes none, -1 if it is not served to
+	// them. The default serves no request.
+	virtual int devIOCTLArgSize(unsigned long request);
+
         virtual ssize_t devRead(void *buf, size_t count);
 
         virtual ssize_t devWrite(void *buf, size_t count);
 
+	// Wake waiting threads and run derived devices (see VirtDevObj::addUpstream).
+	// Derived devices may read from this device, so do not hold a lock
+	// that devRead() takes when calling this.
 	void updateNotify();
 
 	const std::string 	m_name;
 	const std::string 	m_dev_base_path;
-	std::string 		m_dev_instance_path;
+	char	 		m_dev_instance_path[DEV_PATH_MAX];
 	unsigned int 		m_sample_interval;
 	union DeviceId		m_id;
 
@@ -117,6 +134,73 @@ public:
 
 	WorkHandle 	m_work_handle	= 0;
 
+	// Number of sample periods skipped because a multi-phase measurement
+	// was still in progress
+	unsigned long getMeasureOverruns()
+	{
+		return m_measure_overruns;
+	}
+
+	// Take up to max_samples published samples, oldest first. timestamps
+	// may be nullptr. Returns the number of samples, or -1 if the device
+	// has no sample buffer.
+	int readSamples(void *out, uint64_t *timestamps, unsigned int max_samples);
+
+	// Like readSamples(), but leaves the samples for other readers. seq
+	// is the reader's position in the stream, start with 0.
+	int peekSamples(uint64_t &seq, void *out, uint64_t *timestamps, unsigned int max_samples);
+
+	// Size of a published sample, 0 if the device has no sample buffer
+	unsigned int getSampleSize()
+	{
+		return m_sample_buffer ? m_sample_buffer->m_sample_size : 0;
+	}
+
+	// Fields of a published sample, nullptr if not described
+	const SampleField *getSampleLayout(unsigned int &num_fields)
+	{
+		num_fields = m_sample_layout_size;
+		return m_sample_layout;
+	}
+
+protected:
+	// Keep published samples in a buffer of capacity samples of
+	// sample_size bytes. Call before start().
+	int enableSampleBuffer(unsigned int sample_size, unsigned int capacity);
+
+	// Describe the fields of a published sample, so recordings of the
+	// device compress well. fields must outlive the device.
+	void setSampleLayout(const SampleField *fields, unsigned int num_fields)
+	{
+		m_sample_layout = fields;
+		m_sample_layout_size = num_fields;
+	}
+
+	// Queue a batch of samples, oldest first, and notify readers once.
+	// The samples are also recorded while the Recorder runs, and written
+	// to the rings of DevServer streams.
+	int publishSamples(const void *samples, const uint64_t *timestamps, unsigned int count);
+
+	// Multi-phase measurement. A driver that has to wait, e.g. between
+	// starting a conversion and reading the result, calls resumeMeasureIn()
+	// from _measure() and returns. _measure() is called again after
+	// delay_usec with measurePhase() incremented, and the HRT thread is
+	// free to run other work meanwhile. The phase is 0 at each new sample
+	// period; a period that starts while a measurement is still in
+	// progress is skipped.
+	void resumeMeasureIn(uint32_t delay_usec);
+
+	// Like resumeMeasureIn(), but the next phase starts when
+	// resumeMeasure() is called, e.g. from an I/O completion callback.
+	// resumeMeasure() may be called from any thread.
+	void suspendMeasure();
+	void resumeMeasure();
+
+	unsigned int measurePhase()
+	{
+		return m_measure_phase;
+	}
+
 private:
 	int addHandle(DevHandle &h);
 	int removeHandle(DevHandle &h);
@@ -124,13 +208,32 @@ private:
 	friend DevMgr;
 
 	static void measure(void *arg, const WorkHandle wh);
+	static void resume(void *arg, const WorkHandle wh);
+
+	void runMeasure();
 
 	// Disallow copy
 	DevObj(const DevObj&);
 
 	int 			m_driver_instance;	// m_driver_instance = -1 when unregistered
-	std::list<DevHandle *>	m_handles;
-	unsigned 		m_refcount;
+	DevHandle *		m_handles;		// intrusive list through DevHandle::m_next
+	unsigned 		m_refcount;		// number of handles
+	bool			m_detaching;		// stop() is releasing client handles
+
+	// Dataflow state, owned by DevMgr
+	unsigned int		m_rank;			// 0 if not downstream of another device
+	unsigned int		m_downstream_count;
+	unsigned long		m_update_gen;
+
+	// Multi-phase measurement state
+	WorkHandle		m_resume_handle;
+	unsigned int		m_measure_phase;
+	bool			m_resume_requested;
+	unsigned long		m_measure_overruns;
+
+	SampleBuffer *		m_sample_buffer;
+	const SampleField *	m_sample_layout;
+	unsigned int		m_sample_layout_size;
 };
 
 };
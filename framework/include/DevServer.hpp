@@ -0,0 +1,140 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#define DEV_SERVER_MAX_CLIENTS	16
+#define DEV_SERVER_MAX_HANDLES	32		// open handles per client
+#define DEV_SERVER_MAX_STREAMS	32		// streams of all clients
+#define DEV_SERVER_MAX_MESSAGE	(64 * 1024)	// bytes of a batch of requests, or of its replies
+#define DEV_STREAM_MAX_CAPACITY	(64 * 1024)	// samples in a stream ring
+#define DEV_SERVER_MAX_PATH	64		// of a device path, with the terminating null
+
+namespace DriverFramework {
+
+class DevObj;
+
+/*
+  Protocol of the device server. The socket is a SOCK_SEQPACKET Unix
+  domain socket. A client sends a batch of requests as one message and
+  receives the replies, in the same order, as one message. Each request
+  is a DevRequest followed by length bytes, each reply a DevReply
+  followed by length bytes, both padded to a multiple of 8 bytes.
+
+  Results are >= 0 on success, -errno or the device's result otherwise.
+ */
+enum DevRequestOp {
+	DEV_REQ_OPEN = 1,	// the device path. Result: the handle
+	DEV_REQ_CLOSE,
+	DEV_REQ_READ,		// arg: bytes to read. Reply: the bytes read
+	DEV_REQ_WRITE,		// the bytes to write
+	DEV_REQ_IOCTL,		// arg: the command. The argument, of the size the device declares
+				// (DevObj::devIOCTLArgSize), returned in the reply
+	DEV_REQ_STREAM,		// arg: samples in the ring. Result: 0, the ring's fd comes with SCM_RIGHTS
+};
+
+struct DevRequest
+{
+	uint8_t		op;		// DevRequestOp
+	uint8_t		reserved;
+	uint16_t	handle;		// from DEV_REQ_OPEN
+	uint32_t	length;
+	uint64_t	arg;
+};
+
+struct DevReply
+{
+	int32_t		result;
+	uint32_t	length;
+};
+
+/*
+  Shared memory ring of a stream, followed by capacity timestamps and
+  capacity samples. The server writes the samples published by the
+  device: reserve is raised before the slots are overwritten and head
+  after, so a reader knows which of the samples it copied are valid.
+  notify changes with every write, a reader that sets waiters can sleep
+  on it with a futex.
+ */
+struct DevStreamRing
+{
+	char		magic[4];	// "DFSR"
+	uint32_t	sample_size;
+	uint32_t	capacity;	// a power of 2
+	uint32_t	closed;		// the server stopped writing
+	uint64_t	head;		// samples written
+	uint64_t	reserve;	// samples being written
+	uint32_t	notify;
+	uint32_t	waiters;
+	uint8_t		reserved[24];
+};
+
+/**
+ * Exports the registered devices to other processes over a Unix domain
+ * socket. A "df_devserver" thread serves the requests of all clients;
+ * DevClient is the client side.
+ *
+ * Samples of a stream are written into its ring by the thread that
+ * publishes them, and never pass through the socket. Access is controlled
+ * by the permissions of the socket file.
+ */
+class DevServer
+{
+public:
+	// Listen at socket_path, replacing a stale socket. Returns 0 or -errno.
+	static int start(const char *socket_path);
+
+	// Close the clients' handles and streams and remove the socket
+	static void stop(void);
+
+	static bool isRunning(void);
+
+	// A client streams a device
+	static bool isStreaming(void);
+
+private:
+	friend class DevObj;
+
+	// Called by DevObj::publishSamples()
+	static void stream(DevObj &dev, const void *samples, const uint64_t *timestamps, unsigned int count);
+
+	// The device is destroyed, close what refers to it
+	static void removeDevice(DevObj &dev);
+};
+
+};
@@ -33,21 +33,22 @@
 * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
 * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
+#include "Logger.hpp"
 
 #pragma once
 
 // Show backtrace on error
 #define DF_ENABLE_BACKTRACE 1
 
-//-----------------------------------------------------------------------
-// Macros
-//-----------------------------------------------------------------------
+// Realtime mode: HRT thread stack size, and the part of each realtime
+// thread's stack that is touched up front
+#define DF_HRT_STACK_SIZE	(128 * 1024)
+#define DF_STACK_PREFAULT	(64 * 1024)
 
-// Substitute logging implemntation here
-#define DF_LOG_INFO(FMT, ...) printf(FMT "\n", ##__VA_ARGS__)
-#define DF_LOG_ERR(FMT, ...)  printf(FMT "\n", ##__VA_ARGS__)
+// DF_LOG_ERR, DF_LOG_INFO and DF_LOG_DEBUG are defined in Logger.hpp
 
 namespace DriverFramework {
 
@@ -85,6 +86,20 @@ public:
 	// This function must be called before any of the functions below
 	static int initialize(void);
 
+	// Initialize in realtime mode. The framework's internal structures
+	// (work items, device registry, locks, sample buffers) are placed in
+	// an arena of arena_size bytes. The arena and the stacks of the HRT
+	// thread and the caller are pre-faulted, and the process memory is
+	// locked with mlockall(), so the HRT thread neither page faults nor
+	// waits on the allocator.
+	static int initializeRealtime(size_t arena_size);
+
+	static bool isRealtime();
+
+	// Touch bytes of the calling thread's stack so it is resident. Threads
+	// created by drivers call this at startup in realtime mode.
+	static void prefaultStack(size_t bytes);
+
 	// Terminate the driver framework
 	static void shutdown(void);
 
@@ -92,15 +107,46 @@ public:
 	static void waitForShutdown();
 };
 
-// 
+// Result of WorkMgr::planPhases() and the load observed since
+struct WorkPlanStats
+{
+	uint32_t	hyperperiod_usec;		// span over which the phase plan repeats
+	uint32_t	tick_usec;			// planning resolution (also the coalescing slack)
+	unsigned int	num_items;			// periodic work items included in the plan
+	unsigned int	predicted_max_items;		// most items due within a single tick
+	float		predicted_max_utilization;	// worst-case fraction of a tick spent in callbacks
+	unsigned int	measured_max_items;		// most items dispatched by a single wakeup
+	float		measured_max_utilization;	// worst-case fraction of a tick spent in callbacks
+	unsigned long	measured_wakeups;		// wakeups that dispatched at least one item
+};
+
+//
 class WorkMgr
 {
 public:
 	// Interface functions
 	static WorkHandle create(workCallback cb, void *arg, uint32_t delay);
+
+	// If the callback is running on another thread, waits for it to
+	// return, so must not be called with a lock the callback takes
 	static void destroy(WorkHandle &handle);
 	static bool schedule(WorkHandle handle);
 
+	// Schedule to run once after delay_usec instead of the delay given to
+	// create(). Items created with a delay of 0 are not phase planned.
+	static bool scheduleIn(WorkHandle handle, uint32_t delay_usec);
+
+	// Assign phase offsets to all registered periodic work items so their
+	// deadlines are spread over the hyperperiod on a grid of slack_usec.
+	// Items due within half a grid step of each other are dispatched by
+	// a single wakeup.
+	// Returns the number of planned items, or < 0 on error.
+	static int planPhases(uint32_t slack_usec);
+
+	// Get the predicted load of the current plan and the measured load
+	// since it was applied
+	static void getPlanStats(WorkPlanStats &stats);
+
 private:
 	friend class Framework;
 
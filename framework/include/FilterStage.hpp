@@ -0,0 +1,99 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <list>
+#include "VirtDevObj.hpp"
+#include "SampleFilter.hpp"
+
+#pragma once
+
+// Samples taken from the upstream device per pass
+#define FILTER_STAGE_BATCH 32
+
+namespace DriverFramework {
+
+/**
+ * Derived device that filters the sample stream of an upstream device and
+ * publishes the result as its own stream of float[channels] samples, so
+ * every consumer reads filtered data without filtering it again.
+ *
+ * The stage runs in the context of the upstream device each time it
+ * publishes, and follows the upstream stream with peekSamples(), leaving
+ * the raw samples to other readers. Filters run in the order added.
+ */
+class FilterStage : public VirtDevObj
+{
+public:
+	// capacity is the number of filtered samples kept for readers
+	FilterStage(const char *name, const char *dev_base_path, unsigned int channels, unsigned int capacity);
+	virtual ~FilterStage();
+
+	// Filter channels floats taken at the given byte offsets of each
+	// upstream sample, or consecutive floats if offsets is nullptr.
+	// Call before start().
+	int setInput(DevObj &upstream, const size_t *offsets);
+
+	// Append a filter to the chain. The filter must outlive the stage.
+	// Call before start().
+	void addFilter(SampleFilter &filter);
+
+	virtual int start();
+	virtual int stop();
+
+	// Restart all filters from the next sample
+	void reset();
+
+	const unsigned int	m_channels;
+
+protected:
+	virtual void _measure();
+
+private:
+	const unsigned int	m_lanes;
+	const unsigned int	m_capacity;
+	DevObj *		m_upstream;
+	size_t *		m_offsets;
+	std::list<SampleFilter *> m_filters;
+
+	uint64_t		m_seq;		// position in the upstream stream
+	uint8_t *		m_in;
+	uint64_t *		m_timestamps;
+	float *			m_work;
+	float *			m_out;
+	bool			m_reset;	// set by reset() on any thread
+};
+
+};
@@ -0,0 +1,149 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <pthread.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+enum I2CTransferType {
+	I2CTransferType_ReadReg  = 0,
+	I2CTransferType_WriteReg = 1,
+	I2CTransferType_Batch    = 2,
+	I2CTransferType_ReadBlock = 3,
+};
+
+// One register access of a batched transfer. For a write, buffer[0] is
+// reserved for the register number and the data starts at buffer[1], so
+// the segment is sent without an intermediate copy. length never
+// includes the reserved byte.
+struct I2CSegment
+{
+	enum I2CTransferType	type;		// ReadReg or WriteReg
+	uint8_t			reg;
+	uint8_t *		buffer;
+	int			length;
+};
+
+// Access to the I2C buses. I2CDevObj and I2CBus perform all bus I/O
+// through a backend, so drivers can run on a DSPAL target, on Linux, or
+// against simulated devices.
+class I2CBackend
+{
+public:
+	virtual ~I2CBackend() {}
+
+	// Returns a file descriptor for the bus, or -errno
+	virtual int open(const char *bus_path) = 0;
+	virtual int close(int fd) = 0;
+
+	// Select the slave device for subsequent transfers on fd
+	virtual int setSlaveAddress(int fd, uint8_t address) = 0;
+
+	// Write the register number and read length bytes in one combined
+	// transaction. Returns the number of bytes read.
+	virtual int readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length) = 0;
+
+	// buffer[0] holds the register number. Returns the number of bytes written.
+	virtual int write(int fd, const uint8_t *buffer, int length) = 0;
+
+	// Execute a batch of segments. Returns the number of kernel calls
+	// made, or < 0 on failure. The default issues one call per segment.
+	virtual int transfer(int fd, I2CSegment *segments, unsigned int count);
+
+	// SMBus block read: the device sends a byte count followed by up to 32
+	// data bytes. Returns the number of data bytes stored in out_buffer
+	// (at most max_length), or -ENOTSUP if the bus cannot do block reads.
+	virtual int readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length);
+
+	// Backend used by devices that do not select one
+	static I2CBackend &getDefault(void);
+	static void setDefault(I2CBackend &backend);
+};
+
+// Qualcomm DSPAL /dev/i2c-N interface
+class DSPALI2CBackend : public I2CBackend
+{
+public:
+	virtual int open(const char *bus_path);
+	virtual int close(int fd);
+	virtual int setSlaveAddress(int fd, uint8_t address);
+	virtual int readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length);
+	virtual int write(int fd, const uint8_t *buffer, int length);
+
+	static DSPALI2CBackend &instance(void);
+};
+
+#ifdef __linux__
+// Linux i2c-dev interface. Register reads and batches are combined
+// transactions of a single I2C_RDWR ioctl.
+class LinuxI2CBackend : public I2CBackend
+{
+public:
+	LinuxI2CBackend();
+	virtual ~LinuxI2CBackend();
+
+	virtual int open(const char *bus_path);
+	virtual int close(int fd);
+	virtual int setSlaveAddress(int fd, uint8_t address);
+	virtual int readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length);
+	virtual int write(int fd, const uint8_t *buffer, int length);
+	virtual int transfer(int fd, I2CSegment *segments, unsigned int count);
+	virtual int readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length);
+
+	static LinuxI2CBackend &instance(void);
+
+protected:
+	// System calls, overridden to run against a fake device node.
+	// Return >= 0 on success, -errno on failure.
+	virtual int sysOpen(const char *path, int flags);
+	virtual int sysClose(int fd);
+	virtual int sysWrite(int fd, const void *buffer, size_t length);
+	virtual int sysIoctl(int fd, unsigned long request, void *arg);
+
+private:
+	// I2C_RDWR needs the slave address in each message
+	int getSlaveAddress(int fd, uint16_t &address);
+
+	std::map<int, uint16_t>	m_slave_address;
+	pthread_mutex_t		m_lock;
+};
+#endif
+
+};
@@ -0,0 +1,191 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <pthread.h>
+#include "I2CBackend.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+class I2CDevObj;
+class I2CBus;
+struct I2CTransfer;
+
+typedef void (*i2cCompletionCallback)(void *arg, struct I2CTransfer &txn);
+
+// Bus usage of one device
+struct I2CDeviceBusStats
+{
+	unsigned long	transfers;
+	unsigned long	deadline_misses;	// transfers completed after their deadline
+	uint64_t	total_wait_usec;	// time from submit to start of transfer
+	uint64_t	max_wait_usec;
+};
+
+// A register transfer queued on a bus. The memory of the transfer and of
+// its buffer is owned by the caller and must stay valid until the
+// completion callback has been called.
+struct I2CTransfer
+{
+	enum I2CTransferType	type;
+	uint8_t			slave_address;	// 0 to keep the bus default
+	uint8_t			reg;		// register to read from or write to
+	uint8_t *		buffer;
+	int			length;
+
+	// For I2CTransferType_Batch
+	struct I2CSegment *	segments;
+	unsigned int		num_segments;
+
+	// Arbitration: higher priority first, then earliest deadline
+	int			priority;
+	uint32_t		deadline_usec;	// relative to submit, 0 for none
+	struct I2CDeviceBusStats *device_stats;	// optional
+
+	// Set by the bus
+	int			result;		// 0 on success (bytes for ReadBlock), < 0 on failure
+	unsigned int		calls;		// bus calls made
+	bool			queued;
+
+	// Owned by the bus
+	i2cCompletionCallback	completion;
+	void *			arg;
+	uint64_t		submit_time;
+	uint64_t		deadline;
+	struct I2CTransfer *	next;
+};
+
+struct I2CBusStats
+{
+	unsigned int	queue_depth;		// transfers waiting for the bus
+	unsigned int	max_queue_depth;
+	unsigned long	transfers;
+	unsigned long	errors;
+	uint64_t	total_transfer_usec;
+	uint64_t	max_transfer_usec;
+	uint64_t	total_wait_usec;	// time from submit to start of transfer
+	uint64_t	max_wait_usec;
+	float		utilization;		// fraction of time the bus was busy
+};
+
+// One worker thread per bus owns the file descriptor of the bus and
+// executes the transfers of all devices on it. Waiting transfers are
+// ordered by priority, then by deadline. The worker runs at high
+// priority, so a transfer of a low priority thread cannot be held up by
+// medium priority threads while a more urgent transfer waits behind it.
+// Batches of devices with less than the highest priority of the devices
+// attached to the bus run one segment per call, and more urgent transfers
+// go in between.
+// Devices on different buses transfer in parallel.
+class I2CBus
+{
+public:
+	// Get the bus for the device path, starting its worker if needed.
+	// priority is the bus priority of the attaching device, and release()
+	// takes the same value.
+	static I2CBus *acquire(const char *bus_path, I2CBackend &backend, int priority);
+	static void release(I2CBus *bus, int priority);
+
+	// Queue a transfer. completion is called from the bus worker thread.
+	// Returns 0 on success, -EBUSY if txn is already queued.
+	int submit(I2CTransfer &txn, i2cCompletionCallback completion, void *arg);
+
+	// Queue a transfer and wait for it to complete. Returns txn.result.
+	int transferSync(I2CTransfer &txn);
+
+	void getStats(I2CBusStats &stats);
+
+	// Copy stats updated by the worker for a device on this bus
+	void getDeviceStats(const I2CDeviceBusStats &device_stats, I2CDeviceBusStats &stats);
+
+	// Print the stats of all buses
+	static void dumpStats(void);
+
+	const std::string	m_bus_path;
+
+private:
+	I2CBus(const char *bus_path, I2CBackend &backend);
+	~I2CBus();
+
+	int start(void);
+	void stop(void);
+
+	static void *process_trampoline(void *arg);
+	void process(void);
+
+	bool selectSlave(I2CTransfer &txn);
+	void execute(I2CTransfer &txn);
+	void executeBatch(I2CTransfer &txn);
+
+	// Run a dequeued transfer, account for it and complete it. Call with
+	// m_lock held; it is released meanwhile.
+	void dispatch(I2CTransfer &txn);
+
+	// Dequeue the first waiting transfer if it is more urgent than txn
+	I2CTransfer *popOutranking(I2CTransfer &txn);
+
+	static bool outranks(const I2CTransfer &a, const I2CTransfer &b);
+
+	// Disallow copy
+	I2CBus(const I2CBus&);
+
+	I2CBackend &		m_backend;
+	int			m_fd;
+	uint8_t			m_slave_address;
+	unsigned int		m_refcount;
+	pthread_t		m_tid;
+	pthread_mutex_t		m_lock;
+	pthread_cond_t		m_cond;
+	pthread_cond_t		m_done_cond;
+	bool			m_exit_requested;
+	int			m_max_priority;
+	std::list<int>		m_priorities;	// of the attached devices
+
+	I2CTransfer *		m_head;
+
+	I2CBusStats		m_stats;
+	uint64_t		m_busy_usec;
+	uint64_t		m_nested_usec;	// in dispatch() calls within the current one
+	uint64_t		m_start_time;
+
+	static std::list<I2CBus *>	m_buses;
+	static pthread_mutex_t		m_buses_lock;
+};
+
+};
@@ -38,6 +38,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "DevObj.hpp"
+#include "I2CBus.hpp"
+#include "SensorFifo.hpp"
+#include "RegisterShadow.hpp"
 
 #pragma once
 
@@ -59,34 +62,145 @@ public:
 		DevObj(name, dev_base_path, DeviceBusType_I2C, sample_interval)
 	{}
 
-	virtual ~I2CDevObj() {}
+	virtual ~I2CDevObj();
 
 	virtual int start();
 	virtual int stop();
 
+	// Select the bus backend before start(). Defaults to I2CBackend::getDefault().
+	void setBackend(I2CBackend &backend)
+	{
+		m_backend = &backend;
+	}
+
+	// Slave address selected on the bus at start(); 0 leaves the bus default
+	void setSlaveAddress(uint8_t address)
+	{
+		m_id.dev_id_s.address = address;
+	}
+
 	static int readReg(DevHandle &h, uint8_t address, uint8_t *out_buffer, int length);
 	static int writeReg(DevHandle &h, uint8_t address, uint8_t *out_buffer, int length);
 
-protected:
-	int dev_open(int flags)
+	// SMBus block read; returns the number of bytes read or < 0 on failure
+	static int readBlock(DevHandle &h, uint8_t address, uint8_t *out_buffer, int max_length);
+
+	// Execute several register reads and writes, possibly non-contiguous,
+	// with as few kernel calls as the bus interface allows
+	static int transfer(DevHandle &h, I2CSegment *segments, unsigned int count);
+
+	// Bus calls issued by the synchronous transfer functions
+	unsigned long getSyscallCount()
 	{
-		int fd = ::open(m_dev_instance_path.c_str(), flags);
-		if (fd >= 0) {
-			m_fd = fd;
-		}
-		return (fd >= 0) ? 0 : -errno;
+		return m_syscall_count;
 	}
 
-	int dev_close()
+	// Bus arbitration: transfers of higher priority devices go first, then
+	// those with the earliest deadline. The deadline is relative to the
+	// submit time, 0 for none. Set before start().
+	void setBusPriority(int priority)
 	{
-		return ::close(m_fd);
+		m_bus_priority = priority;
 	}
 
-private:
+	void setBusDeadline(uint32_t deadline_usec)
+	{
+		m_bus_deadline = deadline_usec;
+	}
+
+	// Get the stats of the bus this device is on. Returns -1 if not started.
+	int getBusStats(I2CBusStats &stats);
+
+	// Wait times and deadline misses of this device's transfers
+	void getDeviceBusStats(I2CDeviceBusStats &stats);
+
+	// Shadowed registers found changed on the device by _verifyRegs()
+	unsigned long getRegMismatches()
+	{
+		return m_reg_mismatches;
+	}
+
+protected:
+	// Queue a transfer on the bus worker. The calling thread does not
+	// block on bus I/O; completion is called from the bus worker thread.
+	int submit(I2CTransfer &txn, i2cCompletionCallback completion, void *arg);
+
+	// Queue a transfer from _measure() and continue with the next
+	// measurement phase once it completes (see DevObj::resumeMeasureIn()).
+	// txn.result holds the outcome in the next phase.
+	int submitAndResume(I2CTransfer &txn);
+
+	// Synchronous transfers. The calling thread waits while the bus
+	// executes them in arbitration order.
 	int _readReg(uint8_t address, uint8_t *out_buffer, int length);
 	int _writeReg(uint8_t address, uint8_t *out_buffer, int length);
+	int _transfer(I2CSegment *segments, unsigned int count);
+	int _readBlock(uint8_t address, uint8_t *out_buffer, int max_length);
+
+	// Execute txn with this device's slave address and arbitration
+	// settings and wait for it
+	int transferSync(I2CTransfer &txn);
+
+	// Drain a sensor hardware FIFO: read the fill level, then up to
+	// max_samples complete samples in one burst. Timestamps are
+	// back-interpolated from the time of the fill level read at the
+	// configured ODR. Returns the number of samples read, or < 0 on
+	// failure.
+	int _drainFifo(const SensorFifoConfig &config, uint8_t *out_buffer,
+		       uint64_t *timestamps, unsigned int max_samples);
+
+	// Register shadow (see RegisterShadow). Call before start().
+	int enableRegisterShadow();
+	void setStaticRegs(uint8_t address, unsigned int count);
+
+	// Read registers, from the shadow if all are static and known. Staged
+	// writes to the range are flushed first.
+	int _readRegCached(uint8_t address, uint8_t *out_buffer, int length);
+
+	// Stage a register write until the next _flushRegs()
+	int _writeRegCached(uint8_t address, const uint8_t *in_buffer, int length);
+
+	// Write all staged registers, adjacent ones in a single burst
+	int _flushRegs();
+
+	// Read back the static registers and rewrite those that differ from
+	// the shadow, e.g. after the device was reset. Returns the number of
+	// registers that differed, or < 0 on failure.
+	int _verifyRegs();
+
+	// Flush, and verify every setRegVerifyInterval() (e.g. from _measure())
+	int _syncRegs();
+
+	void setRegVerifyInterval(uint32_t interval_usec)
+	{
+		m_reg_verify_interval = interval_usec;
+	}
+
+private:
+	friend I2CBus;
+
+	static int _readReg(I2CBackend &backend, int fd, uint8_t address, uint8_t *out_buffer, int length);
+	static int _writeReg(I2CBackend &backend, int fd, uint8_t address, uint8_t *in_buffer, int length);
+
+	// Returns the number of bus calls made, or < 0 on failure
+	static int _transfer(I2CBackend &backend, int fd, I2CSegment *segments, unsigned int count);
+
+	static void resumeCompletion(void *arg, I2CTransfer &txn);
+
+	// SensorFifoReadReg for _drainFifo()
+	static int fifoReadReg(void *ctx, uint8_t address, uint8_t *out_buffer, int length);
+
+	I2CBackend *m_backend = nullptr;
+	I2CBus *m_bus = nullptr;
+	int m_bus_priority = 0;
+	uint32_t m_bus_deadline = 0;
+	I2CDeviceBusStats m_device_bus_stats = {};
+	unsigned long m_syscall_count = 0;
 
-	int m_fd = 0;
+	RegisterShadow *m_shadow = nullptr;
+	uint32_t m_reg_verify_interval = 0;
+	uint64_t m_reg_verify_time = 0;
+	unsigned long m_reg_mismatches = 0;
 };
 
 };
@@ -0,0 +1,276 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+#pragma once
+
+// Log levels. Messages above DF_LOG_LEVEL are compiled out.
+#define DF_LOG_LEVEL_NONE	0
+#define DF_LOG_LEVEL_ERR	1
+#define DF_LOG_LEVEL_INFO	2
+#define DF_LOG_LEVEL_DEBUG	3
+
+#ifndef DF_LOG_LEVEL
+#define DF_LOG_LEVEL		DF_LOG_LEVEL_INFO
+#endif
+
+#define DF_LOG_MAX_THREADS	16		// threads with a log ring at the same time
+#define DF_LOG_RING_SIZE	16384		// bytes per thread, a power of 2
+#define DF_LOG_MAX_RECORD	256		// longest encoded message
+#define DF_LOG_MAX_STRING	64		// longest string argument kept, with the null
+#define DF_LOG_FLUSH_USEC	10000		// period of the logger thread
+
+// While the Logger runs the message is queued and printed by the logger
+// thread, otherwise it is printed right away
+#define DF_LOG_DEFERRED(FMT, ...) \
+	do { \
+		if (!DriverFramework::Logger::log(FMT "\n", ##__VA_ARGS__)) { \
+			printf(FMT "\n", ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+// Compiled out, but the format is still checked
+#define DF_LOG_NONE(FMT, ...) \
+	do { \
+		if (0) { \
+			printf(FMT "\n", ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+#if DF_LOG_LEVEL >= DF_LOG_LEVEL_ERR
+#define DF_LOG_ERR(FMT, ...)	DF_LOG_DEFERRED(FMT, ##__VA_ARGS__)
+#else
+#define DF_LOG_ERR(FMT, ...)	DF_LOG_NONE(FMT, ##__VA_ARGS__)
+#endif
+
+#if DF_LOG_LEVEL >= DF_LOG_LEVEL_INFO
+#define DF_LOG_INFO(FMT, ...)	DF_LOG_DEFERRED(FMT, ##__VA_ARGS__)
+#else
+#define DF_LOG_INFO(FMT, ...)	DF_LOG_NONE(FMT, ##__VA_ARGS__)
+#endif
+
+#if DF_LOG_LEVEL >= DF_LOG_LEVEL_DEBUG
+#define DF_LOG_DEBUG(FMT, ...)	DF_LOG_DEFERRED(FMT, ##__VA_ARGS__)
+#else
+#define DF_LOG_DEBUG(FMT, ...)	DF_LOG_NONE(FMT, ##__VA_ARGS__)
+#endif
+
+namespace DriverFramework {
+
+// Argument types of an encoded message
+enum LogArgType {
+	LOG_ARG_INT = 1,
+	LOG_ARG_UINT,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STRING,
+};
+
+struct LogRecordHeader
+{
+	uint16_t	size;		// of the record, including this header
+	uint16_t	nargs;
+	const char *	fmt;		// a string literal, so it identifies the message
+	uint64_t	seq;		// orders messages across threads
+};
+
+// A message encoded as its format string and raw arguments. The
+// arguments are formatted later by the logger thread.
+class LogRecord
+{
+public:
+	LogRecord(const char *fmt, uint64_t seq) :
+		m_size(sizeof(LogRecordHeader)),
+		m_nargs(0)
+	{
+		LogRecordHeader *hdr = header();
+		hdr->fmt = fmt;
+		hdr->seq = seq;
+	}
+
+	void add() {}
+
+	template <typename T, typename... Rest>
+	void add(T arg, Rest... rest)
+	{
+		put(arg);
+		add(rest...);
+	}
+
+	// Fill in the header, returns the record size
+	unsigned int finish()
+	{
+		header()->size = m_size;
+		header()->nargs = m_nargs;
+		return m_size;
+	}
+
+	const uint8_t *data() const
+	{
+		return m_data;
+	}
+
+private:
+	LogRecordHeader *header()
+	{
+		return reinterpret_cast<LogRecordHeader *>(m_data);
+	}
+
+	template <typename V>
+	void putValue(LogArgType type, V value)
+	{
+		// Arguments that do not fit are left out
+		if (m_size + 1 + sizeof(value) > sizeof(m_data)) {
+			return;
+		}
+		m_data[m_size] = type;
+		memcpy(&m_data[m_size + 1], &value, sizeof(value));
+		m_size += 1 + sizeof(value);
+		m_nargs++;
+	}
+
+	void put(const char *s)
+	{
+		if (s == nullptr) {
+			s = "(null)";
+		}
+		size_t len = strnlen(s, DF_LOG_MAX_STRING - 1);
+		if (m_size + 2 + len > sizeof(m_data)) {
+			return;
+		}
+		m_data[m_size] = LOG_ARG_STRING;
+		m_data[m_size + 1] = (uint8_t)len;
+		memcpy(&m_data[m_size + 2], s, len);
+		m_size += 2 + len;
+		m_nargs++;
+	}
+
+	void put(char *s)
+	{
+		put((const char *)s);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type put(T v)
+	{
+		putValue(LOG_ARG_INT, (int64_t)v);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type put(T v)
+	{
+		putValue(LOG_ARG_UINT, (uint64_t)v);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_enum<T>::value>::type put(T v)
+	{
+		putValue(LOG_ARG_INT, (int64_t)v);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_floating_point<T>::value>::type put(T v)
+	{
+		putValue(LOG_ARG_DOUBLE, (double)v);
+	}
+
+	template <typename T>
+	void put(T *p)
+	{
+		putValue(LOG_ARG_PTR, (uint64_t)(uintptr_t)p);
+	}
+
+	uint8_t		m_data[DF_LOG_MAX_RECORD];
+	unsigned int	m_size;
+	unsigned int	m_nargs;
+};
+
+// Deferred logger. A thread logging a message copies the format string
+// pointer and the raw arguments into a ring of its own, without locking
+// or allocating. A background thread merges the rings in time order,
+// formats the messages and writes them out. A message that does not fit
+// in its thread's ring is dropped and counted.
+class Logger
+{
+public:
+	// Start the logger thread. Until then messages are printed directly.
+	// Called by Framework::initialize().
+	static int start(void);
+
+	// Print the queued messages and stop the logger thread
+	static void stop(void);
+
+	// Print the messages queued so far
+	static void flush(void);
+
+	static bool isRunning(void)
+	{
+		return __atomic_load_n(&s_running, __ATOMIC_ACQUIRE);
+	}
+
+	// Write messages to out instead of stdout
+	static void setOutput(FILE *out);
+
+	// Messages dropped because a ring was full or no ring was free
+	static unsigned long getDropped(void);
+
+	// Queue a message. Returns false if the logger is not running, the
+	// message is then for the caller to print.
+	template <typename... Args>
+	static bool log(const char *fmt, Args... args)
+	{
+		if (!isRunning()) {
+			return false;
+		}
+		// A counter rather than a clock read, which costs more than
+		// the rest of the call
+		LogRecord rec(fmt, __atomic_fetch_add(&s_seq, 1, __ATOMIC_RELAXED));
+		rec.add(args...);
+		push(rec.data(), rec.finish());
+		return true;
+	}
+
+private:
+	static void push(const uint8_t *rec, unsigned int size);
+
+	static bool s_running;
+	static uint64_t s_seq;
+};
+
+};
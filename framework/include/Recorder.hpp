@@ -0,0 +1,212 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include "SampleCodec.hpp"
+
+#pragma once
+
+#define RECORDER_FORMAT_VERSION	2
+#define RECORDER_BLOCK_SIZE	4096		// O_DIRECT alignment of buffers, writes and file offsets
+#define RECORDER_MAX_DEVICES	32		// devices recorded at the same time
+#define RECORDER_BUFFER_SIZE	(1024 * 1024)	// default bytes per buffer
+#define RECORDER_FLUSH_USEC	100000		// default age at which a partly filled buffer is written
+#define RECORDER_INDEX_ENTRIES	1024		// records listed by a RECORD_INDEX, at most
+
+namespace DriverFramework {
+
+class DevObj;
+
+/*
+  Recording file format. The file is a sequence of records, each starting
+  with a RecordHeader and padded to a multiple of 8 bytes. The first
+  record is a RECORD_FILE. A RECORD_DEVICE assigns a device number before
+  the first sample of a device, and may later assign the number to
+  another device. It is followed by a RECORD_LAYOUT if the device
+  describes its samples. A RECORD_PAD only has valid size and type
+  fields and can be as short as 8 bytes; it keeps O_DIRECT writes block
+  aligned.
+
+  Compressed recordings hold RECORD_BLOCKs instead of RECORD_SAMPLEs.
+  Their header has the seq and timestamp of the first sample, and the
+  samples that follow are consecutive. The block is coded by SampleCodec
+  with the device's layout, or the default layout if there is none.
+
+  Every buffer of a compressed recording ends with a RECORD_INDEX that
+  lists its RECORD_DEVICE, RECORD_LAYOUT, RECORD_BLOCK and RECORD_SAMPLE
+  records, so a reader can find the blocks of a device and time range
+  without reading the others. Its RecordIndexInfo is the last 16 bytes
+  of the record and links to the previous RECORD_INDEX, so the last 16
+  bytes of a complete file lead to all of them. Readers skip record types
+  they do not know.
+ */
+enum RecordType {
+	RECORD_FILE = 1,	// RecordFileInfo
+	RECORD_DEVICE,		// RecordDeviceInfo
+	RECORD_SAMPLE,		// one sample of the device's sample size
+	RECORD_DROP,		// RecordDropInfo, samples lost from seq on
+	RECORD_PAD,		// no payload, skip size bytes
+	RECORD_LAYOUT,		// RecordLayoutInfo and its SampleFields
+	RECORD_BLOCK,		// RecordBlockInfo and the coded samples
+	RECORD_INDEX,		// RecordIndexEntrys, then a RecordIndexInfo
+};
+
+struct RecordHeader
+{
+	uint16_t	size;		// of the record, including this header
+	uint8_t		type;		// RecordType
+	uint8_t		device;		// device number from the RECORD_DEVICE
+	uint32_t	seq;		// low 32 bits of the sample's stream sequence number
+	uint64_t	timestamp;	// offsetTime() of the sample, in usec
+};
+
+struct RecordFileInfo
+{
+	char		magic[8];	// "DFREC"
+	uint32_t	version;	// RECORDER_FORMAT_VERSION
+	uint32_t	block_size;	// alignment of the writes, 0 if not aligned
+	uint64_t	realtime_usec;	// realtime clock at the header's timestamp
+};
+
+struct RecordDeviceInfo
+{
+	uint32_t	dev_id;		// DeviceId::dev_id
+	uint16_t	sample_size;
+	uint16_t	reserved;
+	char		path[64];	// device instance path
+};
+
+struct RecordDropInfo
+{
+	uint32_t	count;
+	uint32_t	reserved;
+};
+
+struct RecordLayoutInfo
+{
+	uint16_t	num_fields;
+	uint16_t	reserved;
+	// followed by num_fields SampleFields
+};
+
+struct RecordBlockInfo
+{
+	uint16_t	count;		// samples in the block
+	uint16_t	length;		// coded bytes that follow
+};
+
+struct RecordIndexEntry
+{
+	uint32_t	offset;		// bytes from the record to the RECORD_INDEX
+	uint8_t		type;		// RecordType
+	uint8_t		device;
+	uint16_t	count;		// samples, up to CODEC_BLOCK_SAMPLES consecutive RECORD_SAMPLEs
+	uint64_t	first_timestamp;
+	uint64_t	last_timestamp;
+};
+
+struct RecordIndexInfo
+{
+	uint32_t	num_entries;
+	uint32_t	prev;		// bytes back to the previous RECORD_INDEX, 0 for the first
+	uint32_t	reserved;
+	char		magic[4];	// "DFIX"
+};
+
+struct RecorderConfig
+{
+	size_t		buffer_size = RECORDER_BUFFER_SIZE;	// a multiple of RECORDER_BLOCK_SIZE
+	unsigned int	buffers = 2;				// at least 2
+	bool		direct_io = true;			// O_DIRECT, if the file system supports it
+	uint64_t	preallocate = 0;			// bytes reserved up front with fallocate()
+	uint32_t	flush_usec = RECORDER_FLUSH_USEC;
+	bool		compress = false;			// write RECORD_BLOCKs and RECORD_INDEXes
+};
+
+struct RecorderStats
+{
+	unsigned long	samples;	// samples recorded
+	unsigned long	dropped;	// samples lost because all buffers were full
+	uint64_t	bytes_written;
+	uint64_t	bytes_raw;	// what the samples take as RECORD_SAMPLEs
+	unsigned long	writes;
+	unsigned long	write_errors;
+	uint32_t	max_write_usec;	// longest single write
+	bool		direct_io;	// the file is written with O_DIRECT
+};
+
+/**
+ * Records every sample published by every device to a file.
+ *
+ * DevObj::publishSamples() serializes the samples into the active one of
+ * a few preallocated buffers. When compressing, samples are first coded
+ * into a block per device, which is copied to the buffer when full. Full
+ * buffers are written by a "df_recorder" thread with pwrite(), and what
+ * is pending is written at least every flush_usec, so publishers never
+ * wait for the disk. When every buffer is waiting to
+ * be written, samples are dropped, counted, and a RECORD_DROP is written
+ * once there is space again.
+ */
+class Recorder
+{
+public:
+	static int start(const char *path, const RecorderConfig &config = RecorderConfig());
+
+	// Write the buffered samples and close the file
+	static void stop(void);
+
+	static bool isRunning(void)
+	{
+		return __atomic_load_n(&s_running, __ATOMIC_ACQUIRE);
+	}
+
+	static void getStats(RecorderStats &stats);
+
+private:
+	friend class DevObj;
+
+	// Called by DevObj::publishSamples(). seq is the stream sequence
+	// number of the first sample.
+	static void record(DevObj &dev, uint64_t seq, const void *samples, const uint64_t *timestamps,
+			   unsigned int count);
+
+	// The device is destroyed, its number may be reused
+	static void removeDevice(DevObj &dev);
+
+	static bool s_running;
+};
+
+};
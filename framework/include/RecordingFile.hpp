@@ -0,0 +1,132 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "Recorder.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+/**
+ * Read only view of a file written by the Recorder, mapped into memory.
+ *
+ * Records are visited by offset:
+ *
+ *	for (size_t off = 0; (hdr = file.at(off)) != nullptr; off += hdr->size)
+ *
+ * at() stops at the end of the file and at the first malformed record, so
+ * a file cut short by a crash reads up to the last complete record.
+ */
+class RecordingFile
+{
+public:
+	RecordingFile();
+	~RecordingFile();
+
+	// Map the file and check its RECORD_FILE. The file is read ahead
+	// unless it is to be read out of order. Returns 0 or -errno.
+	int open(const char *path, bool sequential = true);
+
+	void close();
+
+	// Fault in the whole mapping and lock it in memory, for readers that
+	// must not wait for the disk. Without the privilege or enough
+	// RLIMIT_MEMLOCK the pages are only faulted in, and may be reclaimed
+	// later. Returns 0 or -errno from mlock().
+	int lockInMemory();
+
+	bool isOpen()
+	{
+		return m_data != nullptr;
+	}
+
+	// Record at offset, nullptr at the end of the file or if the record
+	// is not valid
+	const RecordHeader *at(size_t offset) const
+	{
+		if (offset + 8 > m_size) {
+			return nullptr;
+		}
+
+		const RecordHeader *hdr = (const RecordHeader *)&m_data[offset];
+		if (hdr->size < 8 || (hdr->size & 7) || hdr->size > m_size - offset ||
+		    (hdr->type != RECORD_PAD && hdr->size < sizeof(RecordHeader))) {
+			return nullptr;
+		}
+		return hdr;
+	}
+
+	static const void *payload(const RecordHeader *hdr)
+	{
+		return hdr + 1;
+	}
+
+	static size_t payloadSize(const RecordHeader *hdr)
+	{
+		return hdr->size - sizeof(RecordHeader);
+	}
+
+	// Offset of the first RECORD_DEVICE for the device at path, or -1
+	ssize_t findDevice(const char *path) const;
+
+	// Only while the file is open
+	const RecordFileInfo &getInfo() const
+	{
+		return *(const RecordFileInfo *)payload(at(0));
+	}
+
+	size_t getSize() const
+	{
+		return m_size;
+	}
+
+	// The mapped file, only while it is open
+	const uint8_t *getData() const
+	{
+		return m_data;
+	}
+
+private:
+	// Disallow copy
+	RecordingFile(const RecordingFile&);
+
+	const uint8_t *	m_data;
+	size_t		m_size;
+};
+
+};
@@ -0,0 +1,240 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+#include "RecordingFile.hpp"
+#include "SampleCodec.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+// A device found in a recording. A device recorded again under the same
+// path is the same device, unless its samples changed.
+struct RecordingDevice
+{
+	char		path[64];
+	uint32_t	dev_id;
+	unsigned int	sample_size;
+	bool		has_layout;			// from a RECORD_LAYOUT, else the default
+	unsigned int	num_fields;
+	SampleField	fields[CODEC_MAX_FIELDS];
+	unsigned long	samples;
+	uint64_t	first_timestamp;
+	uint64_t	last_timestamp;
+};
+
+// Values of one field of the samples, of the field's type
+struct RecordingColumn
+{
+	SampleField	field;
+	unsigned int	width;		// bytes per value
+	void *		values;
+};
+
+/**
+ * Samples of a device read by RecordingReader::read(), a column per field
+ * of the device's layout.
+ */
+class RecordingColumns
+{
+public:
+	RecordingColumns();
+	~RecordingColumns();
+
+	void clear();
+
+	size_t getCount() const
+	{
+		return m_count;
+	}
+
+	const uint64_t *getTimestamps() const
+	{
+		return m_timestamps;
+	}
+
+	unsigned int getNumColumns() const
+	{
+		return m_num_columns;
+	}
+
+	const RecordingColumn &getColumn(unsigned int i) const
+	{
+		return m_columns[i];
+	}
+
+	// Column of the field at offset in the sample, nullptr if none
+	const RecordingColumn *findColumn(unsigned int offset) const;
+
+private:
+	friend class RecordingReader;
+
+	// Disallow copy
+	RecordingColumns(const RecordingColumns&);
+
+	size_t		m_count;
+	uint64_t *	m_timestamps;
+	unsigned int	m_num_columns;
+	RecordingColumn	m_columns[CODEC_MAX_FIELDS];
+};
+
+struct ReadJob;
+
+/**
+ * Reader of Recorder files for offline analysis.
+ *
+ * open() builds a list of the blocks of every device from the
+ * RECORD_INDEXes of a compressed recording, reading only the end of each
+ * buffer and the device records. Files without an index, and files cut
+ * short, are scanned record by record instead, as the index of the last
+ * buffer may be missing.
+ *
+ * read() selects the blocks of a device that overlap the time range and
+ * decodes them on a number of threads, each taking the next block, into
+ * columns. Other blocks are not read. The threads other than the caller
+ * are started by the first read() that needs them and kept until the
+ * reader is destroyed, so short reads do not pay for creating threads.
+ */
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	// Map the file and load its index. Returns 0 or -errno.
+	int open(const char *path);
+
+	void close();
+
+	// The blocks were found from RECORD_INDEXes, rather than by a scan
+	bool isIndexed() const
+	{
+		return m_indexed;
+	}
+
+	unsigned int getNumDevices() const
+	{
+		return m_devices.size();
+	}
+
+	const RecordingDevice &getDevice(unsigned int i) const
+	{
+		return m_devices[i];
+	}
+
+	// Number of the device recorded at path, or -1
+	int findDevice(const char *path) const;
+
+	// Blocks, and runs of RECORD_SAMPLEs, of all devices
+	size_t getNumBlocks() const
+	{
+		return m_entries.size();
+	}
+
+	// Decode the samples of device with start_usec <= timestamp < end_usec
+	// on threads threads, 0 for one per CPU. Returns the number of
+	// samples, or -errno.
+	ssize_t read(unsigned int device, uint64_t start_usec, uint64_t end_usec, RecordingColumns &columns,
+		     unsigned int threads = 0);
+
+	// Blocks decoded by the last read()
+	size_t getBlocksRead() const
+	{
+		return m_blocks_read;
+	}
+
+private:
+	// A RECORD_BLOCK, or up to CODEC_BLOCK_SAMPLES consecutive RECORD_SAMPLEs
+	struct Entry
+	{
+		size_t		offset;
+		uint8_t		type;
+		uint8_t		number;		// device number in the file
+		uint16_t	count;
+		unsigned int	device;		// in m_devices
+		uint64_t	first_timestamp;
+		uint64_t	last_timestamp;
+	};
+
+	// Disallow copy
+	RecordingReader(const RecordingReader&);
+
+	int loadIndex();
+	void scan();
+
+	// Handle a RECORD_DEVICE or RECORD_LAYOUT, in file order
+	void addDevice(const RecordHeader *hdr);
+	void addLayout(const RecordHeader *hdr);
+
+	// A block or run of samples, in file order. Returns false if it
+	// belongs to no device.
+	bool addEntry(size_t offset, uint8_t type, uint8_t number, unsigned int count,
+		      uint64_t first_timestamp, uint64_t last_timestamp);
+
+	// Decode an entry into samples and timestamps. Returns the number of
+	// samples, or -1 if the records are not valid.
+	int decodeEntry(const Entry &entry, SampleCodec &codec, uint8_t *samples, uint64_t *timestamps) const;
+
+	void readEntries(ReadJob &job) const;
+
+	// Start workers until there are count, as far as possible
+	void startWorkers(unsigned int count);
+	void stopWorkers();
+	static void *workerTrampoline(void *arg);
+	void worker();
+
+	RecordingFile			m_file;
+	std::vector<RecordingDevice>	m_devices;
+	std::vector<Entry>		m_entries;
+	int				m_numbers[256];	// device of each device number while loading, -1 if none
+	bool				m_indexed;
+	size_t				m_blocks_read;
+
+	std::vector<pthread_t>		m_workers;
+	pthread_mutex_t			m_pool_lock;
+	pthread_cond_t			m_work_cond;	// a job was posted, or the workers are stopping
+	pthread_cond_t			m_done_cond;	// a worker left the job
+	ReadJob *			m_job;
+	unsigned int			m_job_slots;	// workers still to join the job
+	unsigned int			m_job_busy;	// workers on the job
+	bool				m_stopping;
+};
+
+};
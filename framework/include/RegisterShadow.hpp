@@ -0,0 +1,99 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Copy of the 256 registers of a device. Registers declared static (e.g.
+// configuration that only the driver changes) are served from the shadow
+// once known. Writes are staged as dirty and flushed in runs, so adjacent
+// registers go out in one burst.
+class RegisterShadow
+{
+public:
+	RegisterShadow();
+
+	// Declare registers whose value only changes when the driver writes them
+	void setStatic(uint8_t reg, unsigned int count);
+
+	// Copy registers to out if all are static and known
+	bool lookup(uint8_t reg, uint8_t *out, unsigned int length);
+
+	// Record values read from the device. Dirty registers keep their
+	// staged value.
+	void fill(uint8_t reg, const uint8_t *in, unsigned int length);
+
+	// Stage values to be written
+	void stage(uint8_t reg, const uint8_t *in, unsigned int length);
+
+	bool isDirty(uint8_t reg, unsigned int length);
+
+	// Find the next run of registers to write, starting at or after
+	// *reg. Runs of dirty registers separated by up to max_gap static,
+	// known registers are merged, as rewriting those costs less than
+	// another transaction. Returns false if nothing is dirty.
+	bool nextDirtyRun(unsigned int &reg, unsigned int &length, unsigned int max_gap, unsigned int max_length);
+
+	// Find the next run of static, known registers at or after reg
+	bool nextStaticRun(unsigned int &reg, unsigned int &length, unsigned int max_length);
+
+	void clean(uint8_t reg, unsigned int length);
+
+	// Current shadow value
+	const uint8_t *values(uint8_t reg)
+	{
+		return &m_value[reg];
+	}
+
+private:
+	enum {
+		REG_VALID	= 1,
+		REG_DIRTY	= 2,
+		REG_STATIC	= 4,
+	};
+
+	bool has(unsigned int reg, uint8_t flags)
+	{
+		return reg < 256 && (m_flags[reg] & flags) == flags;
+	}
+
+	uint8_t		m_value[256];
+	uint8_t		m_flags[256];
+};
+
+};
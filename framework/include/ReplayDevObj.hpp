@@ -0,0 +1,133 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include "VirtDevObj.hpp"
+#include "RecordingFile.hpp"
+
+#pragma once
+
+// Samples published at once, at most
+#define REPLAY_BATCH 256
+
+// Speed for replaying without waiting between samples
+#define REPLAY_AS_FAST_AS_POSSIBLE 0.0f
+
+namespace DriverFramework {
+
+/**
+ * Device that publishes the samples of one device from a Recorder file,
+ * so consumers read recorded data through the usual sample buffer,
+ * updateNotify() and read() paths. Compressed recordings are decoded a
+ * block at a time.
+ *
+ * Samples are published at their recorded spacing, divided by the speed.
+ * The recorded timestamps are published unchanged. At
+ * REPLAY_AS_FAST_AS_POSSIBLE each pass publishes a full batch and the
+ * next pass is scheduled right away, which leaves the HRT thread to
+ * other work in between.
+ */
+class ReplayDevObj : public VirtDevObj
+{
+public:
+	// capacity is the number of samples kept for readers
+	ReplayDevObj(const char *name, const char *dev_base_path, unsigned int capacity);
+	virtual ~ReplayDevObj();
+
+	// Replay the device recorded at device_path, e.g. "/dev/baro0".
+	// The file is locked in memory while open. Call before start().
+	// Returns 0 or -errno.
+	int open(const char *log_path, const char *device_path);
+
+	// 1 for the recorded timing, N for N times faster. Call before start().
+	void setSpeed(float speed);
+
+	// Replay from the first sample. Once started, the device replays
+	// again only after stop().
+	virtual int start();
+	virtual int stop();
+
+	// Reads whole samples, oldest first
+	virtual ssize_t devRead(void *buf, size_t count);
+
+	// All samples were published
+	bool isFinished()
+	{
+		return __atomic_load_n(&m_finished, __ATOMIC_ACQUIRE);
+	}
+
+	unsigned long getPublished()
+	{
+		return __atomic_load_n(&m_published, __ATOMIC_RELAXED);
+	}
+
+protected:
+	virtual void _measure();
+
+private:
+	// The next sample of the device, decoding blocks on the way. Returns
+	// false at the end of the recording.
+	bool nextSample(const uint8_t *&sample, uint64_t &timestamp);
+
+	// Move past the sample returned by nextSample()
+	void consumeSample();
+
+	const unsigned int	m_capacity;
+	RecordingFile		m_file;
+	char			m_device_path[DEV_PATH_MAX];
+	unsigned int		m_sample_size;
+	float			m_speed;
+
+	size_t			m_begin;	// the device's first RECORD_DEVICE
+	size_t			m_offset;	// next record to look at
+	int			m_number;	// device number in the file, -1 while unassigned
+	uint64_t		m_first_timestamp;
+	uint64_t		m_start_time;
+
+	SampleCodec		m_codec;
+	uint8_t *		m_block;	// decoded samples of a RECORD_BLOCK
+	uint64_t *		m_block_timestamps;
+	unsigned int		m_block_count;
+	unsigned int		m_block_pos;
+
+	uint8_t *		m_batch;
+	uint64_t *		m_timestamps;
+	unsigned long		m_published;
+	bool			m_finished;
+	bool			m_started;
+};
+
+};
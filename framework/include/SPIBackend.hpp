@@ -0,0 +1,102 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Set in the register byte to read from a device
+#define SPI_READ_FLAG 0x80
+
+// One segment of a full-duplex SPI transfer. The chip select stays
+// asserted across the segments of a transfer unless cs_change is set.
+struct SPISegment
+{
+	const uint8_t *	tx_buffer;	// nullptr clocks out zeros
+	uint8_t *	rx_buffer;	// nullptr discards the received bytes
+	uint32_t	length;
+	bool		cs_change;	// deselect the device after this segment
+	uint16_t	delay_usec;	// delay after this segment
+};
+
+// Access to the SPI buses. Each file descriptor addresses one device
+// (chip select) on a bus.
+class SPIBackend
+{
+public:
+	virtual ~SPIBackend() {}
+
+	// Returns a file descriptor for the device, or -errno
+	virtual int open(const char *dev_path) = 0;
+	virtual int close(int fd) = 0;
+
+	// Set the SPI mode (0-3), word size and maximum clock of the device
+	virtual int configure(int fd, uint8_t mode, uint8_t bits_per_word, uint32_t speed_hz) = 0;
+
+	// Execute the segments as one transaction, clocked at speed_hz.
+	// Returns the number of kernel calls made, or -errno on failure.
+	virtual int transfer(int fd, SPISegment *segments, unsigned int count, uint32_t speed_hz) = 0;
+
+	// Backend used by devices that do not select one, or nullptr if the
+	// platform has no SPI backend
+	static SPIBackend *getDefault(void);
+	static void setDefault(SPIBackend &backend);
+};
+
+#ifdef __linux__
+// Linux spidev interface. A transfer is a single SPI_IOC_MESSAGE ioctl.
+class LinuxSPIBackend : public SPIBackend
+{
+public:
+	virtual int open(const char *dev_path);
+	virtual int close(int fd);
+	virtual int configure(int fd, uint8_t mode, uint8_t bits_per_word, uint32_t speed_hz);
+	virtual int transfer(int fd, SPISegment *segments, unsigned int count, uint32_t speed_hz);
+
+	static LinuxSPIBackend &instance(void);
+
+protected:
+	// System calls, overridden to run against a fake device node.
+	// Return >= 0 on success, -errno on failure.
+	virtual int sysOpen(const char *path, int flags);
+	virtual int sysClose(int fd);
+	virtual int sysIoctl(int fd, unsigned long request, void *arg);
+};
+#endif
+
+};
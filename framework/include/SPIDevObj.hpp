@@ -0,0 +1,111 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <string>
+#include "DevObj.hpp"
+#include "SPIBackend.hpp"
+#include "SensorFifo.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+class SPIDevObj : public DevObj
+{
+public:
+	SPIDevObj(const char *name, const char *dev_base_path, unsigned int sample_interval) :
+		DevObj(name, dev_base_path, DeviceBusType_SPI, sample_interval)
+	{}
+
+	virtual ~SPIDevObj() {}
+
+	virtual int start();
+	virtual int stop();
+
+	// Select the bus backend before start(). Defaults to SPIBackend::getDefault().
+	void setBackend(SPIBackend &backend)
+	{
+		m_backend = &backend;
+	}
+
+	// SPI mode (0-3) and clock of the device, applied at start()
+	void setMode(uint8_t mode)
+	{
+		m_mode = mode;
+	}
+
+	void setBusFrequency(uint32_t speed_hz)
+	{
+		m_speed_hz = speed_hz;
+	}
+
+	// Register burst read and write, each in a single transaction
+	static int readReg(DevHandle &h, uint8_t address, uint8_t *out_buffer, int length);
+	static int writeReg(DevHandle &h, uint8_t address, uint8_t *in_buffer, int length);
+
+	// Execute the segments as one transaction with one kernel call
+	static int transfer(DevHandle &h, SPISegment *segments, unsigned int count);
+
+	// Bus calls issued by the transfer functions
+	unsigned long getSyscallCount()
+	{
+		return m_syscall_count;
+	}
+
+protected:
+	int _readReg(uint8_t address, uint8_t *out_buffer, int length);
+	int _writeReg(uint8_t address, uint8_t *in_buffer, int length);
+	int _transfer(SPISegment *segments, unsigned int count);
+
+	// Drain a sensor hardware FIFO: read the fill level, then up to
+	// max_samples complete samples in one burst. Timestamps are
+	// back-interpolated from the time of the fill level read at the
+	// configured ODR. Returns the number of samples read, or < 0 on
+	// failure.
+	int _drainFifo(const SensorFifoConfig &config, uint8_t *out_buffer,
+		       uint64_t *timestamps, unsigned int max_samples);
+
+private:
+	// SensorFifoReadReg for _drainFifo()
+	static int fifoReadReg(void *ctx, uint8_t address, uint8_t *out_buffer, int length);
+
+	SPIBackend *m_backend = nullptr;
+	int m_fd = -1;
+	uint8_t m_mode = 3;
+	uint32_t m_speed_hz = 1000000;
+	unsigned long m_syscall_count = 0;
+};
+
+};
@@ -0,0 +1,98 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <pthread.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Ring buffer of timestamped fixed-size samples. A full buffer drops the
+// oldest samples.
+class SampleBuffer
+{
+public:
+	SampleBuffer(unsigned int sample_size, unsigned int capacity);
+	~SampleBuffer();
+
+	// Append count samples, oldest first, under a single lock. Returns
+	// the sequence number of the first sample.
+	uint64_t push(const void *samples, const uint64_t *timestamps, unsigned int count);
+
+	// Remove up to max_samples, oldest first. timestamps may be nullptr.
+	// Returns the number of samples copied to out.
+	unsigned int pop(void *out, uint64_t *timestamps, unsigned int max_samples);
+
+	// Copy up to max_samples from sequence number seq on without removing
+	// them, so several readers can follow the stream. seq counts samples
+	// pushed since creation and is advanced past the samples copied.
+	// Samples no longer in the buffer are skipped.
+	unsigned int peek(uint64_t &seq, void *out, uint64_t *timestamps, unsigned int max_samples);
+
+	unsigned int getAvailable();
+
+	// False if the storage could not be allocated
+	bool isValid()
+	{
+		return m_data && m_timestamps;
+	}
+
+	// Samples dropped because the buffer was full
+	unsigned long getOverflows()
+	{
+		return m_overflows;
+	}
+
+	const unsigned int	m_sample_size;
+	const unsigned int	m_capacity;
+
+private:
+	// Disallow copy
+	SampleBuffer(const SampleBuffer&);
+
+	// Copy count samples starting at ring index first, with m_lock held
+	void copyOut(unsigned int first, unsigned int count, uint8_t *out, uint64_t *timestamps);
+
+	uint8_t *		m_data;
+	uint64_t *		m_timestamps;
+	unsigned int		m_head;		// oldest sample
+	unsigned int		m_count;
+	unsigned long		m_overflows;
+	uint64_t		m_pushed;	// sequence number of the next sample
+	pthread_mutex_t		m_lock;
+};
+
+};
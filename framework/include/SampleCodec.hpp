@@ -0,0 +1,169 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#define CODEC_MAX_FIELDS	64	// fields of a sample layout, after expanding the default
+#define CODEC_BLOCK_SAMPLES	256	// samples per block, at most
+#define CODEC_BLOCK_BYTES	4096	// encoded bytes per block, at most
+
+namespace DriverFramework {
+
+// How a field of a sample is coded
+enum SampleFieldType {
+	FIELD_INT8 = 1,		// integers: zigzag varint of the change
+	FIELD_UINT8,
+	FIELD_INT16,
+	FIELD_UINT16,
+	FIELD_INT32,
+	FIELD_UINT32,
+	FIELD_INT64,
+	FIELD_UINT64,
+	FIELD_TIMESTAMP,	// uint64_t: zigzag varint of the change of the change
+	FIELD_FLOAT,		// XOR with the previous value, zero bytes left out
+	FIELD_DOUBLE,
+};
+
+// Part of the recording file format (RECORD_LAYOUT)
+struct SampleField
+{
+	uint16_t	offset;		// in the sample
+	uint8_t		type;		// SampleFieldType
+	uint8_t		reserved;
+};
+
+/**
+ * Streaming codec for a device's samples.
+ *
+ * Samples are coded field by field against the previous sample of the
+ * same block, and sample timestamps as delta-of-delta. A block starts
+ * from zero state, so every block decodes on its own: a reader can seek
+ * to any block, or decode blocks in parallel.
+ *
+ * Without a layout the sample is coded as 32 bit words like floats, and
+ * trailing bytes as FIELD_UINT8. Bytes not covered by a field decode as
+ * zero.
+ */
+class SampleCodec
+{
+public:
+	SampleCodec();
+
+	// Returns 0, or -EINVAL if the layout does not fit the sample or
+	// CODEC_MAX_FIELDS
+	int init(unsigned int sample_size, const SampleField *fields, unsigned int num_fields);
+
+	unsigned int getSampleSize()
+	{
+		return m_sample_size;
+	}
+
+	// The layout set by init(), with the default expanded
+	const SampleField *getFields(unsigned int &num_fields) const
+	{
+		num_fields = m_num_fields;
+		return m_fields;
+	}
+
+	// Bytes of a field of the type, 0 if the type is not known
+	static unsigned int fieldSize(uint8_t type);
+
+	// Most bytes a sample can take, with its timestamp
+	unsigned int maxEncodedSize()
+	{
+		return m_max_encoded;
+	}
+
+	// Start a block in out, of capacity bytes
+	void beginBlock(uint8_t *out, size_t capacity);
+
+	// Append a sample to the block. Returns false, leaving the block as
+	// it was, if it might not fit.
+	bool encode(const void *sample, uint64_t timestamp);
+
+	// Encoded bytes and samples in the block
+	size_t blockSize()
+	{
+		return m_pos - m_out;
+	}
+
+	unsigned int blockCount()
+	{
+		return m_count;
+	}
+
+	uint64_t blockTimestamp()
+	{
+		return m_first_timestamp;
+	}
+
+	// Decode a block of count samples whose first sample is at
+	// first_timestamp. Returns count, or -1 if the block is corrupt.
+	int decode(const uint8_t *in, size_t len, unsigned int count, uint64_t first_timestamp,
+		   void *samples, uint64_t *timestamps);
+
+private:
+	void reset(uint64_t first_timestamp);
+
+	// Decode a sample into out, returns the input after it or nullptr if
+	// it is corrupt. Without checked, the input must hold m_fast_bytes.
+	template <bool checked>
+	const uint8_t *decodeSample(const uint8_t *p, const uint8_t *end, uint8_t *out);
+
+	unsigned int	m_sample_size;
+	unsigned int	m_num_fields;
+	unsigned int	m_max_encoded;
+	unsigned int	m_fast_bytes;	// input that holds any sample, with read ahead
+	bool		m_covered;	// the fields cover every byte of the sample
+	SampleField	m_fields[CODEC_MAX_FIELDS];
+
+	// Per block state: previous value of each field, and the previous
+	// change of the timestamps
+	uint64_t	m_prev[CODEC_MAX_FIELDS];
+	uint64_t	m_prev_delta[CODEC_MAX_FIELDS];
+	uint64_t	m_prev_timestamp;
+	uint64_t	m_prev_timestamp_delta;
+
+	uint8_t *	m_out;
+	uint8_t *	m_pos;
+	uint8_t *	m_end;
+	unsigned int	m_count;
+	uint64_t	m_first_timestamp;
+};
+
+};
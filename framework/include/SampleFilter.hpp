@@ -0,0 +1,170 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+
+#pragma once
+
+#define MEDIAN_FILTER_MAX_WINDOW 9
+
+namespace DriverFramework {
+
+// One step of a FilterStage. Samples are interleaved with lanes floats
+// per sample, the channel count rounded up to a multiple of 4, and the
+// per-channel state is kept in the same layout so each step runs on all
+// channels of a sample at once.
+class SampleFilter
+{
+public:
+	SampleFilter() : m_lanes(0) {}
+	virtual ~SampleFilter() {}
+
+	// Allocate the state for lanes floats per sample. Called by
+	// FilterStage::start().
+	virtual int init(unsigned int lanes) = 0;
+
+	// Start over: the next sample primes the state
+	virtual void reset() = 0;
+
+	// Filter count samples in place. Returns the number of samples kept;
+	// kept samples and their timestamps are moved to the front.
+	virtual unsigned int process(float *samples, uint64_t *timestamps, unsigned int count) = 0;
+
+protected:
+	unsigned int	m_lanes;
+
+private:
+	// Disallow copy
+	SampleFilter(const SampleFilter&);
+};
+
+// Second order IIR section, transposed direct form II. The state is
+// primed for a steady input equal to the first sample.
+class BiquadFilter : public SampleFilter
+{
+public:
+	BiquadFilter();
+	virtual ~BiquadFilter();
+
+	// y = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2) x
+	void setCoefficients(float b0, float b1, float b2, float a1, float a2);
+
+	// Butterworth low pass
+	int setLowPass(float sample_hz, float cutoff_hz);
+
+	virtual int init(unsigned int lanes);
+	virtual void reset();
+	virtual unsigned int process(float *samples, uint64_t *timestamps, unsigned int count);
+
+private:
+	float		m_b0, m_b1, m_b2, m_a1, m_a2;
+	float *		m_z1;
+	float *		m_z2;
+	bool		m_primed;
+};
+
+// FIR filter keeping every decimation-th output. The history is primed
+// with the first sample.
+class FIRFilter : public SampleFilter
+{
+public:
+	FIRFilter(const float *taps, unsigned int num_taps, unsigned int decimation);
+	virtual ~FIRFilter();
+
+	virtual int init(unsigned int lanes);
+	virtual void reset();
+	virtual unsigned int process(float *samples, uint64_t *timestamps, unsigned int count);
+
+private:
+	float *			m_taps;		// reversed, oldest first
+	const unsigned int	m_num_taps;
+	const unsigned int	m_decimation;
+
+	// Each sample is stored twice, num_taps apart, so the newest num_taps
+	// samples are always contiguous
+	float *			m_history;
+	unsigned int		m_pos;
+	unsigned int		m_phase;
+	bool			m_primed;
+};
+
+// Moving median over an odd window of up to MEDIAN_FILTER_MAX_WINDOW
+// samples, computed with a min/max sorting network
+class MedianFilter : public SampleFilter
+{
+public:
+	MedianFilter(unsigned int window);
+	virtual ~MedianFilter();
+
+	virtual int init(unsigned int lanes);
+	virtual void reset();
+	virtual unsigned int process(float *samples, uint64_t *timestamps, unsigned int count);
+
+private:
+	const unsigned int	m_window;
+	float *			m_history;
+	unsigned int		m_pos;
+	bool			m_primed;
+};
+
+// Replaces a value that differs from the last accepted one by more than
+// max_step with the last accepted value. After max_rejects consecutive
+// rejections the new level is accepted, so a real step gets through.
+class OutlierFilter : public SampleFilter
+{
+public:
+	OutlierFilter(float max_step, unsigned int max_rejects);
+	virtual ~OutlierFilter();
+
+	virtual int init(unsigned int lanes);
+	virtual void reset();
+	virtual unsigned int process(float *samples, uint64_t *timestamps, unsigned int count);
+
+	// Values replaced so far
+	unsigned long getRejected()
+	{
+		return m_rejected;
+	}
+
+private:
+	const float		m_max_step;
+	const unsigned int	m_max_rejects;
+	float *			m_last;
+	unsigned int *		m_rejects;
+	unsigned long		m_rejected;
+	bool			m_primed;
+};
+
+};
@@ -0,0 +1,82 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+
+#pragma once
+
+namespace DriverFramework {
+
+// Description of a sensor hardware FIFO, as used by the FIFO drain of
+// I2CDevObj and SPIDevObj
+struct SensorFifoConfig
+{
+	uint8_t		count_reg;		// register holding the fill level
+	uint8_t		count_length;		// 1 or 2 bytes
+	bool		count_big_endian;
+	uint16_t	count_mask;		// valid bits of the fill level
+	bool		count_in_bytes;		// fill level in bytes rather than samples
+	uint8_t		data_reg;		// FIFO data port
+	unsigned int	sample_size;		// bytes per FIFO entry
+	uint32_t	odr_hz;			// output data rate of the sensor
+};
+
+// Register read of the bus backend draining the FIFO
+typedef int (*SensorFifoReadReg)(void *ctx, uint8_t address, uint8_t *out_buffer, int length);
+
+class SensorFifo
+{
+public:
+	// Returns 0 if config can be drained, or -EINVAL
+	static int validate(const SensorFifoConfig &config);
+
+	// Read the fill level, then up to max_samples complete samples in one
+	// burst, both with read_reg. Timestamps are back-interpolated from
+	// the time of the fill level read at the configured ODR. Returns the
+	// number of samples read, or < 0 on failure.
+	static int drain(const SensorFifoConfig &config, SensorFifoReadReg read_reg, void *ctx,
+			 uint8_t *out_buffer, uint64_t *timestamps, unsigned int max_samples);
+
+	// Number of complete samples for the raw count register bytes
+	static unsigned int parseCount(const SensorFifoConfig &config, const uint8_t *count_bytes);
+
+	// Timestamps of the count oldest samples of a FIFO, oldest first. The
+	// newest sample in the FIFO was taken at newest_time, newer_count
+	// samples after the last one timestamped, all one ODR period apart.
+	static void backInterpolate(const SensorFifoConfig &config, uint64_t newest_time,
+				    unsigned int count, unsigned int newer_count, uint64_t *timestamps);
+};
+
+};
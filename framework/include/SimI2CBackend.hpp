@@ -0,0 +1,162 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include "I2CBackend.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+class SimI2CBackend;
+
+// Register map model of an I2C slave device. Reads and writes auto
+// increment the register number, wrapping at 0xff.
+class SimI2CDevice
+{
+public:
+	SimI2CDevice(uint8_t address);
+	virtual ~SimI2CDevice();
+
+	void setReg(uint8_t reg, uint8_t value);
+	void setRegs(uint8_t reg, const uint8_t *values, unsigned int length);
+	uint8_t getReg(uint8_t reg);
+
+	// Scripted values: every read starting at reg takes the next step of
+	// step_length bytes from values, wrapping around after the last step
+	void scriptRegs(uint8_t reg, const uint8_t *values, unsigned int step_length, unsigned int steps);
+
+	const uint8_t	m_address;
+
+	unsigned long	m_read_count = 0;
+	unsigned long	m_write_count = 0;
+
+protected:
+	friend SimI2CBackend;
+
+	// Device behaviour. Models override these to react to accesses, for
+	// instance to start a conversion when a control register is written.
+	// Called with the model locked.
+	virtual void read(uint8_t reg, uint8_t *out_buffer, int length);
+	virtual void write(uint8_t reg, const uint8_t *data, int length);
+
+	uint8_t		m_regs[256];
+
+private:
+	struct Script {
+		uint8_t			reg;
+		unsigned int		step_length;
+		unsigned int		steps;
+		unsigned int		next;
+		std::vector<uint8_t>	values;
+	};
+
+	void lock();
+	void unlock();
+
+	std::list<Script>	m_scripts;
+	pthread_mutex_t		m_lock;
+};
+
+// In-process I2C buses. Each bus path holds device models and serializes
+// transfers, which take a fixed latency plus the time to clock the bytes
+// at the bus rate (9 clocks per byte including ACK).
+class SimI2CBackend : public I2CBackend
+{
+public:
+	SimI2CBackend();
+	virtual ~SimI2CBackend();
+
+	// Put a device model on the bus at bus_path
+	int attach(const char *bus_path, SimI2CDevice &dev);
+	void detach(SimI2CDevice &dev);
+
+	// Default: no latency, 400 kHz. Use a bus rate of 0 for no limit.
+	void setTiming(const char *bus_path, uint32_t latency_usec, uint32_t bus_rate_hz);
+
+	// Execute a batch as one call with one latency, like the Linux
+	// I2C_RDWR ioctl. Disable to model one call per segment. Default on.
+	void setCombinedTransfers(bool enable)
+	{
+		m_combined_transfers = enable;
+	}
+
+	// Calls made to the backend, i.e. the syscalls a real bus would need
+	unsigned long getCallCount()
+	{
+		return m_call_count;
+	}
+
+	virtual int open(const char *bus_path);
+	virtual int close(int fd);
+	virtual int setSlaveAddress(int fd, uint8_t address);
+	virtual int readReg(int fd, uint8_t reg, uint8_t *out_buffer, int length);
+	virtual int write(int fd, const uint8_t *buffer, int length);
+	virtual int transfer(int fd, I2CSegment *segments, unsigned int count);
+
+	// The model answers with the byte count at reg, followed by the data
+	virtual int readBlock(int fd, uint8_t reg, uint8_t *out_buffer, int max_length);
+
+private:
+	struct SimBus {
+		std::string			path;
+		std::list<SimI2CDevice *>	devices;
+		uint32_t			latency_usec;
+		uint32_t			bus_rate_hz;
+		pthread_mutex_t			lock;
+	};
+
+	struct SimFd {
+		SimBus *	bus;
+		uint8_t		address;
+	};
+
+	SimBus *getBus(const char *bus_path);
+	SimBus *getFdBus(int fd, SimI2CDevice *&dev);
+	void occupyBus(SimBus &bus, unsigned int bytes);
+	static int access(SimI2CDevice *dev, I2CSegment &seg);
+
+	std::list<SimBus *>	m_buses;
+	std::vector<SimFd>	m_fds;
+	unsigned long		m_call_count;
+	bool			m_combined_transfers;
+	pthread_mutex_t		m_lock;
+};
+
+};
@@ -0,0 +1,142 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "SPIBackend.hpp"
+
+#pragma once
+
+namespace DriverFramework {
+
+class SimSPIBackend;
+
+// Register map model of an SPI device. The first byte of a transaction
+// selects the register, with bit 7 set for a read; the following bytes
+// read or write consecutive registers. A register can be set up as a
+// FIFO data port, which pops queued bytes instead of incrementing.
+class SimSPIDevice
+{
+public:
+	SimSPIDevice();
+	virtual ~SimSPIDevice();
+
+	void setReg(uint8_t reg, uint8_t value);
+	void setRegs(uint8_t reg, const uint8_t *values, unsigned int length);
+	uint8_t getReg(uint8_t reg);
+
+	// Reads of reg return bytes pushed with pushFifo(), zeros when empty
+	void setFifoReg(uint8_t reg);
+	void pushFifo(const uint8_t *data, unsigned int length);
+	unsigned int getFifoLength();
+
+	unsigned long	m_transactions = 0;
+
+protected:
+	friend SimSPIBackend;
+
+	// Device behaviour; called with the model locked. Models override
+	// these to react to accesses.
+	virtual void select();
+	virtual uint8_t exchange(uint8_t tx);
+	virtual void deselect() {}
+
+	uint8_t			m_regs[128];
+	std::deque<uint8_t>	m_fifo;
+
+private:
+	void lock();
+	void unlock();
+
+	int		m_fifo_reg;
+	bool		m_first;
+	bool		m_read;
+	uint8_t		m_reg;
+	pthread_mutex_t	m_lock;
+};
+
+// In-process SPI devices. A transaction takes a fixed latency plus the
+// time to clock its bytes at the requested speed.
+class SimSPIBackend : public SPIBackend
+{
+public:
+	SimSPIBackend();
+	virtual ~SimSPIBackend();
+
+	// Put a device model at dev_path, e.g. "/dev/spidev0.1"
+	int attach(const char *dev_path, SimSPIDevice &dev);
+	void detach(SimSPIDevice &dev);
+
+	// Fixed cost of each transaction (default 0)
+	void setLatency(uint32_t latency_usec)
+	{
+		m_latency_usec = latency_usec;
+	}
+
+	unsigned long getCallCount()
+	{
+		return m_call_count;
+	}
+
+	// Configuration last applied to dev
+	int getConfig(SimSPIDevice &dev, uint8_t &mode, uint32_t &speed_hz);
+
+	virtual int open(const char *dev_path);
+	virtual int close(int fd);
+	virtual int configure(int fd, uint8_t mode, uint8_t bits_per_word, uint32_t speed_hz);
+	virtual int transfer(int fd, SPISegment *segments, unsigned int count, uint32_t speed_hz);
+
+private:
+	struct SimNode {
+		std::string	path;
+		SimSPIDevice *	dev;
+		uint8_t		mode;
+		uint32_t	speed_hz;
+	};
+
+	SimNode *getNode(int fd);
+
+	std::list<SimNode>	m_nodes;
+	std::vector<SimNode *>	m_fds;
+	uint32_t		m_latency_usec;
+	unsigned long		m_call_count;
+	pthread_mutex_t		m_lock;
+};
+
+};
@@ -36,14 +36,54 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <pthread.h>
 
+// Histogram buckets of SyncObjStats. Bucket 0 counts times below 1 usec,
+// bucket i times in [2^(i-1), 2^i) usec, the last one all longer times.
+#define SYNC_OBJ_HIST_BUCKETS 16
+
 namespace DriverFramework {
 
+// Lock implementation used by a SyncObj
+enum SyncObjType {
+	// pthread mutex and condition variable
+	SYNC_OBJ_DEFAULT = 0,
+
+	// pthread mutex with priority inheritance. A thread holding the lock
+	// runs at the priority of the highest priority thread waiting for it,
+	// so a low priority reader cannot stall the HRT thread behind medium
+	// priority work.
+	SYNC_OBJ_PRIO_INHERIT,
+
+	// Futex lock and event that spin briefly before sleeping, for short
+	// critical sections. No priority inheritance. Falls back to
+	// SYNC_OBJ_DEFAULT where futexes are not available.
+	SYNC_OBJ_FUTEX,
+};
+
+// Contention statistics of a SyncObj, collected when the framework is
+// built with DF_LOCK_STATS (cmake -DDF_LOCK_STATS=ON). Times in nsec.
+struct SyncObjStats
+{
+	const char *	name;
+	unsigned long	acquisitions;
+	unsigned long	contended;			// acquisitions that had to wait
+	uint64_t	wait_total;
+	uint64_t	wait_max;
+	uint64_t	hold_total;
+	uint64_t	hold_max;
+	char		hold_max_thread[16];		// name of the thread that held it longest
+	unsigned long	wait_hist[SYNC_OBJ_HIST_BUCKETS];
+	unsigned long	hold_hist[SYNC_OBJ_HIST_BUCKETS];
+};
+
 class SyncObj
 {
 public:
-	SyncObj();
+	// name identifies the lock in the contention statistics and must
+	// outlive it
+	SyncObj(SyncObjType type = SYNC_OBJ_DEFAULT, const char *name = nullptr);
 	~SyncObj();
 
 	void lock();
@@ -51,13 +91,80 @@ public:
 
 	// Returns 0 on success, ETIMEDOUT on timeout
 	// Use timeout_ms = 0 for blocking wait
+	// The timeout is measured on CLOCK_MONOTONIC, so it is not affected
+	// by changes to the system time.
 	int waitOnSignal(unsigned long timeout_ms);
 
+	// Wake one waiting thread. The caller does not need to hold the lock,
+	// but then a thread that has checked its condition and is about to
+	// wait can miss the signal.
 	void signal(void);
 
+	SyncObjType getType()
+	{
+		return m_type;
+	}
+
+	const char *getName()
+	{
+		return m_name;
+	}
+
+	// Copy the contention statistics. Must not be called with the lock
+	// held. Returns false if DF_LOCK_STATS is disabled.
+	bool getStats(SyncObjStats &stats);
+
+	// Clear the statistics. Must not be called with the lock held.
+	void resetStats();
+
+	// Statistics of up to max live locks, most total wait time first.
+	// Returns the number of entries, 0 if DF_LOCK_STATS is disabled.
+	static unsigned int getAllStats(SyncObjStats *stats, unsigned int max);
+
+	// Log the statistics of all live locks, most total wait time first
+	static void dumpStats(void);
+
 private:
+	// Disallow copy
+	SyncObj(const SyncObj&);
+
+	// The lock without statistics
+	bool rawTryLock();
+	void rawLock();
+	void rawUnlock();
+
+	void futexLockSlow();
+
+#ifdef DF_LOCK_STATS
+	void acquired(bool contended, uint64_t wait);
+	void releasing();
+
+	// Bracket updates of m_stats, with the lock held
+	void statsWriteBegin();
+	void statsWriteEnd();
+
+	// Copy m_stats without taking the lock
+	void snapshotStats(SyncObjStats &stats);
+
+	SyncObjStats	m_stats;		// written with the lock held
+	unsigned int	m_stats_seq;		// odd while m_stats is written
+	uint64_t	m_acquired_at;
+	SyncObj *	m_stats_prev;		// in the list of live locks
+	SyncObj *	m_stats_next;
+#endif
+
+	SyncObjType	m_type;
+	const char *	m_name;
+
 	pthread_mutex_t m_lock;
 	pthread_cond_t	m_new_data_cond;
+
+	// SYNC_OBJ_FUTEX state
+	int		m_futex;		// 0 unlocked, 1 locked, 2 locked with sleepers
+	int		m_spin;			// average spins before acquiring
+	int		m_spin_max;
+	unsigned int	m_event_seq;		// incremented by signal()
+	int		m_event_waiters;
 };
 
 };
@@ -49,6 +49,18 @@ public:
 
 	virtual ~VirtDevObj() {}
 
+	// A derived device with sample_interval 0 needs no timer: its
+	// _measure() runs whenever an upstream device calls updateNotify()
+	int addUpstream(DevObj &upstream)
+	{
+		return DevMgr::addDependency(upstream, *this);
+	}
+
+	void removeUpstream(DevObj &upstream)
+	{
+		DevMgr::removeDependency(upstream, *this);
+	}
+
 protected:
 	virtual void _measure() = 0;
 
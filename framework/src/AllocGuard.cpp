@@ -0,0 +1,82 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <atomic>
+#include "AllocGuard.hpp"
+
+using namespace DriverFramework;
+
+static std::atomic<bool> s_armed(false);
+static std::atomic<unsigned long> s_violations(0);
+static thread_local unsigned int t_realtime_depth = 0;
+
+void AllocGuard::arm()
+{
+	s_armed = true;
+}
+
+void AllocGuard::disarm()
+{
+	s_armed = false;
+}
+
+AllocGuard::RealtimeScope::RealtimeScope()
+{
+	t_realtime_depth++;
+}
+
+AllocGuard::RealtimeScope::~RealtimeScope()
+{
+	t_realtime_depth--;
+}
+
+bool AllocGuard::inRealtime()
+{
+	return t_realtime_depth > 0;
+}
+
+bool AllocGuard::onAllocate(size_t size)
+{
+	if (!s_armed || t_realtime_depth == 0) {
+		return false;
+	}
+	s_violations++;
+	return true;
+}
+
+unsigned long AllocGuard::getViolations()
+{
+	return s_violations;
+}
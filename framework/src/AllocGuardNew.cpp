@@ -0,0 +1,110 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+#include "DriverFramework.hpp"
+#include "AllocGuard.hpp"
+
+#ifdef DF_ENABLE_BACKTRACE
+#include <execinfo.h>
+#endif
+
+// Replacement global allocator for tests. Aborts on the first heap
+// allocation made by a realtime thread after Framework::initialize().
+
+using namespace DriverFramework;
+
+static void *guardedAlloc(size_t size)
+{
+	if (AllocGuard::onAllocate(size)) {
+		// Nothing here may allocate
+		static const char msg[] = "AllocGuard: heap allocation on a realtime thread\n";
+		ssize_t ret = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+		(void)ret;
+#ifdef DF_ENABLE_BACKTRACE
+		void *buffer[16];
+		backtrace_symbols_fd(buffer, ::backtrace(buffer, 16), STDERR_FILENO);
+#endif
+		abort();
+	}
+
+	return malloc(size ? size : 1);
+}
+
+void *operator new(size_t size)
+{
+	void *p = guardedAlloc(size);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return guardedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return guardedAlloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,101 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Arena.hpp"
+
+// Allocations are aligned for any type
+#define ARENA_ALIGN 16
+
+using namespace DriverFramework;
+
+Arena::Arena() :
+	m_base(nullptr),
+	m_size(0),
+	m_used(0)
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+int Arena::init(size_t size, bool prefault)
+{
+	if (m_base) {
+		return -1;
+	}
+
+	m_base = (uint8_t *)malloc(size);
+	if (m_base == nullptr) {
+		return -2;
+	}
+	m_size = size;
+	m_used = 0;
+
+	if (prefault) {
+		long page = sysconf(_SC_PAGESIZE);
+		if (page <= 0) {
+			page = 4096;
+		}
+		for (size_t off = 0; off < size; off += page) {
+			((volatile uint8_t *)m_base)[off] = 0;
+		}
+	}
+	return 0;
+}
+
+void *Arena::alloc(size_t size)
+{
+	void *p = nullptr;
+
+	pthread_mutex_lock(&m_lock);
+	size_t start = (m_used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (start <= m_size && size <= m_size - start) {
+		p = &m_base[start];
+		m_used = start + size;
+		memset(p, 0, size);
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return p;
+}
+
+size_t Arena::getUsed()
+{
+	pthread_mutex_lock(&m_lock);
+	size_t used = m_used;
+	pthread_mutex_unlock(&m_lock);
+	return used;
+}
@@ -0,0 +1,483 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "DevClient.hpp"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+using namespace DriverFramework;
+
+#define MESSAGE_ALIGN(size)	(((size) + 7) & ~(size_t)7)
+
+DevStream::DevStream() :
+	m_ring(nullptr),
+	m_map_size(0),
+	m_pos(0),
+	m_lost(0)
+{}
+
+DevStream::~DevStream()
+{
+	close();
+}
+
+int DevStream::attach(int fd)
+{
+	close();
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(DevStreamRing)) {
+		return -EINVAL;
+	}
+	void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		return -errno;
+	}
+
+	DevStreamRing *ring = (DevStreamRing *)data;
+	uint64_t size = sizeof(DevStreamRing) + (uint64_t)ring->capacity * (sizeof(uint64_t) + ring->sample_size);
+	if (memcmp(ring->magic, "DFSR", 4) != 0 || ring->capacity == 0 ||
+	    (ring->capacity & (ring->capacity - 1)) || size > (uint64_t)st.st_size) {
+		munmap(data, st.st_size);
+		return -EINVAL;
+	}
+
+	m_ring = ring;
+	m_map_size = st.st_size;
+	m_pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	m_lost = 0;
+	return 0;
+}
+
+void DevStream::close()
+{
+	if (m_ring) {
+		munmap(m_ring, m_map_size);
+		m_ring = nullptr;
+	}
+}
+
+int DevStream::read(void *out, uint64_t *timestamps, unsigned int max_samples)
+{
+	if (m_ring == nullptr) {
+		return -1;
+	}
+
+	const uint32_t capacity = m_ring->capacity;
+	const uint32_t sample_size = m_ring->sample_size;
+	const uint64_t *slots_ts = (const uint64_t *)(m_ring + 1);
+	const uint8_t *slots = (const uint8_t *)&slots_ts[capacity];
+	uint8_t *dst = (uint8_t *)out;
+
+	uint64_t head = __atomic_load_n(&m_ring->head, __ATOMIC_ACQUIRE);
+	if (head - m_pos > capacity) {
+		m_lost += head - m_pos - capacity;
+		m_pos = head - capacity;
+	}
+	unsigned int count = (head - m_pos < max_samples) ? head - m_pos : max_samples;
+
+	// In up to two runs, at the end and the start of the ring
+	unsigned int done = 0;
+	while (done < count) {
+		uint32_t slot = (m_pos + done) & (capacity - 1);
+		unsigned int run = (capacity - slot < count - done) ? capacity - slot : count - done;
+		memcpy(&dst[done * sample_size], &slots[slot * sample_size], run * sample_size);
+		if (timestamps) {
+			memcpy(&timestamps[done], &slots_ts[slot], run * sizeof(uint64_t));
+		}
+		done += run;
+	}
+
+	// Samples the server started to overwrite while they were copied
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t reserve = __atomic_load_n(&m_ring->reserve, __ATOMIC_RELAXED);
+	if (reserve > m_pos + capacity) {
+		uint64_t bad = reserve - capacity - m_pos;
+		if (bad > count) {
+			bad = count;
+		}
+		memmove(dst, &dst[bad * sample_size], (count - bad) * sample_size);
+		if (timestamps) {
+			memmove(timestamps, &timestamps[bad], (count - bad) * sizeof(uint64_t));
+		}
+		m_lost += bad;
+		m_pos += bad;
+		count -= bad;
+	}
+
+	m_pos += count;
+	return count;
+}
+
+int DevStream::wait(unsigned int timeout_ms)
+{
+	if (m_ring == nullptr) {
+		return -EPIPE;
+	}
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	for (;;) {
+		uint32_t notify = __atomic_load_n(&m_ring->notify, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&m_ring->waiters, 1, __ATOMIC_SEQ_CST);
+		bool closed = __atomic_load_n(&m_ring->closed, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&m_ring->head, __ATOMIC_SEQ_CST) != m_pos || closed) {
+			__atomic_store_n(&m_ring->waiters, 0, __ATOMIC_RELAXED);
+			return (__atomic_load_n(&m_ring->head, __ATOMIC_ACQUIRE) != m_pos) ? 1 : -EPIPE;
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t left = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+		if (left <= 0) {
+			__atomic_store_n(&m_ring->waiters, 0, __ATOMIC_RELAXED);
+			return 0;
+		}
+
+#ifdef __linux__
+		struct timespec ts;
+		ts.tv_sec = left / 1000000000;
+		ts.tv_nsec = left % 1000000000;
+		syscall(SYS_futex, &m_ring->notify, FUTEX_WAIT, notify, &ts, NULL, 0);
+#else
+		(void)notify;
+		usleep(left < 1000000 ? left / 1000 + 1 : 1000);
+#endif
+	}
+}
+
+DevClient::DevClient() :
+	m_fd(-1),
+	m_request(nullptr),
+	m_reply(nullptr),
+	m_request_len(0),
+	m_reply_len(0),
+	m_num_pending(0),
+	m_received_fd(-1)
+{}
+
+DevClient::~DevClient()
+{
+	disconnect();
+}
+
+int DevClient::connect(const char *socket_path)
+{
+	disconnect();
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int ret = -errno;
+		::close(fd);
+		return ret;
+	}
+
+	m_fd = fd;
+	m_request = new uint8_t[DEV_SERVER_MAX_MESSAGE];
+	m_reply = new uint8_t[DEV_SERVER_MAX_MESSAGE];
+	m_request_len = 0;
+	m_reply_len = 0;
+	m_num_pending = 0;
+	return 0;
+}
+
+void DevClient::disconnect()
+{
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+	if (m_received_fd >= 0) {
+		::close(m_received_fd);
+		m_received_fd = -1;
+	}
+	delete [] m_request;
+	m_request = nullptr;
+	delete [] m_reply;
+	m_reply = nullptr;
+	m_num_pending = 0;
+}
+
+int DevClient::queue(uint8_t op, int handle, uint64_t arg, const void *data, size_t len,
+		     int *result, void *out, size_t out_len)
+{
+	if (m_fd < 0) {
+		return -ENOTCONN;
+	}
+	if (handle < 0 || handle > UINT16_MAX) {
+		return -EBADF;
+	}
+
+	size_t request_len = m_request_len + MESSAGE_ALIGN(sizeof(DevRequest) + len);
+	size_t reply_len = m_reply_len + MESSAGE_ALIGN(sizeof(DevReply) + out_len);
+	if (m_num_pending == DEV_CLIENT_MAX_BATCH || request_len > DEV_SERVER_MAX_MESSAGE ||
+	    reply_len > DEV_SERVER_MAX_MESSAGE) {
+		return -ENOSPC;
+	}
+
+	DevRequest req;
+	req.op = op;
+	req.reserved = 0;
+	req.handle = handle;
+	req.length = len;
+	req.arg = arg;
+	memcpy(&m_request[m_request_len], &req, sizeof(req));
+	if (len) {
+		memcpy(&m_request[m_request_len + sizeof(req)], data, len);
+	}
+
+	Pending &p = m_pending[m_num_pending++];
+	p.result = result;
+	p.out = out;
+	p.out_len = out_len;
+	m_request_len = request_len;
+	m_reply_len = reply_len;
+	return 0;
+}
+
+int DevClient::queueOpen(const char *dev_path, int *result)
+{
+	size_t len = strlen(dev_path);
+	if (len == 0 || len >= DEV_SERVER_MAX_PATH) {
+		return -EINVAL;
+	}
+	return queue(DEV_REQ_OPEN, 0, 0, dev_path, len, result, nullptr, 0);
+}
+
+int DevClient::queueClose(int handle, int *result)
+{
+	return queue(DEV_REQ_CLOSE, handle, 0, nullptr, 0, result, nullptr, 0);
+}
+
+int DevClient::queueRead(int handle, void *buf, size_t len, int *result)
+{
+	return queue(DEV_REQ_READ, handle, len, nullptr, 0, result, buf, len);
+}
+
+int DevClient::queueWrite(int handle, const void *buf, size_t len, int *result)
+{
+	return queue(DEV_REQ_WRITE, handle, 0, buf, len, result, nullptr, 0);
+}
+
+int DevClient::queueIoctl(int handle, unsigned long cmd, void *arg, size_t len, int *result)
+{
+	return queue(DEV_REQ_IOCTL, handle, cmd, arg, len, result, arg, len);
+}
+
+int DevClient::submit()
+{
+	if (m_fd < 0) {
+		return -ENOTCONN;
+	}
+	if (m_num_pending == 0) {
+		return 0;
+	}
+
+	ssize_t ret;
+	do {
+		ret = send(m_fd, m_request, m_request_len, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	struct iovec iov;
+	iov.iov_base = m_reply;
+	iov.iov_len = DEV_SERVER_MAX_MESSAGE;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (ret == (ssize_t)m_request_len) {
+		do {
+			ret = recvmsg(m_fd, &msg, MSG_CMSG_CLOEXEC);
+		} while (ret < 0 && errno == EINTR);
+	}
+	else if (ret >= 0) {
+		errno = EMSGSIZE;
+		ret = -1;
+	}
+	if (ret <= 0) {
+		int err = (ret == 0) ? -ECONNRESET : -errno;
+		disconnect();
+		return err;
+	}
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			if (m_received_fd >= 0) {
+				::close(m_received_fd);
+			}
+			memcpy(&m_received_fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	size_t off = 0;
+	for (unsigned int i = 0; i < m_num_pending; i++) {
+		const Pending &p = m_pending[i];
+		DevReply reply;
+		if (off + sizeof(reply) > (size_t)ret) {
+			reply.result = -EPROTO;
+			reply.length = 0;
+		}
+		else {
+			memcpy(&reply, &m_reply[off], sizeof(reply));
+			if (reply.length > ret - off - sizeof(reply)) {
+				reply.result = -EPROTO;
+				reply.length = 0;
+			}
+		}
+		if (p.out && reply.length) {
+			memcpy(p.out, &m_reply[off + sizeof(reply)], (reply.length < p.out_len) ? reply.length : p.out_len);
+		}
+		if (p.result) {
+			*p.result = reply.result;
+		}
+		off = MESSAGE_ALIGN(off + sizeof(reply) + reply.length);
+	}
+
+	m_num_pending = 0;
+	m_request_len = 0;
+	m_reply_len = 0;
+	return 0;
+}
+
+int DevClient::open(const char *dev_path)
+{
+	int result = -EIO;
+	int ret = queueOpen(dev_path, &result);
+	if (ret == 0) {
+		ret = submit();
+	}
+	return (ret < 0) ? ret : result;
+}
+
+int DevClient::close(int handle)
+{
+	int result = -EIO;
+	int ret = queueClose(handle, &result);
+	if (ret == 0) {
+		ret = submit();
+	}
+	return (ret < 0) ? ret : result;
+}
+
+ssize_t DevClient::read(int handle, void *buf, size_t len)
+{
+	int result = -EIO;
+	int ret = queueRead(handle, buf, len, &result);
+	if (ret == 0) {
+		ret = submit();
+	}
+	return (ret < 0) ? ret : result;
+}
+
+ssize_t DevClient::write(int handle, const void *buf, size_t len)
+{
+	int result = -EIO;
+	int ret = queueWrite(handle, buf, len, &result);
+	if (ret == 0) {
+		ret = submit();
+	}
+	return (ret < 0) ? ret : result;
+}
+
+int DevClient::ioctl(int handle, unsigned long cmd, void *arg, size_t len)
+{
+	int result = -EIO;
+	int ret = queueIoctl(handle, cmd, arg, len, &result);
+	if (ret == 0) {
+		ret = submit();
+	}
+	return (ret < 0) ? ret : result;
+}
+
+int DevClient::openStream(int handle, unsigned int capacity, DevStream &stream)
+{
+	if (m_num_pending) {
+		return -EBUSY;
+	}
+
+	int result = -EIO;
+	int ret = queue(DEV_REQ_STREAM, handle, capacity, nullptr, 0, &result, nullptr, 0);
+	if (ret == 0) {
+		ret = submit();
+	}
+	if (ret < 0) {
+		return ret;
+	}
+	if (result < 0) {
+		return result;
+	}
+	if (m_received_fd < 0) {
+		return -EPROTO;
+	}
+
+	ret = stream.attach(m_received_fd);
+	::close(m_received_fd);
+	m_received_fd = -1;
+	return ret;
+}
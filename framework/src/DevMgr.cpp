@@ -34,12 +34,13 @@
 * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 #include <stdio.h>
-#include <string>
-#include <list>
+#include <string.h>
 #include "DriverFramework.hpp"
 #include "SyncObj.hpp"
 #include "DevObj.hpp"
 #include "DevMgr.hpp"
+#include "AllocGuard.hpp"
+#include "Arena.hpp"
 
 #include <stdlib.h>
 #include <execinfo.h>
@@ -53,36 +54,75 @@ bool DevMgr::m_initialized = false;
 
 #define NO_VERIFY 1 // Use fast method to get DevObj
 
-// TODO add missing locking and reimplement with map
-// This is meant just to work for now. It hs not been optimized yet.
+// The registry and the dataflow graph are fixed-size arrays allocated at
+// initialization, so registering devices and handles does not allocate.
 
-static std::list<DriverFramework::DevObj *> *g_driver_list = nullptr;
+static DevObj **g_driver_list = nullptr;
+static unsigned int g_driver_count = 0;
 
+// A thread blocked in waitForUpdate(). Lives on the waiter's stack and is
+// linked into g_wait_list, so waiting does not allocate.
 class WaitList {
 public:
 	WaitList(UpdateList &in_set, UpdateList &out_set) :
 		m_in_set(in_set),
-		m_out_set(out_set)
+		m_out_set(out_set),
+		m_lock(SYNC_OBJ_FUTEX, "DevMgr waiter"),
+		m_prev(nullptr),
+		m_next(nullptr)
 	{}
 	~WaitList() {}
 		
 	UpdateList &	m_in_set;
 	UpdateList &	m_out_set;
-	SyncObj 	m_lock;
+	SyncObj 	m_lock;		// protects m_out_set
+
+	WaitList *	m_prev;
+	WaitList *	m_next;
+};
+
+// Lock order: g_wait_lock, then WaitList::m_lock
+static WaitList *g_wait_list = nullptr;
+static SyncObj *g_wait_lock = nullptr;
+
+// Dataflow graph of derived devices
+struct Dependency {
+	DevObj *upstream;
+	DevObj *downstream;
 };
 
-static std::list<WaitList *> *g_wait_list = 0;
+static Dependency *g_dependency_list = nullptr;
+static unsigned int g_dependency_count = 0;
+static DevObj **g_derived_list = nullptr;	// sorted by rank
+static unsigned int g_derived_count = 0;
+static SyncObj *g_graph_lock = nullptr;
+static unsigned long g_update_gen = 0;
+
+// Generation being propagated by this thread, 0 outside propagateUpdate()
+static thread_local unsigned long t_propagation_gen = 0;
 
 int DevMgr::initialize(void)
 {
-	g_wait_list = new std::list<WaitList *>;
-	g_driver_list = new std::list<DriverFramework::DevObj *>;
-	if (g_driver_list == nullptr) {
+	g_driver_list = dfNewArray<DevObj *>(DEV_MGR_MAX_DRIVERS);
+	g_dependency_list = dfNewArray<Dependency>(DEV_MGR_MAX_DEPENDENCIES);
+	g_derived_list = dfNewArray<DevObj *>(DEV_MGR_MAX_DEPENDENCIES);
+	g_lock = dfNew<SyncObj>(SYNC_OBJ_DEFAULT, "DevMgr registry");
+
+	// Held briefly by every updateNotify()
+	g_wait_lock = dfNew<SyncObj>(SYNC_OBJ_FUTEX, "DevMgr wait list");
+
+	// Held by the HRT thread while running derived devices
+	g_graph_lock = dfNew<SyncObj>(SYNC_OBJ_PRIO_INHERIT, "DevMgr graph");
+	g_driver_count = 0;
+	g_dependency_count = 0;
+	g_derived_count = 0;
+
+	if (g_driver_list == nullptr || g_dependency_list == nullptr || g_derived_list == nullptr) {
+		finalize();
 		return -1;
 	}
-	g_lock = new SyncObj();
-	if (g_lock == nullptr) {
-		delete g_driver_list;
+	if (g_lock == nullptr || g_wait_lock == nullptr || g_graph_lock == nullptr) {
+		finalize();
 		return -2;
 	}
 
@@ -92,54 +132,77 @@ int DevMgr::initialize(void)
 
 void DevMgr::finalize(void)
 {
-	if (g_driver_list == nullptr) {
-		return;
+	if (g_lock) {
+		g_lock->lock();
 	}
-	g_lock->lock();
 	m_initialized = false;
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin(); 
-	while (it != g_driver_list->end()) {
-		it = g_driver_list->erase(it);
-	}
-	delete g_driver_list;
+	dfDeleteArray(g_driver_list);
 	g_driver_list = nullptr;
+	g_driver_count = 0;
 
-	delete g_wait_list;
-	g_wait_list = nullptr;
+	dfDelete(g_wait_lock);
+	g_wait_lock = nullptr;
 
-	g_lock->unlock();
-	delete g_lock;
+	if (g_graph_lock) {
+		g_graph_lock->lock();
+	}
+	dfDeleteArray(g_dependency_list);
+	g_dependency_list = nullptr;
+	g_dependency_count = 0;
+	dfDeleteArray(g_derived_list);
+	g_derived_list = nullptr;
+	g_derived_count = 0;
+	if (g_graph_lock) {
+		g_graph_lock->unlock();
+	}
+	dfDelete(g_graph_lock);
+	g_graph_lock = nullptr;
+
+	if (g_lock) {
+		g_lock->unlock();
+	}
+	dfDelete(g_lock);
 	g_lock = nullptr;
 }
 
+// Call with g_lock held
+static DevObj *findByPath(const char *path)
+{
+	for (unsigned int i = 0; i < g_driver_count; i++) {
+		if (strcmp(path, g_driver_list[i]->m_dev_instance_path) == 0) {
+			return g_driver_list[i];
+		}
+	}
+	return nullptr;
+}
+
 int DevMgr::registerDriver(DevObj *obj)
 {
 	if (g_driver_list == nullptr) {
 		return -1;
 	}
 
-	int found = false;
+	int instance = -1;
 	g_lock->lock();
+	if (g_driver_count >= DEV_MGR_MAX_DRIVERS) {
+		g_lock->unlock();
+		DF_LOG_ERR("error: too many drivers, %s not added", obj->m_name.c_str());
+		return -1;
+	}
 	for (unsigned int i=0; i < DRIVER_MAX_INSTANCES; i++)
 	{
-		std::string tmp_path = obj->m_dev_base_path + std::to_string(i);;
-		std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin();
-		while (it != g_driver_list->end()) {
-			if ( tmp_path == (*it)->m_dev_instance_path) {
-				found = true;
-				break;
-			}
-			++it;
-		}
-		if (!found)  {
-			obj->m_dev_instance_path = tmp_path;
-			g_driver_list->push_back(obj);
-			DF_LOG_INFO("Added driver %p %s", obj, obj->m_dev_instance_path.c_str());
+		char tmp_path[DEV_PATH_MAX];
+		snprintf(tmp_path, sizeof(tmp_path), "%s%u", obj->m_dev_base_path.c_str(), i);
+		if (findByPath(tmp_path) == nullptr)  {
+			strcpy(obj->m_dev_instance_path, tmp_path);
+			g_driver_list[g_driver_count++] = obj;
+			DF_LOG_INFO("Added driver %p %s", obj, obj->m_dev_instance_path);
+			instance = i;
 			break;
 		}
 	}
 	g_lock->unlock();
-	return 0;
+	return instance;
 }
 
 void DevMgr::unregisterDriver(DevObj *obj)
@@ -148,13 +211,15 @@ void DevMgr::unregisterDriver(DevObj *obj)
 		return;
 	}
 	g_lock->lock();
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin(); 
-	while (it != g_driver_list->end()) {
-		if (*it == obj) {
-			g_driver_list->erase(it);
+	for (unsigned int i = 0; i < g_driver_count; i++) {
+		if (g_driver_list[i] == obj) {
+			// Keep registration order
+			for (; i + 1 < g_driver_count; i++) {
+				g_driver_list[i] = g_driver_list[i + 1];
+			}
+			g_driver_count--;
 			break;
 		}
-		++it;
 	}
 	g_lock->unlock();
 }
@@ -164,20 +229,22 @@ DevObj *DevMgr::getDevObjByName(const char *name, unsigned int instance)
 	if (g_driver_list == nullptr) {
 		return nullptr;
 	}
+	DevObj *obj = nullptr;
 	g_lock->lock();
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin(); 
-	while (it != g_driver_list->end()) {
-		if ((*it)->m_name == name) {
+	for (unsigned int i = 0; i < g_driver_count; i++) {
+		DevObj *it = g_driver_list[i];
+		if (it->m_name == name) {
 			// see if instance matches
-			const std::string tmp_path = (*it)->m_dev_base_path + std::to_string(instance);
-			if (tmp_path == (*it)->m_dev_instance_path) {
+			char tmp_path[DEV_PATH_MAX];
+			snprintf(tmp_path, sizeof(tmp_path), "%s%u", it->m_dev_base_path.c_str(), instance);
+			if (strcmp(tmp_path, it->m_dev_instance_path) == 0) {
+				obj = it;
 				break;
 			}
 		}
-		++it;
 	}
 	g_lock->unlock();
-	return (it != g_driver_list->end()) ? *it : nullptr;
+	return obj;
 }
 
 DevObj *DevMgr::getDevObjByID(union DeviceId id)
@@ -185,31 +252,30 @@ DevObj *DevMgr::getDevObjByID(union DeviceId id)
 	if (g_driver_list == nullptr) {
 		return nullptr;
 	}
+	DevObj *obj = nullptr;
 	g_lock->lock();
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin(); 
-	while (it != g_driver_list->end()) {
-		if ((*it)->getId().dev_id == id.dev_id) {
+	for (unsigned int i = 0; i < g_driver_count; i++) {
+		if (g_driver_list[i]->getId().dev_id == id.dev_id) {
+			obj = g_driver_list[i];
 			break;
 		}
-		++it;
 	}
 	g_lock->unlock();
-	return (it == g_driver_list->end()) ? nullptr : *it;
+	return obj;
 }
 
 DevObj *DevMgr::_getDevObjByHandle(DevHandle &h)
 {
+	DevObj *obj = nullptr;
 	g_lock->lock();
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin();
-	while (it != g_driver_list->end()) {
-		if (h.m_handle == *it) {
+	for (unsigned int i = 0; i < g_driver_count; i++) {
+		if (h.m_handle == g_driver_list[i]) {
+			obj = g_driver_list[i];
 			break;
 		}
-		++it;
 	}
-
 	g_lock->unlock();
-	return (it == g_driver_list->end()) ? nullptr : *it;
+	return obj;
 }
 
 void DevMgr::getHandle(const char *dev_path, DevHandle &h)
@@ -218,22 +284,15 @@ void DevMgr::getHandle(const char *dev_path, DevHandle &h)
 		h.m_errno = ESRCH;
 		return;
 	}
-	const std::string name(dev_path);
 	h.m_errno = EBADF;
 
 	//g_lock->lock();
-	std::list<DriverFramework::DevObj *>::iterator it = g_driver_list->begin();
-	while (it != g_driver_list->end()) {
-		if ( name == (*it)->m_dev_instance_path) {
-			// Device is registered
-			//g_lock->unlock();
-			(*it)->addHandle(h);
-			//g_lock->lock();
-			h.m_handle = *it;
-			h.m_errno = 0;
-			break;
-		}
-		++it;
+	DevObj *obj = findByPath(dev_path);
+	if (obj) {
+		// Device is registered
+		obj->addHandle(h);
+		h.m_handle = obj;
+		h.m_errno = 0;
 	}
 	//g_lock->unlock();
 }
@@ -255,49 +314,286 @@ void DevMgr::setDevHandleError(DevHandle &h, int error)
 
 int DevMgr::waitForUpdate(UpdateList &in_set, UpdateList &out_set, unsigned int timeout_ms)
 {
+	if (g_wait_lock == nullptr) {
+		return -ESRCH;
+	}
+
+	AllocGuard::RealtimeScope realtime;
 	WaitList wl(in_set, out_set);
 
+	// Hold m_lock from before the waiter is visible until the wait
+	// starts, so an update in between is not missed
+	g_wait_lock->lock();
 	wl.m_lock.lock();
-	g_wait_list->push_front(&wl);
+	wl.m_next = g_wait_list;
+	if (g_wait_list) {
+		g_wait_list->m_prev = &wl;
+	}
+	g_wait_list = &wl;
+	g_wait_lock->unlock();
 
 	int ret = wl.m_lock.waitOnSignal(timeout_ms);
+	wl.m_lock.unlock();
 
-	// Remove the List item
-	std::list<WaitList *>::iterator it = g_wait_list->begin();
-	while(it != g_wait_list->end()) {
-		if (*it == &wl) {
-			it = g_wait_list->erase(it);
-			break;
-		}
-		++it;
+	g_wait_lock->lock();
+	if (wl.m_prev) {
+		wl.m_prev->m_next = wl.m_next;
+	}
+	else {
+		g_wait_list = wl.m_next;
 	}
+	if (wl.m_next) {
+		wl.m_next->m_prev = wl.m_prev;
+	}
+	g_wait_lock->unlock();
 
-	wl.m_lock.unlock();
 	return ret;
 }
 
 void  DevMgr::updateNotify(DevObj &obj)
 {
-	std::list<WaitList *>::iterator it =  g_wait_list->begin();
+	if (g_wait_lock) {
+		g_wait_lock->lock();
+		for (WaitList *wl = g_wait_list; wl != nullptr; wl = wl->m_next) {
+			bool updated = false;
+
+			wl->m_lock.lock();
+			UpdateList::iterator in_it = wl->m_in_set.begin();
+			for (; in_it != wl->m_in_set.end(); ++in_it) {
+
+				// If the obj is equal the obj of DevHandle
+				if ((*in_it)->m_handle == &obj) {
+
+					// Add obj to the out set
+					if (!wl->m_out_set.contains(*in_it)) {
+						wl->m_out_set.push_back(*in_it);
+					}
+					updated = true;
+				}
+			}
+			if (updated) {
+				wl->m_lock.signal();
+			}
+			wl->m_lock.unlock();
+		}
+		g_wait_lock->unlock();
+	}
+
+	if (t_propagation_gen) {
+		// Published by a derived device during propagation
+		obj.m_update_gen = t_propagation_gen;
+	}
+	else if (obj.m_downstream_count) {
+		propagateUpdate(obj);
+	}
+}
 
-	for (; it != g_wait_list->end(); ++it) {
+//------------------------------------------------------------------------
+// Dataflow graph
+//------------------------------------------------------------------------
 
-		UpdateList::iterator in_it = (*it)->m_in_set.begin();
-		for (; in_it != (*it)->m_in_set.end(); ++in_it) {
+void DevMgr::propagateUpdate(DevObj &obj)
+{
+	g_graph_lock->lock();
+	if (g_derived_list == nullptr) {
+		g_graph_lock->unlock();
+		return;
+	}
+	obj.m_update_gen = ++g_update_gen;
+	t_propagation_gen = g_update_gen;
+
+	// Derived devices are sorted by rank, so every upstream of a device
+	// has already run (and published or not) when it is reached
+	for (unsigned int i = 0; i < g_derived_count; i++) {
+		for (unsigned int d = 0; d < g_dependency_count; d++) {
+			const Dependency &dep = g_dependency_list[d];
+			if (dep.downstream == g_derived_list[i] && dep.upstream->m_update_gen == g_update_gen) {
+				g_derived_list[i]->runMeasure();
+				break;
+			}
+		}
+	}
 
-			// If the obj is equal the obj of DevHandle
-			if ((*in_it)->m_handle == &obj) {
+	t_propagation_gen = 0;
+	g_graph_lock->unlock();
+}
 
-				// Add obj to the out set
-				(*it)->m_out_set.push_back((*in_it));
+bool DevMgr::lowerRank(DevObj *a, DevObj *b)
+{
+	return a->m_rank < b->m_rank;
+}
+
+// Call with g_graph_lock held
+void DevMgr::rankDependencies(void)
+{
+	unsigned int d;
+	for (d = 0; d < g_dependency_count; d++) {
+		g_dependency_list[d].upstream->m_rank = 0;
+		g_dependency_list[d].downstream->m_rank = 0;
+	}
+
+	// Longest path from a source. The graph is acyclic so this settles
+	// after at most one pass per dependency.
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (d = 0; d < g_dependency_count; d++) {
+			Dependency &dep = g_dependency_list[d];
+			if (dep.downstream->m_rank < dep.upstream->m_rank + 1) {
+				dep.downstream->m_rank = dep.upstream->m_rank + 1;
+				changed = true;
+			}
+		}
+	}
+
+	// Stable insertion sort, the list is short and mostly sorted
+	for (unsigned int i = 1; i < g_derived_count; i++) {
+		DevObj *obj = g_derived_list[i];
+		unsigned int j = i;
+		for (; j > 0 && lowerRank(obj, g_derived_list[j - 1]); j--) {
+			g_derived_list[j] = g_derived_list[j - 1];
+		}
+		g_derived_list[j] = obj;
+	}
+}
+
+static bool reachable(DevObj *from, DevObj *to)
+{
+	if (from == to) {
+		return true;
+	}
+	for (unsigned int d = 0; d < g_dependency_count; d++) {
+		if (g_dependency_list[d].upstream == from && reachable(g_dependency_list[d].downstream, to)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Call with g_graph_lock held
+static void removeDerived(DevObj *obj)
+{
+	for (unsigned int i = 0; i < g_derived_count; i++) {
+		if (g_derived_list[i] == obj) {
+			for (; i + 1 < g_derived_count; i++) {
+				g_derived_list[i] = g_derived_list[i + 1];
 			}
+			g_derived_count--;
+			return;
+		}
+	}
+}
+
+// Call with g_graph_lock held
+static bool isDerived(DevObj *obj)
+{
+	for (unsigned int d = 0; d < g_dependency_count; d++) {
+		if (g_dependency_list[d].downstream == obj) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Call with g_graph_lock held
+static void removeDependencyAt(unsigned int index)
+{
+	for (unsigned int d = index; d + 1 < g_dependency_count; d++) {
+		g_dependency_list[d] = g_dependency_list[d + 1];
+	}
+	g_dependency_count--;
+}
+
+int DevMgr::addDependency(DevObj &upstream, DevObj &downstream)
+{
+	if (g_graph_lock == nullptr) {
+		return -ESRCH;
+	}
+	g_graph_lock->lock();
+
+	if (reachable(&downstream, &upstream)) {
+		g_graph_lock->unlock();
+		return -EINVAL;
+	}
+
+	for (unsigned int d = 0; d < g_dependency_count; d++) {
+		if (g_dependency_list[d].upstream == &upstream && g_dependency_list[d].downstream == &downstream) {
+			g_graph_lock->unlock();
+			return 0;
+		}
+	}
+
+	if (g_dependency_count >= DEV_MGR_MAX_DEPENDENCIES) {
+		g_graph_lock->unlock();
+		return -ENOSPC;
+	}
+
+	bool derived = isDerived(&downstream);
+
+	Dependency d = { &upstream, &downstream };
+	g_dependency_list[g_dependency_count++] = d;
+	upstream.m_downstream_count++;
+
+	// A derived device has at least one dependency, so this cannot overflow
+	if (!derived) {
+		g_derived_list[g_derived_count++] = &downstream;
+	}
+
+	rankDependencies();
+	g_graph_lock->unlock();
+	return 0;
+}
+
+void DevMgr::removeDependency(DevObj &upstream, DevObj &downstream)
+{
+	if (g_graph_lock == nullptr) {
+		return;
+	}
+	g_graph_lock->lock();
+
+	unsigned int d = 0;
+	while (d < g_dependency_count) {
+		if (g_dependency_list[d].upstream == &upstream && g_dependency_list[d].downstream == &downstream) {
+			upstream.m_downstream_count--;
+			removeDependencyAt(d);
+			continue;
 		}
-		if ((*it)->m_out_set.size() > 0) {
-			(*it)->m_lock.lock();
-			(*it)->m_lock.signal();
-			(*it)->m_lock.unlock();
+		++d;
+	}
+	if (!isDerived(&downstream)) {
+		removeDerived(&downstream);
+	}
+
+	rankDependencies();
+	g_graph_lock->unlock();
+}
+
+void DevMgr::removeDependencies(DevObj &obj)
+{
+	if (g_graph_lock == nullptr) {
+		return;
+	}
+	g_graph_lock->lock();
+
+	unsigned int d = 0;
+	while (d < g_dependency_count) {
+		Dependency dep = g_dependency_list[d];
+		if (dep.upstream == &obj || dep.downstream == &obj) {
+			dep.upstream->m_downstream_count--;
+			removeDependencyAt(d);
+
+			// Drop the downstream from the derived list if this was its last upstream
+			if (dep.downstream != &obj && !isDerived(dep.downstream)) {
+				removeDerived(dep.downstream);
+			}
+			continue;
 		}
+		++d;
 	}
+	removeDerived(&obj);
+
+	rankDependencies();
+	g_graph_lock->unlock();
 }
 
 //------------------------------------------------------------------------
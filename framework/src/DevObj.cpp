@@ -35,6 +35,9 @@
 * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 #include "DevObj.hpp"
+#include "Arena.hpp"
+#include "Recorder.hpp"
+#include "DevServer.hpp"
 
 using namespace DriverFramework;
 
@@ -43,8 +46,21 @@ DevObj::DevObj(const char *name, const char *dev_base_path, DeviceBusType bus_ty
 	m_dev_base_path(dev_base_path),
 	m_sample_interval(sample_interval),
 	m_driver_instance(-1),
-	m_refcount(0)
+	m_handles(nullptr),
+	m_refcount(0),
+	m_detaching(false),
+	m_rank(0),
+	m_downstream_count(0),
+	m_update_gen(0),
+	m_resume_handle(0),
+	m_measure_phase(0),
+	m_resume_requested(false),
+	m_measure_overruns(0),
+	m_sample_buffer(nullptr),
+	m_sample_layout(nullptr),
+	m_sample_layout_size(0)
 {
+	m_dev_instance_path[0] = '\0';
 	m_id.dev_id_s.bus = 0;
 	m_id.dev_id_s.address = 0;
 	m_id.dev_id_s.devtype = bus_type;
@@ -67,30 +83,96 @@ int DevObj::start(void)
 }
 
 int DevObj::stop(void) {
+	// Releasing the last client handle does not stop the device again
+	m_detaching = true;
+	Recorder::removeDevice(*this);
+	DevServer::removeDevice(*this);
+	m_detaching = false;
+
+	if (m_resume_handle) {
+		WorkMgr::destroy(m_resume_handle);
+		m_measure_phase = 0;
+	}
 	if (m_work_handle) {
 		WorkMgr::destroy(m_work_handle);
 		m_work_handle=0;
 		DevMgr::unregisterDriver(this);
+		m_driver_instance = -1;
 	}
 	return 0;
 }
 
 DevObj::~DevObj() 
 {
-	std::list<DevHandle *>::iterator it = m_handles.begin();
-	while (it != m_handles.end()) {
-		if ((*it)->isValid()) {
-			DevMgr::releaseHandle(**m_handles.begin());
+	while (m_handles) {
+		DevHandle *h = m_handles;
+		if (h->isValid()) {
+			DevMgr::releaseHandle(*h);
 		}
-		else {
-			m_handles.erase(it);
+		if (m_handles == h) {
+			// Not released through DevMgr
+			m_handles = h->m_next;
+			h->m_next = nullptr;
+			m_refcount--;
 		}
-		it = m_handles.begin();
 	}
 
+	DevMgr::removeDependencies(*this);
+
 	if (isRegistered()) {
 		DevMgr::unregisterDriver(this);
 	}
+
+	dfDelete(m_sample_buffer);
+}
+
+int DevObj::enableSampleBuffer(unsigned int sample_size, unsigned int capacity)
+{
+	if (m_sample_buffer || sample_size == 0 || capacity == 0) {
+		return -1;
+	}
+	// From the framework arena in realtime mode
+	SampleBuffer *buffer = dfNew<SampleBuffer>(sample_size, capacity);
+	if (buffer == nullptr || !buffer->isValid()) {
+		dfDelete(buffer);
+		return -1;
+	}
+	m_sample_buffer = buffer;
+	return 0;
+}
+
+int DevObj::publishSamples(const void *samples, const uint64_t *timestamps, unsigned int count)
+{
+	if (m_sample_buffer == nullptr) {
+		return -1;
+	}
+	if (count) {
+		uint64_t seq = m_sample_buffer->push(samples, timestamps, count);
+		if (Recorder::isRunning()) {
+			Recorder::record(*this, seq, samples, timestamps, count);
+		}
+		if (DevServer::isStreaming()) {
+			DevServer::stream(*this, samples, timestamps, count);
+		}
+		updateNotify();
+	}
+	return 0;
+}
+
+int DevObj::readSamples(void *out, uint64_t *timestamps, unsigned int max_samples)
+{
+	if (m_sample_buffer == nullptr) {
+		return -1;
+	}
+	return m_sample_buffer->pop(out, timestamps, max_samples);
+}
+
+int DevObj::peekSamples(uint64_t &seq, void *out, uint64_t *timestamps, unsigned int max_samples)
+{
+	if (m_sample_buffer == nullptr) {
+		return -1;
+	}
+	return m_sample_buffer->peek(seq, out, timestamps, max_samples);
 }
 
 int DevObj::devIOCTL(unsigned long request, void *arg)
@@ -98,6 +180,11 @@ int DevObj::devIOCTL(unsigned long request, void *arg)
 	return -1;
 }
 
+int DevObj::devIOCTLArgSize(unsigned long request)
+{
+	return -1;
+}
+
 ssize_t DevObj::devRead(void *buf, size_t count)
 {
 	return -1;
@@ -113,36 +200,77 @@ void DevObj::measure(void *arg, const WorkHandle wh)
 	// Reschedule callback
 	WorkMgr::schedule(wh);
 
-	reinterpret_cast<DevObj *>(arg)->_measure();
+	DevObj *me = reinterpret_cast<DevObj *>(arg);
+	if (me->m_measure_phase) {
+		// The previous multi-phase measurement has not completed
+		me->m_measure_overruns++;
+		return;
+	}
+	me->runMeasure();
+}
+
+void DevObj::resume(void *arg, const WorkHandle wh)
+{
+	reinterpret_cast<DevObj *>(arg)->runMeasure();
+}
+
+void DevObj::runMeasure()
+{
+	m_resume_requested = false;
+	_measure();
+	m_measure_phase = m_resume_requested ? m_measure_phase + 1 : 0;
+}
+
+void DevObj::suspendMeasure()
+{
+	if (!m_resume_handle) {
+		// Delay 0 keeps the resume item out of the phase plan
+		m_resume_handle = WorkMgr::create(resume, this, 0);
+	}
+	m_resume_requested = true;
+}
+
+void DevObj::resumeMeasure()
+{
+	WorkMgr::scheduleIn(m_resume_handle, 0);
+}
+
+void DevObj::resumeMeasureIn(uint32_t delay_usec)
+{
+	suspendMeasure();
+	if (!WorkMgr::scheduleIn(m_resume_handle, delay_usec)) {
+		m_resume_requested = false;
+	}
 }
 
 // Return -1 on failure, otherwise recount
 int DevObj::addHandle(DevHandle &h)
 {
-	if (m_handles.size() == 0) {
+	if (m_refcount == 0) {
 		int ret = start();
 		if (ret < 0) {
 			return -1;
 		}
 	}
-	m_handles.push_back(&h);
-	return m_handles.size();
+	h.m_next = m_handles;
+	m_handles = &h;
+	return ++m_refcount;
 }
 
 // Return -1 on failure, otherwise recount
 int DevObj::removeHandle(DevHandle &h)
 {
-	std::list<DevHandle *>::iterator it = m_handles.begin();
-	while (it != m_handles.end()) {
-		if (*it == &h) {
-			it = m_handles.erase(it);
-			if (it == m_handles.end()) {
+	for (DevHandle **link = &m_handles; *link; link = &(*link)->m_next) {
+		if (*link == &h) {
+			*link = h.m_next;
+			h.m_next = nullptr;
+			if (--m_refcount == 0 && !m_detaching) {
 				stop();
 			}
+			break;
 		}
-		++it;
 	}
-	return m_handles.size();
+	return m_refcount;
 }
 
 void DevObj::updateNotify()
@@ -153,11 +281,15 @@ void DevObj::updateNotify()
 void DevObj::setSampleInterval(unsigned int sample_interval)
 {
 	if (m_sample_interval != sample_interval) {
-		WorkMgr::destroy(m_work_handle);
 		m_sample_interval = sample_interval;
-		m_work_handle = WorkMgr::create(measure, this, m_sample_interval);
-		if (m_sample_interval != 0 && m_driver_instance >= 0) {
-			WorkMgr::schedule(m_work_handle);
+
+		// If stopped, start() creates the work item with the new interval
+		if (m_work_handle) {
+			WorkMgr::destroy(m_work_handle);
+			if (m_sample_interval != 0) {
+				m_work_handle = WorkMgr::create(measure, this, m_sample_interval);
+				WorkMgr::schedule(m_work_handle);
+			}
 		}
 	}
 }
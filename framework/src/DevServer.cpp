@@ -0,0 +1,645 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "DriverFramework.hpp"
+#include "DevObj.hpp"
+#include "DevServer.hpp"
+#include "SyncObj.hpp"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+using namespace DriverFramework;
+
+static_assert(sizeof(DevRequest) == 16 && sizeof(DevReply) == 8 && sizeof(DevStreamRing) == 64,
+	      "part of the protocol");
+static_assert(DEV_PATH_MAX <= DEV_SERVER_MAX_PATH, "device path does not fit");
+
+#define MESSAGE_ALIGN(size)	(((size) + 7) & ~(size_t)7)
+
+struct ServerClient
+{
+	int		fd;
+	DevHandle	handles[DEV_SERVER_MAX_HANDLES];
+};
+
+// The client can write the ring header, so the server keeps the layout
+// and write position of the ring here and only stores to the header
+struct ServerStream
+{
+	DevObj *	dev;		// nullptr if the slot is free
+	ServerClient *	client;
+	unsigned int	handle;
+	DevStreamRing *	ring;
+	size_t		map_size;
+	uint32_t	capacity;
+	uint32_t	sample_size;
+	uint64_t	head;
+};
+
+// s_client_lock guards the clients' handles, and is held while a batch is
+// served, except during calls into a driver. s_stream_lock guards the
+// streams. It is taken by publishers, which may be realtime threads, so it
+// inherits their priority. Both are taken in that order.
+static pthread_mutex_t s_client_lock = PTHREAD_MUTEX_INITIALIZER;
+static SyncObj s_stream_lock(SYNC_OBJ_PRIO_INHERIT, "DevServer streams");
+
+// Set while a thread calls into drivers with s_client_lock released.
+// s_busy_dev is the device called, or nullptr if not known, e.g. while a
+// handle is opened. removeDevice() waits for the call to return.
+static bool s_device_call = false;
+static DevObj *s_busy_dev = nullptr;
+static pthread_t s_busy_tid;
+static pthread_cond_t s_idle_cond = PTHREAD_COND_INITIALIZER;
+
+static ServerClient *s_clients[DEV_SERVER_MAX_CLIENTS];
+static ServerStream s_streams[DEV_SERVER_MAX_STREAMS];
+static unsigned int s_num_streams = 0;
+
+static int s_listen_fd = -1;
+static int s_wake_pipe[2] = { -1, -1 };
+static char s_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t s_tid;
+static bool s_running = false;
+static bool s_stopping = false;
+
+// Used by the server thread only
+static uint8_t *s_request = nullptr;
+static uint8_t *s_reply = nullptr;
+
+static void wakeReader(DevStreamRing *ring)
+{
+	__atomic_add_fetch(&ring->notify, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST)) {
+#ifdef __linux__
+		// Shared between processes, so not FUTEX_PRIVATE_FLAG
+		syscall(SYS_futex, &ring->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+	}
+}
+
+static void writeRing(ServerStream &stream, const uint8_t *samples, const uint64_t *timestamps, unsigned int count)
+{
+	DevStreamRing *ring = stream.ring;
+	const uint32_t capacity = stream.capacity;
+	const uint32_t sample_size = stream.sample_size;
+	uint64_t *slots_ts = (uint64_t *)(ring + 1);
+	uint8_t *slots = (uint8_t *)&slots_ts[capacity];
+	uint64_t head = stream.head;
+
+	// Readers drop what they copy from slots about to be overwritten
+	__atomic_store_n(&ring->reserve, head + count, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	unsigned int skip = (count > capacity) ? count - capacity : 0;
+	for (unsigned int i = skip; i < count; i++) {
+		uint32_t slot = (head + i) & (capacity - 1);
+		slots_ts[slot] = timestamps[i];
+		memcpy(&slots[slot * sample_size], &samples[i * sample_size], sample_size);
+	}
+
+	stream.head = head + count;
+	__atomic_store_n(&ring->head, stream.head, __ATOMIC_RELEASE);
+	wakeReader(ring);
+}
+
+void DevServer::stream(DevObj &dev, const void *samples, const uint64_t *timestamps, unsigned int count)
+{
+	s_stream_lock.lock();
+	for (unsigned int i = 0; i < DEV_SERVER_MAX_STREAMS; i++) {
+		if (s_streams[i].dev == &dev) {
+			writeRing(s_streams[i], (const uint8_t *)samples, timestamps, count);
+		}
+	}
+	s_stream_lock.unlock();
+}
+
+// With s_stream_lock held
+static void closeStream(ServerStream &stream)
+{
+	__atomic_store_n(&stream.ring->closed, 1, __ATOMIC_RELEASE);
+	wakeReader(stream.ring);
+	munmap(stream.ring, stream.map_size);
+	stream.dev = nullptr;
+	__atomic_sub_fetch(&s_num_streams, 1, __ATOMIC_RELAXED);
+}
+
+// Close the streams of a client's handle, or of all its handles. With
+// s_client_lock held.
+static void closeStreams(ServerClient *client, int handle)
+{
+	s_stream_lock.lock();
+	for (unsigned int i = 0; i < DEV_SERVER_MAX_STREAMS; i++) {
+		if (s_streams[i].dev && s_streams[i].client == client &&
+		    (handle < 0 || s_streams[i].handle == (unsigned int)handle)) {
+			closeStream(s_streams[i]);
+		}
+	}
+	s_stream_lock.unlock();
+}
+
+void DevServer::removeDevice(DevObj &dev)
+{
+	pthread_mutex_lock(&s_client_lock);
+	// Unless the device is removed by the call itself
+	while (s_device_call && (s_busy_dev == nullptr || s_busy_dev == &dev) &&
+	       !pthread_equal(pthread_self(), s_busy_tid)) {
+		pthread_cond_wait(&s_idle_cond, &s_client_lock);
+	}
+	for (unsigned int c = 0; c < DEV_SERVER_MAX_CLIENTS; c++) {
+		ServerClient *client = s_clients[c];
+		for (unsigned int h = 0; client && h < DEV_SERVER_MAX_HANDLES; h++) {
+			if (DevMgr::getDevObjByHandle<DevObj>(client->handles[h]) == &dev) {
+				closeStreams(client, h);
+				DevMgr::releaseHandle(client->handles[h]);
+			}
+		}
+	}
+	pthread_mutex_unlock(&s_client_lock);
+}
+
+// Map a ring for dev into stream. Returns its file descriptor.
+static int openRing(DevObj &dev, uint64_t capacity, ServerStream &stream)
+{
+	unsigned int sample_size = dev.getSampleSize();
+	if (sample_size == 0) {
+		return -ENOTSUP;
+	}
+	if (capacity == 0 || capacity > DEV_STREAM_MAX_CAPACITY) {
+		return -EINVAL;
+	}
+	uint32_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	size_t map_size = sizeof(DevStreamRing) + size * (sizeof(uint64_t) + sample_size);
+	map_size = (map_size + page - 1) & ~(size_t)(page - 1);
+
+#ifdef __linux__
+	int fd = memfd_create("df_stream", MFD_CLOEXEC);
+#else
+	char name[64];
+	snprintf(name, sizeof(name), "/df_stream_%d_%p", (int)getpid(), (void *)&dev);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		shm_unlink(name);
+	}
+#endif
+	if (fd < 0) {
+		return -errno;
+	}
+	void *data = MAP_FAILED;
+	if (ftruncate(fd, map_size) == 0) {
+		data = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (data == MAP_FAILED) {
+		int ret = -errno;
+		::close(fd);
+		return ret;
+	}
+
+	DevStreamRing *ring = (DevStreamRing *)data;
+	memcpy(ring->magic, "DFSR", 4);
+	ring->sample_size = sample_size;
+	ring->capacity = size;
+
+	stream.dev = &dev;
+	stream.ring = ring;
+	stream.map_size = map_size;
+	stream.capacity = size;
+	stream.sample_size = sample_size;
+	stream.head = 0;
+	return fd;
+}
+
+// Call into a driver without s_client_lock, so other threads are not held
+// up by slow devices. dev is nullptr if the device is not known. Called
+// with s_client_lock held.
+static void beginDeviceCall(DevObj *dev)
+{
+	s_device_call = true;
+	s_busy_dev = dev;
+	s_busy_tid = pthread_self();
+	pthread_mutex_unlock(&s_client_lock);
+}
+
+static void endDeviceCall()
+{
+	pthread_mutex_lock(&s_client_lock);
+	s_device_call = false;
+	s_busy_dev = nullptr;
+	pthread_cond_broadcast(&s_idle_cond);
+}
+
+// Serve a request of client into reply. Returns the result, sets
+// reply_len and, for a new stream, fd.
+static int32_t serve(ServerClient &client, const DevRequest &req, const uint8_t *data, uint8_t *reply,
+		     size_t reply_space, uint32_t &reply_len, int &fd)
+{
+	reply_len = 0;
+
+	if (req.op == DEV_REQ_OPEN) {
+		char path[DEV_SERVER_MAX_PATH];
+		if (req.length == 0 || req.length >= sizeof(path)) {
+			return -EINVAL;
+		}
+		memcpy(path, data, req.length);
+		path[req.length] = '\0';
+
+		for (unsigned int h = 0; h < DEV_SERVER_MAX_HANDLES; h++) {
+			if (!client.handles[h].isValid()) {
+				// The first handle starts the device
+				beginDeviceCall(nullptr);
+				DevMgr::getHandle(path, client.handles[h]);
+				endDeviceCall();
+				return client.handles[h].isValid() ? (int32_t)h : -ENOENT;
+			}
+		}
+		return -EMFILE;
+	}
+
+	if (req.handle >= DEV_SERVER_MAX_HANDLES || !client.handles[req.handle].isValid()) {
+		return -EBADF;
+	}
+	DevHandle &h = client.handles[req.handle];
+	DevObj *dev = DevMgr::getDevObjByHandle<DevObj>(h);
+
+	switch (req.op) {
+	case DEV_REQ_CLOSE:
+		closeStreams(&client, req.handle);
+		// The last handle stops the device
+		beginDeviceCall(dev);
+		DevMgr::releaseHandle(h);
+		endDeviceCall();
+		return 0;
+
+	case DEV_REQ_READ: {
+			size_t len = (req.arg < reply_space) ? req.arg : reply_space;
+			beginDeviceCall(dev);
+			ssize_t ret = h.read(reply, len);
+			endDeviceCall();
+			if (ret > 0) {
+				reply_len = ret;
+			}
+			return ret;
+		}
+
+	case DEV_REQ_WRITE: {
+			beginDeviceCall(dev);
+			ssize_t ret = h.write((void *)data, req.length);
+			endDeviceCall();
+			return ret;
+		}
+
+	case DEV_REQ_IOCTL: {
+			// Only commands with a declared argument size, so the
+			// driver never reads or writes past the buffer
+			int size = dev->devIOCTLArgSize(req.arg);
+			if (size < 0) {
+				return -ENOTTY;
+			}
+			if (req.length < (uint32_t)size) {
+				return -EINVAL;
+			}
+			if ((size_t)size > reply_space) {
+				return -ENOSPC;
+			}
+			// The driver updates the argument in the reply
+			memcpy(reply, data, size);
+			reply_len = size;
+			beginDeviceCall(dev);
+			int ret = h.ioctl(req.arg, size ? reply : nullptr);
+			endDeviceCall();
+			return ret;
+		}
+
+	case DEV_REQ_STREAM: {
+			if (fd >= 0) {
+				// One stream per batch
+				return -EBUSY;
+			}
+			ServerStream stream;
+			int ret = openRing(*dev, req.arg, stream);
+			if (ret < 0) {
+				return ret;
+			}
+
+			s_stream_lock.lock();
+			unsigned int i = 0;
+			while (i < DEV_SERVER_MAX_STREAMS && s_streams[i].dev) {
+				i++;
+			}
+			if (i == DEV_SERVER_MAX_STREAMS) {
+				s_stream_lock.unlock();
+				munmap(stream.ring, stream.map_size);
+				::close(ret);
+				return -ENOSPC;
+			}
+			stream.client = &client;
+			stream.handle = req.handle;
+			s_streams[i] = stream;
+			__atomic_add_fetch(&s_num_streams, 1, __ATOMIC_RELAXED);
+			s_stream_lock.unlock();
+
+			fd = ret;
+			return 0;
+		}
+
+	default:
+		return -ENOSYS;
+	}
+}
+
+// Serve a batch of requests of len bytes and send the replies. Returns
+// false if the client is to be disconnected.
+static bool serveBatch(ServerClient &client, size_t len)
+{
+	size_t in = 0;
+	size_t out = 0;
+	int fd = -1;
+
+	pthread_mutex_lock(&s_client_lock);
+	while (in + sizeof(DevRequest) <= len) {
+		DevRequest req;
+		memcpy(&req, &s_request[in], sizeof(req));
+		in += sizeof(req);
+		if (req.length > len - in || out + sizeof(DevReply) > DEV_SERVER_MAX_MESSAGE) {
+			pthread_mutex_unlock(&s_client_lock);
+			return false;
+		}
+
+		DevReply reply;
+		uint8_t *reply_data = &s_reply[out + sizeof(reply)];
+		size_t space = (DEV_SERVER_MAX_MESSAGE - out - sizeof(reply)) & ~(size_t)7;
+		reply.result = serve(client, req, &s_request[in], reply_data, space, reply.length, fd);
+		memcpy(&s_reply[out], &reply, sizeof(reply));
+		out = MESSAGE_ALIGN(out + sizeof(reply) + reply.length);
+		in = MESSAGE_ALIGN(in + req.length);
+	}
+	pthread_mutex_unlock(&s_client_lock);
+
+	struct iovec iov;
+	iov.iov_base = s_reply;
+	iov.iov_len = out;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	if (fd >= 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	// A client that does not read its replies must not block the server
+	// thread, so it is disconnected once its socket buffer is full
+	ssize_t ret;
+	do {
+		ret = sendmsg(client.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	// The client has its own descriptor, the mapping stays
+	if (fd >= 0) {
+		::close(fd);
+	}
+	return ret == (ssize_t)out;
+}
+
+static void removeClient(unsigned int c)
+{
+	pthread_mutex_lock(&s_client_lock);
+	ServerClient *client = s_clients[c];
+	s_clients[c] = nullptr;
+	closeStreams(client, -1);
+	beginDeviceCall(nullptr);
+	for (unsigned int h = 0; h < DEV_SERVER_MAX_HANDLES; h++) {
+		if (client->handles[h].isValid()) {
+			DevMgr::releaseHandle(client->handles[h]);
+		}
+	}
+	endDeviceCall();
+	pthread_mutex_unlock(&s_client_lock);
+
+	::close(client->fd);
+	delete client;
+}
+
+static void *process_trampoline(void *arg)
+{
+	struct pollfd fds[DEV_SERVER_MAX_CLIENTS + 2];
+	unsigned int owner[DEV_SERVER_MAX_CLIENTS + 2];
+
+	for (;;) {
+		fds[0].fd = s_wake_pipe[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = s_listen_fd;
+		fds[1].events = POLLIN;
+		unsigned int n = 2;
+		for (unsigned int c = 0; c < DEV_SERVER_MAX_CLIENTS; c++) {
+			if (s_clients[c]) {
+				fds[n].fd = s_clients[c]->fd;
+				fds[n].events = POLLIN;
+				owner[n++] = c;
+			}
+		}
+
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			DF_LOG_ERR("DevServer: poll failed (%d)", -errno);
+			break;
+		}
+		if (fds[0].revents || __atomic_load_n(&s_stopping, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		for (unsigned int i = 2; i < n; i++) {
+			if (fds[i].revents == 0) {
+				continue;
+			}
+			ssize_t len = recv(fds[i].fd, s_request, DEV_SERVER_MAX_MESSAGE, 0);
+			if (len < 0 && errno == EINTR) {
+				continue;
+			}
+			if (len <= 0 || !serveBatch(*s_clients[owner[i]], len)) {
+				removeClient(owner[i]);
+			}
+		}
+
+		if (fds[1].revents & POLLIN) {
+			int fd = accept(s_listen_fd, NULL, NULL);
+			if (fd < 0) {
+				continue;
+			}
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+			unsigned int c = 0;
+			while (c < DEV_SERVER_MAX_CLIENTS && s_clients[c]) {
+				c++;
+			}
+			if (c == DEV_SERVER_MAX_CLIENTS) {
+				DF_LOG_ERR("DevServer: too many clients");
+				::close(fd);
+				continue;
+			}
+			ServerClient *client = new ServerClient;
+			client->fd = fd;
+			pthread_mutex_lock(&s_client_lock);
+			s_clients[c] = client;
+			pthread_mutex_unlock(&s_client_lock);
+		}
+	}
+	return NULL;
+}
+
+int DevServer::start(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	if (s_running) {
+		return -EBUSY;
+	}
+
+	s_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (s_listen_fd < 0) {
+		return -errno;
+	}
+	fcntl(s_listen_fd, F_SETFD, FD_CLOEXEC);
+
+	// A socket left by a server that did not stop
+	unlink(socket_path);
+	if (bind(s_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(s_listen_fd, DEV_SERVER_MAX_CLIENTS) < 0 || pipe(s_wake_pipe) < 0) {
+		int ret = -errno;
+		::close(s_listen_fd);
+		s_listen_fd = -1;
+		return ret;
+	}
+	snprintf(s_socket_path, sizeof(s_socket_path), "%s", socket_path);
+
+	s_request = new uint8_t[DEV_SERVER_MAX_MESSAGE];
+	s_reply = new uint8_t[DEV_SERVER_MAX_MESSAGE];
+	s_stopping = false;
+
+	if (pthread_create(&s_tid, NULL, process_trampoline, NULL)) {
+		stop();
+		return -1;
+	}
+#ifdef __linux__
+	pthread_setname_np(s_tid, "df_devserver");
+#endif
+
+	s_running = true;
+	return 0;
+}
+
+void DevServer::stop(void)
+{
+	if (s_running) {
+		__atomic_store_n(&s_stopping, true, __ATOMIC_RELEASE);
+		char c = 0;
+		ssize_t ret;
+		do {
+			ret = write(s_wake_pipe[1], &c, 1);
+		} while (ret < 0 && errno == EINTR);
+		if (ret != 1) {
+			// Also wakes the thread's poll()
+			DF_LOG_ERR("DevServer: cannot wake the server thread (%d)", -errno);
+			shutdown(s_listen_fd, SHUT_RDWR);
+		}
+		pthread_join(s_tid, NULL);
+		s_running = false;
+	}
+
+	for (unsigned int c = 0; c < DEV_SERVER_MAX_CLIENTS; c++) {
+		if (s_clients[c]) {
+			removeClient(c);
+		}
+	}
+	if (s_listen_fd >= 0) {
+		::close(s_listen_fd);
+		s_listen_fd = -1;
+		unlink(s_socket_path);
+	}
+	for (unsigned int i = 0; i < 2; i++) {
+		if (s_wake_pipe[i] >= 0) {
+			::close(s_wake_pipe[i]);
+			s_wake_pipe[i] = -1;
+		}
+	}
+	delete [] s_request;
+	s_request = nullptr;
+	delete [] s_reply;
+	s_reply = nullptr;
+}
+
+bool DevServer::isRunning(void)
+{
+	return s_running;
+}
+
+bool DevServer::isStreaming(void)
+{
+	return __atomic_load_n(&s_num_streams, __ATOMIC_RELAXED) != 0;
+}
@@ -34,12 +34,23 @@
 * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 #include <stdio.h>
-#include <list>
-#include <map>
+#include <errno.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
 #include <pthread.h>
 #include "DriverFramework.hpp"
 #include "DevObj.hpp"
 #include "DevMgr.hpp"
+#include "AllocGuard.hpp"
+#include "Arena.hpp"
+#include "Recorder.hpp"
+#include "DevServer.hpp"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 // Used for backtrace
 #ifdef DF_ENABLE_BACKTRACE
@@ -55,6 +66,17 @@
 
 #define SHOW_STATS 0
 
+// Phase planner limits
+#define PLAN_DEFAULT_TICK_USEC	100
+#define PLAN_MAX_SLOTS		4096
+#define PLAN_MAX_HYPERPERIOD	10000000
+
+// Work items are preallocated so create() and the HRT thread never touch
+// the heap. A handle is the pool index + 1 in the low bits and a
+// generation count in the high bits, so stale handles are rejected.
+#define WORK_ITEMS_MAX		128
+#define WORK_HANDLE_INDEX_BITS	16
+
 using namespace DriverFramework;
 
 //-----------------------------------------------------------------------
@@ -63,29 +85,58 @@ using namespace DriverFramework;
 class WorkItem
 {
 public:
+	WorkItem() :
+		WorkItem(nullptr, nullptr, 0, 0)
+	{}
+
 	WorkItem(workCallback callback, void *arg, uint32_t delay, WorkHandle handle) : 
+		m_next(nullptr),
+		m_prev(nullptr),
+		m_queued(false),
 		m_arg(arg),
 		m_queue_time(0),
+		m_deadline(0),
 		m_callback(callback),
 		m_delay(delay),
-		m_handle(handle)
+		m_queue_delay(delay),
+		m_phase(0),
+		m_phased(false),
+		m_handle(handle),
+		m_runtime_total(0),
+		m_runtime_count(0)
 	{
 		resetStats();
 	}
 	~WorkItem() {}
 
-	void schedule();
+	void schedule(uint64_t now, uint32_t delay);
+
+	// Expected callback runtime in usec, used by the phase planner
+	uint32_t estimatedCost();
 
 	void updateStats(unsigned int cur_usec);
 	void resetStats();
 	void dumpStats();
 
+	// HRTWorkQueue links
+	WorkItem *	m_next;
+	WorkItem *	m_prev;
+	bool		m_queued;
+
 	void *		m_arg;
 	uint64_t	m_queue_time;
+	uint64_t	m_deadline;
 	workCallback	m_callback;
 	uint32_t	m_delay;
+	uint32_t	m_queue_delay;	// delay requested when last scheduled
+	uint32_t	m_phase;	// offset of the deadline grid assigned by the planner
+	bool		m_phased;
 	WorkHandle	m_handle;
 
+	// callback runtime
+	uint64_t	m_runtime_total;
+	unsigned long	m_runtime_count;
+
 	// statistics
 	unsigned long m_last;
 	unsigned long m_min;
@@ -97,29 +148,56 @@ public:
 class HRTWorkQueue
 {
 public:
+	HRTWorkQueue(void) {}
+	~HRTWorkQueue(void) {}
+
 	static HRTWorkQueue *instance(void);
 
 	static int initialize(void);
 	static void finalize(void);
 
-	void scheduleWorkItem(WorkItem *item);
+	void scheduleWorkItem(WorkItem *item, uint32_t delay);
+	void unscheduleWorkItem(WorkItem *item);
+
+	// Block while the callback of item runs on the HRT thread. Call
+	// without holding locks the callback may take.
+	void waitForCallback(WorkItem *item);
 
 	void shutdown(void);
 	void enableStats(bool enable);
 	void clearAll();
 
+	// Set the coalescing slack and reset the measured load
+	void setPlan(uint32_t slack_usec, uint32_t tick_usec);
+	void getMeasuredLoad(WorkPlanStats &stats);
+
 	static void *process_trampoline(void *);
 
-private:
-	HRTWorkQueue(void) {}
-	~HRTWorkQueue(void) {}
+	void hrtLock(void);
+	void hrtUnlock(void);
 
+private:
 	void process(void);
 
-	void hrtLock(void);
-	void hrtUnlock(void);
+	// Append item unless queued, remove it if queued. Call with the lock held.
+	void enqueue(WorkItem *item);
+	void dequeue(WorkItem *item);
 
-	std::list<WorkItem *>	m_work;
+	// Intrusive list of scheduled items
+	WorkItem *	m_head = nullptr;
+	WorkItem *	m_tail = nullptr;
+
+	// Item whose callback is running, and whether it was destroyed meanwhile
+	WorkItem *	m_current = nullptr;
+	bool		m_current_destroyed = false;
+
+	uint32_t	m_slack = 0;
+	uint32_t	m_tick = PLAN_DEFAULT_TICK_USEC;
+
+	// measured load per wakeup
+	unsigned int	m_max_items = 0;
+	uint64_t	m_max_busy = 0;
+	unsigned long	m_wakeups = 0;
 
 	bool m_enable_stats = false;
 	bool m_exit_requested = false;
@@ -138,8 +216,18 @@ static pthread_mutex_t g_framework_exit = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t g_hrt_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t g_reschedule_cond = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t g_framework_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_callback_done_cond = PTHREAD_COND_INITIALIZER;
 
-static std::map<WorkHandle, WorkItem> *g_work_items = nullptr;
+static WorkItem *g_work_items = nullptr;	// pool of WORK_ITEMS_MAX
+static pthread_mutex_t g_work_items_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Current phase plan
+static WorkPlanStats g_plan_stats = {};
+
+// Realtime mode. The arena is kept after shutdown since devices holding
+// arena memory may be destroyed later.
+static Arena *g_arena = nullptr;
+static bool g_realtime = false;
 
 //-----------------------------------------------------------------------
 // Static Functions
@@ -245,8 +333,24 @@ void DriverFramework::backtrace()
 /*************************************************************************
   Framework
 *************************************************************************/
+Arena *Arena::framework()
+{
+	return g_realtime ? g_arena : nullptr;
+}
+
+bool Arena::owns(const void *p)
+{
+	return g_arena && g_arena->contains(p);
+}
+
 void Framework::shutdown()
 {
+	// Write out the samples recorded so far
+	Recorder::stop();
+
+	// Close the handles of other processes
+	DevServer::stop();
+
 	// Stop the HRT queue thread
 	HRTWorkQueue *wq = HRTWorkQueue::instance();
 	if (wq) {
@@ -262,6 +366,14 @@ void Framework::shutdown()
 	// Free the DevMgr resources
 	DevMgr::finalize();
 
+	if (g_realtime) {
+		munlockall();
+		g_realtime = false;
+	}
+
+	// Print what is queued, later messages are printed directly
+	Logger::stop();
+
 	// allow Framework to exit
 	pthread_mutex_lock(&g_framework_exit);
 	pthread_cond_signal(&g_framework_cond);
@@ -270,6 +382,9 @@ void Framework::shutdown()
 
 int Framework::initialize()
 {
+	// Messages from here on are formatted and printed by the logger thread
+	Logger::start();
+
 	int ret = HRTWorkQueue::initialize();
 	if (ret < 0) {
 		return ret;
@@ -282,9 +397,64 @@ int Framework::initialize()
 	if (ret < 0) {
 		return ret-20;
 	}
+
+	// From here on realtime threads must not allocate
+	AllocGuard::arm();
 	return 0;
 }
 
+int Framework::initializeRealtime(size_t arena_size)
+{
+	if (g_arena == nullptr) {
+		g_arena = new Arena();
+		if (g_arena->init(arena_size, true) < 0) {
+			delete g_arena;
+			g_arena = nullptr;
+			return -30;
+		}
+	}
+	else if (g_arena->getSize() - g_arena->getUsed() < arena_size) {
+		// Initialized before: the first arena is reused
+		DF_LOG_ERR("Framework: %zu bytes left in the realtime arena, %zu requested",
+			   g_arena->getSize() - g_arena->getUsed(), arena_size);
+		return -31;
+	}
+
+#ifdef __GLIBC__
+	// Keep freed heap memory mapped so it stays locked and faulted in
+	mallopt(M_MMAP_MAX, 0);
+	mallopt(M_TRIM_THRESHOLD, -1);
+#endif
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		DF_LOG_ERR("Framework: mlockall failed (%d), memory is not locked", errno);
+	}
+
+	prefaultStack(DF_STACK_PREFAULT);
+
+	g_realtime = true;
+	int ret = initialize();
+	if (ret < 0) {
+		munlockall();
+		g_realtime = false;
+	}
+	return ret;
+}
+
+bool Framework::isRealtime()
+{
+	return g_realtime;
+}
+
+void Framework::prefaultStack(size_t bytes)
+{
+	volatile uint8_t *stack = (volatile uint8_t *)alloca(bytes);
+
+	for (size_t off = 0; off < bytes; off += 1024) {
+		stack[off] = 0;
+	}
+}
+
 void Framework::waitForShutdown()
 {
 	// Block until shutdown requested
@@ -296,6 +466,32 @@ void Framework::waitForShutdown()
 /*************************************************************************
   WorkItem
 *************************************************************************/
+void WorkItem::schedule(uint64_t now, uint32_t delay)
+{
+	m_queue_time = now;
+	m_queue_delay = delay;
+	m_deadline = now + delay;
+
+	if (m_phased && m_delay && delay == m_delay) {
+		// Snap to the nearest point of the planned grid (m_phase + k * m_delay)
+		// so the offset assigned by the planner does not drift away
+		uint64_t k = (m_deadline + m_delay/2 - m_phase) / m_delay;
+		m_deadline = m_phase + k*m_delay;
+		if (m_deadline <= now) {
+			m_deadline += m_delay;
+		}
+	}
+}
+
+uint32_t WorkItem::estimatedCost()
+{
+	if (m_runtime_count == 0) {
+		return 1;
+	}
+	uint64_t cost = m_runtime_total / m_runtime_count;
+	return cost ? cost : 1;
+}
+
 void WorkItem::updateStats(unsigned int cur_usec)
 {
 	unsigned long delay = (m_last == ~0x0UL) ? (cur_usec - m_queue_time) : (cur_usec - m_last);
@@ -340,6 +536,12 @@ HRTWorkQueue *HRTWorkQueue::m_instance = NULL;
 
 void *HRTWorkQueue::process_trampoline(void *arg)
 {
+	AllocGuard::RealtimeScope realtime;
+
+	if (Framework::isRealtime()) {
+		Framework::prefaultStack(DF_HRT_STACK_SIZE - DF_HRT_STACK_SIZE / 4);
+	}
+
 	if (m_instance) {
 		m_instance->process();
 	}
@@ -367,7 +569,7 @@ static int setRealtimeSched(pthread_attr_t &attr)
 
 int HRTWorkQueue::initialize(void)
 {
-	m_instance = new HRTWorkQueue();
+	m_instance = dfNew<HRTWorkQueue>();
 
 	if (m_instance == nullptr) {
 		return 1;
@@ -383,10 +585,19 @@ int HRTWorkQueue::initialize(void)
 		return 3;
 	}
 
+	// A known stack size, so all of it can be pre-faulted
+	if (Framework::isRealtime() && pthread_attr_setstacksize(&attr, DF_HRT_STACK_SIZE)) {
+		return 5;
+	}
+
 	// Create high priority worker thread
 	if (pthread_create(&g_tid, &attr, process_trampoline, NULL)) {
 		return 4;
 	}
+#ifdef __linux__
+	// Identifies the thread in lock statistics and tools like top
+	pthread_setname_np(g_tid, "df_hrt");
+#endif
 	return 0;
 }
 
@@ -398,24 +609,126 @@ void HRTWorkQueue::finalize(void)
 		wq->clearAll();
 		pthread_mutex_destroy(&g_hrt_lock);
 
-		delete wq;
-		wq = nullptr;
+		dfDelete(wq);
+		m_instance = nullptr;
 	}
 }
 
-void HRTWorkQueue::scheduleWorkItem(WorkItem *item)
+void HRTWorkQueue::enqueue(WorkItem *item)
+{
+	if (item->m_queued) {
+		return;
+	}
+	item->m_next = nullptr;
+	item->m_prev = m_tail;
+	if (m_tail) {
+		m_tail->m_next = item;
+	}
+	else {
+		m_head = item;
+	}
+	m_tail = item;
+	item->m_queued = true;
+}
+
+void HRTWorkQueue::dequeue(WorkItem *item)
+{
+	if (!item->m_queued) {
+		return;
+	}
+	if (item->m_prev) {
+		item->m_prev->m_next = item->m_next;
+	}
+	else {
+		m_head = item->m_next;
+	}
+	if (item->m_next) {
+		item->m_next->m_prev = item->m_prev;
+	}
+	else {
+		m_tail = item->m_prev;
+	}
+	item->m_next = nullptr;
+	item->m_prev = nullptr;
+	item->m_queued = false;
+}
+
+void HRTWorkQueue::scheduleWorkItem(WorkItem *item, uint32_t delay)
 {
 	hrtLock();
-	m_work.push_back(item);
-	item->m_queue_time = offsetTime();
+	// Scheduling a queued item moves its deadline
+	enqueue(item);
+	item->schedule(offsetTime(), delay);
 	pthread_cond_signal(&g_reschedule_cond);
 	hrtUnlock();
 }
 
+void HRTWorkQueue::unscheduleWorkItem(WorkItem *item)
+{
+	hrtLock();
+	dequeue(item);
+	if (item == m_current) {
+		m_current_destroyed = true;
+	}
+	hrtUnlock();
+}
+
+void HRTWorkQueue::waitForCallback(WorkItem *item)
+{
+	bool warned = false;
+
+	hrtLock();
+	// A callback may destroy its own item
+	while (item == m_current && !pthread_equal(pthread_self(), g_tid)) {
+		timespec ts = offsetTimeToAbsoluteTime(offsetTime() + 1000000);
+		if (pthread_cond_timedwait(&g_callback_done_cond, &g_hrt_lock, &ts) == ETIMEDOUT && !warned) {
+			// Most likely the caller holds a lock the callback is waiting for
+			DF_LOG_ERR("WorkMgr: destroy() still waiting for a running callback after 1 s");
+			warned = true;
+		}
+	}
+	hrtUnlock();
+}
+
 void HRTWorkQueue::clearAll()
 {
 	hrtLock();
-	m_work.clear();
+	while (m_head) {
+		dequeue(m_head);
+	}
+	hrtUnlock();
+}
+
+void HRTWorkQueue::setPlan(uint32_t slack_usec, uint32_t tick_usec)
+{
+	hrtLock();
+	m_slack = slack_usec;
+	m_tick = tick_usec;
+
+	// Move pending deadlines onto the new phase grid. Snapping can move a
+	// deadline into the past, and all of those would then be dispatched
+	// together by the next wakeup.
+	uint64_t now = offsetTime();
+	for (WorkItem *item = m_head; item; item = item->m_next) {
+		item->schedule(item->m_queue_time, item->m_queue_delay);
+		while (item->m_phased && item->m_queue_delay == item->m_delay && item->m_deadline <= now) {
+			item->m_deadline += item->m_delay;
+		}
+	}
+
+	m_max_items = 0;
+	m_max_busy = 0;
+	m_wakeups = 0;
+	pthread_cond_signal(&g_reschedule_cond);
+	hrtUnlock();
+}
+
+void HRTWorkQueue::getMeasuredLoad(WorkPlanStats &stats)
+{
+	hrtLock();
+	stats.measured_max_items = m_max_items;
+	stats.measured_max_utilization = (float)m_max_busy / m_tick;
+	stats.measured_wakeups = m_wakeups;
 	hrtUnlock();
 }
 
@@ -429,47 +742,77 @@ void HRTWorkQueue::shutdown(void)
 
 void HRTWorkQueue::process(void)
 {
-	std::list<WorkItem *>::iterator work_itr;
+	WorkItem *work_itr;
 	uint64_t next;
-	uint64_t elapsed;
 	uint64_t remaining;
 	timespec ts;
 	uint64_t now;
+	uint64_t start;
+	unsigned int dispatched;
 
 	while(!m_exit_requested) {
 		hrtLock();
 
 		// Wake up every 10 sec if nothing scheduled
 		next = 10000000;
-		work_itr = m_work.begin();
+		work_itr = m_head;
+		dispatched = 0;
 
 		now = offsetTime();
-		while (work_itr != m_work.end()) {
+		start = now;
+		while (work_itr != nullptr) {
 			now = offsetTime();
-			elapsed = now - (*work_itr)->m_queue_time;
 
-			if (elapsed >= (*work_itr)->m_delay) {
-				WorkItem *dequeuedWork = *work_itr;
+			// Items due within the slack are coalesced into this wakeup
+			if (now + m_slack >= work_itr->m_deadline) {
+				WorkItem *dequeuedWork = work_itr;
+
+				// Remove before dispatch so the callback can reschedule
+				// or destroy the WorkItem while the lock is released
+				dequeue(dequeuedWork);
+				m_current = dequeuedWork;
+				m_current_destroyed = false;
 
-				// Mutex is recursive so the WorkItem can be rescheduled
-				// while the lock is held
 				dequeuedWork->updateStats(now);
 				hrtUnlock();
 				dequeuedWork->m_callback(dequeuedWork->m_arg, dequeuedWork->m_handle);
+				uint64_t done = offsetTime();
 				hrtLock();
 
-				work_itr = m_work.erase(work_itr);
+				if (!m_current_destroyed) {
+					dequeuedWork->m_runtime_total += done - now;
+					dequeuedWork->m_runtime_count++;
+				} else {
+					pthread_cond_broadcast(&g_callback_done_cond);
+				}
+				m_current = nullptr;
+				++dispatched;
+
+				// The list may have changed while unlocked
+				next = 10000000;
+				work_itr = m_head;
 			} else {
-				remaining = (*work_itr)->m_delay - elapsed;
+				remaining = work_itr->m_deadline - now;
 				if (remaining < next) {
 					next = remaining;
 				}
 
 				// try the next in the list
-				++work_itr;
+				work_itr = work_itr->m_next;
 			}
 		}
 
+		if (dispatched) {
+			++m_wakeups;
+			if (dispatched > m_max_items) {
+				m_max_items = dispatched;
+			}
+			// now was taken before the last callback ran
+			uint64_t busy = offsetTime() - start;
+			if (busy > m_max_busy) {
+				m_max_busy = busy;
+			}
+		}
 
 		// pthread_cond_timedwait uses absolute time
 		ts = offsetTimeToAbsoluteTime(now+next);
@@ -495,50 +838,271 @@ void HRTWorkQueue::hrtUnlock()
 *************************************************************************/
 int WorkMgr::initialize()
 {
-	g_work_items = new std::map<WorkHandle,WorkItem>;
-	return 0;
+	g_work_items = dfNewArray<WorkItem>(WORK_ITEMS_MAX);
+	return g_work_items ? 0 : -1;
 }
 
 void WorkMgr::finalize()
 {
-	std::map<WorkHandle,WorkItem>::iterator it = g_work_items->begin();
-	while(it != g_work_items->end())
-	{
-		// Remove the element from the map
-		g_work_items->erase(it);
-		it = g_work_items->begin();
-	}
-	delete g_work_items;
+	pthread_mutex_lock(&g_work_items_lock);
+	dfDeleteArray(g_work_items);
 	g_work_items = nullptr;
+	pthread_mutex_unlock(&g_work_items_lock);
+}
+
+// Call with g_work_items_lock held
+static WorkItem *lookupWorkItem(WorkHandle handle)
+{
+	unsigned int index = (handle & ((1 << WORK_HANDLE_INDEX_BITS) - 1)) - 1;
+
+	if (g_work_items == nullptr || index >= WORK_ITEMS_MAX ||
+	    g_work_items[index].m_handle != handle) {
+		return nullptr;
+	}
+	return &g_work_items[index];
 }
 
 WorkHandle WorkMgr::create(workCallback cb, void *arg, uint32_t delay)
 {
-	static WorkHandle i=1000;
-	std::map<WorkHandle,WorkItem>::iterator it = g_work_items->begin();
-	++i;
-  	g_work_items->insert (it, std::pair<WorkHandle,WorkItem>(i, WorkItem(cb, arg, delay, i)));
-	return i;
+	static uint32_t generation = 0;
+	WorkHandle handle = 0;
+
+	pthread_mutex_lock(&g_work_items_lock);
+	for (unsigned int i = 0; g_work_items && i < WORK_ITEMS_MAX; ++i) {
+		if (g_work_items[i].m_handle == 0) {
+			if (++generation >= (1u << (32 - WORK_HANDLE_INDEX_BITS))) {
+				generation = 1;
+			}
+			handle = (generation << WORK_HANDLE_INDEX_BITS) | (i + 1);
+			g_work_items[i] = WorkItem(cb, arg, delay, handle);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_work_items_lock);
+
+	if (handle == 0) {
+		DF_LOG_ERR("WorkMgr: all %d work items in use", WORK_ITEMS_MAX);
+	}
+	return handle;
 }
 
 void WorkMgr::destroy(WorkHandle &handle)
 {
-	// remove from map, then from work queue, then delete
-	std::map<WorkHandle,WorkItem>::iterator it = g_work_items->find(handle);
-	if (it != g_work_items->end()) {
-		g_work_items->erase(it);
+	// remove from work queue, then free the pool entry
+	HRTWorkQueue *wq = HRTWorkQueue::instance();
+	pthread_mutex_lock(&g_work_items_lock);
+	WorkItem *item = lookupWorkItem(handle);
+	if (item) {
+		if (wq) {
+			wq->unscheduleWorkItem(item);
+		}
+		item->m_handle = 0;
+	}
+	pthread_mutex_unlock(&g_work_items_lock);
+
+	// The caller may free what a running callback uses once this returns
+	if (item && wq) {
+		wq->waitForCallback(item);
 	}
+
 	// mark the handle as cleared
 	handle = 0;
 }
 
 bool WorkMgr::schedule(WorkHandle handle)
 {
-	std::map<WorkHandle,WorkItem>::iterator it = g_work_items->find(handle);
-	bool ret = it != g_work_items->end();
-	if (ret) {
-		HRTWorkQueue::instance()->scheduleWorkItem(&(it->second));
+	HRTWorkQueue *wq = HRTWorkQueue::instance();
+	if (wq == nullptr) {
+		return false;
+	}
+
+	pthread_mutex_lock(&g_work_items_lock);
+	WorkItem *item = lookupWorkItem(handle);
+	if (item) {
+		wq->scheduleWorkItem(item, item->m_delay);
+	}
+	pthread_mutex_unlock(&g_work_items_lock);
+	return item != nullptr;
+}
+
+bool WorkMgr::scheduleIn(WorkHandle handle, uint32_t delay_usec)
+{
+	HRTWorkQueue *wq = HRTWorkQueue::instance();
+	if (wq == nullptr) {
+		return false;
 	}
-	return ret;
+
+	pthread_mutex_lock(&g_work_items_lock);
+	WorkItem *item = lookupWorkItem(handle);
+	if (item) {
+		wq->scheduleWorkItem(item, delay_usec);
+	}
+	pthread_mutex_unlock(&g_work_items_lock);
+	return item != nullptr;
 }
 
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static bool shorterPeriodFirst(WorkItem *a, WorkItem *b)
+{
+	if (a->m_delay != b->m_delay) {
+		return a->m_delay < b->m_delay;
+	}
+	return a->estimatedCost() > b->estimatedCost();
+}
+
+int WorkMgr::planPhases(uint32_t slack_usec)
+{
+	HRTWorkQueue *wq = HRTWorkQueue::instance();
+	if (wq == nullptr || g_work_items == nullptr) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&g_work_items_lock);
+
+	std::vector<WorkItem *> items;
+	for (unsigned int i = 0; i < WORK_ITEMS_MAX; ++i) {
+		if (g_work_items[i].m_handle && g_work_items[i].m_delay) {
+			items.push_back(&g_work_items[i]);
+		}
+	}
+
+	WorkPlanStats plan = {};
+	plan.num_items = items.size();
+
+	if (items.empty()) {
+		plan.tick_usec = slack_usec ? slack_usec : PLAN_DEFAULT_TICK_USEC;
+		g_plan_stats = plan;
+		wq->setPlan(slack_usec, plan.tick_usec);
+		pthread_mutex_unlock(&g_work_items_lock);
+		return 0;
+	}
+
+	std::sort(items.begin(), items.end(), shorterPeriodFirst);
+
+	// Coalescing more than half the shortest period would merge
+	// consecutive deadlines of the same item
+	uint32_t min_delay = items.front()->m_delay;
+	if (slack_usec > min_delay/2) {
+		slack_usec = min_delay/2;
+	}
+
+	// The hyperperiod is the LCM of all periods, bounded so the plan stays small
+	uint64_t hyperperiod = 1;
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		uint64_t d = items[i]->m_delay;
+		hyperperiod = hyperperiod / gcd(hyperperiod, d) * d;
+		if (hyperperiod > PLAN_MAX_HYPERPERIOD) {
+			hyperperiod = (PLAN_MAX_HYPERPERIOD / items.back()->m_delay) * items.back()->m_delay;
+			break;
+		}
+	}
+
+	uint64_t tick = slack_usec ? slack_usec : PLAN_DEFAULT_TICK_USEC;
+	if (tick > min_delay) {
+		tick = min_delay;
+	}
+	if (hyperperiod / tick > PLAN_MAX_SLOTS) {
+		tick = (hyperperiod + PLAN_MAX_SLOTS - 1) / PLAN_MAX_SLOTS;
+	}
+
+	// Phase slots are one tick apart, so a coalescing window of a whole
+	// tick would merge each slot with its neighbour into one wakeup
+	if (slack_usec >= tick) {
+		slack_usec = tick / 2;
+	}
+	unsigned int slots = (hyperperiod + tick - 1) / tick;
+
+	// Greedy assignment: constrained (short period) items first, each one
+	// takes the phase whose worst slot is least loaded
+	std::vector<uint64_t> cost(slots, 0);
+	std::vector<unsigned int> count(slots, 0);
+
+	for (unsigned int i = 0; i < items.size(); ++i) {
+		WorkItem *item = items[i];
+		uint32_t item_cost = item->estimatedCost();
+		unsigned int period = (item->m_delay + tick/2) / tick;
+		if (period == 0) {
+			period = 1;
+		}
+		unsigned int phases = (period < slots) ? period : slots;
+
+		// Ties are broken by the load of the neighbouring slots so items
+		// end up spaced out rather than in adjacent ticks
+		unsigned int best_phase = 0;
+		uint64_t best_max = ~0ULL;
+		uint64_t best_sum = ~0ULL;
+		uint64_t best_near = ~0ULL;
+		for (unsigned int p = 0; p < phases; ++p) {
+			uint64_t worst = 0;
+			uint64_t sum = 0;
+			uint64_t near = 0;
+			for (unsigned int s = p; s < slots; s += period) {
+				if (cost[s] > worst) {
+					worst = cost[s];
+				}
+				sum += cost[s];
+				near += cost[(s + slots - 1) % slots] + cost[(s + 1) % slots];
+			}
+			if (worst < best_max ||
+			    (worst == best_max && (sum < best_sum || (sum == best_sum && near < best_near)))) {
+				best_max = worst;
+				best_sum = sum;
+				best_near = near;
+				best_phase = p;
+			}
+		}
+
+		for (unsigned int s = best_phase; s < slots; s += period) {
+			cost[s] += item_cost;
+			count[s]++;
+		}
+
+		item->m_phase = best_phase * tick;
+		if (item->m_phase >= item->m_delay) {
+			item->m_phase = 0;
+		}
+		item->m_phased = true;
+	}
+
+	uint64_t max_cost = 0;
+	for (unsigned int s = 0; s < slots; ++s) {
+		if (cost[s] > max_cost) {
+			max_cost = cost[s];
+		}
+		if (count[s] > plan.predicted_max_items) {
+			plan.predicted_max_items = count[s];
+		}
+	}
+
+	plan.hyperperiod_usec = hyperperiod;
+	plan.tick_usec = tick;
+	plan.predicted_max_utilization = (float)max_cost / tick;
+	g_plan_stats = plan;
+
+	wq->setPlan(slack_usec, tick);
+
+	pthread_mutex_unlock(&g_work_items_lock);
+
+	return plan.num_items;
+}
+
+void WorkMgr::getPlanStats(WorkPlanStats &stats)
+{
+	pthread_mutex_lock(&g_work_items_lock);
+	stats = g_plan_stats;
+	pthread_mutex_unlock(&g_work_items_lock);
+
+	HRTWorkQueue *wq = HRTWorkQueue::instance();
+	if (wq) {
+		wq->getMeasuredLoad(stats);
+	}
+}
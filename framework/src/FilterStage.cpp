@@ -0,0 +1,174 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <string.h>
+#include "FilterStage.hpp"
+
+using namespace DriverFramework;
+
+FilterStage::FilterStage(const char *name, const char *dev_base_path, unsigned int channels, unsigned int capacity) :
+	VirtDevObj(name, dev_base_path, 0),
+	m_channels(channels),
+	m_lanes((channels + 3) & ~3u),
+	m_capacity(capacity),
+	m_upstream(nullptr),
+	m_offsets(new size_t[channels]),
+	m_seq(0),
+	m_in(nullptr),
+	m_timestamps(new uint64_t[FILTER_STAGE_BATCH]),
+	m_work(new float[FILTER_STAGE_BATCH * m_lanes]),
+	m_out(new float[FILTER_STAGE_BATCH * channels]),
+	m_reset(false)
+{
+	for (unsigned int c = 0; c < channels; c++) {
+		m_offsets[c] = c * sizeof(float);
+	}
+}
+
+FilterStage::~FilterStage()
+{
+	delete [] m_offsets;
+	delete [] m_in;
+	delete [] m_timestamps;
+	delete [] m_work;
+	delete [] m_out;
+}
+
+int FilterStage::setInput(DevObj &upstream, const size_t *offsets)
+{
+	unsigned int sample_size = upstream.getSampleSize();
+
+	for (unsigned int c = 0; c < m_channels; c++) {
+		size_t offset = offsets ? offsets[c] : c * sizeof(float);
+		if (offset + sizeof(float) > sample_size) {
+			return -EINVAL;
+		}
+		m_offsets[c] = offset;
+	}
+
+	delete [] m_in;
+	m_in = new uint8_t[FILTER_STAGE_BATCH * sample_size];
+	m_upstream = &upstream;
+	return 0;
+}
+
+void FilterStage::addFilter(SampleFilter &filter)
+{
+	m_filters.push_back(&filter);
+}
+
+int FilterStage::start()
+{
+	if (m_upstream == nullptr) {
+		return -EINVAL;
+	}
+
+	if (getSampleSize() == 0) {
+		int ret = enableSampleBuffer(m_channels * sizeof(float), m_capacity);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	std::list<SampleFilter *>::iterator it = m_filters.begin();
+	for (; it != m_filters.end(); ++it) {
+		int ret = (*it)->init(m_lanes);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	int ret = VirtDevObj::start();
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Starts with the oldest sample still buffered upstream
+	m_seq = 0;
+
+	return addUpstream(*m_upstream);
+}
+
+int FilterStage::stop()
+{
+	if (m_upstream) {
+		removeUpstream(*m_upstream);
+	}
+	return VirtDevObj::stop();
+}
+
+void FilterStage::reset()
+{
+	__atomic_store_n(&m_reset, true, __ATOMIC_RELEASE);
+}
+
+void FilterStage::_measure()
+{
+	const unsigned int sample_size = m_upstream->getSampleSize();
+
+	// Clear before resetting, so a reset() that comes in meanwhile is
+	// not lost
+	if (__atomic_exchange_n(&m_reset, false, __ATOMIC_ACQUIRE)) {
+		std::list<SampleFilter *>::iterator it = m_filters.begin();
+		for (; it != m_filters.end(); ++it) {
+			(*it)->reset();
+		}
+	}
+
+	int count;
+	while ((count = m_upstream->peekSamples(m_seq, m_in, m_timestamps, FILTER_STAGE_BATCH)) > 0) {
+
+		// Unpack into lanes, the padding lanes stay zero
+		memset(m_work, 0, count * m_lanes * sizeof(float));
+		for (int i = 0; i < count; i++) {
+			for (unsigned int c = 0; c < m_channels; c++) {
+				memcpy(&m_work[i * m_lanes + c], &m_in[i * sample_size + m_offsets[c]], sizeof(float));
+			}
+		}
+
+		unsigned int kept = count;
+		std::list<SampleFilter *>::iterator it = m_filters.begin();
+		for (; it != m_filters.end() && kept; ++it) {
+			kept = (*it)->process(m_work, m_timestamps, kept);
+		}
+
+		for (unsigned int i = 0; i < kept; i++) {
+			memcpy(&m_out[i * m_channels], &m_work[i * m_lanes], m_channels * sizeof(float));
+		}
+
+		publishSamples(m_out, m_timestamps, kept);
+	}
+}
@@ -0,0 +1,420 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "Logger.hpp"
+
+using namespace DriverFramework;
+
+// Single producer, single consumer ring of encoded messages. Positions
+// are free running and wrap modulo DF_LOG_RING_SIZE.
+class LogRing
+{
+public:
+	alignas(64) uint32_t	m_head;		// written by the owning thread
+	alignas(64) uint32_t	m_tail;		// written by the logger
+	bool			m_in_use;
+	bool			m_released;	// the owning thread exited
+
+	uint8_t			m_data[DF_LOG_RING_SIZE];
+
+	void copyIn(uint32_t pos, const uint8_t *src, unsigned int len)
+	{
+		uint32_t off = pos & (DF_LOG_RING_SIZE - 1);
+		unsigned int first = DF_LOG_RING_SIZE - off;
+		if (first >= len) {
+			memcpy(&m_data[off], src, len);
+		}
+		else {
+			memcpy(&m_data[off], src, first);
+			memcpy(m_data, src + first, len - first);
+		}
+	}
+
+	void copyOut(uint32_t pos, uint8_t *dst, unsigned int len)
+	{
+		uint32_t off = pos & (DF_LOG_RING_SIZE - 1);
+		unsigned int first = DF_LOG_RING_SIZE - off;
+		if (first >= len) {
+			memcpy(dst, &m_data[off], len);
+		}
+		else {
+			memcpy(dst, &m_data[off], first);
+			memcpy(dst + first, m_data, len - first);
+		}
+	}
+};
+
+bool Logger::s_running = false;
+uint64_t Logger::s_seq = 0;
+
+// Static, so logging works before the framework is initialized and a
+// thread's ring stays valid across restarts
+static LogRing s_rings[DF_LOG_MAX_THREADS];
+static thread_local LogRing *t_ring = nullptr;
+
+static pthread_key_t s_ring_key;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+static unsigned long s_dropped = 0;
+static unsigned long s_reported_dropped = 0;
+
+// Serializes consumers: the logger thread, flush() and stop()
+static pthread_mutex_t s_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *s_out = nullptr;
+
+static pthread_t s_tid;
+static bool s_stop = false;
+
+static void releaseRing(void *ring)
+{
+	// The logger frees the ring once it is drained
+	__atomic_store_n(&((LogRing *)ring)->m_released, true, __ATOMIC_RELEASE);
+}
+
+static void flushAtExit(void)
+{
+	Logger::flush();
+}
+
+static void initOnce(void)
+{
+	pthread_key_create(&s_ring_key, releaseRing);
+	atexit(flushAtExit);
+}
+
+static LogRing *claimRing(void)
+{
+	for (unsigned int i = 0; i < DF_LOG_MAX_THREADS; i++) {
+		bool unused = false;
+		if (__atomic_compare_exchange_n(&s_rings[i].m_in_use, &unused, true, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			// Does not allocate for the first keys of a process
+			pthread_setspecific(s_ring_key, &s_rings[i]);
+			return &s_rings[i];
+		}
+	}
+	return nullptr;
+}
+
+void Logger::push(const uint8_t *rec, unsigned int size)
+{
+	LogRing *ring = t_ring;
+	if (ring == nullptr) {
+		ring = t_ring = claimRing();
+		if (ring == nullptr) {
+			__atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	uint32_t head = ring->m_head;
+	uint32_t tail = __atomic_load_n(&ring->m_tail, __ATOMIC_ACQUIRE);
+	if (head - tail + size > DF_LOG_RING_SIZE) {
+		__atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ring->copyIn(head, rec, size);
+	__atomic_store_n(&ring->m_head, head + size, __ATOMIC_RELEASE);
+}
+
+// Append the message formatted from an encoded record to out. Each
+// conversion of the format is printed on its own with the argument
+// widened to the type it was stored as.
+static void formatRecord(const uint8_t *rec, FILE *out)
+{
+	LogRecordHeader hdr;
+	memcpy(&hdr, rec, sizeof(hdr));
+
+	const uint8_t *arg = rec + sizeof(hdr);
+	const uint8_t *end = rec + hdr.size;
+	const char *p = hdr.fmt;
+
+	while (*p) {
+		if (*p != '%') {
+			const char *next = strchr(p, '%');
+			size_t len = next ? (size_t)(next - p) : strlen(p);
+			fwrite(p, 1, len, out);
+			p += len;
+			continue;
+		}
+		if (p[1] == '%') {
+			fputc('%', out);
+			p += 2;
+			continue;
+		}
+
+		// Flags, width and precision are kept, the length modifier is
+		// replaced to match the stored argument
+		const char *start = p++;
+		char spec[32];
+		size_t n = 0;
+		spec[n++] = '%';
+		bool star = false;
+		while (*p && strchr("-+ #0123456789.*", *p) && n < sizeof(spec) - 4) {
+			star = star || (*p == '*');
+			spec[n++] = *p++;
+		}
+		while (*p && strchr("hlLqjzt", *p)) {
+			p++;
+		}
+		char conv = *p;
+		if (conv == '\0' || star || arg >= end) {
+			// Not supported, or no argument left: print as is
+			fwrite(start, 1, (conv ? p + 1 : p) - start, out);
+			if (conv) {
+				p++;
+			}
+			continue;
+		}
+		p++;
+
+		uint8_t type = *arg++;
+		int64_t i64 = 0;
+		uint64_t u64 = 0;
+		double d = 0.0;
+		char str[DF_LOG_MAX_STRING];
+
+		switch (type) {
+		case LOG_ARG_INT:
+			memcpy(&i64, arg, sizeof(i64));
+			u64 = (uint64_t)i64;
+			d = (double)i64;
+			arg += sizeof(i64);
+			break;
+		case LOG_ARG_UINT:
+		case LOG_ARG_PTR:
+			memcpy(&u64, arg, sizeof(u64));
+			i64 = (int64_t)u64;
+			d = (double)u64;
+			arg += sizeof(u64);
+			break;
+		case LOG_ARG_DOUBLE:
+			memcpy(&d, arg, sizeof(d));
+			i64 = (int64_t)d;
+			u64 = (uint64_t)i64;
+			arg += sizeof(d);
+			break;
+		case LOG_ARG_STRING: {
+			unsigned int len = *arg++;
+			memcpy(str, arg, len);
+			str[len] = '\0';
+			arg += len;
+			break;
+		}
+		default:
+			// Corrupt record
+			fputs("<bad log record>", out);
+			return;
+		}
+
+		switch (conv) {
+		case 'd':
+		case 'i':
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, (long long)i64);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, (unsigned long long)u64);
+			break;
+		case 'c':
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, (int)i64);
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, d);
+			break;
+		case 'p':
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, (void *)(uintptr_t)u64);
+			break;
+		case 's':
+			spec[n++] = conv;
+			spec[n] = '\0';
+			fprintf(out, spec, type == LOG_ARG_STRING ? str : "<not a string>");
+			break;
+		default:
+			fwrite(start, 1, p - start, out);
+			break;
+		}
+	}
+}
+
+// Print the messages queued up to now, in logging order across threads
+static void drain(void)
+{
+	uint32_t heads[DF_LOG_MAX_THREADS];
+	uint8_t rec[DF_LOG_MAX_RECORD];
+
+	pthread_mutex_lock(&s_drain_lock);
+	FILE *out = s_out ? s_out : stdout;
+
+	// Messages queued while draining wait for the next pass
+	for (unsigned int i = 0; i < DF_LOG_MAX_THREADS; i++) {
+		heads[i] = __atomic_load_n(&s_rings[i].m_head, __ATOMIC_ACQUIRE);
+	}
+
+	for (;;) {
+		LogRing *oldest = nullptr;
+		uint64_t oldest_seq = 0;
+
+		for (unsigned int i = 0; i < DF_LOG_MAX_THREADS; i++) {
+			LogRing &ring = s_rings[i];
+			if (ring.m_tail == heads[i]) {
+				continue;
+			}
+			LogRecordHeader hdr;
+			ring.copyOut(ring.m_tail, (uint8_t *)&hdr, sizeof(hdr));
+			if (oldest == nullptr || hdr.seq < oldest_seq) {
+				oldest = &ring;
+				oldest_seq = hdr.seq;
+			}
+		}
+		if (oldest == nullptr) {
+			break;
+		}
+
+		uint16_t size;
+		oldest->copyOut(oldest->m_tail, (uint8_t *)&size, sizeof(size));
+		oldest->copyOut(oldest->m_tail, rec, size);
+		__atomic_store_n(&oldest->m_tail, oldest->m_tail + size, __ATOMIC_RELEASE);
+
+		formatRecord(rec, out);
+	}
+
+	// Free the rings of threads that exited
+	for (unsigned int i = 0; i < DF_LOG_MAX_THREADS; i++) {
+		LogRing &ring = s_rings[i];
+		if (__atomic_load_n(&ring.m_released, __ATOMIC_ACQUIRE) &&
+		    ring.m_tail == __atomic_load_n(&ring.m_head, __ATOMIC_ACQUIRE)) {
+			ring.m_head = 0;
+			ring.m_tail = 0;
+			ring.m_released = false;
+			__atomic_store_n(&ring.m_in_use, false, __ATOMIC_RELEASE);
+		}
+	}
+
+	unsigned long dropped = __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+	if (dropped != s_reported_dropped) {
+		fprintf(out, "Logger: %lu messages dropped\n", dropped - s_reported_dropped);
+		s_reported_dropped = dropped;
+	}
+
+	fflush(out);
+	pthread_mutex_unlock(&s_drain_lock);
+}
+
+static void *process_trampoline(void *arg)
+{
+	while (!__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) {
+		usleep(DF_LOG_FLUSH_USEC);
+		drain();
+	}
+	return NULL;
+}
+
+int Logger::start(void)
+{
+	if (isRunning()) {
+		return 0;
+	}
+	pthread_once(&s_once, initOnce);
+
+	__atomic_store_n(&s_stop, false, __ATOMIC_RELEASE);
+	if (pthread_create(&s_tid, NULL, process_trampoline, NULL)) {
+		return -1;
+	}
+#ifdef __linux__
+	pthread_setname_np(s_tid, "df_log");
+#endif
+	__atomic_store_n(&s_running, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void Logger::stop(void)
+{
+	if (!isRunning()) {
+		return;
+	}
+
+	// Messages logged from now on are printed directly
+	__atomic_store_n(&s_running, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&s_stop, true, __ATOMIC_RELEASE);
+	pthread_join(s_tid, NULL);
+	drain();
+}
+
+void Logger::flush(void)
+{
+	drain();
+}
+
+void Logger::setOutput(FILE *out)
+{
+	pthread_mutex_lock(&s_drain_lock);
+	s_out = out;
+	pthread_mutex_unlock(&s_drain_lock);
+}
+
+unsigned long Logger::getDropped(void)
+{
+	return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
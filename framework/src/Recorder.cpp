@@ -0,0 +1,721 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "DriverFramework.hpp"
+#include "DevObj.hpp"
+#include "Recorder.hpp"
+#include "SyncObj.hpp"
+
+using namespace DriverFramework;
+
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader is part of the file format");
+static_assert(DEV_PATH_MAX <= sizeof(RecordDeviceInfo::path), "device path does not fit");
+
+#define RECORD_ALIGN(size)	(((size) + 7) & ~(size_t)7)
+
+// Largest record, the size field is 16 bits
+#define RECORD_MAX_SIZE		0xfff8
+
+static_assert(sizeof(RecordIndexEntry) == 24 && sizeof(RecordIndexInfo) == 16, "part of the file format");
+static_assert(sizeof(RecordHeader) + RECORDER_INDEX_ENTRIES * sizeof(RecordIndexEntry) +
+	      sizeof(RecordIndexInfo) <= RECORD_MAX_SIZE, "RECORD_INDEX too large");
+
+struct RecorderBuffer
+{
+	uint8_t *	data;
+	size_t		used;
+};
+
+struct RecorderDevice
+{
+	const DevObj *	dev;
+	unsigned long	drops;		// samples lost since the last RECORD_DROP
+	uint64_t	drop_seq;
+	uint64_t	drop_timestamp;
+
+	// Block being coded when compressing, the codec is nullptr for
+	// devices written as RECORD_SAMPLEs
+	SampleCodec *	codec;
+	uint8_t *	block;
+	uint64_t	block_seq;
+	uint64_t	block_last_timestamp;
+	size_t		raw_size;	// of one RECORD_SAMPLE
+};
+
+bool Recorder::s_running = false;
+
+// Guards everything below. Publishers hold it while serializing samples,
+// the recorder thread only to hand over buffers. Publishers run on the
+// HRT thread, so the lock passes their priority on to the recorder
+// thread while it holds the lock.
+static SyncObj s_lock(SYNC_OBJ_PRIO_INHERIT, "Recorder");
+
+static RecorderConfig s_config;
+static RecorderBuffer *s_buffers = nullptr;
+
+// Buffers s_write ... s_write + s_queued - 1 are waiting to be written,
+// the next one is being filled
+static unsigned int s_write = 0;
+static unsigned int s_queued = 0;
+static uint64_t s_flushed_at = 0;
+
+static RecorderDevice s_devices[RECORDER_MAX_DEVICES];
+static SampleCodec *s_codecs = nullptr;
+static uint8_t *s_blocks = nullptr;
+static RecorderStats s_stats;
+
+// Records of the active buffer for its RECORD_INDEX, when compressing.
+// The offsets are in the buffer until the index is written.
+static RecordIndexEntry *s_index = nullptr;
+static unsigned int s_index_count = 0;
+static size_t s_index_back = 0;		// from the last RECORD_INDEX to the active buffer, 0 if none
+static unsigned long s_reported_dropped = 0;
+
+static int s_fd = -1;
+static off_t s_offset = 0;
+static size_t s_align = 0;	// pad writes to this, 0 without O_DIRECT
+static pthread_t s_tid;
+static bool s_stop = false;
+
+// The buffer being filled, nullptr if all are waiting to be written
+static RecorderBuffer *activeBuffer()
+{
+	if (s_queued == s_config.buffers) {
+		return nullptr;
+	}
+	return &s_buffers[(s_write + s_queued) % s_config.buffers];
+}
+
+static size_t indexSize(unsigned int num_entries)
+{
+	return sizeof(RecordHeader) + num_entries * sizeof(RecordIndexEntry) + sizeof(RecordIndexInfo);
+}
+
+// Pad buf so that size more bytes end at the write alignment
+static void pad(RecorderBuffer &buf, size_t size)
+{
+	if (s_align == 0) {
+		return;
+	}
+
+	size_t gap = ((buf.used + size + s_align - 1) & ~(s_align - 1)) - buf.used - size;
+	if (gap) {
+		RecordHeader *hdr = (RecordHeader *)&buf.data[buf.used];
+		hdr->size = gap;
+		hdr->type = RECORD_PAD;
+		buf.used += gap;
+	}
+}
+
+// End buf with the RECORD_INDEX of its records
+static void writeIndex(RecorderBuffer &buf)
+{
+	size_t size = indexSize(s_index_count);
+	pad(buf, size);
+
+	RecordHeader *hdr = (RecordHeader *)&buf.data[buf.used];
+	hdr->size = size;
+	hdr->type = RECORD_INDEX;
+	hdr->device = 0;
+	hdr->seq = 0;
+	hdr->timestamp = offsetTime();
+
+	RecordIndexEntry *entries = (RecordIndexEntry *)(hdr + 1);
+	for (unsigned int i = 0; i < s_index_count; i++) {
+		entries[i] = s_index[i];
+		entries[i].offset = buf.used - s_index[i].offset;
+	}
+
+	RecordIndexInfo *info = (RecordIndexInfo *)&entries[s_index_count];
+	info->num_entries = s_index_count;
+	info->prev = s_index_back ? s_index_back + buf.used : 0;
+	info->reserved = 0;
+	memcpy(info->magic, "DFIX", 4);
+
+	buf.used += size;
+	s_index_back = size;
+	s_index_count = 0;
+}
+
+// Queue the active buffer for writing, padded to the write alignment
+static void queueActive()
+{
+	RecorderBuffer *buf = activeBuffer();
+	if (buf == nullptr || buf->used == 0) {
+		return;
+	}
+
+	if (s_index) {
+		writeIndex(*buf);
+	}
+	else {
+		pad(*buf, 0);
+	}
+
+	s_queued++;
+	s_lock.signal();
+}
+
+// A record of size bytes fits in buf, leaving space for its RECORD_INDEX
+// with one more entry
+static bool fits(const RecorderBuffer &buf, size_t size)
+{
+	if (s_index == nullptr) {
+		return buf.used + size <= s_config.buffer_size;
+	}
+	return s_index_count < RECORDER_INDEX_ENTRIES &&
+	       buf.used + size + indexSize(s_index_count + 1) <= s_config.buffer_size;
+}
+
+// Space for a record of size bytes, with s_lock held
+static RecordHeader *reserve(size_t size, uint8_t type, uint8_t device, uint64_t seq, uint64_t timestamp)
+{
+	// Rotating would not make room for a record larger than a buffer
+	if (size + (s_index ? indexSize(1) : 0) > s_config.buffer_size) {
+		return nullptr;
+	}
+
+	RecorderBuffer *buf = activeBuffer();
+	if (buf && !fits(*buf, size)) {
+		queueActive();
+		buf = activeBuffer();
+	}
+	if (buf == nullptr || !fits(*buf, size)) {
+		return nullptr;
+	}
+
+	RecordHeader *hdr = (RecordHeader *)&buf->data[buf->used];
+	hdr->size = size;
+	hdr->type = type;
+	hdr->device = device;
+	hdr->seq = (uint32_t)seq;
+	hdr->timestamp = timestamp;
+	buf->used += size;
+	return hdr;
+}
+
+// List a record just reserved in the RECORD_INDEX of the active buffer
+static void addIndex(const RecordHeader *hdr, unsigned int count, uint64_t last_timestamp)
+{
+	if (s_index == nullptr) {
+		return;
+	}
+
+	uint32_t offset = (const uint8_t *)hdr - activeBuffer()->data;
+
+	// Consecutive RECORD_SAMPLEs of a device share an entry
+	if (hdr->type == RECORD_SAMPLE && s_index_count) {
+		RecordIndexEntry &last = s_index[s_index_count - 1];
+		if (last.type == RECORD_SAMPLE && last.device == hdr->device && last.count < CODEC_BLOCK_SAMPLES &&
+		    last.offset + last.count * hdr->size == offset) {
+			last.count++;
+			last.last_timestamp = last_timestamp;
+			return;
+		}
+	}
+
+	RecordIndexEntry &entry = s_index[s_index_count++];
+	entry.offset = offset;
+	entry.type = hdr->type;
+	entry.device = hdr->device;
+	entry.count = count;
+	entry.first_timestamp = hdr->timestamp;
+	entry.last_timestamp = last_timestamp;
+}
+
+// Number of dev, writing its RECORD_DEVICE the first time. Returns -1 if
+// the device can not be recorded now.
+static int deviceNumber(DevObj &dev)
+{
+	int unused = -1;
+	for (int i = 0; i < RECORDER_MAX_DEVICES; i++) {
+		if (s_devices[i].dev == &dev) {
+			return i;
+		}
+		if (unused < 0 && s_devices[i].dev == nullptr) {
+			unused = i;
+		}
+	}
+	if (unused < 0) {
+		return -1;
+	}
+
+	RecordHeader *hdr = reserve(RECORD_ALIGN(sizeof(RecordHeader) + sizeof(RecordDeviceInfo)),
+				    RECORD_DEVICE, unused, 0, offsetTime());
+	if (hdr == nullptr) {
+		return -1;
+	}
+	addIndex(hdr, 0, hdr->timestamp);
+
+	RecordDeviceInfo *info = (RecordDeviceInfo *)(hdr + 1);
+	memset(info, 0, sizeof(*info));
+	info->dev_id = dev.getId().dev_id;
+	info->sample_size = dev.getSampleSize();
+	snprintf(info->path, sizeof(info->path), "%s", dev.m_dev_instance_path);
+
+	unsigned int num_fields;
+	const SampleField *fields = dev.getSampleLayout(num_fields);
+	if (fields) {
+		hdr = reserve(RECORD_ALIGN(sizeof(RecordHeader) + sizeof(RecordLayoutInfo) +
+					   num_fields * sizeof(SampleField)),
+			      RECORD_LAYOUT, unused, 0, offsetTime());
+		if (hdr == nullptr) {
+			// Written again with the RECORD_DEVICE next time
+			return -1;
+		}
+		addIndex(hdr, 0, hdr->timestamp);
+		RecordLayoutInfo *layout = (RecordLayoutInfo *)(hdr + 1);
+		layout->num_fields = num_fields;
+		layout->reserved = 0;
+		memcpy(layout + 1, fields, num_fields * sizeof(SampleField));
+	}
+
+	RecorderDevice &d = s_devices[unused];
+	d.dev = &dev;
+	d.drops = 0;
+	d.raw_size = RECORD_ALIGN(sizeof(RecordHeader) + dev.getSampleSize());
+	d.codec = nullptr;
+
+	// Samples the codec can not describe are written as they are
+	if (s_codecs && s_codecs[unused].init(dev.getSampleSize(), fields, num_fields) == 0) {
+		d.codec = &s_codecs[unused];
+		d.block = &s_blocks[unused * CODEC_BLOCK_BYTES];
+		d.codec->beginBlock(d.block, CODEC_BLOCK_BYTES);
+	}
+	return unused;
+}
+
+static void addDrops(RecorderDevice &d, unsigned long count, uint64_t seq, uint64_t timestamp)
+{
+	if (d.drops == 0) {
+		d.drop_seq = seq;
+		d.drop_timestamp = timestamp;
+	}
+	d.drops += count;
+	s_stats.dropped += count;
+}
+
+// Report earlier losses before the samples that follow them. Returns
+// false if they are still pending.
+static bool writeDrops(int num)
+{
+	RecorderDevice &d = s_devices[num];
+	if (d.drops == 0) {
+		return true;
+	}
+
+	RecordHeader *hdr = reserve(RECORD_ALIGN(sizeof(RecordHeader) + sizeof(RecordDropInfo)),
+				    RECORD_DROP, num, d.drop_seq, d.drop_timestamp);
+	if (hdr == nullptr) {
+		return false;
+	}
+	RecordDropInfo *info = (RecordDropInfo *)(hdr + 1);
+	info->count = d.drops;
+	info->reserved = 0;
+	d.drops = 0;
+	return true;
+}
+
+// Copy the device's coded block to the active buffer and start the next
+static void flushBlock(int num)
+{
+	RecorderDevice &d = s_devices[num];
+	SampleCodec *codec = d.codec;
+	unsigned int count = codec->blockCount();
+	if (count == 0) {
+		return;
+	}
+
+	size_t length = codec->blockSize();
+	RecordHeader *hdr = nullptr;
+	if (writeDrops(num)) {
+		hdr = reserve(RECORD_ALIGN(sizeof(RecordHeader) + sizeof(RecordBlockInfo) + length),
+			      RECORD_BLOCK, num, d.block_seq, codec->blockTimestamp());
+	}
+
+	if (hdr) {
+		RecordBlockInfo *info = (RecordBlockInfo *)(hdr + 1);
+		info->count = count;
+		info->length = length;
+		memcpy(info + 1, d.block, length);
+		addIndex(hdr, count, d.block_last_timestamp);
+		s_stats.samples += count;
+		s_stats.bytes_raw += count * d.raw_size;
+	}
+	else {
+		addDrops(d, count, d.block_seq, codec->blockTimestamp());
+	}
+
+	codec->beginBlock(d.block, CODEC_BLOCK_BYTES);
+}
+
+static void flushBlocks()
+{
+	for (int i = 0; i < RECORDER_MAX_DEVICES; i++) {
+		if (s_devices[i].dev && s_devices[i].codec) {
+			flushBlock(i);
+		}
+	}
+}
+
+void Recorder::record(DevObj &dev, uint64_t seq, const void *samples, const uint64_t *timestamps,
+		      unsigned int count)
+{
+	const uint8_t *in = (const uint8_t *)samples;
+	const unsigned int sample_size = dev.getSampleSize();
+	const size_t size = RECORD_ALIGN(sizeof(RecordHeader) + sample_size);
+
+	s_lock.lock();
+
+	// Stopped while waiting for the lock
+	if (s_buffers == nullptr || s_stop) {
+		s_lock.unlock();
+		return;
+	}
+
+	int num = (size <= RECORD_MAX_SIZE) ? deviceNumber(dev) : -1;
+	if (num < 0) {
+		s_stats.dropped += count;
+		s_lock.unlock();
+		return;
+	}
+
+	RecorderDevice &d = s_devices[num];
+	unsigned int i = 0;
+
+	if (d.codec) {
+		SampleCodec *codec = d.codec;
+		for (; i < count; i++) {
+			// A block only holds consecutive samples
+			if (codec->blockCount() && seq + i != d.block_seq + codec->blockCount()) {
+				flushBlock(num);
+			}
+			if (!codec->encode(&in[i * sample_size], timestamps[i])) {
+				flushBlock(num);
+				codec->encode(&in[i * sample_size], timestamps[i]);
+			}
+			if (codec->blockCount() == 1) {
+				d.block_seq = seq + i;
+			}
+			d.block_last_timestamp = timestamps[i];
+		}
+	}
+	else {
+		if (writeDrops(num)) {
+			for (; i < count; i++) {
+				RecordHeader *hdr = reserve(size, RECORD_SAMPLE, num, seq + i, timestamps[i]);
+				if (hdr == nullptr) {
+					break;
+				}
+				memcpy(hdr + 1, &in[i * sample_size], sample_size);
+				addIndex(hdr, 1, timestamps[i]);
+			}
+		}
+		s_stats.samples += i;
+		s_stats.bytes_raw += i * size;
+
+		if (i < count) {
+			addDrops(d, count - i, seq + i, timestamps[i]);
+		}
+	}
+
+	s_lock.unlock();
+}
+
+void Recorder::removeDevice(DevObj &dev)
+{
+	s_lock.lock();
+	for (int i = 0; i < RECORDER_MAX_DEVICES; i++) {
+		if (s_devices[i].dev == &dev) {
+			if (s_buffers && s_devices[i].codec && !s_stop) {
+				flushBlock(i);
+			}
+			s_devices[i].dev = nullptr;
+		}
+	}
+	s_lock.unlock();
+}
+
+// Write a buffer at the end of the file, without s_lock
+static int writeBuffer(const RecorderBuffer &buf)
+{
+	size_t done = 0;
+	while (done < buf.used) {
+		ssize_t ret = pwrite(s_fd, &buf.data[done], buf.used - done, s_offset + done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+static void *process_trampoline(void *arg)
+{
+	s_lock.lock();
+
+	while (!s_stop || s_queued) {
+		if (s_queued == 0) {
+			// Partly filled blocks and buffers are written at least
+			// every flush_usec
+			uint64_t now = offsetTime();
+			if (now - s_flushed_at >= s_config.flush_usec) {
+				flushBlocks();
+				queueActive();
+				s_flushed_at = now;
+			}
+			else {
+				// Rounded up, as a timeout of 0 waits forever
+				uint64_t remaining = s_flushed_at + s_config.flush_usec - now;
+				s_lock.waitOnSignal((remaining + 999) / 1000);
+			}
+			continue;
+		}
+
+		RecorderBuffer &buf = s_buffers[s_write];
+		s_lock.unlock();
+
+		uint64_t start = offsetTime();
+		int ret = writeBuffer(buf);
+		uint32_t elapsed = offsetTime() - start;
+
+		s_lock.lock();
+		if (ret < 0) {
+			s_stats.write_errors++;
+			DF_LOG_ERR("Recorder: write failed (%d)", ret);
+		}
+		else {
+			s_offset += buf.used;
+			s_stats.bytes_written += buf.used;
+			s_stats.writes++;
+			if (elapsed > s_stats.max_write_usec) {
+				s_stats.max_write_usec = elapsed;
+			}
+		}
+		buf.used = 0;
+		s_write = (s_write + 1) % s_config.buffers;
+		s_queued--;
+
+		if (s_stats.dropped != s_reported_dropped) {
+			DF_LOG_ERR("Recorder: %lu samples dropped", s_stats.dropped - s_reported_dropped);
+			s_reported_dropped = s_stats.dropped;
+		}
+	}
+
+	s_lock.unlock();
+	return NULL;
+}
+
+static int openFile(const char *path, bool direct_io)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (direct_io) {
+		int fd = open(path, flags | O_DIRECT, 0644);
+		// Not every file system supports O_DIRECT
+		if (fd >= 0 || errno != EINVAL) {
+			if (fd >= 0) {
+				s_align = RECORDER_BLOCK_SIZE;
+			}
+			return fd;
+		}
+	}
+#endif
+	return open(path, flags, 0644);
+}
+
+static void freeBuffers()
+{
+	if (s_buffers) {
+		for (unsigned int i = 0; i < s_config.buffers; i++) {
+			free(s_buffers[i].data);
+		}
+		delete [] s_buffers;
+		s_buffers = nullptr;
+	}
+	delete [] s_codecs;
+	s_codecs = nullptr;
+	delete [] s_blocks;
+	s_blocks = nullptr;
+	delete [] s_index;
+	s_index = nullptr;
+}
+
+int Recorder::start(const char *path, const RecorderConfig &config)
+{
+	if (config.buffers < 2 || config.buffer_size < RECORDER_BLOCK_SIZE ||
+	    config.buffer_size % RECORDER_BLOCK_SIZE) {
+		return -EINVAL;
+	}
+
+	s_lock.lock();
+
+	if (s_buffers) {
+		s_lock.unlock();
+		return -EBUSY;
+	}
+
+	s_config = config;
+	s_buffers = new RecorderBuffer[config.buffers];
+	for (unsigned int i = 0; i < config.buffers; i++) {
+		void *data = nullptr;
+		if (posix_memalign(&data, RECORDER_BLOCK_SIZE, config.buffer_size)) {
+			data = nullptr;
+		}
+		s_buffers[i].data = (uint8_t *)data;
+		s_buffers[i].used = 0;
+	}
+	for (unsigned int i = 0; i < config.buffers; i++) {
+		if (s_buffers[i].data == nullptr) {
+			freeBuffers();
+			s_lock.unlock();
+			return -ENOMEM;
+		}
+		// Fault the pages in now rather than on the first samples
+		memset(s_buffers[i].data, 0, config.buffer_size);
+	}
+
+	s_align = 0;
+	s_fd = openFile(path, config.direct_io);
+	if (s_fd < 0) {
+		int ret = -errno;
+		freeBuffers();
+		s_lock.unlock();
+		return ret;
+	}
+
+#ifdef __linux__
+	// Reserve the space so writes do not wait for block allocation
+	if (config.preallocate && fallocate(s_fd, FALLOC_FL_KEEP_SIZE, 0, config.preallocate) < 0) {
+		DF_LOG_ERR("Recorder: fallocate failed (%d)", -errno);
+	}
+#endif
+
+	if (config.compress) {
+		s_codecs = new SampleCodec[RECORDER_MAX_DEVICES];
+		s_blocks = new uint8_t[RECORDER_MAX_DEVICES * CODEC_BLOCK_BYTES];
+		s_index = new RecordIndexEntry[RECORDER_INDEX_ENTRIES];
+	}
+	s_index_count = 0;
+	s_index_back = 0;
+
+	s_offset = 0;
+	s_write = 0;
+	s_queued = 0;
+	s_flushed_at = offsetTime();
+	s_stop = false;
+	memset(s_devices, 0, sizeof(s_devices));
+	memset(&s_stats, 0, sizeof(s_stats));
+	s_stats.direct_io = (s_align != 0);
+	s_reported_dropped = 0;
+
+	uint64_t now = offsetTime();
+	struct timespec ts;
+	clockGetRealtime(&ts);
+	RecordHeader *hdr = reserve(RECORD_ALIGN(sizeof(RecordHeader) + sizeof(RecordFileInfo)),
+				    RECORD_FILE, 0, 0, now);
+	RecordFileInfo *info = (RecordFileInfo *)(hdr + 1);
+	memset(info, 0, sizeof(*info));
+	memcpy(info->magic, "DFREC", 5);
+	info->version = RECORDER_FORMAT_VERSION;
+	info->block_size = s_align;
+	info->realtime_usec = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	if (pthread_create(&s_tid, NULL, process_trampoline, NULL)) {
+		close(s_fd);
+		s_fd = -1;
+		freeBuffers();
+		s_lock.unlock();
+		return -1;
+	}
+#ifdef __linux__
+	pthread_setname_np(s_tid, "df_recorder");
+#endif
+
+	__atomic_store_n(&s_running, true, __ATOMIC_RELEASE);
+	s_lock.unlock();
+	return 0;
+}
+
+void Recorder::stop(void)
+{
+	s_lock.lock();
+	if (s_buffers == nullptr) {
+		s_lock.unlock();
+		return;
+	}
+
+	// Publishers stop recording, the thread writes what is queued
+	__atomic_store_n(&s_running, false, __ATOMIC_RELEASE);
+	flushBlocks();
+
+	// No sample follows losses at the end of the recording to report them
+	for (int i = 0; i < RECORDER_MAX_DEVICES; i++) {
+		if (s_devices[i].dev) {
+			writeDrops(i);
+		}
+	}
+	queueActive();
+	s_stop = true;
+	s_lock.signal();
+	s_lock.unlock();
+
+	pthread_join(s_tid, NULL);
+
+	s_lock.lock();
+	fsync(s_fd);
+	close(s_fd);
+	s_fd = -1;
+	freeBuffers();
+	memset(s_devices, 0, sizeof(s_devices));
+	s_lock.unlock();
+}
+
+void Recorder::getStats(RecorderStats &stats)
+{
+	s_lock.lock();
+	stats = s_stats;
+	s_lock.unlock();
+}
@@ -0,0 +1,144 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "RecordingFile.hpp"
+
+using namespace DriverFramework;
+
+RecordingFile::RecordingFile() :
+	m_data(nullptr),
+	m_size(0)
+{}
+
+RecordingFile::~RecordingFile()
+{
+	close();
+}
+
+int RecordingFile::open(const char *path, bool sequential)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int ret = -errno;
+		::close(fd);
+		return ret;
+	}
+	if (st.st_size < (off_t)(sizeof(RecordHeader) + sizeof(RecordFileInfo))) {
+		::close(fd);
+		return -EINVAL;
+	}
+
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return -errno;
+	}
+
+	if (sequential) {
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+		madvise(data, st.st_size, MADV_WILLNEED);
+	}
+	else {
+		// Only the pages that are used are read
+		madvise(data, st.st_size, MADV_RANDOM);
+	}
+
+	m_data = (const uint8_t *)data;
+	m_size = st.st_size;
+
+	const RecordHeader *hdr = at(0);
+	if (hdr == nullptr || hdr->type != RECORD_FILE || payloadSize(hdr) < sizeof(RecordFileInfo) ||
+	    memcmp(getInfo().magic, "DFREC", 6) != 0 || getInfo().version > RECORDER_FORMAT_VERSION) {
+		close();
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void RecordingFile::close()
+{
+	if (m_data) {
+		munmap((void *)m_data, m_size);
+		m_data = nullptr;
+		m_size = 0;
+	}
+}
+
+int RecordingFile::lockInMemory()
+{
+	if (m_data == nullptr) {
+		return -EBADF;
+	}
+	if (mlock(m_data, m_size) == 0) {
+		return 0;
+	}
+	int ret = -errno;
+
+	// Read a byte of every page
+	long page = sysconf(_SC_PAGESIZE);
+	volatile uint8_t sink = 0;
+	for (size_t off = 0; off < m_size; off += page) {
+		sink += m_data[off];
+	}
+	(void)sink;
+	return ret;
+}
+
+ssize_t RecordingFile::findDevice(const char *path) const
+{
+	const RecordHeader *hdr;
+	for (size_t off = 0; (hdr = at(off)) != nullptr; off += hdr->size) {
+		if (hdr->type == RECORD_DEVICE && payloadSize(hdr) >= sizeof(RecordDeviceInfo)) {
+			const RecordDeviceInfo *info = (const RecordDeviceInfo *)payload(hdr);
+			if (strncmp(info->path, path, sizeof(info->path)) == 0) {
+				return off;
+			}
+		}
+	}
+	return -1;
+}
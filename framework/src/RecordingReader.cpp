@@ -0,0 +1,686 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "RecordingReader.hpp"
+
+namespace DriverFramework {
+
+// A read() shared by the threads decoding its entries
+struct ReadJob
+{
+	const RecordingDevice *		device;
+	const size_t *			selected;	// entries to decode
+	size_t				num_selected;
+	const size_t *			slots;		// first sample of each entry in the columns
+	unsigned int *			kept;		// samples of each entry in the time range
+	uint64_t			start_usec;
+	uint64_t			end_usec;
+	RecordingColumns *		columns;
+	size_t				next;		// next of selected to decode
+	bool				failed;
+};
+
+};
+
+using namespace DriverFramework;
+
+static size_t indexSize(unsigned int num_entries)
+{
+	return sizeof(RecordHeader) + num_entries * sizeof(RecordIndexEntry) + sizeof(RecordIndexInfo);
+}
+
+template <typename T>
+static void gather(const uint8_t *samples, unsigned int sample_size, unsigned int offset,
+		   const uint16_t *selected, unsigned int count, T *out)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		memcpy(&out[i], &samples[selected[i] * sample_size + offset], sizeof(T));
+	}
+}
+
+RecordingColumns::RecordingColumns() :
+	m_count(0),
+	m_timestamps(nullptr),
+	m_num_columns(0)
+{}
+
+RecordingColumns::~RecordingColumns()
+{
+	clear();
+}
+
+void RecordingColumns::clear()
+{
+	free(m_timestamps);
+	m_timestamps = nullptr;
+	for (unsigned int i = 0; i < m_num_columns; i++) {
+		free(m_columns[i].values);
+	}
+	m_num_columns = 0;
+	m_count = 0;
+}
+
+const RecordingColumn *RecordingColumns::findColumn(unsigned int offset) const
+{
+	for (unsigned int i = 0; i < m_num_columns; i++) {
+		if (m_columns[i].field.offset == offset) {
+			return &m_columns[i];
+		}
+	}
+	return nullptr;
+}
+
+RecordingReader::RecordingReader() :
+	m_indexed(false),
+	m_blocks_read(0),
+	m_job(nullptr),
+	m_job_slots(0),
+	m_job_busy(0),
+	m_stopping(false)
+{
+	pthread_mutex_init(&m_pool_lock, NULL);
+	pthread_cond_init(&m_work_cond, NULL);
+	pthread_cond_init(&m_done_cond, NULL);
+}
+
+RecordingReader::~RecordingReader()
+{
+	stopWorkers();
+	close();
+	pthread_cond_destroy(&m_done_cond);
+	pthread_cond_destroy(&m_work_cond);
+	pthread_mutex_destroy(&m_pool_lock);
+}
+
+int RecordingReader::open(const char *path)
+{
+	close();
+
+	// Blocks are read in the order they are asked for
+	int ret = m_file.open(path, false);
+	if (ret < 0) {
+		return ret;
+	}
+
+	m_indexed = (loadIndex() == 0);
+	if (!m_indexed) {
+		scan();
+	}
+
+	for (unsigned int i = 0; i < m_devices.size(); i++) {
+		m_devices[i].first_timestamp = UINT64_MAX;
+		m_devices[i].last_timestamp = 0;
+	}
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		RecordingDevice &dev = m_devices[m_entries[i].device];
+		if (m_entries[i].first_timestamp < dev.first_timestamp) {
+			dev.first_timestamp = m_entries[i].first_timestamp;
+		}
+		if (m_entries[i].last_timestamp > dev.last_timestamp) {
+			dev.last_timestamp = m_entries[i].last_timestamp;
+		}
+	}
+	for (unsigned int i = 0; i < m_devices.size(); i++) {
+		if (m_devices[i].samples == 0) {
+			m_devices[i].first_timestamp = 0;
+		}
+	}
+	return 0;
+}
+
+void RecordingReader::close()
+{
+	m_file.close();
+	m_devices.clear();
+	m_entries.clear();
+	for (unsigned int i = 0; i < 256; i++) {
+		m_numbers[i] = -1;
+	}
+	m_indexed = false;
+	m_blocks_read = 0;
+}
+
+int RecordingReader::findDevice(const char *path) const
+{
+	for (unsigned int i = 0; i < m_devices.size(); i++) {
+		if (strncmp(m_devices[i].path, path, sizeof(m_devices[i].path)) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void RecordingReader::addDevice(const RecordHeader *hdr)
+{
+	if (RecordingFile::payloadSize(hdr) < sizeof(RecordDeviceInfo)) {
+		return;
+	}
+	const RecordDeviceInfo *info = (const RecordDeviceInfo *)RecordingFile::payload(hdr);
+
+	// The latest device of that path, if its samples are the same
+	int found = -1;
+	for (unsigned int i = 0; i < m_devices.size(); i++) {
+		if (strncmp(m_devices[i].path, info->path, sizeof(info->path)) == 0 &&
+		    m_devices[i].dev_id == info->dev_id && m_devices[i].sample_size == info->sample_size) {
+			found = i;
+		}
+	}
+
+	if (found < 0) {
+		SampleCodec codec;
+		if (codec.init(info->sample_size, nullptr, 0) < 0) {
+			m_numbers[hdr->device] = -1;
+			return;
+		}
+
+		RecordingDevice dev;
+		memset(&dev, 0, sizeof(dev));
+		memcpy(dev.path, info->path, sizeof(dev.path));
+		dev.path[sizeof(dev.path) - 1] = '\0';
+		dev.dev_id = info->dev_id;
+		dev.sample_size = info->sample_size;
+		const SampleField *fields = codec.getFields(dev.num_fields);
+		memcpy(dev.fields, fields, dev.num_fields * sizeof(SampleField));
+
+		m_devices.push_back(dev);
+		found = m_devices.size() - 1;
+	}
+	m_numbers[hdr->device] = found;
+}
+
+void RecordingReader::addLayout(const RecordHeader *hdr)
+{
+	int d = m_numbers[hdr->device];
+	const RecordLayoutInfo *info = (const RecordLayoutInfo *)RecordingFile::payload(hdr);
+	if (d < 0 || RecordingFile::payloadSize(hdr) < sizeof(*info) ||
+	    RecordingFile::payloadSize(hdr) < sizeof(*info) + info->num_fields * sizeof(SampleField)) {
+		return;
+	}
+
+	const SampleField *fields = (const SampleField *)(info + 1);
+	RecordingDevice dev = m_devices[d];
+	if (dev.has_layout && dev.num_fields == info->num_fields &&
+	    memcmp(dev.fields, fields, info->num_fields * sizeof(SampleField)) == 0) {
+		return;
+	}
+
+	// Blocks coded with a layout that does not fit can not be decoded
+	SampleCodec codec;
+	if (codec.init(dev.sample_size, fields, info->num_fields) < 0) {
+		m_numbers[hdr->device] = -1;
+		return;
+	}
+
+	// The samples so far were coded differently
+	if (dev.samples) {
+		dev.samples = 0;
+		m_devices.push_back(dev);
+		d = m_devices.size() - 1;
+		m_numbers[hdr->device] = d;
+	}
+
+	m_devices[d].has_layout = true;
+	m_devices[d].num_fields = info->num_fields;
+	memcpy(m_devices[d].fields, fields, info->num_fields * sizeof(SampleField));
+}
+
+bool RecordingReader::addEntry(size_t offset, uint8_t type, uint8_t number, unsigned int count,
+			       uint64_t first_timestamp, uint64_t last_timestamp)
+{
+	int d = m_numbers[number];
+	if (d < 0 || count == 0 || count > CODEC_BLOCK_SAMPLES) {
+		return false;
+	}
+
+	Entry entry;
+	entry.offset = offset;
+	entry.type = type;
+	entry.number = number;
+	entry.count = count;
+	entry.device = d;
+	entry.first_timestamp = first_timestamp;
+	entry.last_timestamp = last_timestamp;
+	m_entries.push_back(entry);
+
+	m_devices[d].samples += count;
+	return true;
+}
+
+int RecordingReader::loadIndex()
+{
+	const uint8_t *data = m_file.getData();
+	size_t size = m_file.getSize();
+	std::vector<size_t> indexes;
+
+	// A complete file ends with a RECORD_INDEX
+	if (size < indexSize(0)) {
+		return -1;
+	}
+	const RecordIndexInfo *info = (const RecordIndexInfo *)&data[size - sizeof(RecordIndexInfo)];
+	if (memcmp(info->magic, "DFIX", 4) != 0 || info->num_entries > RECORDER_INDEX_ENTRIES ||
+	    indexSize(info->num_entries) > size) {
+		return -1;
+	}
+
+	size_t offset = size - indexSize(info->num_entries);
+	for (;;) {
+		const RecordHeader *hdr = m_file.at(offset);
+		if (hdr == nullptr || hdr->type != RECORD_INDEX || hdr->size < indexSize(0)) {
+			return -1;
+		}
+		info = (const RecordIndexInfo *)&data[offset + hdr->size - sizeof(RecordIndexInfo)];
+		if (memcmp(info->magic, "DFIX", 4) != 0 || info->num_entries > RECORDER_INDEX_ENTRIES ||
+		    hdr->size != indexSize(info->num_entries)) {
+			return -1;
+		}
+		indexes.push_back(offset);
+
+		if (info->prev == 0) {
+			break;
+		}
+		if (info->prev > offset) {
+			return -1;
+		}
+		offset -= info->prev;
+	}
+
+	// In file order
+	for (size_t i = indexes.size(); i-- > 0;) {
+		offset = indexes[i];
+		const RecordHeader *hdr = m_file.at(offset);
+		const RecordIndexEntry *entries = (const RecordIndexEntry *)RecordingFile::payload(hdr);
+		info = (const RecordIndexInfo *)&entries[(hdr->size - indexSize(0)) / sizeof(RecordIndexEntry)];
+
+		for (unsigned int n = 0; n < info->num_entries; n++) {
+			const RecordIndexEntry &e = entries[n];
+			if (e.offset > offset) {
+				return -1;
+			}
+
+			const RecordHeader *rec;
+			switch (e.type) {
+			case RECORD_DEVICE:
+			case RECORD_LAYOUT:
+				rec = m_file.at(offset - e.offset);
+				if (rec == nullptr || rec->type != e.type || rec->device != e.device) {
+					return -1;
+				}
+				if (e.type == RECORD_DEVICE) {
+					addDevice(rec);
+				}
+				else {
+					addLayout(rec);
+				}
+				break;
+
+			case RECORD_BLOCK:
+			case RECORD_SAMPLE:
+				addEntry(offset - e.offset, e.type, e.device, e.count, e.first_timestamp,
+					 e.last_timestamp);
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+void RecordingReader::scan()
+{
+	m_devices.clear();
+	m_entries.clear();
+	for (unsigned int i = 0; i < 256; i++) {
+		m_numbers[i] = -1;
+	}
+
+	// Last block of each device number, whose samples end before the
+	// next block starts
+	long last_block[256];
+	for (unsigned int i = 0; i < 256; i++) {
+		last_block[i] = -1;
+	}
+
+	const RecordHeader *hdr;
+	for (size_t off = 0; (hdr = m_file.at(off)) != nullptr; off += hdr->size) {
+		switch (hdr->type) {
+		case RECORD_DEVICE:
+			addDevice(hdr);
+			last_block[hdr->device] = -1;
+			break;
+
+		case RECORD_LAYOUT:
+			addLayout(hdr);
+			break;
+
+		case RECORD_BLOCK: {
+				const RecordBlockInfo *info = (const RecordBlockInfo *)RecordingFile::payload(hdr);
+				if (RecordingFile::payloadSize(hdr) < sizeof(*info) ||
+				    !addEntry(off, RECORD_BLOCK, hdr->device, info->count, hdr->timestamp, UINT64_MAX)) {
+					break;
+				}
+				if (last_block[hdr->device] >= 0) {
+					m_entries[last_block[hdr->device]].last_timestamp = hdr->timestamp;
+				}
+				last_block[hdr->device] = m_entries.size() - 1;
+				break;
+			}
+
+		case RECORD_SAMPLE:
+			if (!m_entries.empty()) {
+				Entry &last = m_entries.back();
+				if (last.type == RECORD_SAMPLE && last.number == hdr->device &&
+				    (int)last.device == m_numbers[hdr->device] && last.count < CODEC_BLOCK_SAMPLES &&
+				    last.offset + last.count * hdr->size == off) {
+					last.count++;
+					last.last_timestamp = hdr->timestamp;
+					m_devices[last.device].samples++;
+					break;
+				}
+			}
+			addEntry(off, RECORD_SAMPLE, hdr->device, 1, hdr->timestamp, hdr->timestamp);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// The last block of a device is decoded for its last timestamp
+	uint64_t timestamps[CODEC_BLOCK_SAMPLES];
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		Entry &entry = m_entries[i];
+		if (entry.last_timestamp != UINT64_MAX) {
+			continue;
+		}
+		const RecordingDevice &dev = m_devices[entry.device];
+		SampleCodec codec;
+		uint8_t *samples = new uint8_t[CODEC_BLOCK_SAMPLES * dev.sample_size];
+		codec.init(dev.sample_size, dev.fields, dev.num_fields);
+		int n = decodeEntry(entry, codec, samples, timestamps);
+		entry.last_timestamp = (n > 0) ? timestamps[n - 1] : entry.first_timestamp;
+		delete [] samples;
+	}
+}
+
+int RecordingReader::decodeEntry(const Entry &entry, SampleCodec &codec, uint8_t *samples,
+				 uint64_t *timestamps) const
+{
+	const RecordHeader *hdr = m_file.at(entry.offset);
+
+	if (entry.type == RECORD_BLOCK) {
+		if (hdr == nullptr || hdr->type != RECORD_BLOCK || hdr->device != entry.number) {
+			return -1;
+		}
+		const RecordBlockInfo *info = (const RecordBlockInfo *)RecordingFile::payload(hdr);
+		if (RecordingFile::payloadSize(hdr) < sizeof(*info) + info->length || info->count != entry.count) {
+			return -1;
+		}
+		return codec.decode((const uint8_t *)(info + 1), info->length, info->count, hdr->timestamp,
+				    samples, timestamps);
+	}
+
+	const unsigned int sample_size = codec.getSampleSize();
+	size_t offset = entry.offset;
+	for (unsigned int i = 0; i < entry.count; i++) {
+		hdr = m_file.at(offset);
+		if (hdr == nullptr || hdr->type != RECORD_SAMPLE || hdr->device != entry.number ||
+		    RecordingFile::payloadSize(hdr) < sample_size) {
+			return -1;
+		}
+		memcpy(&samples[i * sample_size], RecordingFile::payload(hdr), sample_size);
+		timestamps[i] = hdr->timestamp;
+		offset += hdr->size;
+	}
+	return entry.count;
+}
+
+void RecordingReader::startWorkers(unsigned int count)
+{
+	while (m_workers.size() < count) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, workerTrampoline, this) != 0) {
+			break;
+		}
+		m_workers.push_back(tid);
+	}
+}
+
+void RecordingReader::stopWorkers()
+{
+	pthread_mutex_lock(&m_pool_lock);
+	m_stopping = true;
+	pthread_cond_broadcast(&m_work_cond);
+	pthread_mutex_unlock(&m_pool_lock);
+
+	for (size_t t = 0; t < m_workers.size(); t++) {
+		pthread_join(m_workers[t], NULL);
+	}
+	m_workers.clear();
+}
+
+void *RecordingReader::workerTrampoline(void *arg)
+{
+	((RecordingReader *)arg)->worker();
+	return NULL;
+}
+
+void RecordingReader::worker()
+{
+	pthread_mutex_lock(&m_pool_lock);
+	while (!m_stopping) {
+		if (m_job_slots == 0) {
+			pthread_cond_wait(&m_work_cond, &m_pool_lock);
+			continue;
+		}
+		m_job_slots--;
+		m_job_busy++;
+		ReadJob *job = m_job;
+		pthread_mutex_unlock(&m_pool_lock);
+
+		readEntries(*job);
+
+		pthread_mutex_lock(&m_pool_lock);
+		if (--m_job_busy == 0) {
+			pthread_cond_signal(&m_done_cond);
+		}
+	}
+	pthread_mutex_unlock(&m_pool_lock);
+}
+
+void RecordingReader::readEntries(ReadJob &job) const
+{
+	const RecordingDevice &dev = *job.device;
+	RecordingColumns &columns = *job.columns;
+	const unsigned int sample_size = dev.sample_size;
+
+	SampleCodec codec;
+	codec.init(sample_size, dev.fields, dev.num_fields);
+	uint8_t *samples = new uint8_t[CODEC_BLOCK_SAMPLES * sample_size];
+	uint64_t timestamps[CODEC_BLOCK_SAMPLES];
+	uint16_t selected[CODEC_BLOCK_SAMPLES];
+
+	size_t i;
+	while ((i = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED)) < job.num_selected) {
+		int n = decodeEntry(m_entries[job.selected[i]], codec, samples, timestamps);
+		if (n < 0) {
+			__atomic_store_n(&job.failed, true, __ATOMIC_RELAXED);
+			break;
+		}
+
+		const size_t slot = job.slots[i];
+		unsigned int kept = 0;
+		for (int k = 0; k < n; k++) {
+			if (timestamps[k] >= job.start_usec && timestamps[k] < job.end_usec) {
+				columns.m_timestamps[slot + kept] = timestamps[k];
+				selected[kept++] = k;
+			}
+		}
+
+		for (unsigned int c = 0; c < columns.m_num_columns; c++) {
+			const RecordingColumn &column = columns.m_columns[c];
+			const unsigned int offset = column.field.offset;
+			switch (column.width) {
+			case 1:
+				gather(samples, sample_size, offset, selected, kept, (uint8_t *)column.values + slot);
+				break;
+			case 2:
+				gather(samples, sample_size, offset, selected, kept, (uint16_t *)column.values + slot);
+				break;
+			case 4:
+				gather(samples, sample_size, offset, selected, kept, (uint32_t *)column.values + slot);
+				break;
+			default:
+				gather(samples, sample_size, offset, selected, kept, (uint64_t *)column.values + slot);
+				break;
+			}
+		}
+		job.kept[i] = kept;
+	}
+
+	delete [] samples;
+}
+
+ssize_t RecordingReader::read(unsigned int device, uint64_t start_usec, uint64_t end_usec,
+			      RecordingColumns &columns, unsigned int threads)
+{
+	columns.clear();
+	m_blocks_read = 0;
+
+	if (!m_file.isOpen() || device >= m_devices.size()) {
+		return -EINVAL;
+	}
+	const RecordingDevice &dev = m_devices[device];
+
+	// Only the entries that overlap the range are read
+	std::vector<size_t> selected;
+	std::vector<size_t> slots;
+	size_t total = 0;
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		const Entry &entry = m_entries[i];
+		if (entry.device == device && entry.first_timestamp < end_usec && entry.last_timestamp >= start_usec) {
+			selected.push_back(i);
+			slots.push_back(total);
+			total += entry.count;
+		}
+	}
+	std::vector<unsigned int> kept(selected.size(), 0);
+	if (selected.empty()) {
+		return 0;
+	}
+
+	columns.m_timestamps = (uint64_t *)malloc(total * sizeof(uint64_t));
+	bool allocated = (columns.m_timestamps != nullptr);
+	for (unsigned int c = 0; c < dev.num_fields; c++) {
+		RecordingColumn &column = columns.m_columns[c];
+		column.field = dev.fields[c];
+		column.width = SampleCodec::fieldSize(column.field.type);
+		column.values = malloc(total * column.width);
+		columns.m_num_columns++;
+		allocated = allocated && column.values;
+	}
+	if (!allocated) {
+		columns.clear();
+		return -ENOMEM;
+	}
+
+	ReadJob job;
+	job.device = &dev;
+	job.selected = selected.data();
+	job.num_selected = selected.size();
+	job.slots = slots.data();
+	job.kept = kept.data();
+	job.start_usec = start_usec;
+	job.end_usec = end_usec;
+	job.columns = &columns;
+	job.next = 0;
+	job.failed = false;
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+	if (threads > selected.size()) {
+		threads = selected.size();
+	}
+
+	// The calling thread is one of them
+	startWorkers(threads - 1);
+	pthread_mutex_lock(&m_pool_lock);
+	m_job = &job;
+	m_job_slots = (threads - 1 < m_workers.size()) ? threads - 1 : m_workers.size();
+	pthread_cond_broadcast(&m_work_cond);
+	pthread_mutex_unlock(&m_pool_lock);
+
+	readEntries(job);
+
+	// Workers that have not joined yet would find nothing left to decode
+	pthread_mutex_lock(&m_pool_lock);
+	m_job_slots = 0;
+	while (m_job_busy) {
+		pthread_cond_wait(&m_done_cond, &m_pool_lock);
+	}
+	m_job = nullptr;
+	pthread_mutex_unlock(&m_pool_lock);
+
+	if (job.failed) {
+		columns.clear();
+		return -EIO;
+	}
+
+	// Samples out of the range, in the first and last entries, leave gaps
+	size_t count = 0;
+	for (size_t i = 0; i < selected.size(); i++) {
+		if (slots[i] != count && kept[i]) {
+			memmove(&columns.m_timestamps[count], &columns.m_timestamps[slots[i]], kept[i] * sizeof(uint64_t));
+			for (unsigned int c = 0; c < columns.m_num_columns; c++) {
+				RecordingColumn &column = columns.m_columns[c];
+				memmove((uint8_t *)column.values + count * column.width,
+					(uint8_t *)column.values + slots[i] * column.width, kept[i] * column.width);
+			}
+		}
+		count += kept[i];
+	}
+
+	columns.m_count = count;
+	m_blocks_read = selected.size();
+	return count;
+}
@@ -0,0 +1,157 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <string.h>
+#include "RegisterShadow.hpp"
+
+using namespace DriverFramework;
+
+RegisterShadow::RegisterShadow()
+{
+	memset(m_value, 0, sizeof(m_value));
+	memset(m_flags, 0, sizeof(m_flags));
+}
+
+void RegisterShadow::setStatic(uint8_t reg, unsigned int count)
+{
+	for (unsigned int i = reg; i < 256 && i < reg + count; i++) {
+		m_flags[i] |= REG_STATIC;
+	}
+}
+
+bool RegisterShadow::lookup(uint8_t reg, uint8_t *out, unsigned int length)
+{
+	if (reg + length > 256) {
+		return false;
+	}
+	for (unsigned int i = reg; i < reg + length; i++) {
+		if (!has(i, REG_STATIC | REG_VALID)) {
+			return false;
+		}
+	}
+	memcpy(out, &m_value[reg], length);
+	return true;
+}
+
+void RegisterShadow::fill(uint8_t reg, const uint8_t *in, unsigned int length)
+{
+	for (unsigned int i = 0; i < length && reg + i < 256; i++) {
+		if (!(m_flags[reg + i] & REG_DIRTY)) {
+			m_value[reg + i] = in[i];
+			m_flags[reg + i] |= REG_VALID;
+		}
+	}
+}
+
+void RegisterShadow::stage(uint8_t reg, const uint8_t *in, unsigned int length)
+{
+	for (unsigned int i = 0; i < length && reg + i < 256; i++) {
+		m_value[reg + i] = in[i];
+		m_flags[reg + i] |= REG_VALID | REG_DIRTY;
+	}
+}
+
+bool RegisterShadow::isDirty(uint8_t reg, unsigned int length)
+{
+	for (unsigned int i = reg; i < 256 && i < reg + length; i++) {
+		if (m_flags[i] & REG_DIRTY) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool RegisterShadow::nextDirtyRun(unsigned int &reg, unsigned int &length, unsigned int max_gap, unsigned int max_length)
+{
+	unsigned int start = reg;
+	while (start < 256 && !(m_flags[start] & REG_DIRTY)) {
+		++start;
+	}
+	if (start == 256) {
+		return false;
+	}
+
+	unsigned int end = start + 1;	// one past the last dirty register
+	while (end < 256 && end - start < max_length) {
+		if (m_flags[end] & REG_DIRTY) {
+			++end;
+			continue;
+		}
+
+		// Bridge a short gap of static registers with known values
+		unsigned int gap = 0;
+		while (gap < max_gap && has(end + gap, REG_STATIC | REG_VALID) &&
+		       !(m_flags[end + gap] & REG_DIRTY)) {
+			++gap;
+		}
+		if (has(end + gap, REG_DIRTY) && end + gap + 1 - start <= max_length) {
+			end += gap + 1;
+		}
+		else {
+			break;
+		}
+	}
+
+	reg = start;
+	length = end - start;
+	return true;
+}
+
+bool RegisterShadow::nextStaticRun(unsigned int &reg, unsigned int &length, unsigned int max_length)
+{
+	unsigned int start = reg;
+	while (start < 256 && !has(start, REG_STATIC | REG_VALID)) {
+		++start;
+	}
+	if (start == 256) {
+		return false;
+	}
+
+	unsigned int end = start + 1;
+	while (end < 256 && end - start < max_length && has(end, REG_STATIC | REG_VALID)) {
+		++end;
+	}
+
+	reg = start;
+	length = end - start;
+	return true;
+}
+
+void RegisterShadow::clean(uint8_t reg, unsigned int length)
+{
+	for (unsigned int i = reg; i < 256 && i < reg + length; i++) {
+		m_flags[i] &= ~REG_DIRTY;
+	}
+}
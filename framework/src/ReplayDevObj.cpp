@@ -0,0 +1,290 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "ReplayDevObj.hpp"
+
+using namespace DriverFramework;
+
+ReplayDevObj::ReplayDevObj(const char *name, const char *dev_base_path, unsigned int capacity) :
+	VirtDevObj(name, dev_base_path, 0),
+	m_capacity(capacity),
+	m_sample_size(0),
+	m_speed(1.0f),
+	m_begin(0),
+	m_offset(0),
+	m_number(-1),
+	m_first_timestamp(0),
+	m_start_time(0),
+	m_block(nullptr),
+	m_block_timestamps(new uint64_t[CODEC_BLOCK_SAMPLES]),
+	m_block_count(0),
+	m_block_pos(0),
+	m_batch(nullptr),
+	m_timestamps(new uint64_t[REPLAY_BATCH]),
+	m_published(0),
+	m_finished(true),
+	m_started(false)
+{
+	m_device_path[0] = '\0';
+}
+
+ReplayDevObj::~ReplayDevObj()
+{
+	delete [] m_block;
+	delete [] m_block_timestamps;
+	delete [] m_batch;
+	delete [] m_timestamps;
+}
+
+int ReplayDevObj::open(const char *log_path, const char *device_path)
+{
+	int ret = m_file.open(log_path);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ssize_t begin = m_file.findDevice(device_path);
+	if (begin < 0) {
+		m_file.close();
+		return -ENOENT;
+	}
+
+	const RecordDeviceInfo *info = (const RecordDeviceInfo *)RecordingFile::payload(m_file.at(begin));
+	if (info->sample_size == 0 || (m_sample_size && info->sample_size != m_sample_size)) {
+		m_file.close();
+		return -EINVAL;
+	}
+
+	// The device keeps its sample buffer when reopened
+	if (m_sample_size == 0) {
+		if (enableSampleBuffer(info->sample_size, m_capacity) < 0) {
+			m_file.close();
+			return -ENOMEM;
+		}
+		m_sample_size = info->sample_size;
+		m_block = new uint8_t[CODEC_BLOCK_SAMPLES * m_sample_size];
+		m_batch = new uint8_t[REPLAY_BATCH * m_sample_size];
+	}
+
+	// _measure() reads the mapping on the HRT thread, where a page fault
+	// would delay every other work item
+	ret = m_file.lockInMemory();
+	if (ret < 0) {
+		DF_LOG_ERR("ReplayDevObj: cannot lock %s (%d), replay may wait for the disk", log_path, ret);
+	}
+
+	snprintf(m_device_path, sizeof(m_device_path), "%s", device_path);
+	m_begin = begin;
+
+	// Timing is relative to the first sample
+	const uint8_t *sample;
+	m_offset = m_begin;
+	m_number = -1;
+	m_block_count = 0;
+	m_block_pos = 0;
+	if (nextSample(sample, m_first_timestamp) == false) {
+		m_first_timestamp = 0;
+	}
+	return 0;
+}
+
+bool ReplayDevObj::nextSample(const uint8_t *&sample, uint64_t &timestamp)
+{
+	if (m_block_pos < m_block_count) {
+		sample = &m_block[m_block_pos * m_sample_size];
+		timestamp = m_block_timestamps[m_block_pos];
+		return true;
+	}
+
+	const RecordHeader *hdr;
+	for (; (hdr = m_file.at(m_offset)) != nullptr; m_offset += hdr->size) {
+		if (hdr->type == RECORD_DEVICE) {
+			const RecordDeviceInfo *dev = (const RecordDeviceInfo *)RecordingFile::payload(hdr);
+			if (RecordingFile::payloadSize(hdr) < sizeof(*dev)) {
+				continue;
+			}
+			if (strncmp(dev->path, m_device_path, sizeof(dev->path)) == 0) {
+				m_number = hdr->device;
+				m_codec.init(m_sample_size, nullptr, 0);
+			}
+			else if (hdr->device == m_number) {
+				// The number now belongs to another device
+				m_number = -1;
+			}
+			continue;
+		}
+		if (hdr->device != m_number) {
+			continue;
+		}
+
+		if (hdr->type == RECORD_SAMPLE && RecordingFile::payloadSize(hdr) >= m_sample_size) {
+			sample = (const uint8_t *)RecordingFile::payload(hdr);
+			timestamp = hdr->timestamp;
+			return true;
+		}
+		else if (hdr->type == RECORD_LAYOUT) {
+			const RecordLayoutInfo *info = (const RecordLayoutInfo *)RecordingFile::payload(hdr);
+			if (RecordingFile::payloadSize(hdr) >= sizeof(*info) &&
+			    RecordingFile::payloadSize(hdr) >= sizeof(*info) + info->num_fields * sizeof(SampleField)) {
+				m_codec.init(m_sample_size, (const SampleField *)(info + 1), info->num_fields);
+			}
+		}
+		else if (hdr->type == RECORD_BLOCK) {
+			const RecordBlockInfo *info = (const RecordBlockInfo *)RecordingFile::payload(hdr);
+			if (RecordingFile::payloadSize(hdr) < sizeof(*info) ||
+			    RecordingFile::payloadSize(hdr) < sizeof(*info) + info->length ||
+			    info->count > CODEC_BLOCK_SAMPLES || m_codec.getSampleSize() != m_sample_size) {
+				continue;
+			}
+			int n = m_codec.decode((const uint8_t *)(info + 1), info->length, info->count, hdr->timestamp,
+					       m_block, m_block_timestamps);
+			if (n > 0) {
+				m_offset += hdr->size;
+				m_block_count = n;
+				m_block_pos = 0;
+				sample = m_block;
+				timestamp = m_block_timestamps[0];
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ReplayDevObj::consumeSample()
+{
+	if (m_block_pos < m_block_count) {
+		m_block_pos++;
+	}
+	else {
+		m_offset += m_file.at(m_offset)->size;
+	}
+}
+
+void ReplayDevObj::setSpeed(float speed)
+{
+	m_speed = speed;
+}
+
+int ReplayDevObj::start()
+{
+	if (!m_file.isOpen()) {
+		return -EINVAL;
+	}
+
+	// Also called when the first handle is opened
+	int ret = VirtDevObj::start();
+	if (ret < 0 || m_started) {
+		return ret;
+	}
+	m_started = true;
+
+	m_offset = m_begin;
+	m_number = -1;
+	m_block_count = 0;
+	m_block_pos = 0;
+	__atomic_store_n(&m_published, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&m_finished, false, __ATOMIC_RELEASE);
+	m_start_time = offsetTime();
+
+	// Runs _measure() on the HRT thread
+	resumeMeasureIn(0);
+	return 0;
+}
+
+int ReplayDevObj::stop()
+{
+	// Waits for a pass that is running
+	int ret = VirtDevObj::stop();
+	__atomic_store_n(&m_finished, true, __ATOMIC_RELEASE);
+	m_started = false;
+	return ret;
+}
+
+ssize_t ReplayDevObj::devRead(void *buf, size_t count)
+{
+	if (m_sample_size == 0) {
+		return -1;
+	}
+	int n = readSamples(buf, nullptr, count / m_sample_size);
+	return (n < 0) ? n : n * m_sample_size;
+}
+
+void ReplayDevObj::_measure()
+{
+	if (isFinished()) {
+		return;
+	}
+
+	const uint64_t now = offsetTime();
+	const bool timed = (m_speed > 0.0f);
+	uint64_t delay = 0;
+	unsigned int count = 0;
+
+	const uint8_t *sample;
+	uint64_t timestamp;
+	bool more;
+	while ((more = nextSample(sample, timestamp))) {
+		if (timed) {
+			uint64_t elapsed = (timestamp > m_first_timestamp) ? timestamp - m_first_timestamp : 0;
+			uint64_t due = m_start_time + (uint64_t)(elapsed / m_speed);
+			if (due > now) {
+				delay = due - now;
+				break;
+			}
+		}
+		if (count == REPLAY_BATCH) {
+			break;
+		}
+		memcpy(&m_batch[count * m_sample_size], sample, m_sample_size);
+		m_timestamps[count++] = timestamp;
+		consumeSample();
+	}
+
+	if (count) {
+		publishSamples(m_batch, m_timestamps, count);
+		__atomic_store_n(&m_published, m_published + count, __ATOMIC_RELAXED);
+	}
+
+	if (!more) {
+		__atomic_store_n(&m_finished, true, __ATOMIC_RELEASE);
+		return;
+	}
+
+	resumeMeasureIn(delay);
+}
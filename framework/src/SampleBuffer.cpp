@@ -0,0 +1,169 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <string.h>
+#include "SampleBuffer.hpp"
+#include "Arena.hpp"
+
+using namespace DriverFramework;
+
+SampleBuffer::SampleBuffer(unsigned int sample_size, unsigned int capacity) :
+	m_sample_size(sample_size),
+	m_capacity(capacity),
+	m_data(dfNewArray<uint8_t>(sample_size * capacity)),
+	m_timestamps(dfNewArray<uint64_t>(capacity)),
+	m_head(0),
+	m_count(0),
+	m_overflows(0),
+	m_pushed(0)
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+SampleBuffer::~SampleBuffer()
+{
+	pthread_mutex_destroy(&m_lock);
+	dfDeleteArray(m_data);
+	dfDeleteArray(m_timestamps);
+}
+
+uint64_t SampleBuffer::push(const void *samples, const uint64_t *timestamps, unsigned int count)
+{
+	const uint8_t *in = (const uint8_t *)samples;
+
+	pthread_mutex_lock(&m_lock);
+
+	uint64_t seq = m_pushed;
+
+	// Only the newest samples fit
+	if (count > m_capacity) {
+		unsigned int skipped = count - m_capacity;
+		in += skipped * m_sample_size;
+		timestamps += skipped;
+		m_overflows += skipped;
+		m_pushed += skipped;
+		count = m_capacity;
+	}
+
+	unsigned int space = m_capacity - m_count;
+	if (count > space) {
+		unsigned int dropped = count - space;
+		m_head = (m_head + dropped) % m_capacity;
+		m_count -= dropped;
+		m_overflows += dropped;
+	}
+
+	unsigned int tail = (m_head + m_count) % m_capacity;
+
+	// Copy in up to two contiguous runs
+	unsigned int first = m_capacity - tail;
+	if (first > count) {
+		first = count;
+	}
+	memcpy(&m_data[tail * m_sample_size], in, first * m_sample_size);
+	memcpy(&m_timestamps[tail], timestamps, first * sizeof(uint64_t));
+	if (count > first) {
+		memcpy(m_data, &in[first * m_sample_size], (count - first) * m_sample_size);
+		memcpy(m_timestamps, &timestamps[first], (count - first) * sizeof(uint64_t));
+	}
+	m_count += count;
+	m_pushed += count;
+
+	pthread_mutex_unlock(&m_lock);
+
+	return seq;
+}
+
+void SampleBuffer::copyOut(unsigned int first, unsigned int count, uint8_t *out, uint64_t *timestamps)
+{
+	unsigned int run = m_capacity - first;
+	if (run > count) {
+		run = count;
+	}
+
+	memcpy(out, &m_data[first * m_sample_size], run * m_sample_size);
+	if (timestamps) {
+		memcpy(timestamps, &m_timestamps[first], run * sizeof(uint64_t));
+	}
+	if (count > run) {
+		memcpy(&out[run * m_sample_size], m_data, (count - run) * m_sample_size);
+		if (timestamps) {
+			memcpy(&timestamps[run], m_timestamps, (count - run) * sizeof(uint64_t));
+		}
+	}
+}
+
+unsigned int SampleBuffer::pop(void *out, uint64_t *timestamps, unsigned int max_samples)
+{
+	uint8_t *dst = (uint8_t *)out;
+
+	pthread_mutex_lock(&m_lock);
+
+	unsigned int count = (max_samples < m_count) ? max_samples : m_count;
+	copyOut(m_head, count, dst, timestamps);
+	m_head = (m_head + count) % m_capacity;
+	m_count -= count;
+
+	pthread_mutex_unlock(&m_lock);
+
+	return count;
+}
+
+unsigned int SampleBuffer::peek(uint64_t &seq, void *out, uint64_t *timestamps, unsigned int max_samples)
+{
+	pthread_mutex_lock(&m_lock);
+
+	uint64_t oldest = m_pushed - m_count;
+	if (seq < oldest) {
+		seq = oldest;
+	}
+
+	uint64_t available = m_pushed - seq;
+	unsigned int count = (max_samples < available) ? max_samples : (unsigned int)available;
+	copyOut((m_head + (unsigned int)(seq - oldest)) % m_capacity, count, (uint8_t *)out, timestamps);
+	seq += count;
+
+	pthread_mutex_unlock(&m_lock);
+
+	return count;
+}
+
+unsigned int SampleBuffer::getAvailable()
+{
+	pthread_mutex_lock(&m_lock);
+	unsigned int count = m_count;
+	pthread_mutex_unlock(&m_lock);
+	return count;
+}
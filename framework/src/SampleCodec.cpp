@@ -0,0 +1,418 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <string.h>
+#include "SampleCodec.hpp"
+
+using namespace DriverFramework;
+
+static inline uint64_t zigzag(uint64_t v)
+{
+	return (v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t v)
+{
+	return (v >> 1) ^ (0 - (v & 1));
+}
+
+static inline uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint64_t &v)
+{
+	// One byte for most changes of sensor data
+	if (p < end && *p < 0x80) {
+		v = *p;
+		return p + 1;
+	}
+
+	v = 0;
+	for (unsigned int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (b < 0x80) {
+			return p;
+		}
+	}
+	return nullptr;
+}
+
+// A control byte with the number of trailing zero bytes in the high
+// nibble and of the bytes that follow in the low nibble, 0 if unchanged
+static inline uint8_t *putXor(uint8_t *p, uint64_t x)
+{
+	if (x == 0) {
+		*p++ = 0;
+		return p;
+	}
+	unsigned int trail = __builtin_ctzll(x) / 8;
+	unsigned int len = 8 - __builtin_clzll(x) / 8 - trail;
+	x >>= trail * 8;
+	*p++ = (trail << 4) | len;
+	for (unsigned int i = 0; i < len; i++) {
+		*p++ = (uint8_t)x;
+		x >>= 8;
+	}
+	return p;
+}
+
+// Without bounds checks, for input known to hold a whole sample
+static inline const uint8_t *getVarintFast(const uint8_t *p, uint64_t &v)
+{
+	if (*p < 0x80) {
+		v = *p;
+		return p + 1;
+	}
+
+	v = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (b < 0x80) {
+			return p;
+		}
+	}
+	return nullptr;
+}
+
+static inline const uint8_t *getXor(const uint8_t *p, const uint8_t *end, uint64_t &x)
+{
+	if (p >= end) {
+		return nullptr;
+	}
+	uint8_t ctrl = *p++;
+	unsigned int len = ctrl & 0x0f;
+	unsigned int trail = ctrl >> 4;
+	if (len + trail > 8 || p + len > end) {
+		return nullptr;
+	}
+	x = 0;
+	for (unsigned int i = 0; i < len; i++) {
+		x |= (uint64_t)p[i] << (i * 8);
+	}
+	x <<= trail * 8;
+	return p + len;
+}
+
+// Reads 8 bytes after the control byte whatever its length, so the input
+// must have that much slack
+static inline const uint8_t *getXorFast(const uint8_t *p, uint64_t &x)
+{
+	uint8_t ctrl = *p++;
+	unsigned int len = ctrl & 0x0f;
+	unsigned int trail = ctrl >> 4;
+	if (len + trail > 8) {
+		return nullptr;
+	}
+	if (len == 0) {
+		x = 0;
+		return p;
+	}
+	memcpy(&x, p, 8);
+	if (len < 8) {
+		x &= (1ULL << (len * 8)) - 1;
+	}
+	x <<= trail * 8;
+	return p + len;
+}
+
+unsigned int SampleCodec::fieldSize(uint8_t type)
+{
+	switch (type) {
+	case FIELD_INT8:
+	case FIELD_UINT8:
+		return 1;
+	case FIELD_INT16:
+	case FIELD_UINT16:
+		return 2;
+	case FIELD_INT32:
+	case FIELD_UINT32:
+	case FIELD_FLOAT:
+		return 4;
+	case FIELD_INT64:
+	case FIELD_UINT64:
+	case FIELD_TIMESTAMP:
+	case FIELD_DOUBLE:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+// Integers are widened to 64 bits, so changes are the same for every width
+static inline uint64_t loadField(const uint8_t *src, uint8_t type)
+{
+	switch (type) {
+	case FIELD_INT8:	{ int8_t v; memcpy(&v, src, 1); return (int64_t)v; }
+	case FIELD_UINT8:	return *src;
+	case FIELD_INT16:	{ int16_t v; memcpy(&v, src, 2); return (int64_t)v; }
+	case FIELD_UINT16:	{ uint16_t v; memcpy(&v, src, 2); return v; }
+	case FIELD_INT32:	{ int32_t v; memcpy(&v, src, 4); return (int64_t)v; }
+	case FIELD_UINT32:
+	case FIELD_FLOAT:	{ uint32_t v; memcpy(&v, src, 4); return v; }
+	default:		{ uint64_t v; memcpy(&v, src, 8); return v; }
+	}
+}
+
+static inline void storeField(uint8_t *dst, uint8_t type, uint64_t v)
+{
+	// Little endian, the low bytes of the value. Fixed size copies are
+	// single stores.
+	switch (SampleCodec::fieldSize(type)) {
+	case 1:		*dst = (uint8_t)v; break;
+	case 2:		{ uint16_t w = v; memcpy(dst, &w, 2); break; }
+	case 4:		{ uint32_t w = v; memcpy(dst, &w, 4); break; }
+	default:	memcpy(dst, &v, 8); break;
+	}
+}
+
+// Whether any two fields share a byte
+static bool overlaps(const SampleField *fields, unsigned int num_fields)
+{
+	for (unsigned int i = 0; i < num_fields; i++) {
+		unsigned int end_i = fields[i].offset + SampleCodec::fieldSize(fields[i].type);
+		for (unsigned int j = i + 1; j < num_fields; j++) {
+			unsigned int end_j = fields[j].offset + SampleCodec::fieldSize(fields[j].type);
+			if (fields[i].offset < end_j && fields[j].offset < end_i) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+SampleCodec::SampleCodec() :
+	m_sample_size(0),
+	m_num_fields(0),
+	m_max_encoded(0),
+	m_fast_bytes(0),
+	m_covered(false),
+	m_out(nullptr),
+	m_pos(nullptr),
+	m_end(nullptr),
+	m_count(0),
+	m_first_timestamp(0)
+{}
+
+int SampleCodec::init(unsigned int sample_size, const SampleField *fields, unsigned int num_fields)
+{
+	unsigned int n = 0;
+
+	if (fields) {
+		if (num_fields > CODEC_MAX_FIELDS) {
+			return -EINVAL;
+		}
+		for (; n < num_fields; n++) {
+			unsigned int size = fieldSize(fields[n].type);
+			if (size == 0 || fields[n].offset + size > sample_size) {
+				return -EINVAL;
+			}
+			m_fields[n] = fields[n];
+		}
+	}
+	else {
+		if ((sample_size / 4) + (sample_size % 4) > CODEC_MAX_FIELDS) {
+			return -EINVAL;
+		}
+		unsigned int offset = 0;
+		for (; offset + 4 <= sample_size; offset += 4, n++) {
+			m_fields[n].offset = offset;
+			m_fields[n].type = FIELD_FLOAT;
+		}
+		for (; offset < sample_size; offset++, n++) {
+			m_fields[n].offset = offset;
+			m_fields[n].type = FIELD_UINT8;
+		}
+	}
+
+	// A 64 bit varint takes up to 10 bytes, a 64 bit XOR up to 9
+	unsigned int max = 10;
+	for (unsigned int i = 0; i < n; i++) {
+		max += (fieldSize(m_fields[i].type) == 8) ? 10 : 9;
+	}
+	if (max > CODEC_BLOCK_BYTES) {
+		return -EINVAL;
+	}
+
+	// Decoding skips the bounds checks while the input holds the longest
+	// valid encoding of every field plus the read ahead of getXorFast()
+	unsigned int covered = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		covered += fieldSize(m_fields[i].type);
+	}
+
+	m_sample_size = sample_size;
+	m_num_fields = n;
+	m_max_encoded = max;
+	m_fast_bytes = 10 * (n + 1) + 8;
+	m_covered = (covered == sample_size) && !overlaps(m_fields, n);
+	return 0;
+}
+
+void SampleCodec::reset(uint64_t first_timestamp)
+{
+	memset(m_prev, 0, m_num_fields * sizeof(m_prev[0]));
+	memset(m_prev_delta, 0, m_num_fields * sizeof(m_prev_delta[0]));
+	m_prev_timestamp = first_timestamp;
+	m_prev_timestamp_delta = 0;
+	m_first_timestamp = first_timestamp;
+}
+
+void SampleCodec::beginBlock(uint8_t *out, size_t capacity)
+{
+	m_out = out;
+	m_pos = out;
+	m_end = out + capacity;
+	m_count = 0;
+}
+
+bool SampleCodec::encode(const void *sample, uint64_t timestamp)
+{
+	if (m_count == CODEC_BLOCK_SAMPLES || (size_t)(m_end - m_pos) < m_max_encoded) {
+		return false;
+	}
+	if (m_count == 0) {
+		reset(timestamp);
+	}
+
+	const uint8_t *in = (const uint8_t *)sample;
+	uint8_t *p = m_pos;
+
+	uint64_t delta = timestamp - m_prev_timestamp;
+	p = putVarint(p, zigzag(delta - m_prev_timestamp_delta));
+	m_prev_timestamp = timestamp;
+	m_prev_timestamp_delta = delta;
+
+	for (unsigned int i = 0; i < m_num_fields; i++) {
+		const SampleField &f = m_fields[i];
+		uint64_t v = loadField(&in[f.offset], f.type);
+
+		switch (f.type) {
+		case FIELD_FLOAT:
+		case FIELD_DOUBLE:
+			p = putXor(p, v ^ m_prev[i]);
+			break;
+		case FIELD_TIMESTAMP:
+			delta = v - m_prev[i];
+			p = putVarint(p, zigzag(delta - m_prev_delta[i]));
+			m_prev_delta[i] = delta;
+			break;
+		default:
+			p = putVarint(p, zigzag(v - m_prev[i]));
+			break;
+		}
+		m_prev[i] = v;
+	}
+
+	m_pos = p;
+	m_count++;
+	return true;
+}
+
+template <bool checked>
+const uint8_t *SampleCodec::decodeSample(const uint8_t *p, const uint8_t *end, uint8_t *out)
+{
+	uint64_t v;
+	p = checked ? getVarint(p, end, v) : getVarintFast(p, v);
+	if (p == nullptr) {
+		return nullptr;
+	}
+	m_prev_timestamp_delta += unzigzag(v);
+	m_prev_timestamp += m_prev_timestamp_delta;
+
+	if (!m_covered) {
+		memset(out, 0, m_sample_size);
+	}
+	for (unsigned int i = 0; i < m_num_fields; i++) {
+		const SampleField &f = m_fields[i];
+
+		switch (f.type) {
+		case FIELD_FLOAT:
+		case FIELD_DOUBLE:
+			p = checked ? getXor(p, end, v) : getXorFast(p, v);
+			m_prev[i] ^= v;
+			break;
+		case FIELD_TIMESTAMP:
+			p = checked ? getVarint(p, end, v) : getVarintFast(p, v);
+			m_prev_delta[i] += unzigzag(v);
+			m_prev[i] += m_prev_delta[i];
+			break;
+		default:
+			p = checked ? getVarint(p, end, v) : getVarintFast(p, v);
+			m_prev[i] += unzigzag(v);
+			break;
+		}
+		if (p == nullptr) {
+			return nullptr;
+		}
+		storeField(&out[f.offset], f.type, m_prev[i]);
+	}
+	return p;
+}
+
+int SampleCodec::decode(const uint8_t *in, size_t len, unsigned int count, uint64_t first_timestamp,
+			void *samples, uint64_t *timestamps)
+{
+	const uint8_t *p = in;
+	const uint8_t *end = in + len;
+	uint8_t *out = (uint8_t *)samples;
+
+	reset(first_timestamp);
+
+	for (unsigned int n = 0; n < count; n++, out += m_sample_size) {
+		if ((size_t)(end - p) >= m_fast_bytes) {
+			p = decodeSample<false>(p, end, out);
+		}
+		else {
+			p = decodeSample<true>(p, end, out);
+		}
+		if (p == nullptr) {
+			return -1;
+		}
+		if (timestamps) {
+			timestamps[n] = m_prev_timestamp;
+		}
+	}
+	return count;
+}
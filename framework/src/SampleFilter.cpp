@@ -0,0 +1,355 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include "DFSimd.hpp"
+#include "SampleFilter.hpp"
+
+using namespace DriverFramework;
+
+//-----------------------------------------------------------------------
+// BiquadFilter
+//-----------------------------------------------------------------------
+
+BiquadFilter::BiquadFilter() :
+	m_b0(1.0f), m_b1(0.0f), m_b2(0.0f), m_a1(0.0f), m_a2(0.0f),
+	m_z1(nullptr),
+	m_z2(nullptr),
+	m_primed(false)
+{
+}
+
+BiquadFilter::~BiquadFilter()
+{
+	delete [] m_z1;
+	delete [] m_z2;
+}
+
+void BiquadFilter::setCoefficients(float b0, float b1, float b2, float a1, float a2)
+{
+	m_b0 = b0;
+	m_b1 = b1;
+	m_b2 = b2;
+	m_a1 = a1;
+	m_a2 = a2;
+	m_primed = false;
+}
+
+int BiquadFilter::setLowPass(float sample_hz, float cutoff_hz)
+{
+	if (sample_hz <= 0.0f || cutoff_hz <= 0.0f || cutoff_hz >= sample_hz / 2) {
+		return -EINVAL;
+	}
+
+	// Bilinear transform with Q = 1/sqrt(2)
+	double w = 2.0 * M_PI * cutoff_hz / sample_hz;
+	double alpha = sin(w) / (2.0 * M_SQRT1_2);
+	double a0 = 1.0 + alpha;
+	double b = (1.0 - cos(w)) / 2.0;
+
+	setCoefficients(b / a0, 2.0 * b / a0, b / a0, -2.0 * cos(w) / a0, (1.0 - alpha) / a0);
+	return 0;
+}
+
+int BiquadFilter::init(unsigned int lanes)
+{
+	delete [] m_z1;
+	delete [] m_z2;
+	m_lanes = lanes;
+	m_z1 = new float[lanes];
+	m_z2 = new float[lanes];
+	reset();
+	return 0;
+}
+
+void BiquadFilter::reset()
+{
+	m_primed = false;
+}
+
+unsigned int BiquadFilter::process(float *samples, uint64_t *timestamps, unsigned int count)
+{
+	if (count && !m_primed) {
+		// Steady state for an input equal to the first sample
+		for (unsigned int l = 0; l < m_lanes; l++) {
+			float x = samples[l];
+			float y = x * (m_b0 + m_b1 + m_b2) / (1.0f + m_a1 + m_a2);
+			m_z1[l] = y - m_b0 * x;
+			m_z2[l] = m_b2 * x - m_a2 * y;
+		}
+		m_primed = true;
+	}
+
+	const df_f32x4 b0 = df_set1_f32x4(m_b0);
+	const df_f32x4 b1 = df_set1_f32x4(m_b1);
+	const df_f32x4 b2 = df_set1_f32x4(m_b2);
+	const df_f32x4 a1 = df_set1_f32x4(m_a1);
+	const df_f32x4 a2 = df_set1_f32x4(m_a2);
+
+	for (unsigned int l = 0; l < m_lanes; l += 4) {
+		df_f32x4 z1 = df_load_f32x4(&m_z1[l]);
+		df_f32x4 z2 = df_load_f32x4(&m_z2[l]);
+
+		for (unsigned int i = 0; i < count; i++) {
+			float *p = &samples[i * m_lanes + l];
+			df_f32x4 x = df_load_f32x4(p);
+			df_f32x4 y = df_add_f32x4(df_mul_f32x4(b0, x), z1);
+			z1 = df_add_f32x4(df_sub_f32x4(df_mul_f32x4(b1, x), df_mul_f32x4(a1, y)), z2);
+			z2 = df_sub_f32x4(df_mul_f32x4(b2, x), df_mul_f32x4(a2, y));
+			df_store_f32x4(p, y);
+		}
+
+		df_store_f32x4(&m_z1[l], z1);
+		df_store_f32x4(&m_z2[l], z2);
+	}
+
+	return count;
+}
+
+//-----------------------------------------------------------------------
+// FIRFilter
+//-----------------------------------------------------------------------
+
+FIRFilter::FIRFilter(const float *taps, unsigned int num_taps, unsigned int decimation) :
+	m_taps(new float[num_taps ? num_taps : 1]),
+	m_num_taps(num_taps ? num_taps : 1),
+	m_decimation(decimation ? decimation : 1),
+	m_history(nullptr),
+	m_pos(0),
+	m_phase(0),
+	m_primed(false)
+{
+	m_taps[0] = 1.0f;
+	for (unsigned int k = 0; k < num_taps; k++) {
+		m_taps[num_taps - 1 - k] = taps[k];
+	}
+}
+
+FIRFilter::~FIRFilter()
+{
+	delete [] m_taps;
+	delete [] m_history;
+}
+
+int FIRFilter::init(unsigned int lanes)
+{
+	delete [] m_history;
+	m_lanes = lanes;
+	m_history = new float[2 * m_num_taps * lanes];
+	reset();
+	return 0;
+}
+
+void FIRFilter::reset()
+{
+	m_pos = 0;
+	m_phase = 0;
+	m_primed = false;
+}
+
+unsigned int FIRFilter::process(float *samples, uint64_t *timestamps, unsigned int count)
+{
+	if (count && !m_primed) {
+		for (unsigned int k = 0; k < 2 * m_num_taps; k++) {
+			memcpy(&m_history[k * m_lanes], samples, m_lanes * sizeof(float));
+		}
+		m_primed = true;
+	}
+
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const float *in = &samples[i * m_lanes];
+		memcpy(&m_history[m_pos * m_lanes], in, m_lanes * sizeof(float));
+		memcpy(&m_history[(m_pos + m_num_taps) * m_lanes], in, m_lanes * sizeof(float));
+		m_pos = (m_pos + 1) % m_num_taps;
+
+		if (++m_phase < m_decimation) {
+			continue;
+		}
+		m_phase = 0;
+
+		// The newest num_taps samples, oldest first
+		const float *window = &m_history[m_pos * m_lanes];
+		float *out = &samples[kept * m_lanes];
+
+		for (unsigned int l = 0; l < m_lanes; l += 4) {
+			df_f32x4 acc = df_set1_f32x4(0.0f);
+			for (unsigned int k = 0; k < m_num_taps; k++) {
+				acc = df_add_f32x4(acc, df_mul_f32x4(df_set1_f32x4(m_taps[k]),
+								     df_load_f32x4(&window[k * m_lanes + l])));
+			}
+			df_store_f32x4(&out[l], acc);
+		}
+		timestamps[kept] = timestamps[i];
+		kept++;
+	}
+
+	return kept;
+}
+
+//-----------------------------------------------------------------------
+// MedianFilter
+//-----------------------------------------------------------------------
+
+MedianFilter::MedianFilter(unsigned int window) :
+	m_window((window < MEDIAN_FILTER_MAX_WINDOW) ? (window | 1) : MEDIAN_FILTER_MAX_WINDOW),
+	m_history(nullptr),
+	m_pos(0),
+	m_primed(false)
+{
+}
+
+MedianFilter::~MedianFilter()
+{
+	delete [] m_history;
+}
+
+int MedianFilter::init(unsigned int lanes)
+{
+	delete [] m_history;
+	m_lanes = lanes;
+	m_history = new float[m_window * lanes];
+	reset();
+	return 0;
+}
+
+void MedianFilter::reset()
+{
+	m_pos = 0;
+	m_primed = false;
+}
+
+unsigned int MedianFilter::process(float *samples, uint64_t *timestamps, unsigned int count)
+{
+	if (count && !m_primed) {
+		for (unsigned int k = 0; k < m_window; k++) {
+			memcpy(&m_history[k * m_lanes], samples, m_lanes * sizeof(float));
+		}
+		m_primed = true;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		float *p = &samples[i * m_lanes];
+		memcpy(&m_history[m_pos * m_lanes], p, m_lanes * sizeof(float));
+		m_pos = (m_pos + 1) % m_window;
+
+		for (unsigned int l = 0; l < m_lanes; l += 4) {
+			df_f32x4 v[MEDIAN_FILTER_MAX_WINDOW];
+
+			for (unsigned int k = 0; k < m_window; k++) {
+				v[k] = df_load_f32x4(&m_history[k * m_lanes + l]);
+			}
+
+			// Odd-even transposition sort, window passes
+			for (unsigned int pass = 0; pass < m_window; pass++) {
+				for (unsigned int k = pass & 1; k + 1 < m_window; k += 2) {
+					df_f32x4 lo = df_min_f32x4(v[k], v[k + 1]);
+					v[k + 1] = df_max_f32x4(v[k], v[k + 1]);
+					v[k] = lo;
+				}
+			}
+
+			df_store_f32x4(&p[l], v[m_window / 2]);
+		}
+	}
+
+	return count;
+}
+
+//-----------------------------------------------------------------------
+// OutlierFilter
+//-----------------------------------------------------------------------
+
+OutlierFilter::OutlierFilter(float max_step, unsigned int max_rejects) :
+	m_max_step(max_step),
+	m_max_rejects(max_rejects),
+	m_last(nullptr),
+	m_rejects(nullptr),
+	m_rejected(0),
+	m_primed(false)
+{
+}
+
+OutlierFilter::~OutlierFilter()
+{
+	delete [] m_last;
+	delete [] m_rejects;
+}
+
+int OutlierFilter::init(unsigned int lanes)
+{
+	delete [] m_last;
+	delete [] m_rejects;
+	m_lanes = lanes;
+	m_last = new float[lanes];
+	m_rejects = new unsigned int[lanes];
+	reset();
+	return 0;
+}
+
+void OutlierFilter::reset()
+{
+	m_primed = false;
+}
+
+unsigned int OutlierFilter::process(float *samples, uint64_t *timestamps, unsigned int count)
+{
+	if (count && !m_primed) {
+		memcpy(m_last, samples, m_lanes * sizeof(float));
+		memset(m_rejects, 0, m_lanes * sizeof(unsigned int));
+		m_primed = true;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		float *p = &samples[i * m_lanes];
+
+		for (unsigned int l = 0; l < m_lanes; l++) {
+			if (fabsf(p[l] - m_last[l]) > m_max_step && m_rejects[l] < m_max_rejects) {
+				p[l] = m_last[l];
+				m_rejects[l]++;
+				m_rejected++;
+			}
+			else {
+				m_last[l] = p[l];
+				m_rejects[l] = 0;
+			}
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,115 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include "SensorFifo.hpp"
+#include "DriverFramework.hpp"
+
+using namespace DriverFramework;
+
+int SensorFifo::validate(const SensorFifoConfig &config)
+{
+	if (config.count_length < 1 || config.count_length > 2) {
+		DF_LOG_ERR("error: FIFO count length %u is not 1 or 2", config.count_length);
+		return -EINVAL;
+	}
+	if (config.sample_size == 0) {
+		DF_LOG_ERR("error: FIFO sample size is 0");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int SensorFifo::drain(const SensorFifoConfig &config, SensorFifoReadReg read_reg, void *ctx,
+		      uint8_t *out_buffer, uint64_t *timestamps, unsigned int max_samples)
+{
+	uint8_t count_bytes[2];
+
+	if (validate(config) < 0) {
+		return -EINVAL;
+	}
+
+	uint64_t read_time = offsetTime();
+	if (read_reg(ctx, config.count_reg, count_bytes, config.count_length) < 0) {
+		return -1;
+	}
+
+	unsigned int available = parseCount(config, count_bytes);
+
+	// The rest stays queued for the next drain
+	unsigned int count = (available > max_samples) ? max_samples : available;
+	if (count == 0) {
+		return 0;
+	}
+
+	if (read_reg(ctx, config.data_reg, out_buffer, count * config.sample_size) < 0) {
+		return -1;
+	}
+
+	// The newest sample queued is at most one period older than the read
+	backInterpolate(config, read_time, count, available - count, timestamps);
+
+	return count;
+}
+
+unsigned int SensorFifo::parseCount(const SensorFifoConfig &config, const uint8_t *count_bytes)
+{
+	unsigned int count = count_bytes[0];
+
+	if (config.count_length == 2) {
+		count = config.count_big_endian ?
+			(count_bytes[0] << 8) | count_bytes[1] :
+			(count_bytes[1] << 8) | count_bytes[0];
+	}
+	if (config.count_mask) {
+		count &= config.count_mask;
+	}
+	if (config.count_in_bytes) {
+		count /= config.sample_size;
+	}
+	return count;
+}
+
+void SensorFifo::backInterpolate(const SensorFifoConfig &config, uint64_t newest_time,
+				 unsigned int count, unsigned int newer_count, uint64_t *timestamps)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		// Scale before dividing so a period that is not a whole number of
+		// microseconds does not accumulate into drift across the FIFO
+		uint64_t periods = count - 1 - i + newer_count;
+		uint64_t age = config.odr_hz ? (periods * 1000000 + config.odr_hz / 2) / config.odr_hz : 0;
+		timestamps[i] = (newest_time > age) ? newest_time - age : 0;
+	}
+}
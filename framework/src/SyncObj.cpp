@@ -34,55 +34,487 @@
 * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include "DriverFramework.hpp"
 #include "SyncObj.hpp"
 
-#define DEBUG(FMT, ...)
-//#define DEBUG(FMT, ...) printf(FMT, __VA_ARGS__)
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#define SYNC_OBJ_HAVE_FUTEX 1
+#endif
+
+// Upper bound for the adaptive spin of SYNC_OBJ_FUTEX locks
+#define SYNC_OBJ_SPIN_MAX 100
 
 using namespace DriverFramework;
 
-SyncObj::SyncObj()
+#ifdef DF_LOCK_STATS
+#include <algorithm>
+#include <vector>
+
+// Live locks, for getAllStats()
+static SyncObj *s_stats_list = nullptr;
+static pthread_mutex_t s_stats_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t statsTime()
 {
-	m_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
-	m_new_data_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int histBucket(uint64_t nsec)
+{
+	uint64_t usec = nsec / 1000;
+	if (usec == 0) {
+		return 0;
+	}
+	unsigned int bucket = 64 - __builtin_clzll(usec);
+	return bucket < SYNC_OBJ_HIST_BUCKETS ? bucket : SYNC_OBJ_HIST_BUCKETS - 1;
+}
+#endif
+
+#ifdef SYNC_OBJ_HAVE_FUTEX
+static int futexWait(int *addr, int val, const struct timespec *abs_monotonic)
+{
+	// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline
+	return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, val,
+		       abs_monotonic, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futexWake(int *addr, int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+
+static inline void cpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+#endif
+
+static struct timespec monotonicInFuture(unsigned long time_ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	uint64_t nsecs = ts.tv_nsec + (uint64_t)time_ms * 1000000;
+	ts.tv_sec += nsecs / 1000000000;
+	ts.tv_nsec = nsecs % 1000000000;
+
+	return ts;
+}
+
+SyncObj::SyncObj(SyncObjType type, const char *name) :
+	m_type(type),
+	m_name(name ? name : "unnamed"),
+	m_futex(0),
+	m_spin(0),
+	m_spin_max(SYNC_OBJ_SPIN_MAX),
+	m_event_seq(0),
+	m_event_waiters(0)
+{
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	// On a single CPU the holder cannot run while we spin
+	if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
+		m_spin_max = 0;
+	}
+#else
+	if (m_type == SYNC_OBJ_FUTEX) {
+		m_type = SYNC_OBJ_DEFAULT;
+	}
+#endif
+
+	pthread_mutexattr_t mattr;
+	pthread_mutexattr_init(&mattr);
+	if (m_type == SYNC_OBJ_PRIO_INHERIT &&
+	    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT) != 0) {
+		DF_LOG_ERR("SyncObj: priority inheritance not supported");
+	}
+	pthread_mutex_init(&m_lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+#if !(defined(__APPLE__) && defined(__MACH__))
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&m_new_data_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+#ifdef DF_LOCK_STATS
+	m_stats_seq = 0;
+	resetStats();
+	m_acquired_at = 0;
+
+	pthread_mutex_lock(&s_stats_list_lock);
+	m_stats_prev = nullptr;
+	m_stats_next = s_stats_list;
+	if (s_stats_list) {
+		s_stats_list->m_stats_prev = this;
+	}
+	s_stats_list = this;
+	pthread_mutex_unlock(&s_stats_list_lock);
+#endif
 }
 
 SyncObj::~SyncObj()
 {
+#ifdef DF_LOCK_STATS
+	pthread_mutex_lock(&s_stats_list_lock);
+	if (m_stats_prev) {
+		m_stats_prev->m_stats_next = m_stats_next;
+	}
+	else {
+		s_stats_list = m_stats_next;
+	}
+	if (m_stats_next) {
+		m_stats_next->m_stats_prev = m_stats_prev;
+	}
+	pthread_mutex_unlock(&s_stats_list_lock);
+#endif
+
+	pthread_cond_destroy(&m_new_data_cond);
+	pthread_mutex_destroy(&m_lock);
 }
 
-void SyncObj::lock()
+bool SyncObj::rawTryLock()
+{
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	if (m_type == SYNC_OBJ_FUTEX) {
+		int unlocked = 0;
+		return __atomic_compare_exchange_n(&m_futex, &unlocked, 1, false,
+						   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
+#endif
+	return pthread_mutex_trylock(&m_lock) == 0;
+}
+
+void SyncObj::rawLock()
 {
-	DEBUG("Lock %p\n", this);
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	if (m_type == SYNC_OBJ_FUTEX) {
+		if (!rawTryLock()) {
+			futexLockSlow();
+		}
+		return;
+	}
+#endif
 	pthread_mutex_lock(&m_lock);
 }
 
-void SyncObj::unlock()
+void SyncObj::rawUnlock()
 {
-	DEBUG("unock %p\n", this);
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	if (m_type == SYNC_OBJ_FUTEX) {
+		if (__atomic_fetch_sub(&m_futex, 1, __ATOMIC_RELEASE) != 1) {
+			// There may be sleepers
+			__atomic_store_n(&m_futex, 0, __ATOMIC_RELEASE);
+			futexWake(&m_futex, 1);
+		}
+		return;
+	}
+#endif
 	pthread_mutex_unlock(&m_lock);
 }
 
+void SyncObj::lock()
+{
+#ifdef DF_LOCK_STATS
+	if (rawTryLock()) {
+		acquired(false, 0);
+		return;
+	}
+	uint64_t start = statsTime();
+	rawLock();
+	acquired(true, statsTime() - start);
+#else
+	rawLock();
+#endif
+}
+
+void SyncObj::unlock()
+{
+#ifdef DF_LOCK_STATS
+	releasing();
+#endif
+	rawUnlock();
+}
+
+void SyncObj::futexLockSlow()
+{
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	// Spin for about twice the recent average, as the holder is likely
+	// to release the lock soon if it did so before
+	int avg = __atomic_load_n(&m_spin, __ATOMIC_RELAXED);
+	int max_spin = avg * 2 + 10;
+	if (max_spin > m_spin_max) {
+		max_spin = m_spin_max;
+	}
+
+	int spins = 0;
+	bool acquired = false;
+	while (!acquired && spins < max_spin) {
+		spins++;
+		cpuRelax();
+		int unlocked = 0;
+		if (__atomic_load_n(&m_futex, __ATOMIC_RELAXED) == 0 &&
+		    __atomic_compare_exchange_n(&m_futex, &unlocked, 1, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			acquired = true;
+		}
+	}
+	__atomic_store_n(&m_spin, avg + (spins - avg) / 8, __ATOMIC_RELAXED);
+	if (acquired) {
+		return;
+	}
+
+	// Mark the lock contended and sleep until it is released
+	while (__atomic_exchange_n(&m_futex, 2, __ATOMIC_ACQUIRE) != 0) {
+		futexWait(&m_futex, 2, NULL);
+	}
+#endif
+}
+
 int SyncObj::waitOnSignal(unsigned long timeout_ms)
 {
 	int ret;
-	DEBUG("wait %p\n", &m_new_data_cond);
+
+	struct timespec ts;
+	if (timeout_ms) {
+#if defined(__APPLE__) && defined(__MACH__)
+		ts = absoluteTimeInFuture(timeout_ms);
+#else
+		ts = monotonicInFuture(timeout_ms);
+#endif
+	}
+
+#ifdef DF_LOCK_STATS
+	// The wait is not held time, and the lock is retaken without
+	// counting as an acquisition
+	releasing();
+#endif
+
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	if (m_type == SYNC_OBJ_FUTEX) {
+		// Register before sampling the sequence, so a signal() after
+		// the sample sees the waiter and wakes it
+		__atomic_fetch_add(&m_event_waiters, 1, __ATOMIC_SEQ_CST);
+		unsigned int seq = __atomic_load_n(&m_event_seq, __ATOMIC_SEQ_CST);
+		rawUnlock();
+
+		ret = 0;
+		while (__atomic_load_n(&m_event_seq, __ATOMIC_ACQUIRE) == seq) {
+			if (futexWait((int *)&m_event_seq, (int)seq, timeout_ms ? &ts : NULL) != 0 &&
+			    errno == ETIMEDOUT) {
+				ret = ETIMEDOUT;
+				break;
+			}
+		}
+
+		__atomic_fetch_sub(&m_event_waiters, 1, __ATOMIC_RELAXED);
+		rawLock();
+	}
+	else
+#endif
 	if (timeout_ms) {
-		struct timespec ts = absoluteTimeInFuture(timeout_ms);
 		ret = pthread_cond_timedwait(&m_new_data_cond, &m_lock, &ts);
 	}
 	else {
 		ret = pthread_cond_wait(&m_new_data_cond, &m_lock);
 	}
 
+#ifdef DF_LOCK_STATS
+	m_acquired_at = statsTime();
+#endif
 	return ret;
 }
 
 void SyncObj::signal(void)
 {
-	DEBUG("signal %p\n", &m_new_data_cond);
+#ifdef SYNC_OBJ_HAVE_FUTEX
+	if (m_type == SYNC_OBJ_FUTEX) {
+		__atomic_fetch_add(&m_event_seq, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&m_event_waiters, __ATOMIC_SEQ_CST)) {
+			futexWake((int *)&m_event_seq, 1);
+		}
+		return;
+	}
+#endif
 	pthread_cond_signal(&m_new_data_cond);
 }
 
+#ifdef DF_LOCK_STATS
+
+// Called with the lock held
+void SyncObj::statsWriteBegin()
+{
+	__atomic_store_n(&m_stats_seq, m_stats_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Called with the lock held
+void SyncObj::statsWriteEnd()
+{
+	__atomic_store_n(&m_stats_seq, m_stats_seq + 1, __ATOMIC_RELEASE);
+}
+
+// Retries while a holder of the lock updates the stats, so getAllStats()
+// never waits for a lock while holding s_stats_list_lock
+void SyncObj::snapshotStats(SyncObjStats &stats)
+{
+	for (;;) {
+		unsigned int seq = __atomic_load_n(&m_stats_seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) == 0) {
+			memcpy(&stats, &m_stats, sizeof(stats));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&m_stats_seq, __ATOMIC_RELAXED) == seq) {
+				return;
+			}
+		}
+		sched_yield();
+	}
+}
+
+// Called with the lock held
+void SyncObj::acquired(bool contended, uint64_t wait)
+{
+	statsWriteBegin();
+	m_stats.acquisitions++;
+	if (contended) {
+		m_stats.contended++;
+		m_stats.wait_total += wait;
+		if (wait > m_stats.wait_max) {
+			m_stats.wait_max = wait;
+		}
+	}
+	m_stats.wait_hist[histBucket(wait)]++;
+	statsWriteEnd();
+	m_acquired_at = statsTime();
+}
+
+// Called with the lock held
+void SyncObj::releasing()
+{
+	uint64_t hold = statsTime() - m_acquired_at;
+
+	statsWriteBegin();
+	m_stats.hold_total += hold;
+	m_stats.hold_hist[histBucket(hold)]++;
+	if (hold > m_stats.hold_max) {
+		m_stats.hold_max = hold;
+#ifdef __linux__
+		pthread_getname_np(pthread_self(), m_stats.hold_max_thread, sizeof(m_stats.hold_max_thread));
+#else
+		snprintf(m_stats.hold_max_thread, sizeof(m_stats.hold_max_thread), "%p", (void *)pthread_self());
+#endif
+	}
+	statsWriteEnd();
+}
+
+bool SyncObj::getStats(SyncObjStats &stats)
+{
+	rawLock();
+	stats = m_stats;
+	rawUnlock();
+	return true;
+}
+
+void SyncObj::resetStats()
+{
+	rawLock();
+	statsWriteBegin();
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.name = m_name;
+	statsWriteEnd();
+	rawUnlock();
+}
+
+static bool moreWait(const SyncObjStats &a, const SyncObjStats &b)
+{
+	return a.wait_total > b.wait_total;
+}
+
+unsigned int SyncObj::getAllStats(SyncObjStats *stats, unsigned int max)
+{
+	std::vector<SyncObjStats> all;
+
+	// Locks are created and destroyed with other locks held, so taking
+	// each lock here with s_stats_list_lock held could deadlock
+	pthread_mutex_lock(&s_stats_list_lock);
+	for (SyncObj *obj = s_stats_list; obj != nullptr; obj = obj->m_stats_next) {
+		SyncObjStats s;
+		obj->snapshotStats(s);
+		all.push_back(s);
+	}
+	pthread_mutex_unlock(&s_stats_list_lock);
+
+	std::stable_sort(all.begin(), all.end(), moreWait);
+
+	unsigned int count = all.size() < max ? all.size() : max;
+	std::copy(all.begin(), all.begin() + count, stats);
+	return count;
+}
+
+void SyncObj::dumpStats(void)
+{
+	std::vector<SyncObjStats> all(256);
+	unsigned int count = getAllStats(&all[0], all.size());
+
+	DF_LOG_INFO("%-20s %10s %10s %12s %10s %12s %10s %s",
+		    "lock", "acquired", "contended", "wait us", "max us", "hold us", "max us", "longest holder");
+
+	for (unsigned int i = 0; i < count; i++) {
+		const SyncObjStats &s = all[i];
+		DF_LOG_INFO("%-20s %10lu %10lu %12.1f %10.1f %12.1f %10.1f %s",
+			    s.name, s.acquisitions, s.contended,
+			    s.wait_total / 1000.0, s.wait_max / 1000.0,
+			    s.hold_total / 1000.0, s.hold_max / 1000.0, s.hold_max_thread);
+
+		char line[256];
+		int len = 0;
+		for (unsigned int b = 0; b < SYNC_OBJ_HIST_BUCKETS; b++) {
+			len += snprintf(&line[len], sizeof(line) - len, " %lu", s.wait_hist[b]);
+		}
+		DF_LOG_INFO("    wait histogram (<1us, <2us, ... usec):%s", line);
+		len = 0;
+		for (unsigned int b = 0; b < SYNC_OBJ_HIST_BUCKETS; b++) {
+			len += snprintf(&line[len], sizeof(line) - len, " %lu", s.hold_hist[b]);
+		}
+		DF_LOG_INFO("    hold histogram (<1us, <2us, ... usec):%s", line);
+	}
+}
+
+#else
+
+bool SyncObj::getStats(SyncObjStats &stats)
+{
+	return false;
+}
+
+void SyncObj::resetStats()
+{
+}
+
+unsigned int SyncObj::getAllStats(SyncObjStats *stats, unsigned int max)
+{
+	return 0;
+}
+
+void SyncObj::dumpStats(void)
+{
+	DF_LOG_INFO("Lock statistics are disabled, build with DF_LOCK_STATS");
+}
+
+#endif
@@ -0,0 +1,124 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include "DriverFramework.hpp"
+#include "bench.hpp"
+
+// Cost of a DF_LOG_INFO call with the deferred logger, compared to
+// printing the same message directly. Messages go to /dev/null. Bursts
+// fit in a thread's ring, the logger thread empties it between bursts.
+
+#define BENCH_BURSTS		100
+#define BENCH_BURST_SIZE	100
+#define BENCH_MAX_NSEC		500	// fail above this per deferred message
+
+int main()
+{
+	FILE *devnull = fopen("/dev/null", "w");
+	if (devnull == nullptr) {
+		printf("FAILED: cannot open /dev/null\n");
+		return 1;
+	}
+
+	// Printed directly
+	uint64_t direct[BENCH_BURSTS];
+	for (unsigned int b = 0; b < BENCH_BURSTS; b++) {
+		uint64_t start = nowNsec();
+		for (unsigned int i = 0; i < BENCH_BURST_SIZE; i++) {
+			fprintf(devnull, "sample %u: %d Pa %f C dev %s\n", i, 100653 + i, 25.08, "/dev/baro0");
+		}
+		direct[b] = nowNsec() - start;
+	}
+
+	Logger::start();
+	Logger::setOutput(devnull);
+
+	// Fault in the ring, as mlockall() does in realtime mode
+	for (unsigned int i = 0; i < 4 * BENCH_BURST_SIZE; i++) {
+		DF_LOG_INFO("sample %u: %d Pa %f C dev %s", i, 100653 + i, 25.08, "/dev/baro0");
+		if (i % BENCH_BURST_SIZE == 0) {
+			usleep(2 * DF_LOG_FLUSH_USEC);
+		}
+	}
+	usleep(2 * DF_LOG_FLUSH_USEC);
+	unsigned long warmup_dropped = Logger::getDropped();
+
+	uint64_t deferred[BENCH_BURSTS];
+	for (unsigned int b = 0; b < BENCH_BURSTS; b++) {
+		uint64_t start = nowNsec();
+		for (unsigned int i = 0; i < BENCH_BURST_SIZE; i++) {
+			DF_LOG_INFO("sample %u: %d Pa %f C dev %s", i, 100653 + i, 25.08, "/dev/baro0");
+		}
+		deferred[b] = nowNsec() - start;
+		usleep(2 * DF_LOG_FLUSH_USEC);
+	}
+	unsigned long dropped = Logger::getDropped() - warmup_dropped;
+
+	// A full ring drops messages without blocking
+	uint64_t start = nowNsec();
+	for (unsigned int i = 0; i < 100 * BENCH_BURST_SIZE; i++) {
+		DF_LOG_INFO("sample %u: %d Pa %f C dev %s", i, 100653 + i, 25.08, "/dev/baro0");
+	}
+	double flood = (double)(nowNsec() - start) / (100 * BENCH_BURST_SIZE);
+	unsigned long flood_dropped = Logger::getDropped() - dropped - warmup_dropped;
+
+	Logger::stop();
+	Logger::setOutput(nullptr);
+	fclose(devnull);
+
+	// Median burst, as other threads may preempt a burst
+	std::sort(direct, direct + BENCH_BURSTS);
+	std::sort(deferred, deferred + BENCH_BURSTS);
+	double direct_ns = (double)direct[BENCH_BURSTS / 2] / BENCH_BURST_SIZE;
+	double deferred_ns = (double)deferred[BENCH_BURSTS / 2] / BENCH_BURST_SIZE;
+
+	printf("direct fprintf:  %7.1f ns per message\n", direct_ns);
+	printf("deferred:        %7.1f ns per message (worst burst %.1f ns per message), %lu dropped\n",
+	       deferred_ns, (double)deferred[BENCH_BURSTS - 1] / BENCH_BURST_SIZE, dropped);
+	printf("flooded ring:    %7.1f ns per message, %lu of %u dropped\n",
+	       flood, flood_dropped, 100 * BENCH_BURST_SIZE);
+
+	if (dropped != 0 || deferred_ns > BENCH_MAX_NSEC || flood_dropped == 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
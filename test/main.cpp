@@ -1,8 +1,20 @@
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "DriverFramework.hpp"
 #include "DevMgr.hpp"
+#include "SyncObj.hpp"
+#include "FilterStage.hpp"
+#include "Arena.hpp"
+#include "Recorder.hpp"
+#include "ReplayDevObj.hpp"
+#include "RecordingReader.hpp"
+#include "DevClient.hpp"
+#include "SampleCodec.hpp"
 #include "testdriver.hpp"
 
 using namespace DriverFramework;
@@ -37,6 +49,877 @@ static void test_read(DevHandle &h1, DevHandle &h2, unsigned int timeout_ms, boo
 	printf("test %s (%d)\n", (((result != 0) && !expected_pass) || ((result == 0) && expected_pass)) ? "PASSED" : "FAILED", result);
 }
 
+static void test_dataflow(TestDriver &test)
+{
+	const std::string testname = std::string(TEST_DRIVER_DEV_PATH) + std::to_string(0);
+	const std::string stage1name = std::string(DERIVED_DRIVER_DEV_PATH) + std::to_string(0);
+	const std::string stage2name = std::string(DERIVED_DRIVER_DEV_PATH) + std::to_string(1);
+
+	// Two stage pipeline: test -> stage1 -> stage2
+	DerivedTestDriver stage1(testname.c_str());
+	stage1.start();
+	DerivedTestDriver stage2(stage1name.c_str());
+	stage2.start();
+
+	bool pass = (stage1.addUpstream(test) == 0) && (stage2.addUpstream(stage1) == 0);
+
+	// A cycle must be refused
+	pass = pass && (stage1.addUpstream(stage2) < 0);
+
+	DevHandle h;
+	DevMgr::getHandle(stage2name.c_str(), h);
+
+	UpdateList in_set, out_set;
+	in_set.push_back(&h);
+	int result = DevMgr::waitForUpdate(in_set, out_set, 1000);
+
+	TestMessage m1, m2;
+	stage1.devRead(&m1, sizeof(m1));
+	h.read(&m2, sizeof(m2));
+	printf("Dataflow stage1=%d (%u updates) stage2=%d (%u updates)\n",
+	       m1.val, stage1.m_update_count, m2.val, stage2.m_update_count);
+
+	pass = pass && (result == 0) && (stage2.m_update_count > 0) && (m2.val >= 2);
+
+	stage2.removeUpstream(stage1);
+	stage1.removeUpstream(test);
+
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+static void test_multiphase()
+{
+	MultiPhaseTestDriver mp;
+	mp.start();
+	usleep(200000);
+	mp.stop();
+
+	printf("Multi-phase: %u complete, min duration %llu usec, %lu overruns\n",
+	       mp.m_complete_count, (unsigned long long)mp.m_min_duration, mp.getMeasureOverruns());
+	printf("test %s\n", (mp.m_complete_count > 0 && mp.m_bad_phase_count == 0 &&
+		mp.m_min_duration >= 2*MultiPhaseTestDriver::CONVERSION_USEC) ? "PASSED" : "FAILED");
+}
+
+static void test_filter_stage()
+{
+	SampleTestDriver src;
+	src.start();
+
+	// x, y and z through outlier rejection, median, low pass and a 2:1
+	// decimating FIR; z alone through a wider median
+	static const size_t xyz[] = { offsetof(TestSample, x), offsetof(TestSample, y), offsetof(TestSample, z) };
+	static const float taps[] = { 0.25f, 0.25f, 0.25f, 0.25f };
+	FilterStage lp("LowPass", FILTER_DEV_PATH, 3, 128);
+	OutlierFilter outlier(10.0f, 3);
+	MedianFilter median3(3);
+	BiquadFilter biquad;
+	FIRFilter fir(taps, 4, 2);
+	biquad.setLowPass(1000.0f, 50.0f);
+	lp.addFilter(outlier);
+	lp.addFilter(median3);
+	lp.addFilter(biquad);
+	lp.addFilter(fir);
+
+	FilterStage med("Median", FILTER_DEV_PATH, 1, 256);
+	MedianFilter median5(5);
+	med.addFilter(median5);
+
+	bool pass = (lp.setInput(src, xyz) == 0) && (med.setInput(src, &xyz[2]) == 0) &&
+		    (lp.start() == 0) && (med.start() == 0);
+
+	// Each batch is filtered once, in this thread, before publish() returns
+	for (unsigned int batch = 0; batch < 10; batch++) {
+		TestSample s[20];
+		uint64_t ts[20];
+		for (unsigned int i = 0; i < 20; i++) {
+			unsigned int n = batch * 20 + i;
+			s[i].seq = n;
+			s[i].x = (n == 50) ? 100.0f : 1.0f;
+			s[i].y = -2.0f;
+			s[i].z = (n == 120) ? 50.0f : 3.0f;
+			ts[i] = (n + 1) * 1000;
+		}
+		src.publish(s, ts, 20);
+	}
+
+	float out[200 * 3];
+	uint64_t ts[200];
+	int lp_count = lp.readSamples(out, ts, 200);
+	for (int i = 0; i < lp_count; i++) {
+		if (fabsf(out[i * 3] - 1.0f) > 1e-4f || fabsf(out[i * 3 + 1] + 2.0f) > 1e-4f ||
+		    fabsf(out[i * 3 + 2] - 3.0f) > 1e-4f || ts[i] != (uint64_t)(i + 1) * 2000) {
+			pass = false;
+		}
+	}
+
+	int med_count = med.readSamples(out, ts, 200);
+	for (int i = 0; i < med_count; i++) {
+		if (out[i] != 3.0f) {
+			pass = false;
+		}
+	}
+
+	// The raw stream is still there for other readers
+	TestSample raw[200];
+	int raw_count = src.readSamples(raw, nullptr, 200);
+
+	printf("Filter stage: %d low pass samples (%lu rejected), %d median samples, %d raw samples\n",
+	       lp_count, outlier.getRejected(), med_count, raw_count);
+
+	pass = pass && (lp_count == 100) && (outlier.getRejected() == 2) &&
+	       (med_count == 200) && (raw_count == 200);
+
+	// A 50 Hz low pass at 1 kHz removes a Nyquist rate input
+	BiquadFilter nyquist;
+	nyquist.setLowPass(1000.0f, 50.0f);
+	nyquist.init(4);
+	float alt[100 * 4];
+	for (unsigned int i = 0; i < 100 * 4; i++) {
+		alt[i] = ((i / 4) & 1) ? 1.0f : -1.0f;
+	}
+	nyquist.process(alt, ts, 100);
+	pass = pass && (fabsf(alt[99 * 4]) < 0.01f);
+
+	lp.stop();
+	med.stop();
+	src.stop();
+
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+static void periodicCallback(void *arg, WorkHandle wh)
+{
+	WorkMgr::schedule(wh);
+}
+
+struct DestroyTestState
+{
+	volatile bool	started;
+	volatile bool	finished;
+	WorkHandle	self;
+};
+
+static void slowCallback(void *arg, WorkHandle wh)
+{
+	DestroyTestState *state = (DestroyTestState *)arg;
+	state->started = true;
+	usleep(50000);
+	state->finished = true;
+}
+
+static void selfDestroyCallback(void *arg, WorkHandle wh)
+{
+	DestroyTestState *state = (DestroyTestState *)arg;
+	WorkMgr::destroy(state->self);
+	state->finished = true;
+}
+
+// destroy() returns only once a running callback has returned, and a
+// callback can destroy its own item
+static void test_work_destroy()
+{
+	DestroyTestState state = { false, false, 0 };
+	WorkHandle wh = WorkMgr::create(slowCallback, &state, 1000);
+	WorkMgr::schedule(wh);
+	while (!state.started) {
+		usleep(1000);
+	}
+	WorkMgr::destroy(wh);
+	bool waited = state.finished;
+
+	DestroyTestState self_state = { false, false, 0 };
+	self_state.self = WorkMgr::create(selfDestroyCallback, &self_state, 1000);
+	WorkMgr::schedule(self_state.self);
+	for (unsigned int i = 0; i < 100 && !self_state.finished; i++) {
+		usleep(1000);
+	}
+
+	printf("Destroy during callback: %s, from own callback: %s\n",
+	       waited ? "waited" : "returned early", self_state.finished ? "done" : "stuck");
+	printf("test %s\n", (waited && self_state.finished && self_state.self == 0) ? "PASSED" : "FAILED");
+}
+
+static void test_phase_planner()
+{
+	WorkHandle wh[4];
+
+	// Four items with the same period are all due at the same time
+	for (unsigned int i = 0; i < 4; i++) {
+		wh[i] = WorkMgr::create(periodicCallback, nullptr, 10000);
+		WorkMgr::schedule(wh[i]);
+	}
+	usleep(100000);
+
+	// A wakeup delayed by preemption legitimately dispatches the overdue
+	// items together, so measure over a few windows. Coalesced phase
+	// slots show up in every window.
+	int planned = 0;
+	WorkPlanStats stats;
+	for (unsigned int attempt = 0; attempt < 3; attempt++) {
+		planned = WorkMgr::planPhases(1000);
+		usleep(200000);
+
+		WorkMgr::getPlanStats(stats);
+		printf("Planned %d items: hyperperiod=%u tick=%u predicted max items=%u util=%f "
+		       "measured max items=%u util=%f wakeups=%lu\n",
+		       planned, stats.hyperperiod_usec, stats.tick_usec, stats.predicted_max_items,
+		       stats.predicted_max_utilization, stats.measured_max_items,
+		       stats.measured_max_utilization, stats.measured_wakeups);
+		if (stats.measured_max_items == stats.predicted_max_items) {
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < 4; i++) {
+		WorkMgr::destroy(wh[i]);
+	}
+	printf("test %s\n", (planned >= 4 && stats.predicted_max_items == 1 &&
+			       stats.measured_max_items == 1) ? "PASSED" : "FAILED");
+}
+
+// Messages are formatted by the logger thread as printf() would have
+static void test_logger()
+{
+	FILE *out = tmpfile();
+	Logger::flush();
+	Logger::setOutput(out);
+
+	const std::string name("TestDriver");
+	bool running = Logger::isRunning();
+	DF_LOG_INFO("int %d %5i|%-4u|%lu %llu %zu 0x%02x %c", -42, 7, 3u, 123456789UL, 1ULL << 40, sizeof(int), 0xab, 'z');
+	DF_LOG_INFO("float %f %.3f %8.2e %g", 1.5, 3.14159f, 12345.678, 0.25);
+	DF_LOG_INFO("str %s|%-12s|%5s %p 100%%", name.c_str(), "left", "r", (void *)0x1234);
+	DF_LOG_INFO("no arguments");
+
+	Logger::flush();
+	Logger::setOutput(nullptr);
+
+	char expected[512];
+	snprintf(expected, sizeof(expected),
+		 "int %d %5i|%-4u|%lu %llu %zu 0x%02x %c\n"
+		 "float %f %.3f %8.2e %g\n"
+		 "str %s|%-12s|%5s %p 100%%\n"
+		 "no arguments\n",
+		 -42, 7, 3u, 123456789UL, 1ULL << 40, sizeof(int), 0xab, 'z',
+		 1.5, 3.14159f, 12345.678, 0.25,
+		 name.c_str(), "left", "r", (void *)0x1234);
+
+	char written[512] = {};
+	rewind(out);
+	size_t len = fread(written, 1, sizeof(written) - 1, out);
+	fclose(out);
+
+	bool pass = running && len == strlen(expected) && strcmp(written, expected) == 0;
+	if (!pass) {
+		printf("Logger wrote:\n%s", written);
+	}
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+// Record a device's samples through two small buffers. The second batch
+// does not fit, so part of it is dropped and reported in the file.
+static void test_recorder()
+{
+	SampleTestDriver src;
+	src.start();
+
+	char path[] = "/tmp/df_recorder_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	RecorderConfig config;
+	config.buffer_size = RECORDER_BLOCK_SIZE;
+	config.preallocate = 64 * 1024;
+	bool pass = (fd >= 0) && (Recorder::start(path, config) == 0) && Recorder::isRunning();
+
+	static const unsigned int counts[] = { 20, 400, 10 };
+	TestSample s[400];
+	uint64_t ts[400];
+	unsigned int n = 0;
+	for (unsigned int batch = 0; batch < 3; batch++) {
+		for (unsigned int i = 0; i < counts[batch]; i++, n++) {
+			s[i].seq = n;
+			s[i].x = n * 0.5f;
+			s[i].y = 0.0f;
+			s[i].z = 0.0f;
+			ts[i] = 1000 + n * 10;
+		}
+		src.publish(s, ts, counts[batch]);
+		// Let the recorder thread free a buffer
+		usleep(20000);
+	}
+
+	Recorder::stop();
+	RecorderStats stats;
+	Recorder::getStats(stats);
+	pass = pass && !Recorder::isRunning() && (stats.dropped > 0) && (stats.samples + stats.dropped == n);
+
+	// Every sample is either in the file, in order, or in a drop record
+	uint8_t data[64 * 1024];
+	fd = open(path, O_RDONLY);
+	ssize_t len = (fd >= 0) ? read(fd, data, sizeof(data)) : -1;
+	if (fd >= 0) {
+		close(fd);
+	}
+	unlink(path);
+
+	unsigned int files = 0, devices = 0, samples = 0, dropped = 0;
+	uint32_t next = 0;
+	ssize_t off = 0;
+	while (pass && off + 8 <= len) {
+		RecordHeader hdr;
+		memcpy(&hdr, &data[off], sizeof(hdr));
+		if (hdr.size < 8 || off + hdr.size > len) {
+			pass = false;
+			break;
+		}
+		if (hdr.type == RECORD_FILE) {
+			RecordFileInfo info;
+			memcpy(&info, &data[off + sizeof(hdr)], sizeof(info));
+			pass = (off == 0) && (strcmp(info.magic, "DFREC") == 0) &&
+			       (info.version == RECORDER_FORMAT_VERSION);
+			files++;
+		}
+		else if (hdr.type == RECORD_DEVICE) {
+			RecordDeviceInfo info;
+			memcpy(&info, &data[off + sizeof(hdr)], sizeof(info));
+			pass = (info.sample_size == sizeof(TestSample)) &&
+			       (strcmp(info.path, src.m_dev_instance_path) == 0);
+			devices++;
+		}
+		else if (hdr.type == RECORD_SAMPLE) {
+			TestSample sample;
+			memcpy(&sample, &data[off + sizeof(hdr)], sizeof(sample));
+			pass = (hdr.seq == next) && (sample.seq == next) && (hdr.timestamp == 1000 + next * 10u);
+			next++;
+			samples++;
+		}
+		else if (hdr.type == RECORD_DROP) {
+			RecordDropInfo info;
+			memcpy(&info, &data[off + sizeof(hdr)], sizeof(info));
+			pass = (hdr.seq == next) && (hdr.timestamp == 1000 + next * 10u);
+			next += info.count;
+			dropped += info.count;
+		}
+		off += hdr.size;
+	}
+
+	pass = pass && (off == len) && (files == 1) && (devices == 1) && (next == n) &&
+	       (samples == stats.samples) && (dropped == stats.dropped);
+	if (!pass) {
+		printf("recorded %u samples, %u dropped of %u\n", samples, dropped, n);
+	}
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+
+	src.stop();
+}
+
+// Samples larger than a buffer (but not than a record) are dropped
+// rather than written past the end of the buffer
+static void test_recorder_oversize()
+{
+	const unsigned int sample_size = RECORDER_BLOCK_SIZE + 1000;
+	SampleTestDriver src(sample_size);
+	src.start();
+
+	char path[] = "/tmp/df_recorder_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	RecorderConfig config;
+	config.buffer_size = RECORDER_BLOCK_SIZE;
+	bool pass = (fd >= 0) && (Recorder::start(path, config) == 0);
+
+	uint8_t *samples = new uint8_t[3 * sample_size];
+	uint64_t ts[3] = { 1000, 1010, 1020 };
+	memset(samples, 0x5a, 3 * sample_size);
+	src.publish(samples, ts, 3);
+	delete[] samples;
+
+	Recorder::stop();
+	RecorderStats stats;
+	Recorder::getStats(stats);
+
+	// The file holds the header records and one drop record for all three
+	uint8_t data[2 * RECORDER_BLOCK_SIZE];
+	fd = open(path, O_RDONLY);
+	ssize_t len = (fd >= 0) ? read(fd, data, sizeof(data)) : -1;
+	if (fd >= 0) {
+		close(fd);
+	}
+	unlink(path);
+
+	unsigned int dropped = 0, samples_found = 0;
+	ssize_t off = 0;
+	while (pass && off + (ssize_t)sizeof(RecordHeader) <= len) {
+		RecordHeader hdr;
+		memcpy(&hdr, &data[off], sizeof(hdr));
+		if (hdr.size < 8 || off + hdr.size > len) {
+			pass = false;
+			break;
+		}
+		if (hdr.type == RECORD_SAMPLE) {
+			samples_found++;
+		}
+		else if (hdr.type == RECORD_DROP) {
+			RecordDropInfo info;
+			memcpy(&info, &data[off + sizeof(hdr)], sizeof(info));
+			dropped += info.count;
+		}
+		off += hdr.size;
+	}
+
+	pass = pass && (stats.samples == 0) && (stats.dropped == 3) && (samples_found == 0) && (dropped == 3);
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+
+	src.stop();
+}
+
+struct CodecTestSample
+{
+	int8_t		small;
+	uint16_t	wrapping;
+	int32_t		jumping;
+	uint64_t	time;
+	float		wave;
+	double		walk;
+	uint32_t	counter;
+};
+
+static const SampleField s_codec_test_layout[] = {
+	{ offsetof(CodecTestSample, small),	FIELD_INT8,	 0 },
+	{ offsetof(CodecTestSample, wrapping),	FIELD_UINT16,	 0 },
+	{ offsetof(CodecTestSample, jumping),	FIELD_INT32,	 0 },
+	{ offsetof(CodecTestSample, time),	FIELD_TIMESTAMP, 0 },
+	{ offsetof(CodecTestSample, wave),	FIELD_FLOAT,	 0 },
+	{ offsetof(CodecTestSample, walk),	FIELD_DOUBLE,	 0 },
+	{ offsetof(CodecTestSample, counter),	FIELD_UINT32,	 0 },
+};
+
+// Code samples in blocks with and without a layout, and decode each
+// block on its own, last first
+static void test_sample_codec()
+{
+	static const unsigned int count = 1000;
+	static const unsigned int max_blocks = 32;
+	CodecTestSample in[count];
+	uint64_t ts[count];
+	double walk = 0.0;
+	memset(in, 0, sizeof(in));
+	for (unsigned int i = 0; i < count; i++) {
+		in[i].small = (i % 2) ? -100 : 100;
+		in[i].wrapping = 65500 + i * 7;
+		in[i].jumping = (i % 3) ? -2000000000 : 2000000000;
+		in[i].time = 5000000000ULL + i * 1000 + (i % 5);
+		in[i].wave = sinf(i * 0.01f);
+		walk += (i % 7) * 0.125 - 0.375;
+		in[i].walk = walk;
+		in[i].counter = 0xfffffff0u + i;
+		ts[i] = 1000 + i * 2500 + (i % 3);
+	}
+
+	bool pass = true;
+	for (unsigned int layout = 0; layout < 2; layout++) {
+		const SampleField *fields = layout ? s_codec_test_layout : nullptr;
+		unsigned int num_fields = layout ? sizeof(s_codec_test_layout) / sizeof(s_codec_test_layout[0]) : 0;
+
+		SampleCodec encoder;
+		pass = pass && (encoder.init(sizeof(CodecTestSample), fields, num_fields) == 0);
+
+		static uint8_t blocks[max_blocks][CODEC_BLOCK_BYTES];
+		size_t lengths[max_blocks];
+		unsigned int counts[max_blocks];
+		uint64_t first[max_blocks];
+		unsigned int num_blocks = 0;
+		size_t total = 0;
+
+		for (unsigned int i = 0; pass && i < count; ) {
+			encoder.beginBlock(blocks[num_blocks], CODEC_BLOCK_BYTES);
+			while (i < count && encoder.encode(&in[i], ts[i])) {
+				i++;
+			}
+			lengths[num_blocks] = encoder.blockSize();
+			counts[num_blocks] = encoder.blockCount();
+			first[num_blocks] = encoder.blockTimestamp();
+			total += lengths[num_blocks];
+			pass = (counts[num_blocks] > 0) && (++num_blocks < max_blocks);
+		}
+
+		SampleCodec decoder;
+		pass = pass && (decoder.init(sizeof(CodecTestSample), fields, num_fields) == 0);
+		unsigned int end = count;
+		for (unsigned int b = num_blocks; pass && b-- > 0; ) {
+			CodecTestSample out[CODEC_BLOCK_SAMPLES];
+			uint64_t out_ts[CODEC_BLOCK_SAMPLES];
+			unsigned int base = end - counts[b];
+			pass = (decoder.decode(blocks[b], lengths[b], counts[b], first[b], out, out_ts) == (int)counts[b]) &&
+			       (memcmp(out, &in[base], counts[b] * sizeof(out[0])) == 0) &&
+			       (memcmp(out_ts, &ts[base], counts[b] * sizeof(out_ts[0])) == 0);
+			end = base;
+		}
+
+		// A block cut short is refused
+		CodecTestSample out[CODEC_BLOCK_SAMPLES];
+		pass = pass && (decoder.decode(blocks[0], lengths[0] / 2, counts[0], first[0], out, nullptr) == -1);
+
+		// Raw, each sample takes a RecordHeader and the padded struct
+		if (!pass || total * 2 > count * (sizeof(RecordHeader) + sizeof(CodecTestSample))) {
+			printf("codec %s layout: %zu bytes in %u blocks\n", layout ? "with" : "without", total, num_blocks);
+			pass = false;
+		}
+	}
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+// Record two interleaved devices, then replay one of them as fast as
+// possible, four times faster and at the recorded timing
+static bool replayRecording(SampleTestDriver &src1, SampleTestDriver &src2, bool compress)
+{
+	char path[] = "/tmp/df_replay_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	static const unsigned int count = 50;
+	static const uint64_t spacing = 2000;
+	RecorderConfig config;
+	config.compress = compress;
+	bool pass = (fd >= 0) && (Recorder::start(path, config) == 0);
+	for (unsigned int i = 0; i < count; i++) {
+		TestSample s = { i, 1.0f, 2.0f, 3.0f };
+		uint64_t ts = 1000 + i * spacing;
+		src1.publish(&s, &ts, 1);
+		s.seq += 1000;
+		ts += spacing / 2;
+		src2.publish(&s, &ts, 1);
+	}
+	Recorder::stop();
+
+	ReplayDevObj replay("ReplayTestDriver", "/dev/replay", 256);
+	pass = pass && (replay.open(path, "/dev/nonexistent") == -ENOENT);
+	pass = pass && (replay.open(path, src1.m_dev_instance_path) == 0);
+	unlink(path);
+
+	static const float speeds[] = { REPLAY_AS_FAST_AS_POSSIBLE, 4.0f, 1.0f };
+	for (unsigned int run = 0; pass && run < 3; run++) {
+		replay.setSpeed(speeds[run]);
+
+		DevHandle h;
+		uint64_t start = offsetTime();
+		pass = (replay.start() == 0);
+		if (run == 0) {
+			// Read through a handle, releasing it stops the device
+			DevMgr::getHandle(replay.m_dev_instance_path, h);
+			pass = pass && h.isValid();
+		}
+		for (unsigned int i = 0; pass && i < 2000 && !replay.isFinished(); i++) {
+			usleep(1000);
+		}
+		uint64_t elapsed = offsetTime() - start;
+
+		TestSample out[count + 1];
+		uint64_t ts[count + 1];
+		int n;
+		if (run == 0) {
+			n = h.read(out, sizeof(out)) / (int)sizeof(out[0]);
+			DevMgr::releaseHandle(h);
+			for (int i = 0; i < n; i++) {
+				ts[i] = 1000 + i * spacing;
+			}
+		}
+		else {
+			n = replay.readSamples(out, ts, count + 1);
+			replay.stop();
+		}
+
+		pass = pass && replay.isFinished() && (n == (int)count) && (replay.getPublished() == count);
+		for (int i = 0; pass && i < n; i++) {
+			pass = (out[i].seq == (uint32_t)i) && (ts[i] == 1000 + i * spacing);
+		}
+
+		// The recorded spacing divided by the speed
+		uint64_t span = (count - 1) * spacing;
+		if (speeds[run] > 0.0f) {
+			pass = pass && (elapsed >= (uint64_t)(span / speeds[run]) - 1000);
+		}
+		else {
+			pass = pass && (elapsed < span / 4);
+		}
+		if (!pass) {
+			printf("replay at %.0fx: %d samples in %llu us%s\n", speeds[run], n, (unsigned long long)elapsed,
+			       compress ? ", compressed" : "");
+		}
+	}
+	return pass;
+}
+
+static void test_replay()
+{
+	SampleTestDriver src1;
+	SampleTestDriver src2;
+	src1.start();
+	src2.start();
+
+	bool pass = replayRecording(src1, src2, false) && replayRecording(src1, src2, true);
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+
+	src1.stop();
+	src2.stop();
+}
+
+// Check the samples of src1 read from a recording, all of them and a
+// time range, and return how many there are
+static long readRecording(const char *path, SampleTestDriver &src1, SampleTestDriver &src2, bool indexed)
+{
+	RecordingReader reader;
+	bool pass = (reader.open(path) == 0) && (reader.isIndexed() == indexed) && (reader.getNumDevices() == 2);
+	int dev = reader.findDevice(src1.m_dev_instance_path);
+	pass = pass && (dev >= 0) && (reader.findDevice(src2.m_dev_instance_path) >= 0) &&
+	       (reader.findDevice("/dev/nonexistent") == -1);
+	if (!pass) {
+		return -1;
+	}
+
+	RecordingColumns columns;
+	long n = reader.read(dev, 0, UINT64_MAX, columns, 4);
+	const RecordingColumn *seq = columns.findColumn(offsetof(TestSample, seq));
+	const RecordingColumn *x = columns.findColumn(offsetof(TestSample, x));
+	pass = (n > 0) && ((unsigned long)n == reader.getDevice(dev).samples) && seq && x &&
+	       (reader.getDevice(dev).first_timestamp == 1000) &&
+	       (reader.getDevice(dev).last_timestamp == 1000 + (uint64_t)(n - 1) * 1000);
+	for (long i = 0; pass && i < n; i++) {
+		float value;
+		memcpy(&value, (const uint8_t *)x->values + i * x->width, sizeof(value));
+		pass = (((const uint32_t *)seq->values)[i] == (uint32_t)i) && (value == i * 0.25f) &&
+		       (columns.getTimestamps()[i] == 1000 + (uint64_t)i * 1000);
+	}
+
+	// Only the blocks of the range are decoded
+	size_t all = reader.getBlocksRead();
+	long part = reader.read(dev, 1000 + n / 4 * 1000, 1000 + n / 2 * 1000, columns, 3);
+	pass = pass && (part == n / 2 - n / 4) && (reader.getBlocksRead() < all) &&
+	       (((const uint32_t *)columns.findColumn(offsetof(TestSample, seq))->values)[0] == (uint32_t)(n / 4)) &&
+	       (columns.getTimestamps()[part - 1] == 1000 + (uint64_t)(n / 2 - 1) * 1000);
+
+	if (!pass) {
+		printf("read %ld samples in %zu blocks of %zu%s\n", n, all, reader.getNumBlocks(),
+		       indexed ? ", indexed" : "");
+	}
+	return pass ? n : -1;
+}
+
+// Record two devices, compressed and not, and read one of them back. A
+// compressed file cut short is read without its index.
+static void test_recording_reader()
+{
+	SampleTestDriver src1;
+	SampleTestDriver src2;
+	src1.start();
+	src2.start();
+
+	static const unsigned int count = 3000;
+	bool pass = true;
+	for (unsigned int compress = 0; pass && compress < 2; compress++) {
+		char path[] = "/tmp/df_reader_XXXXXX";
+		int fd = mkstemp(path);
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		RecorderConfig config;
+		config.buffer_size = 4 * RECORDER_BLOCK_SIZE;
+		config.buffers = 4;
+		config.compress = compress;
+		pass = (fd >= 0) && (Recorder::start(path, config) == 0);
+		for (unsigned int i = 0; i < count; i++) {
+			TestSample s = { i, i * 0.25f, 1.0f, 2.0f };
+			uint64_t ts = 1000 + i * 1000;
+			src1.publish(&s, &ts, 1);
+			s.seq += 10000;
+			ts += 500;
+			src2.publish(&s, &ts, 1);
+			if (i % 100 == 0) {
+				usleep(2000);
+			}
+		}
+		Recorder::stop();
+		RecorderStats stats;
+		Recorder::getStats(stats);
+
+		pass = pass && (stats.dropped == 0) && (readRecording(path, src1, src2, compress) == (long)count);
+		if (compress) {
+			struct stat st;
+			pass = pass && (stat(path, &st) == 0) && (truncate(path, st.st_size / 2) == 0);
+			long n = pass ? readRecording(path, src1, src2, false) : -1;
+			pass = (n > 0) && (n < (long)count);
+		}
+		unlink(path);
+	}
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+
+	src1.stop();
+	src2.stop();
+}
+
+// Use devices through the device server: single and batched requests,
+// then a stream that overflows and is closed with its handle
+#ifdef __linux__
+// A stream ring mapped in this process, where a client would write to it
+static DevStreamRing *findStreamRing()
+{
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps == nullptr) {
+		return nullptr;
+	}
+	char line[512];
+	unsigned long start = 0;
+	while (start == 0 && fgets(line, sizeof(line), maps)) {
+		if (strstr(line, "memfd:df_stream") && sscanf(line, "%lx-", &start) != 1) {
+			start = 0;
+		}
+	}
+	fclose(maps);
+	return (DevStreamRing *)start;
+}
+#endif
+
+static void test_dev_server()
+{
+	TestDriver test;
+	SampleTestDriver src;
+	test.start();
+	src.start();
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/df_devserver_%d", (int)getpid());
+	bool pass = (DevServer::start(path) == 0) && DevServer::isRunning();
+
+	DevClient client;
+	pass = pass && (client.connect(path) == 0);
+	pass = pass && (client.open("/dev/nonexistent") == -ENOENT);
+	int h = client.open(test.m_dev_instance_path);
+	int value = 0;
+	pass = pass && (h >= 0) && (client.ioctl(h, TEST_IOCTL_CMD, &value, sizeof(value)) == 0) &&
+	       (value == TEST_IOCTL_RESULT);
+
+	// The argument must be as large as the driver declares, and commands
+	// the driver does not declare are not served
+	char small = 0;
+	pass = pass && (client.ioctl(h, TEST_IOCTL_CMD, nullptr, 0) == -EINVAL) &&
+	       (client.ioctl(h, TEST_IOCTL_CMD, &small, sizeof(small)) == -EINVAL) &&
+	       (client.ioctl(h, TEST_IOCTL_CMD + 1, &value, sizeof(value)) == -ENOTTY);
+
+	// One round trip
+	TestMessage messages[3][3];
+	int results[5] = { 0, 0, 0, 0, 0 };
+	value = 0;
+	for (unsigned int i = 0; i < 3; i++) {
+		pass = pass && (client.queueRead(h, messages[i], sizeof(messages[i]), &results[i]) == 0);
+	}
+	pass = pass && (client.queueIoctl(h, TEST_IOCTL_CMD, &value, sizeof(value), &results[3]) == 0) &&
+	       (client.queueClose(DEV_SERVER_MAX_HANDLES, &results[4]) == 0) && (client.submit() == 0);
+	pass = pass && (results[0] == sizeof(messages[0])) && (results[2] == sizeof(messages[2])) &&
+	       (results[3] == 0) && (value == TEST_IOCTL_RESULT) && (results[4] == -EBADF);
+
+	int hs = client.open(src.m_dev_instance_path);
+	DevStream stream;
+	pass = pass && (hs >= 0) && (client.openStream(h, 16, stream) == -ENOTSUP) &&
+	       (client.openStream(hs, 100, stream) == 0) && DevServer::isStreaming() &&
+	       (stream.getSampleSize() == sizeof(TestSample)) && (stream.wait(10) == 0);
+
+	TestSample in[300];
+	uint64_t in_ts[300];
+	for (unsigned int i = 0; i < 300; i++) {
+		in[i].seq = i;
+		in[i].x = i * 0.5f;
+		in[i].y = 0.0f;
+		in[i].z = 0.0f;
+		in_ts[i] = 1000 + i;
+	}
+	TestSample out[300];
+	uint64_t out_ts[300];
+	src.publish(in, in_ts, 20);
+	src.publish(&in[20], &in_ts[20], 30);
+	pass = pass && (stream.wait(100) == 1) && (stream.read(out, out_ts, 300) == 50) &&
+	       (memcmp(out, in, 50 * sizeof(in[0])) == 0) && (memcmp(out_ts, in_ts, 50 * sizeof(in_ts[0])) == 0);
+
+	// The ring holds the newest 128 samples
+	src.publish(in, in_ts, 300);
+	pass = pass && (stream.read(out, out_ts, 300) == 128) && (stream.getLost() == 172) &&
+	       (out[0].seq == 172) && (out_ts[127] == in_ts[299]);
+
+#ifdef __linux__
+	// The client can write the ring header. The server keeps writing
+	// within the ring, and its head replaces the one written.
+	DevStreamRing *ring = findStreamRing();
+	pass = pass && (ring != nullptr);
+	if (ring) {
+		const uint32_t capacity = ring->capacity;
+		const uint32_t sample_size = ring->sample_size;
+		ring->capacity = 1u << 30;
+		ring->sample_size = 4096;
+		ring->head = 1ull << 40;
+		src.publish(in, in_ts, 10);
+		ring->capacity = capacity;
+		ring->sample_size = sample_size;
+		pass = pass && (stream.read(out, out_ts, 300) == 10) &&
+		       (memcmp(out, in, 10 * sizeof(in[0])) == 0) && (memcmp(out_ts, in_ts, 10 * sizeof(in_ts[0])) == 0);
+	}
+#endif
+
+	pass = pass && (client.close(hs) == 0) && (stream.wait(100) == -EPIPE) && !DevServer::isStreaming();
+
+	// Stopping a device closes the handles and streams of its clients
+	hs = client.open(src.m_dev_instance_path);
+	pass = pass && (hs >= 0) && (client.openStream(hs, 16, stream) == 0);
+	src.stop();
+	pass = pass && (stream.wait(100) == -EPIPE) && !DevServer::isStreaming() && (client.close(hs) == -EBADF);
+
+	pass = pass && (client.close(h) == 0);
+	client.disconnect();
+
+	DevServer::stop();
+	pass = pass && !DevServer::isRunning() && (access(path, F_OK) < 0);
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+
+	src.stop();
+	test.stop();
+}
+
+// Run the framework again in realtime mode. Its structures, and sample
+// buffers of devices, come from the arena.
+static void test_realtime()
+{
+	bool pass = (Framework::initializeRealtime(256 * 1024) == 0) && Framework::isRealtime();
+	Arena *arena = Arena::framework();
+	size_t used = arena ? arena->getUsed() : 0;
+	pass = pass && (used > 0);
+
+	SampleTestDriver *src = new SampleTestDriver();
+	pass = pass && arena && (arena->getUsed() > used);
+	pass = pass && (src->start() == 0);
+
+	TestSample s = { 7, 1.0f, 2.0f, 3.0f };
+	TestSample out = {};
+	uint64_t ts = offsetTime();
+	src->publish(&s, &ts, 1);
+	pass = pass && (src->readSamples(&out, nullptr, 1) == 1) && (out.seq == 7);
+	src->stop();
+
+	Framework::shutdown();
+	pass = pass && !Framework::isRealtime() && (Arena::framework() == nullptr);
+
+	// The buffer stays valid after shutdown and is not handed to free()
+	delete src;
+
+	printf("test %s\n", pass ? "PASSED" : "FAILED");
+}
+
 int main()
 {
 	int ret = Framework::initialize();
@@ -104,11 +987,40 @@ int main()
 		test.start();
 		test_read(h, h2, 1000, true);
 
+		// Test derived devices
+		test_dataflow(test);
 
 	}
 	test.stop();
 
+	test_multiphase();
+
+	test_filter_stage();
+
+	test_work_destroy();
+
+	test_phase_planner();
+
+	test_logger();
+
+	test_recorder();
+
+	test_recorder_oversize();
+
+	test_sample_codec();
+
+	test_replay();
+
+	test_recording_reader();
+
+	test_dev_server();
+
+	// Contention of the framework and driver locks, with DF_LOCK_STATS
+	SyncObj::dumpStats();
+
 	Framework::shutdown();
 
+	test_realtime();
+
 	return 0;
 }
@@ -0,0 +1,222 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "DriverFramework.hpp"
+#include "Recorder.hpp"
+#include "RecordingReader.hpp"
+#include "bench.hpp"
+
+// Decoding a compressed recording of several devices into columns with
+// RecordingReader, on 1 to 8 threads, and reading a short time range.
+// The recording is written by the Recorder to /tmp.
+
+#define BENCH_DEVICES		4
+#define BENCH_SAMPLES		(1000 * 1000)	// per device, at 1 kHz
+#define BENCH_BATCH		100
+#define BENCH_ROUNDS		3
+#define BENCH_RANGE_READS	100
+
+static const SampleField s_layout[] = {
+	{ offsetof(BenchSample, accel[0]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, accel[1]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, accel[2]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, gyro[0]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, gyro[1]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, gyro[2]),	FIELD_INT16,	0 },
+	{ offsetof(BenchSample, seq),		FIELD_UINT32,	0 },
+};
+
+static void *idleThread(void *arg)
+{
+	return NULL;
+}
+
+static uint32_t s_seed = 1;
+
+static int16_t noise(int16_t center)
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return center + (int16_t)((s_seed >> 16) % 33) - 16;
+}
+
+int main()
+{
+	if (Framework::initialize() < 0) {
+		printf("FAILED: framework\n");
+		return 1;
+	}
+
+	char path[] = "/tmp/df_readerbench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		printf("FAILED: cannot create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	// Enough buffers to hold the whole recording, nothing is dropped
+	SampleTestDriver *devs[BENCH_DEVICES];
+	for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+		devs[d] = new SampleTestDriver(sizeof(BenchSample), s_layout, sizeof(s_layout) / sizeof(s_layout[0]));
+		devs[d]->start();
+	}
+	RecorderConfig config;
+	config.compress = true;
+	config.buffers = (BENCH_DEVICES * BENCH_SAMPLES * 16) / RECORDER_BUFFER_SIZE + 2;
+	if (Recorder::start(path, config) < 0) {
+		printf("FAILED: cannot record to %s\n", path);
+		unlink(path);
+		return 1;
+	}
+	BenchSample s[BENCH_BATCH];
+	uint64_t ts[BENCH_BATCH];
+	for (unsigned int n = 0; n < BENCH_SAMPLES; n += BENCH_BATCH) {
+		for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+			for (unsigned int i = 0; i < BENCH_BATCH; i++) {
+				s[i].accel[0] = noise(0);
+				s[i].accel[1] = noise(0);
+				s[i].accel[2] = noise(2048);
+				s[i].gyro[0] = noise(0);
+				s[i].gyro[1] = noise(0);
+				s[i].gyro[2] = noise(0);
+				s[i].seq = n + i;
+				ts[i] = (uint64_t)(n + i) * 1000 + d * 100 + (i % 3);
+			}
+			devs[d]->publish(s, ts, BENCH_BATCH);
+		}
+	}
+	Recorder::stop();
+	RecorderStats stats;
+	Recorder::getStats(stats);
+	for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+		devs[d]->stop();
+		delete devs[d];
+	}
+
+	RecordingReader reader;
+	uint64_t start = nowNsec();
+	int ret = reader.open(path);
+	uint64_t open_nsec = nowNsec() - start;
+	if (ret < 0 || reader.getNumDevices() != BENCH_DEVICES) {
+		printf("FAILED: cannot open %s (%d)\n", path, ret);
+		unlink(path);
+		return 1;
+	}
+	unlink(path);
+
+	printf("recording:   %u devices, %lu samples in %.1f MB (%.1f bytes/sample), %lu dropped\n",
+	       BENCH_DEVICES, stats.samples, stats.bytes_written / 1e6, (double)stats.bytes_written / stats.samples,
+	       stats.dropped);
+	printf("open:        %zu blocks in %.2f ms, %s\n", reader.getNumBlocks(), open_nsec / 1e6,
+	       reader.isIndexed() ? "indexed" : "scanned");
+
+	bool pass = reader.isIndexed() && (stats.dropped == 0);
+	RecordingColumns columns;
+	const size_t bytes = (size_t)BENCH_DEVICES * BENCH_SAMPLES * (sizeof(BenchSample) + sizeof(uint64_t));
+	double single = 0.0;
+
+	// Each thread count decodes every device, best of BENCH_ROUNDS
+	static const unsigned int threads[] = { 1, 2, 4, 8 };
+	for (unsigned int t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		uint64_t best = UINT64_MAX;
+		for (unsigned int r = 0; r < BENCH_ROUNDS; r++) {
+			start = nowNsec();
+			for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+				ssize_t n = reader.read(d, 0, UINT64_MAX, columns, threads[t]);
+				const RecordingColumn *seq = columns.findColumn(offsetof(BenchSample, seq));
+				pass = pass && (n == BENCH_SAMPLES) && seq &&
+				       (((const uint32_t *)seq->values)[BENCH_SAMPLES - 1] == BENCH_SAMPLES - 1);
+			}
+			uint64_t elapsed = nowNsec() - start;
+			if (elapsed < best) {
+				best = elapsed;
+			}
+		}
+		double rate = (double)BENCH_DEVICES * BENCH_SAMPLES * 1e3 / best;
+		if (t == 0) {
+			single = rate;
+		}
+		printf("%u thread%s   %7.1f M samples/s %5.2f GB/s  x%.2f\n", threads[t], threads[t] > 1 ? "s:" : ": ",
+		       rate, (double)bytes / best, rate / single);
+	}
+
+	// One second of one device touches only the blocks around it. The
+	// decoding threads were started by the reads above.
+	ssize_t n = 0;
+	uint64_t range_nsec = UINT64_MAX;
+	for (unsigned int r = 0; r < BENCH_RANGE_READS; r++) {
+		start = nowNsec();
+		n = reader.read(1, 500000000, 501000000, columns, 4);
+		uint64_t elapsed = nowNsec() - start;
+		if (elapsed < range_nsec) {
+			range_nsec = elapsed;
+		}
+	}
+	const RecordingColumn *seq = columns.findColumn(offsetof(BenchSample, seq));
+	pass = pass && (n == 1000) && seq && (((const uint32_t *)seq->values)[0] == 500000) &&
+	       (reader.getBlocksRead() <= 1000 / CODEC_BLOCK_SAMPLES + 2);
+	printf("range:       %zd samples from %zu of %zu blocks in %.1f us on 4 threads\n", n,
+	       reader.getBlocksRead(), reader.getNumBlocks(), range_nsec / 1e3);
+
+	// What a read() would add if it created its threads
+	uint64_t spawn_nsec = UINT64_MAX;
+	for (unsigned int r = 0; r < BENCH_RANGE_READS; r++) {
+		pthread_t tids[3];
+		start = nowNsec();
+		for (unsigned int t = 0; t < 3; t++) {
+			pthread_create(&tids[t], NULL, idleThread, NULL);
+		}
+		for (unsigned int t = 0; t < 3; t++) {
+			pthread_join(tids[t], NULL);
+		}
+		uint64_t elapsed = nowNsec() - start;
+		if (elapsed < spawn_nsec) {
+			spawn_nsec = elapsed;
+		}
+	}
+	printf("spawn:       %.1f us to create and join 3 threads\n", spawn_nsec / 1e3);
+	printf("CPUs online: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	Framework::shutdown();
+	printf("%s\n", pass ? "PASSED" : "FAILED");
+	return pass ? 0 : 1;
+}
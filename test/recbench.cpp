@@ -0,0 +1,177 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include "DriverFramework.hpp"
+#include "Recorder.hpp"
+#include "bench.hpp"
+
+// Aggregate rate the recorder sustains. Four devices publish batches of
+// 16 byte samples every millisecond, first without and then with the
+// recorder running, then as fast as they can. The file goes to /tmp.
+
+#define BENCH_DEVICES		4
+#define BENCH_BATCH		100		// samples per device per millisecond
+#define BENCH_PERIODS		2000
+#define BENCH_FLOOD_SAMPLES	(4 * 1000 * 1000)
+#define BENCH_MAX_NSEC		500		// fail above this per recorded sample
+
+static BenchSample s_samples[BENCH_BATCH];
+static uint64_t s_timestamps[BENCH_BATCH];
+static uint32_t s_seq = 0;
+
+static void fillBatch()
+{
+	uint64_t now = offsetTime();
+	for (unsigned int i = 0; i < BENCH_BATCH; i++) {
+		s_samples[i].seq = s_seq++;
+		s_samples[i].accel[0] = i;
+		s_timestamps[i] = now - (BENCH_BATCH - i) * 10;
+	}
+}
+
+// Publish a batch from every device each millisecond. Returns the median
+// cost of a period per sample.
+static double runPaced(SampleTestDriver **devs, double &rate)
+{
+	static uint64_t cost[BENCH_PERIODS];
+	uint64_t start = nowNsec();
+	uint64_t next = start;
+
+	for (unsigned int p = 0; p < BENCH_PERIODS; p++) {
+		fillBatch();
+		uint64_t t0 = nowNsec();
+		for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+			devs[d]->publish(s_samples, s_timestamps, BENCH_BATCH);
+		}
+		cost[p] = nowNsec() - t0;
+
+		next += 1000000;
+		uint64_t now = nowNsec();
+		if (next > now) {
+			usleep((next - now) / 1000);
+		}
+	}
+
+	rate = (double)BENCH_PERIODS * BENCH_DEVICES * BENCH_BATCH * 1e9 / (nowNsec() - start);
+	std::sort(cost, cost + BENCH_PERIODS);
+	return (double)cost[BENCH_PERIODS / 2] / (BENCH_DEVICES * BENCH_BATCH);
+}
+
+int main()
+{
+	if (Framework::initialize() < 0) {
+		printf("FAILED: framework\n");
+		return 1;
+	}
+
+	SampleTestDriver *devs[BENCH_DEVICES];
+	for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+		devs[d] = new SampleTestDriver(sizeof(BenchSample));
+		devs[d]->start();
+	}
+
+	double rate_off;
+	double cost_off = runPaced(devs, rate_off);
+
+	char path[] = "/tmp/df_recbench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		printf("FAILED: cannot create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	RecorderConfig config;
+	config.preallocate = 256 * 1024 * 1024;
+	if (Recorder::start(path, config) < 0) {
+		printf("FAILED: cannot record to %s\n", path);
+		unlink(path);
+		return 1;
+	}
+
+	double rate_on;
+	double cost_on = runPaced(devs, rate_on);
+	usleep(2 * RECORDER_FLUSH_USEC);
+	RecorderStats paced;
+	Recorder::getStats(paced);
+
+	// As fast as possible, the recorder thread competes with publishers
+	uint64_t start = nowNsec();
+	for (unsigned int n = 0; n < BENCH_FLOOD_SAMPLES; n += BENCH_DEVICES * BENCH_BATCH) {
+		fillBatch();
+		for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+			devs[d]->publish(s_samples, s_timestamps, BENCH_BATCH);
+		}
+	}
+	double offer_sec = (nowNsec() - start) / 1e9;
+
+	// Including the time to write what was buffered
+	Recorder::stop();
+	double flood_sec = (nowNsec() - start) / 1e9;
+	RecorderStats total;
+	Recorder::getStats(total);
+	unlink(path);
+
+	for (unsigned int d = 0; d < BENCH_DEVICES; d++) {
+		devs[d]->stop();
+		delete devs[d];
+	}
+	Framework::shutdown();
+
+	unsigned long flood_recorded = total.samples - paced.samples;
+	unsigned long flood_dropped = total.dropped - paced.dropped;
+
+	printf("not recording: %7.1f ns per sample at %.0f samples/s\n", cost_off, rate_off);
+	printf("recording:     %7.1f ns per sample at %.0f samples/s, %lu of %lu dropped\n",
+	       cost_on, rate_on, paced.dropped, paced.samples + paced.dropped);
+	printf("flood:         %.0f samples/s offered, %.0f samples/s written, %lu of %lu dropped\n",
+	       BENCH_FLOOD_SAMPLES / offer_sec, flood_recorded / flood_sec, flood_dropped,
+	       flood_recorded + flood_dropped);
+	printf("file:          %.1f MB in %lu writes, longest write %u us, %s\n",
+	       total.bytes_written / 1e6, total.writes, total.max_write_usec,
+	       total.direct_io ? "O_DIRECT" : "buffered");
+
+	if (paced.dropped != 0 || cost_on > BENCH_MAX_NSEC || total.write_errors != 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
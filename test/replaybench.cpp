@@ -0,0 +1,150 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "DriverFramework.hpp"
+#include "Recorder.hpp"
+#include "ReplayDevObj.hpp"
+#include "bench.hpp"
+
+// Replay throughput as fast as possible, compared to copying the mapped
+// log with memcpy(). The log holds the samples of one device, written by
+// the Recorder to /tmp.
+
+#define BENCH_SAMPLES		(1000 * 1000)
+#define BENCH_BATCH		100
+#define BENCH_COPIES		5
+
+int main()
+{
+	if (Framework::initialize() < 0) {
+		printf("FAILED: framework\n");
+		return 1;
+	}
+
+	char path[] = "/tmp/df_replaybench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		printf("FAILED: cannot create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	// Enough buffers to hold the whole recording, nothing is dropped
+	SampleTestDriver *dev = new SampleTestDriver(sizeof(BenchSample));
+	dev->start();
+	RecorderConfig config;
+	config.buffers = (BENCH_SAMPLES * 32) / RECORDER_BUFFER_SIZE + 2;
+	if (Recorder::start(path, config) < 0) {
+		printf("FAILED: cannot record to %s\n", path);
+		unlink(path);
+		return 1;
+	}
+	BenchSample s[BENCH_BATCH] = {};
+	uint64_t ts[BENCH_BATCH];
+	for (unsigned int n = 0; n < BENCH_SAMPLES; n += BENCH_BATCH) {
+		for (unsigned int i = 0; i < BENCH_BATCH; i++) {
+			s[i].seq = n + i;
+			ts[i] = (n + i) * 10;
+		}
+		dev->publish(s, ts, BENCH_BATCH);
+	}
+	Recorder::stop();
+	RecorderStats stats;
+	Recorder::getStats(stats);
+	std::string dev_path(dev->m_dev_instance_path);
+	dev->stop();
+	delete dev;
+
+	ReplayDevObj replay("BenchReplay", "/dev/replaybench_out", 4 * REPLAY_BATCH);
+	replay.setSpeed(REPLAY_AS_FAST_AS_POSSIBLE);
+	if (replay.open(path, dev_path.c_str()) < 0) {
+		printf("FAILED: cannot open %s\n", path);
+		unlink(path);
+		return 1;
+	}
+
+	// Memory bandwidth on the same mapping, which also faults it in
+	RecordingFile file;
+	file.open(path);
+	unlink(path);
+	size_t size = file.getSize();
+	uint8_t *copy = new uint8_t[size];
+	uint64_t best_copy = UINT64_MAX;
+	for (unsigned int i = 0; i < BENCH_COPIES; i++) {
+		uint64_t start = nowNsec();
+		memcpy(copy, file.at(0), size);
+		uint64_t elapsed = nowNsec() - start;
+		if (elapsed < best_copy) {
+			best_copy = elapsed;
+		}
+	}
+	delete [] copy;
+
+	uint64_t best_replay = UINT64_MAX;
+	bool complete = true;
+	for (unsigned int i = 0; i < BENCH_COPIES; i++) {
+		uint64_t start = nowNsec();
+		replay.start();
+		while (!replay.isFinished()) {
+			usleep(100);
+		}
+		uint64_t elapsed = nowNsec() - start;
+		complete = complete && (replay.getPublished() == stats.samples);
+		replay.stop();
+		if (elapsed < best_replay) {
+			best_replay = elapsed;
+		}
+	}
+
+	Framework::shutdown();
+
+	printf("log:     %lu samples, %.1f MB\n", stats.samples, size / 1e6);
+	printf("memcpy:  %7.2f GB/s\n", size / (double)best_copy);
+	printf("replay:  %7.2f GB/s, %.1f M samples/s, %.1f ns per sample\n",
+	       size / (double)best_replay, stats.samples * 1e3 / best_replay,
+	       (double)best_replay / stats.samples);
+
+	if (!complete || stats.samples != BENCH_SAMPLES) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
@@ -0,0 +1,310 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "DriverFramework.hpp"
+#include "DevServer.hpp"
+#include "DevClient.hpp"
+#include "bench.hpp"
+
+// Device server request latency and sample streaming, measured by a
+// client in a child process. The child is forked before the framework
+// starts its threads.
+
+#define BENCH_REQUESTS		20000
+#define BENCH_BATCH		16
+#define BENCH_READ_SIZE		64
+#define BENCH_IOCTL_CMD		1
+#define BENCH_IOCTL_SIZE	8
+#define BENCH_FLOOD_SAMPLES	(1000 * 1000)
+#define BENCH_PACED_SAMPLES	(200 * 1000)
+#define BENCH_PACED_BATCH	10
+#define BENCH_PACED_USEC	10	// per sample, 100 kHz
+#define BENCH_RING		4096
+
+// Wider than BenchSample, so the sequence number and values never wrap
+struct ServerSample
+{
+	uint64_t	seq;
+	float		value[6];
+};
+
+class BenchDevice : public SampleTestDriver
+{
+public:
+	BenchDevice() :
+		SampleTestDriver(sizeof(ServerSample))
+	{
+		memset(m_data, 0x5a, sizeof(m_data));
+	}
+	virtual ~BenchDevice() {}
+
+	virtual ssize_t devRead(void *buf, size_t count)
+	{
+		if (count > sizeof(m_data)) {
+			count = sizeof(m_data);
+		}
+		memcpy(buf, m_data, count);
+		return count;
+	}
+
+	virtual int devIOCTL(unsigned long request, void *arg)
+	{
+		return 0;
+	}
+
+	virtual int devIOCTLArgSize(unsigned long request)
+	{
+		return (request == BENCH_IOCTL_CMD) ? BENCH_IOCTL_SIZE : -1;
+	}
+
+protected:
+	uint8_t m_data[BENCH_READ_SIZE];
+};
+
+static int compareTimes(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void printLatency(const char *name, uint64_t *times, unsigned int count, unsigned int per)
+{
+	qsort(times, count, sizeof(times[0]), compareTimes);
+	uint64_t total = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		total += times[i];
+	}
+	printf("%-16s %7.2f us/request  median %7.2f us  p99 %7.2f us per round trip\n", name,
+	       total / 1e3 / count / per, times[count / 2] / 1e3, times[count * 99 / 100] / 1e3);
+}
+
+// Read a stream until the server closes it. Returns false if a sample is
+// missing, out of order or corrupt.
+static bool drain(DevStream &stream, const char *name, uint64_t expected, bool lossless)
+{
+	static ServerSample out[BENCH_RING];
+	uint64_t next = 0;
+	uint64_t received = 0;
+	uint64_t start = 0;
+	bool pass = true;
+
+	while (stream.wait(1000) > 0) {
+		int n;
+		while ((n = stream.read(out, nullptr, BENCH_RING)) > 0) {
+			if (start == 0) {
+				start = nowNsec();
+			}
+			for (int i = 0; i < n; i++) {
+				pass = pass && (out[i].seq >= next) && (out[i].value[5] == (float)out[i].seq);
+				next = out[i].seq + 1;
+			}
+			received += n;
+		}
+	}
+	uint64_t elapsed = nowNsec() - start;
+
+	printf("%-16s %7.2f M samples/s, %lu of %lu received, %lu lost\n", name,
+	       elapsed ? received * 1e3 / elapsed : 0.0, (unsigned long)received, (unsigned long)expected,
+	       stream.getLost());
+	pass = pass && (received + stream.getLost() == expected);
+	if (lossless) {
+		pass = pass && (stream.getLost() == 0);
+	}
+	return pass;
+}
+
+static int runClient(const char *path, int ready_fd)
+{
+	DevClient client;
+	int ret = -1;
+	for (unsigned int i = 0; i < 500 && ret < 0; i++) {
+		ret = client.connect(path);
+		if (ret < 0) {
+			usleep(10000);
+		}
+	}
+
+	int flood = (ret == 0) ? client.open(SAMPLE_DRIVER_DEV_PATH "0") : -1;
+	int paced = (ret == 0) ? client.open(SAMPLE_DRIVER_DEV_PATH "1") : -1;
+	if (flood < 0 || paced < 0) {
+		printf("FAILED: client could not open the devices\n");
+		return 1;
+	}
+
+	static uint64_t times[BENCH_REQUESTS];
+	uint8_t buf[BENCH_BATCH][BENCH_READ_SIZE];
+	bool pass = true;
+
+	for (unsigned int i = 0; i < BENCH_REQUESTS; i++) {
+		uint64_t start = nowNsec();
+		pass = pass && (client.read(flood, buf[0], BENCH_READ_SIZE) == BENCH_READ_SIZE);
+		times[i] = nowNsec() - start;
+	}
+	printLatency("read", times, BENCH_REQUESTS, 1);
+
+	for (unsigned int i = 0; i < BENCH_REQUESTS; i++) {
+		uint64_t start = nowNsec();
+		pass = pass && (client.ioctl(flood, BENCH_IOCTL_CMD, buf[0], BENCH_IOCTL_SIZE) == 0);
+		times[i] = nowNsec() - start;
+	}
+	printLatency("ioctl", times, BENCH_REQUESTS, 1);
+
+	unsigned int batches = BENCH_REQUESTS / BENCH_BATCH;
+	for (unsigned int i = 0; i < batches; i++) {
+		int results[BENCH_BATCH];
+		uint64_t start = nowNsec();
+		for (unsigned int r = 0; r < BENCH_BATCH; r++) {
+			client.queueRead(flood, buf[r], BENCH_READ_SIZE, &results[r]);
+		}
+		pass = pass && (client.submit() == 0);
+		times[i] = nowNsec() - start;
+		for (unsigned int r = 0; r < BENCH_BATCH; r++) {
+			pass = pass && (results[r] == BENCH_READ_SIZE);
+		}
+	}
+	printLatency("read, batch of 16", times, batches, BENCH_BATCH);
+
+	DevStream flood_stream;
+	DevStream paced_stream;
+	if (client.openStream(flood, BENCH_RING, flood_stream) < 0 ||
+	    client.openStream(paced, BENCH_RING, paced_stream) < 0) {
+		printf("FAILED: client could not open the streams\n");
+		return 1;
+	}
+	char c = 'r';
+	if (write(ready_fd, &c, 1) != 1) {
+		return 1;
+	}
+
+	pass = drain(flood_stream, "stream, flood", BENCH_FLOOD_SAMPLES, false) && pass;
+	pass = drain(paced_stream, "stream, 100 kHz", BENCH_PACED_SAMPLES, true) && pass;
+	return pass ? 0 : 1;
+}
+
+static void fill(ServerSample *s, uint64_t *ts, uint64_t seq, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		s[i].seq = seq + i;
+		for (unsigned int v = 0; v < 6; v++) {
+			s[i].value[v] = (float)(seq + i);
+		}
+		ts[i] = seq + i;
+	}
+}
+
+int main()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/df_serverbench_%d", (int)getpid());
+
+	int ready[2];
+	if (pipe(ready) < 0) {
+		printf("FAILED: pipe\n");
+		return 1;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		::close(ready[0]);
+		int ret = runClient(path, ready[1]);
+		fflush(stdout);
+		_exit(ret);
+	}
+	::close(ready[1]);
+
+	if (pid < 0 || Framework::initialize() < 0) {
+		printf("FAILED: framework\n");
+		return 1;
+	}
+
+	BenchDevice *flood = new BenchDevice();
+	BenchDevice *paced = new BenchDevice();
+	flood->start();
+	paced->start();
+	if (DevServer::start(path) < 0) {
+		printf("FAILED: cannot listen at %s\n", path);
+		return 1;
+	}
+
+	char c;
+	bool pass = (read(ready[0], &c, 1) == 1);
+
+	// As fast as the publisher can, in batches of 64. The reader shares
+	// the CPUs, so it may not keep up.
+	ServerSample s[64];
+	uint64_t ts[64];
+	uint64_t start = nowNsec();
+	for (uint64_t n = 0; pass && n < BENCH_FLOOD_SAMPLES; n += 64) {
+		fill(s, ts, n, 64);
+		flood->publish(s, ts, 64);
+	}
+	uint64_t elapsed = nowNsec() - start;
+	printf("publish, flood   %7.2f M samples/s into the ring\n", BENCH_FLOOD_SAMPLES * 1e3 / elapsed);
+	// Destroying the device closes its stream
+	flood->stop();
+	delete flood;
+
+	// Like a fast sensor drained in small batches
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (uint64_t n = 0; pass && n < BENCH_PACED_SAMPLES; n += BENCH_PACED_BATCH) {
+		next.tv_nsec += BENCH_PACED_USEC * BENCH_PACED_BATCH * 1000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		fill(s, ts, n, BENCH_PACED_BATCH);
+		paced->publish(s, ts, BENCH_PACED_BATCH);
+	}
+	paced->stop();
+	delete paced;
+
+	int status = 0;
+	pass = (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0) && pass;
+	printf("CPUs online: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	Framework::shutdown();
+	printf("%s\n", pass ? "PASSED" : "FAILED");
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+/**********************************************************************
+* Copyright (c) 2015 Mark Charlebois
+* 
+* All rights reserved.
+* 
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted (subject to the limitations in the
+* disclaimer below) provided that the following conditions are met:
+* 
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+* 
+*  * Neither the name of Dronecode Project nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+* 
+* NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+* GRANTED BY THIS LICENSE.  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT
+* HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+* OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+* IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "DriverFramework.hpp"
+#include "SyncObj.hpp"
+#include "bench.hpp"
+
+// Benchmark of the SyncObj lock types: uncontended and contended lock
+// cost, signal to wakeup latency, and how long a high priority thread
+// waits for a lock held by a low priority thread while a medium priority
+// thread wants the CPU (priority inversion).
+
+#define BENCH_UNCONTENDED_ITERATIONS	2000000
+#define BENCH_CONTENDED_THREADS		4
+#define BENCH_CONTENDED_ITERATIONS	200000
+#define BENCH_PINGPONG_ITERATIONS	20000
+
+// Inversion scenario, all threads on one CPU
+#define INVERSION_HOLD_USEC		2000	// CPU time the low priority thread holds the lock
+#define INVERSION_MEDIUM_USEC		30000	// time the medium priority thread keeps the CPU
+#define INVERSION_PRIO_LOW		10
+#define INVERSION_PRIO_MEDIUM		20
+#define INVERSION_PRIO_HIGH		30
+#define INVERSION_PRIO_MAIN		40
+
+static const SyncObjType s_types[] = { SYNC_OBJ_DEFAULT, SYNC_OBJ_PRIO_INHERIT, SYNC_OBJ_FUTEX };
+
+static const char *typeName(SyncObjType type)
+{
+	switch (type) {
+	case SYNC_OBJ_PRIO_INHERIT:
+		return "prio-inherit";
+	case SYNC_OBJ_FUTEX:
+		return "futex";
+	default:
+		return "default";
+	}
+}
+
+static double benchUncontended(SyncObjType type)
+{
+	SyncObj lock(type);
+
+	// Warm up caches and the CPU clock
+	for (unsigned int i = 0; i < BENCH_UNCONTENDED_ITERATIONS / 4; i++) {
+		lock.lock();
+		lock.unlock();
+	}
+
+	uint64_t start = nowNsec();
+	for (unsigned int i = 0; i < BENCH_UNCONTENDED_ITERATIONS; i++) {
+		lock.lock();
+		lock.unlock();
+	}
+	return (double)(nowNsec() - start) / BENCH_UNCONTENDED_ITERATIONS;
+}
+
+struct ContendedArgs {
+	SyncObj *	lock;
+	uint64_t *	counter;
+};
+
+static void *contendedThread(void *arg)
+{
+	ContendedArgs *args = (ContendedArgs *)arg;
+
+	for (unsigned int i = 0; i < BENCH_CONTENDED_ITERATIONS; i++) {
+		args->lock->lock();
+		(*args->counter)++;
+		args->lock->unlock();
+	}
+	return NULL;
+}
+
+// Returns ns per lock/unlock pair, or -1 if the counter is wrong
+static double benchContended(SyncObjType type)
+{
+	SyncObj lock(type, typeName(type));
+	uint64_t counter = 0;
+	ContendedArgs args = { &lock, &counter };
+	pthread_t tid[BENCH_CONTENDED_THREADS];
+
+	uint64_t start = nowNsec();
+	for (unsigned int i = 0; i < BENCH_CONTENDED_THREADS; i++) {
+		pthread_create(&tid[i], NULL, contendedThread, &args);
+	}
+	for (unsigned int i = 0; i < BENCH_CONTENDED_THREADS; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	uint64_t elapsed = nowNsec() - start;
+
+	if (counter != (uint64_t)BENCH_CONTENDED_THREADS * BENCH_CONTENDED_ITERATIONS) {
+		DF_LOG_ERR("FAILED: %s counter %llu", typeName(type), (unsigned long long)counter);
+		return -1.0;
+	}
+
+	// With DF_LOCK_STATS
+	SyncObjStats stats;
+	if (lock.getStats(stats)) {
+		if (stats.acquisitions != counter) {
+			DF_LOG_ERR("FAILED: %s counted %lu acquisitions", typeName(type), stats.acquisitions);
+			return -1.0;
+		}
+		DF_LOG_INFO("%-13s %lu of %lu acquisitions contended, max wait %.1f us, max hold %.1f us (%s)",
+			    stats.name, stats.contended, stats.acquisitions,
+			    stats.wait_max / 1000.0, stats.hold_max / 1000.0, stats.hold_max_thread);
+	}
+	return (double)elapsed / (BENCH_CONTENDED_THREADS * BENCH_CONTENDED_ITERATIONS);
+}
+
+struct PingPong {
+	SyncObj *	lock;
+	unsigned int	turn;		// 0: main, 1: partner
+	bool		timed_out;
+};
+
+static void *pingPongThread(void *arg)
+{
+	PingPong *pp = (PingPong *)arg;
+
+	pp->lock->lock();
+	for (unsigned int i = 0; i < BENCH_PINGPONG_ITERATIONS; i++) {
+		while (pp->turn != 1) {
+			if (pp->lock->waitOnSignal(1000) == ETIMEDOUT) {
+				pp->timed_out = true;
+			}
+		}
+		pp->turn = 0;
+		pp->lock->signal();
+	}
+	pp->lock->unlock();
+	return NULL;
+}
+
+// Round trip through signal() and waitOnSignal(), in usec
+static double benchPingPong(SyncObjType type)
+{
+	SyncObj lock(type);
+	PingPong pp = { &lock, 0, false };
+	pthread_t tid;
+
+	pthread_create(&tid, NULL, pingPongThread, &pp);
+
+	uint64_t start = nowNsec();
+	lock.lock();
+	for (unsigned int i = 0; i < BENCH_PINGPONG_ITERATIONS; i++) {
+		pp.turn = 1;
+		lock.signal();
+		while (pp.turn != 0) {
+			if (lock.waitOnSignal(1000) == ETIMEDOUT) {
+				pp.timed_out = true;
+			}
+		}
+	}
+	lock.unlock();
+	uint64_t elapsed = nowNsec() - start;
+
+	pthread_join(tid, NULL);
+
+	if (pp.timed_out) {
+		DF_LOG_ERR("FAILED: %s lost a signal", typeName(type));
+		return -1.0;
+	}
+	return (double)elapsed / BENCH_PINGPONG_ITERATIONS / 1000.0;
+}
+
+struct Inversion {
+	SyncObj *		lock;
+	volatile bool		holding;
+	uint64_t		high_wait_nsec;
+};
+
+static void *lowThread(void *arg)
+{
+	Inversion *inv = (Inversion *)arg;
+
+	inv->lock->lock();
+	inv->holding = true;
+	uint64_t start = nowNsec(CLOCK_THREAD_CPUTIME_ID);
+	while (nowNsec(CLOCK_THREAD_CPUTIME_ID) - start < INVERSION_HOLD_USEC * 1000ULL) {
+	}
+	inv->lock->unlock();
+	return NULL;
+}
+
+static void *mediumThread(void *arg)
+{
+	uint64_t start = nowNsec();
+	while (nowNsec() - start < INVERSION_MEDIUM_USEC * 1000ULL) {
+	}
+	return NULL;
+}
+
+static void *highThread(void *arg)
+{
+	Inversion *inv = (Inversion *)arg;
+
+	uint64_t start = nowNsec();
+	inv->lock->lock();
+	inv->high_wait_nsec = nowNsec() - start;
+	inv->lock->unlock();
+	return NULL;
+}
+
+static int startFifoThread(pthread_t &tid, int prio, void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	struct sched_param param = {};
+	param.sched_priority = prio;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	int ret = pthread_create(&tid, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	return ret;
+}
+
+// Time the high priority thread waits for the lock, in usec, or -1 if
+// SCHED_FIFO threads cannot be created
+static double benchInversion(SyncObjType type)
+{
+	SyncObj lock(type);
+	Inversion inv = { &lock, false, 0 };
+	pthread_t low, medium, high;
+
+	if (startFifoThread(low, INVERSION_PRIO_LOW, lowThread, &inv) != 0) {
+		return -1.0;
+	}
+	while (!inv.holding) {
+		usleep(100);
+	}
+
+	// The high priority thread blocks on the lock, then the medium
+	// priority thread is runnable. Without priority inheritance it runs
+	// instead of the lock holder.
+	startFifoThread(high, INVERSION_PRIO_HIGH, highThread, &inv);
+	usleep(500);
+	startFifoThread(medium, INVERSION_PRIO_MEDIUM, mediumThread, &inv);
+
+	pthread_join(high, NULL);
+	pthread_join(medium, NULL);
+	pthread_join(low, NULL);
+
+	return (double)inv.high_wait_nsec / 1000.0;
+}
+
+static bool setupInversion()
+{
+#ifdef __linux__
+	// One CPU, so the medium priority thread competes with the lock holder
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(0, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+		return false;
+	}
+
+	// Above the test threads, so this thread can start them while they run
+	struct sched_param param = {};
+	param.sched_priority = INVERSION_PRIO_MAIN;
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+	return false;
+#endif
+}
+
+int main()
+{
+	int failures = 0;
+
+	for (unsigned int i = 0; i < sizeof(s_types) / sizeof(s_types[0]); i++) {
+		SyncObjType type = s_types[i];
+		double uncontended = benchUncontended(type);
+		double contended = benchContended(type);
+		double pingpong = benchPingPong(type);
+
+		if (contended < 0.0 || pingpong < 0.0) {
+			failures++;
+		}
+		DF_LOG_INFO("%-13s uncontended %6.1f ns  contended (%d threads) %7.1f ns  signal round trip %6.1f us",
+			    typeName(type), uncontended, BENCH_CONTENDED_THREADS, contended, pingpong);
+	}
+
+	if (setupInversion()) {
+		double waits[sizeof(s_types) / sizeof(s_types[0])];
+
+		for (unsigned int i = 0; i < sizeof(s_types) / sizeof(s_types[0]); i++) {
+			waits[i] = benchInversion(s_types[i]);
+			DF_LOG_INFO("%-13s inversion: high priority thread waited %8.1f us (lock held for %d us of CPU time)",
+				    typeName(s_types[i]), waits[i], INVERSION_HOLD_USEC);
+		}
+
+		// With priority inheritance the wait is bounded by the hold time
+		if (waits[1] < 0.0 || waits[1] >= INVERSION_MEDIUM_USEC) {
+			DF_LOG_ERR("FAILED: priority inheritance did not bound the wait");
+			failures++;
+		}
+	}
+	else {
+		DF_LOG_INFO("inversion: skipped, SCHED_FIFO is not permitted");
+	}
+
+	if (failures) {
+		DF_LOG_ERR("FAILED: %d failures", failures);
+		return 1;
+	}
+
+	DF_LOG_INFO("PASSED");
+	return 0;
+}
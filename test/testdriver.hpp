@@ -3,6 +3,10 @@
 #include "VirtDevObj.hpp"
 
 #define TEST_DRIVER_DEV_PATH "/dev/test"
+#define DERIVED_DRIVER_DEV_PATH "/dev/derived"
+#define MULTIPHASE_DRIVER_DEV_PATH "/dev/multiphase"
+#define SAMPLE_DRIVER_DEV_PATH "/dev/samples"
+#define FILTER_DEV_PATH "/dev/filtered"
 
 #define TEST_IOCTL_CMD 		1
 #define TEST_IOCTL_RESULT 	10
@@ -18,6 +22,7 @@ class TestDriver : public VirtDevObj
 public:
 	TestDriver() :
 		VirtDevObj("TestDriver", TEST_DRIVER_DEV_PATH, 100),
+		m_lock(SYNC_OBJ_DEFAULT, "TestDriver"),
 		m_count(sizeof(m_message)/sizeof(m_message[0]))
 	{}
 	virtual ~TestDriver() {}
@@ -67,6 +72,11 @@ public:
 		return -1;
 	}
 
+	virtual int devIOCTLArgSize(unsigned long cmd)
+	{
+		return (cmd == TEST_IOCTL_CMD) ? sizeof(int) : -1;
+	}
+
 protected:
 	virtual void _measure()
 	{
@@ -74,8 +84,10 @@ protected:
 		m_lock.lock();
 		m_message[i % m_count].val = i;
 		i++;
-		updateNotify();
 		m_lock.unlock();
+
+		// Derived devices read from this device during updateNotify()
+		updateNotify();
 	}
 
 	SyncObj		m_lock;
@@ -83,3 +95,148 @@ protected:
 	unsigned int 	m_count;
 };
 
+// Derived device without a timer. It publishes the largest value read
+// from its upstream device plus one, each time the upstream publishes.
+class DerivedTestDriver : public VirtDevObj
+{
+public:
+	DerivedTestDriver(const char *upstream_path) :
+		VirtDevObj("DerivedTestDriver", DERIVED_DRIVER_DEV_PATH, 0),
+		m_upstream_path(upstream_path),
+		m_lock(SYNC_OBJ_DEFAULT, "DerivedTestDriver")
+	{
+		m_message.val = 0;
+	}
+	virtual ~DerivedTestDriver() {}
+
+	virtual int start()
+	{
+		int ret = VirtDevObj::start();
+		if (ret == 0 && !m_upstream.isValid()) {
+			DevMgr::getHandle(m_upstream_path.c_str(), m_upstream);
+		}
+		return m_upstream.isValid() ? ret : -1;
+	}
+
+	virtual ssize_t devRead(void *buf, size_t len)
+	{
+		if (len > sizeof(m_message))
+		{
+			len = sizeof(m_message);
+		}
+		m_lock.lock();
+		memcpy(buf, &m_message, len);
+		m_lock.unlock();
+		return len;
+	}
+
+	unsigned int	m_update_count = 0;
+
+protected:
+	virtual void _measure()
+	{
+		TestMessage message[3];
+		int len = m_upstream.read(message, sizeof(message));
+		if (len <= 0) {
+			return;
+		}
+		int max = message[0].val;
+		for (unsigned int i = 1; i < len/sizeof(message[0]); i++) {
+			if (message[i].val > max) {
+				max = message[i].val;
+			}
+		}
+		m_lock.lock();
+		m_message.val = max + 1;
+		m_update_count++;
+		m_lock.unlock();
+		updateNotify();
+	}
+
+	const std::string	m_upstream_path;
+	DevHandle		m_upstream;
+	SyncObj			m_lock;
+	TestMessage		m_message;
+};
+
+
+// Driver without a timer that publishes batches of samples on request,
+// like a FIFO drain
+struct TestSample
+{
+	uint32_t	seq;
+	float		x;
+	float		y;
+	float		z;
+};
+
+class SampleTestDriver : public VirtDevObj
+{
+public:
+	SampleTestDriver(unsigned int sample_size = sizeof(TestSample),
+			 const SampleField *fields = nullptr, unsigned int num_fields = 0) :
+		VirtDevObj("SampleTestDriver", SAMPLE_DRIVER_DEV_PATH, 0)
+	{
+		enableSampleBuffer(sample_size, 256);
+		if (fields != nullptr) {
+			setSampleLayout(fields, num_fields);
+		}
+	}
+	virtual ~SampleTestDriver() {}
+
+	int publish(const void *samples, const uint64_t *timestamps, unsigned int count)
+	{
+		return publishSamples(samples, timestamps, count);
+	}
+
+protected:
+	virtual void _measure() {}
+};
+
+// Driver whose measurement is split in three phases separated by a
+// conversion delay, without blocking the HRT thread while waiting
+class MultiPhaseTestDriver : public VirtDevObj
+{
+public:
+	static const uint32_t CONVERSION_USEC = 5000;
+
+	MultiPhaseTestDriver() :
+		VirtDevObj("MultiPhaseTestDriver", MULTIPHASE_DRIVER_DEV_PATH, 20000)
+	{}
+	virtual ~MultiPhaseTestDriver() {}
+
+	unsigned int	m_complete_count = 0;
+	unsigned int	m_bad_phase_count = 0;
+	uint64_t	m_min_duration = ~0ULL;
+
+protected:
+	virtual void _measure()
+	{
+		uint64_t now = offsetTime();
+
+		switch (measurePhase()) {
+		case 0:
+			// start conversion
+			m_start = now;
+			resumeMeasureIn(CONVERSION_USEC);
+			break;
+		case 1:
+			// read first result, start second conversion
+			resumeMeasureIn(CONVERSION_USEC);
+			break;
+		case 2:
+			// read second result
+			if (now - m_start < m_min_duration) {
+				m_min_duration = now - m_start;
+			}
+			m_complete_count++;
+			updateNotify();
+			break;
+		default:
+			m_bad_phase_count++;
+			break;
+		}
+	}
+
+	uint64_t	m_start = 0;
+};